@@ -1,9 +1,15 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <cstdint>
 #include <iostream>
+#include <iterator>
 #include <memory>
+#include <mutex>
+#include <string>
 #include <vector>
 
 #include "EnumHelpers.hpp"
@@ -39,11 +45,8 @@ public:
 
 	virtual void append(Node *n) { assert(false); }
 
-	virtual void print(int indent = 0) const
-	{
-		do_indent(indent);
-		std::cout << "Node\n";
-	}
+	// Writes the tree in the text format of TextEmitter to std::cout.
+	void print(int indent = 0) const;
 
 	Node() = default;
 	virtual ~Node() = default;
@@ -57,32 +60,128 @@ public:
 
 	virtual Type type() const = 0;
 
+	static const char * toString(Type t)
+	{
+		static const char *s[] = {"Chunk", "ExprList", "VarList", "ParamList", "Ellipsis", "LValue", "FunctionCall", "MethodCall",
+			"Assignment", "Value", "TableCtor", "Field", "BinOp", "UnOp", "Break", "Return", "Function", "If", "While", "Repeat",
+			"For", "ForEach"};
+		return s[toUnderlying(t)];
+	}
+
 protected:
-	void do_indent(int indent) const
+	// Deleting a node must not recurse into its children, a long chain of
+	// concatenations or elseifs would run out of stack. Destructors of nodes
+	// with children hand them over here instead, and the outermost one
+	// deletes all of them in a loop.
+	template <typename... Children>
+	static void dispose(Children &... children)
+	{
+		Graveyard &g = graveyard();
+		(g.bury(children), ...);
+		if (g.draining)
+			return;
+
+		g.draining = true;
+		while (!g.nodes.empty()) {
+			std::unique_ptr <Node> node = std::move(g.nodes.back());
+			g.nodes.pop_back();
+		}
+		g.draining = false;
+	}
+
+private:
+	struct Graveyard {
+		template <typename T>
+		void bury(std::unique_ptr <T> &node)
+		{
+			if (node)
+				nodes.emplace_back(node.release());
+		}
+
+		template <typename T>
+		void bury(std::vector <std::unique_ptr <T> > &v)
+		{
+			for (auto &node : v)
+				bury(node);
+		}
+
+		std::vector <std::unique_ptr <Node> > nodes;
+		bool draining = false;
+	};
+
+	static Graveyard & graveyard()
 	{
-		for (int i = 0; i < indent; ++i)
-			std::cout << '\t';
+		static thread_local Graveyard g;
+		return g;
 	}
 };
 
+// Byte range of a statement in the source. Statements of the root chunk are
+// relative to the start of the input, statements of nested chunks to the
+// start of the statement the chunk belongs to, so moving a statement does
+// not touch anything inside it.
+struct Span {
+	std::uint32_t begin = 0;
+	std::uint32_t end = 0;
+};
+
 class Chunk : public Node {
 public:
-	void append(Node *n) override { m_children.emplace_back(n); }
+	~Chunk() override { dispose(m_children); }
+
+	void append(Node *n) override { append(n, Span{}); }
+	void append(Node *n, Span span)
+	{
+		m_children.emplace_back(n);
+		m_spans.push_back(span);
+	}
 
 	const std::vector <std::unique_ptr <Node> > & children() const { return m_children; }
+	const std::vector <Span> & spans() const { return m_spans; }
+
+	void rebase(std::uint32_t base)
+	{
+		for (auto &s : m_spans) {
+			s.begin -= base;
+			s.end -= base;
+		}
+	}
+
+	// Replaces statements [first, last) with statements [from, to) of other,
+	// whose spans are moved by offset. Statements after the replaced ones are
+	// moved by delta.
+	void splice(std::size_t first, std::size_t last, Chunk &other, std::size_t from, std::size_t to, std::int64_t offset, std::int64_t delta)
+	{
+		shift(last, delta);
+
+		m_children.erase(m_children.begin() + first, m_children.begin() + last);
+		m_spans.erase(m_spans.begin() + first, m_spans.begin() + last);
+
+		m_children.insert(m_children.begin() + first, std::make_move_iterator(other.m_children.begin() + from),
+			std::make_move_iterator(other.m_children.begin() + to));
+		m_spans.insert(m_spans.begin() + first, other.m_spans.begin() + from, other.m_spans.begin() + to);
+		for (std::size_t i = first; i < first + (to - from); ++i) {
+			m_spans[i].begin += offset;
+			m_spans[i].end += offset;
+		}
+	}
 
-	void print(int indent = 0) const override
+	// Moves statements [first, end) by delta.
+	void shift(std::size_t first, std::int64_t delta)
 	{
-		do_indent(indent);
-		std::cout << "Chunk:\n";
-		for (const auto &n : m_children)
-			n->print(indent + 1);
+		for (auto s = m_spans.begin() + first; s != m_spans.end(); ++s) {
+			s->begin += delta;
+			s->end += delta;
+		}
 	}
 
+	void resize(std::size_t index, std::int64_t delta) { m_spans[index].end += delta; }
+
 	Node::Type type() const override { return Type::Chunk; }
 
 private:
 	std::vector <std::unique_ptr <Node> > m_children;
+	std::vector <Span> m_spans;
 };
 
 class ParamList : public Node {
@@ -95,21 +194,6 @@ public:
 	bool hasEllipsis() const { return m_ellipsis; }
 	void setEllipsis() { m_ellipsis = true; };
 
-	void print(int indent = 0) const override
-	{
-		do_indent(indent);
-		std::cout << "Name list: ";
-		if (!m_names.empty())
-			std::cout << m_names.front();
-		if (m_names.size() > 1) {
-			for (auto name = m_names.cbegin() + 1; name != m_names.cend(); ++name)
-				std::cout << ", " << *name;
-		}
-		if (m_ellipsis)
-			std::cout << "...";
-		std::cout << '\n';
-	}
-
 	const std::vector <std::string> & names() const { return m_names; }
 	Node::Type type() const override { return Type::ParamList; }
 
@@ -120,20 +204,12 @@ private:
 
 class ExprList : public Node {
 public:
+	~ExprList() override { dispose(m_exprs); }
+
 	void append(Node *n) override { m_exprs.emplace_back(n); }
 
 	const std::vector <std::unique_ptr <Node> > & exprs() const { return m_exprs; }
 
-	void print(int indent = 0) const override
-	{
-		do_indent(indent);
-		std::cout << "Expression list: [\n";
-		for (const auto &n : m_exprs)
-			n->print(indent + 1);
-		do_indent(indent);
-		std::cout << "]\n";
-	}
-
 	Node::Type type() const override { return Type::ExprList; }
 
 private:
@@ -153,30 +229,7 @@ public:
 	LValue(Node *tableExpr, std::string &&fieldName) : m_type{Type::Dot}, m_tableExpr{tableExpr}, m_name{std::move(fieldName)} {}
 	LValue(const std::string &varName) : m_type{Type::Name}, m_name{varName} {}
 	LValue(std::string &&varName) : m_type{Type::Name}, m_name{std::move(varName)} {}
-
-	void print(int indent = 0) const override
-	{
-		do_indent(indent);
-		std::cout << "LValue";
-		switch (m_type) {
-			case Type::Bracket:
-				std::cout << " bracket operator:\n";
-				m_tableExpr->print(indent + 1);
-				m_keyExpr->print(indent + 1);
-				break;
-			case Type::Dot:
-				std::cout << " dot operator:\n";
-				m_tableExpr->print(indent + 1);
-				do_indent(indent + 1);
-				std::cout << "Field name: " << m_name << '\n';
-				break;
-			case Type::Name:
-				std::cout << '\n';
-				do_indent(indent + 1);
-				std::cout << m_name << '\n';
-				break;
-		}
-	}
+	~LValue() override { dispose(m_tableExpr, m_keyExpr); }
 
 	const std::string & name() const { return m_name; }
 	const Node * tableExpr() const { return m_tableExpr.get(); }
@@ -193,6 +246,8 @@ private:
 
 class VarList : public Node {
 public:
+	~VarList() override { dispose(m_vars); }
+
 	void append(LValue *lval)
 	{
 		m_vars.emplace_back(lval);
@@ -203,17 +258,6 @@ public:
 		return m_vars;
 	}
 
-	void print(int indent = 0) const override
-	{
-		do_indent(indent);
-		std::cout << "Variable list: [\n";
-		for (const auto &lv : m_vars) {
-			lv->print(indent + 1);
-		}
-		do_indent(indent);
-		std::cout << "]\n";
-	}
-
 	Node::Type type() const override { return Type::VarList; }
 
 private:
@@ -222,13 +266,13 @@ private:
 
 class Ellipsis : public Node {
 public:
-	void print(int indent = 0) const override
-	{
-		do_indent(indent);
-		std::cout << "Ellipsis (...)\n";
-	}
+	// written as (...), which gives only the first value
+	bool isTruncated() const { return m_truncated; }
+	void setTruncated() { m_truncated = true; }
 
 	Node::Type type() const override { return Type::Ellipsis; }
+private:
+	bool m_truncated = false;
 };
 
 class Assignment : public Node {
@@ -248,27 +292,14 @@ public:
 		if (!m_exprList)
 			m_exprList.reset(new ExprList{});
 	}
+	~Assignment() override { dispose(m_varList, m_exprList); }
 
 	void setLocal(bool local) { m_local = local; }
+	bool isLocal() const { return m_local; }
 
 	const VarList & varList() const { return *m_varList; }
 	const ExprList & exprList() const { return *m_exprList; }
 
-	void print(int indent = 0) const override
-	{
-		do_indent(indent);
-		if (m_local)
-			std::cout << "local ";
-		std::cout << "assignment:\n";
-		m_varList->print(indent + 1);
-		if (!m_exprList->exprs().empty()) {
-			m_exprList->print(indent + 1);
-		} else {
-			do_indent(indent + 1);
-			std::cout << "nil\n";
-		}
-	}
-
 	Node::Type type() const override { return Type::Assignment; }
 
 private:
@@ -288,11 +319,6 @@ public:
 
 class NilValue : public Value {
 public:
-	void print(int indent = 0) const override
-	{
-		do_indent(indent);
-		std::cout << "nil\n";
-	}
 
 	ValueType valueType() const override { return ValueType::Nil; }
 };
@@ -301,12 +327,6 @@ class BooleanValue : public Value {
 public:
 	BooleanValue(bool v) : m_value{v} {}
 
-	void print(int indent = 0) const override
-	{
-		do_indent(indent);
-		std::cout << std::boolalpha << m_value << '\n';
-	}
-
 	ValueType valueType() const override { return ValueType::Boolean; }
 
 	bool value() const { return m_value; }
@@ -319,12 +339,6 @@ public:
 	StringValue(const std::string &v) : m_value{v} {}
 	StringValue(std::string &&v) : m_value{std::move(v)} {}
 
-	void print(int indent = 0) const override
-	{
-		do_indent(indent);
-		std::cout << "String: " << m_value << '\n';
-	}
-
 	ValueType valueType() const override { return ValueType::String; }
 
 	const std::string & value() const { return m_value; }
@@ -336,12 +350,6 @@ class IntValue : public Value {
 public:
 	constexpr IntValue(long v) : m_value{v} {}
 
-	void print(int indent = 0) const override
-	{
-		do_indent(indent);
-		std::cout << "Int: " << m_value << '\n';
-	}
-
 	ValueType valueType() const override { return ValueType::Integer; }
 
 	long value() const { return m_value; }
@@ -353,12 +361,6 @@ class RealValue : public Value {
 public:
 	constexpr RealValue(double v) : m_value{v} {}
 
-	void print(int indent = 0) const override
-	{
-		do_indent(indent);
-		std::cout << "Real: " << m_value << '\n';
-	}
-
 	ValueType valueType() const override { return ValueType::Real; }
 
 	double value() const { return m_value; }
@@ -369,25 +371,21 @@ private:
 class FunctionCall : public Node {
 public:
 	FunctionCall(Node *funcExpr, ExprList *args) : m_functionExpr{funcExpr}, m_args{args} {}
-
-	void print(int indent = 0) const override
-	{
-		do_indent(indent);
-		std::cout << "Function call:\n";
-		m_functionExpr->print(indent + 1);
-		do_indent(indent);
-		std::cout << "Args:\n";
-		m_args->print(indent + 1);
-	}
+	~FunctionCall() override { dispose(m_functionExpr, m_args); }
 
 	const Node & functionExpr() const { return *m_functionExpr; }
 
 	const ExprList & args() const { return *m_args; }
 
+	// written in parentheses, which cut the results to the first one
+	bool isTruncated() const { return m_truncated; }
+	void setTruncated() { m_truncated = true; }
+
 	Node::Type type() const override { return Type::FunctionCall; }
 private:
 	std::unique_ptr <Node> m_functionExpr;
 	std::unique_ptr <ExprList> m_args;
+	bool m_truncated = false;
 };
 
 class MethodCall : public FunctionCall {
@@ -395,15 +393,7 @@ public:
 	MethodCall(Node *funcExpr, ExprList *args, const std::string &methodName) : FunctionCall{funcExpr, args}, m_methodName{methodName} {}
 	MethodCall(Node *funcExpr, ExprList *args, std::string &&methodName) : FunctionCall{funcExpr, args}, m_methodName{std::move(methodName)} {}
 
-	void print(int indent = 0) const override
-	{
-		do_indent(indent);
-		std::cout << "Method call:\n";
-		functionExpr().print(indent + 1);
-		do_indent(indent);
-		std::cout << "Method name: " << m_methodName << '\n';
-		args().print(indent + 1);
-	}
+	const std::string & methodName() const { return m_methodName; }
 
 	Node::Type type() const override { return Type::MethodCall; }
 private:
@@ -421,27 +411,7 @@ public:
 	Field(Node *expr, Node *val) : m_type{Type::Brackets}, m_keyExpr{expr}, m_valueExpr{val} {}
 	Field(const std::string &s, Node *val) : m_type{Type::Literal}, m_fieldName{s}, m_valueExpr{val} {}
 	Field(Node *val) : m_type{Type::NoIndex}, m_keyExpr{nullptr}, m_valueExpr{val} {}
-
-	void print(int indent = 0) const override
-	{
-		do_indent(indent);
-		switch (m_type) {
-			case Type::Brackets:
-				std::cout << "Expr to expr:\n";
-				m_keyExpr->print(indent + 1);
-				break;
-			case Type::Literal:
-				std::cout << "Name to expr:\n";
-				do_indent(indent + 1);
-				std::cout << m_fieldName << '\n';
-				break;
-			case Type::NoIndex:
-				std::cout << "Expr:\n";
-				break;
-		}
-
-		m_valueExpr->print(indent + 1);
-	}
+	~Field() override { dispose(m_keyExpr, m_valueExpr); }
 
 	Type fieldType() const { return m_type; }
 
@@ -460,15 +430,9 @@ private:
 
 class TableCtor : public Node {
 public:
-	void append(Field *f) { m_fields.emplace_back(f); }
+	~TableCtor() override { dispose(m_fields); }
 
-	void print(int indent = 0) const override
-	{
-		do_indent(indent);
-		std::cout << "Table:\n";
-		for (const auto &p : m_fields)
-			p->print(indent + 1);
-	}
+	void append(Field *f) { m_fields.emplace_back(f); }
 
 	const std::vector <std::unique_ptr <Field> > & fields() const { return m_fields; }
 
@@ -499,6 +463,7 @@ public:
 	};
 
 	BinOp(Type t, Node *left, Node *right) : m_type{t}, m_left{left}, m_right{right} {}
+	~BinOp() override { dispose(m_left, m_right); }
 
 	static const std::vector <ValueType> & applicableTypes(Type t)
 	{
@@ -533,14 +498,6 @@ public:
 	const Node & left() const { return *m_left; }
 	const Node & right() const { return *m_right; }
 
-	void print(int indent = 0) const override
-	{
-		do_indent(indent);
-		std::cout << "BinOp: " << toString() << '\n';
-		m_left->print(indent + 1);
-		m_right->print(indent + 1);
-	}
-
 	Node::Type type() const override { return Node::Type::BinOp; }
 
 	const char * toString() const { return toString(m_type); }
@@ -560,6 +517,7 @@ public:
 	};
 
 	UnOp(Type t, Node *op) : m_type{t}, m_operand{op} {}
+	~UnOp() override { dispose(m_operand); }
 
 	static const char * toString(Type t)
 	{
@@ -571,13 +529,6 @@ public:
 
 	const Node & operand() const { return *m_operand; }
 
-	void print(int indent = 0) const override
-	{
-		do_indent(indent);
-		std::cout << "UnOp: " << toString() << '\n';
-		m_operand->print(indent + 1);
-	}
-
 	Node::Type type() const override { return Node::Type::UnOp; }
 
 	const char * toString() const { return toString(m_type); }
@@ -589,11 +540,6 @@ private:
 
 class Break : public Node {
 public:
-	void print(int indent = 0) const override
-	{
-		do_indent(indent);
-		std::cout << "break\n";
-	}
 
 	Node::Type type() const override { return Node::Type::Break; }
 };
@@ -601,14 +547,9 @@ public:
 class Return : public Node {
 public:
 	Return(ExprList *exprList) : m_exprList{exprList} {}
+	~Return() override { dispose(m_exprList); }
 
-	void print(int indent = 0) const override
-	{
-		do_indent(indent);
-		std::cout << "return\n";
-		if (m_exprList)
-			m_exprList->print(indent + 1);
-	}
+	const ExprList * exprList() const { return m_exprList.get(); }
 
 	Node::Type type() const override { return Node::Type::Return; }
 
@@ -618,11 +559,60 @@ private:
 
 typedef std::pair <std::vector <std::string>, std::string> FunctionName;
 
+// The preprocessed input of a parse with lazy function bodies, shared by
+// all of its functions.
+struct LazySource {
+	std::string text;
+	std::vector <std::uint32_t> lineStarts;
+	std::string filename;
+	// Parses the statements in text[body.begin, body.end), which start at
+	// line and column inside nesting brackets and blocks. Spans of the
+	// result are absolute; null for an empty body or with error set.
+	std::unique_ptr <Chunk> (*parse)(const std::shared_ptr <const LazySource> &source, Span body,
+		std::uint32_t line, std::uint32_t column, int nesting, std::string &error);
+};
+
 class Function : public Node {
 public:
+	// A body which is only pre-scanned, it is parsed the first time it is
+	// accessed.
+	struct LazyBody {
+		std::shared_ptr <const LazySource> source;
+		// absolute byte range and position
+		Span range;
+		std::uint32_t line;
+		std::uint32_t column;
+		// brackets and blocks open around the body, which count towards
+		// Driver::MaxNesting in it
+		int nesting;
+		// what the spans of the body are relative to
+		std::uint32_t base = 0;
+		std::once_flag once;
+		std::atomic <bool> parsed{false};
+		std::string error;
+	};
+
 	Function(ParamList *params, Chunk *chunk) : m_params{params}, m_chunk{chunk}, m_local{false} {}
+	Function(ParamList *params, std::unique_ptr <LazyBody> body) : m_params{params}, m_lazy{std::move(body)}, m_local{false} {}
+	~Function() override { dispose(m_params, m_chunk); }
 
-	const Chunk & chunk() const { return *m_chunk; }
+	const Chunk & chunk() const { materialize(); return *m_chunk; }
+	bool hasChunk() const { materialize(); return m_chunk != nullptr; }
+
+	// The body has not been parsed yet.
+	bool isLazy() const { return m_lazy && !m_lazy->parsed.load(std::memory_order_acquire); }
+	const LazyBody * lazyBody() const { return m_lazy.get(); }
+	void setBase(std::uint32_t base) { m_lazy->base = base; }
+	// Why a lazy body could not be parsed, it then has no chunk.
+	const std::string & bodyError() const
+	{
+		static const std::string None;
+		materialize();
+		return m_lazy ? m_lazy->error : None;
+	}
+
+	const std::vector <std::string> & nameParts() const { return m_name; }
+	const std::string & methodName() const { return m_method; }
 
 	bool isLocal() const { return m_local; }
 	void setLocal() { m_local = true; }
@@ -658,44 +648,6 @@ public:
 		m_name.push_back(name);
 	}
 
-	void print(int indent = 0) const override
-	{
-		do_indent(indent);
-		if (m_local)
-			std::cout << "local ";
-		std::cout << "function ";
-
-		if (!m_name.empty()) {
-			std::cout << m_name[0];
-			for (auto iter = m_name.cbegin() + 1; iter != m_name.cend(); ++iter)
-				std::cout << "." << *iter;
-
-			if (!m_method.empty())
-				std::cout << ":" << m_method;
-			std::cout << '\n';
-		} else {
-			std::cout << "<anonymous>\n";
-		}
-
-		do_indent(indent);
-		std::cout << "params:\n";
-		if (m_params) {
-			m_params->print(indent + 1);
-		} else {
-			do_indent(indent + 1);
-			std::cout << "<no params>\n";
-		}
-
-		do_indent(indent);
-		std::cout << "body:\n";
-		if (m_chunk) {
-			m_chunk->print(indent + 1);
-		} else {
-			do_indent(indent + 1);
-			std::cout << "<empty>\n";
-		}
-	}
-
 	const ParamList & params() const
 	{
 		if (!m_params) {
@@ -704,48 +656,54 @@ public:
 		}
 		return *m_params;
 	}
+	bool hasParams() const { return m_params != nullptr; }
+
 	Node::Type type() const override { return Node::Type::Function; }
 
 private:
+	void materialize() const
+	{
+		if (!m_lazy)
+			return;
+
+		std::call_once(m_lazy->once, [this]{
+			LazyBody &body = *m_lazy;
+			m_chunk = body.source->parse(body.source, body.range, body.line, body.column, body.nesting, body.error);
+			if (m_chunk)
+				m_chunk->rebase(body.base);
+			// the text is freed with the last body parsed
+			body.source.reset();
+			body.parsed.store(true, std::memory_order_release);
+		});
+	}
+
 	std::vector <std::string> m_name;
 	std::string m_method;
 	std::unique_ptr <ParamList> m_params;
-	std::unique_ptr <Chunk> m_chunk;
+	mutable std::unique_ptr <Chunk> m_chunk;
+	std::unique_ptr <LazyBody> m_lazy;
 	bool m_local;
 };
 
 class If : public Node {
 public:
 	If(Node *condition, Chunk *chunk) : m_condition{condition}, m_chunk{chunk} {}
+	~If() override { dispose(m_condition, m_chunk, m_nextIf, m_else); }
 
 	void setElse(Chunk *chunk) { m_else.reset(chunk); }
 	void setNextIf(If *next) { m_nextIf.reset(next); }
-
-	void print(int indent = 0) const override
+	// Adds an elseif to the end of the chain in constant time.
+	void appendNextIf(If *next)
 	{
-		do_indent(indent);
-		std::cout << "if:\n";
-		m_condition->print(indent + 1);
-		if (m_chunk) {
-			m_chunk->print(indent + 1);
-		} else {
-			do_indent(indent + 1);
-			std::cout << "<empty>\n";
-		}
-
-		if (m_nextIf) {
-			do_indent(indent);
-			std::cout << "else:\n";
-			m_nextIf->print(indent);
-		}
-
-		if (m_else) {
-			do_indent(indent);
-			std::cout << "else:\n";
-			m_else->print(indent + 1);
-		}
+		(m_lastIf ? m_lastIf : this)->setNextIf(next);
+		m_lastIf = next;
 	}
 
+	const Node & condition() const { return *m_condition; }
+	const Node * chunk() const { return m_chunk.get(); }
+	const If * nextIf() const { return m_nextIf.get(); }
+	const Chunk * elseChunk() const { return m_else.get(); }
+
 	Node::Type type() const override { return Node::Type::If; }
 
 private:
@@ -753,19 +711,17 @@ private:
 	std::unique_ptr <Node> m_chunk;
 	std::unique_ptr <If> m_nextIf;
 	std::unique_ptr <Chunk> m_else;
+	// end of the chain while it is being parsed
+	If *m_lastIf = nullptr;
 };
 
 class While : public Node {
 public:
 	While(Node *condition, Chunk *chunk) : m_condition{condition}, m_chunk{chunk} {}
+	~While() override { dispose(m_condition, m_chunk); }
 
-	void print(int indent = 0) const override
-	{
-		do_indent(indent);
-		std::cout << "while:\n";
-		m_condition->print(indent + 1);
-		m_chunk->print(indent + 1);
-	}
+	const Node & condition() const { return *m_condition; }
+	const Chunk * chunk() const { return m_chunk.get(); }
 
 	Node::Type type() const override { return Node::Type::While; }
 
@@ -777,14 +733,10 @@ private:
 class Repeat : public Node {
 public:
 	Repeat(Node *condition, Chunk *chunk) : m_condition{condition}, m_chunk{chunk} {}
+	~Repeat() override { dispose(m_condition, m_chunk); }
 
-	void print(int indent = 0) const override
-	{
-		do_indent(indent);
-		std::cout << "repeat:\n";
-		m_chunk->print(indent + 1);
-		m_condition->print(indent + 1);
-	}
+	const Node & condition() const { return *m_condition; }
+	const Chunk * chunk() const { return m_chunk.get(); }
 
 	Node::Type type() const override { return Node::Type::Repeat; }
 
@@ -797,33 +749,13 @@ class For : public Node {
 public:
 	For(const std::string &iterator, Node *start, Node *limit, Node *step, Chunk *chunk)
 		: m_iterator{iterator}, m_start{start}, m_limit{limit}, m_step{step}, m_chunk{chunk} {}
+	~For() override { dispose(m_start, m_limit, m_step, m_chunk); }
 
-	void print(int indent = 0) const override
-	{
-		do_indent(indent);
-		std::cout << "for:\n";
-
-		do_indent(indent);
-		std::cout << "iterator: " << m_iterator << '\n';
-
-		do_indent(indent);
-		std::cout << "start:\n";
-		m_start->print(indent + 1);
-
-		do_indent(indent);
-		std::cout << "limit:\n";
-		m_limit->print(indent + 1);
-
-		if (m_step) {
-			do_indent(indent);
-			std::cout << "step:\n";
-			m_step->print(indent + 1);
-		}
-
-		do_indent(indent);
-		std::cout << "do:\n";
-		m_chunk->print(indent + 1);
-	}
+	const std::string & iterator() const { return m_iterator; }
+	const Node & start() const { return *m_start; }
+	const Node & limit() const { return *m_limit; }
+	const Node * step() const { return m_step.get(); }
+	const Chunk * chunk() const { return m_chunk.get(); }
 
 	Node::Type type() const override { return Node::Type::For; }
 
@@ -837,21 +769,11 @@ class ForEach : public Node {
 public:
 	ForEach(ParamList *iterators, ExprList *exprs, Chunk *chunk)
 		: m_iterators{iterators}, m_exprs{exprs}, m_chunk{chunk} {}
+	~ForEach() override { dispose(m_iterators, m_exprs, m_chunk); }
 
-	void print(int indent = 0) const override
-	{
-		do_indent(indent);
-		std::cout << "for_each:\n";
-		m_iterators->print(indent + 1);
-
-		do_indent(indent);
-		std::cout << "in:\n";
-		m_exprs->print(indent + 1);
-
-		do_indent(indent);
-		std::cout << "do:\n";
-		m_chunk->print(indent + 1);
-	}
+	const ParamList & iterators() const { return *m_iterators; }
+	const ExprList & exprs() const { return *m_exprs; }
+	const Chunk * chunk() const { return m_chunk.get(); }
 
 	Node::Type type() const override { return Node::Type::ForEach; }
 
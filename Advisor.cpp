@@ -0,0 +1,255 @@
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <tuple>
+
+#include "Advisor.hpp"
+
+namespace {
+
+// loops deeper than this rank the same
+constexpr unsigned MaxRankedDepth = 15;
+
+std::string quoted(std::string_view name)
+{
+	std::string result{"'"};
+	result += name;
+	result += '\'';
+	return result;
+}
+
+bool isName(const Node *node)
+{
+	return node->type() == Node::Type::LValue && static_cast<const LValue *>(node)->lvalueType() == LValue::Type::Name;
+}
+
+const std::string & nameOf(const Node *node)
+{
+	return static_cast<const LValue *>(node)->name();
+}
+
+// s = s .. x, which copies all of s every time, quadratic in the length of
+// the result.
+class ConcatInLoop : public LintRule {
+public:
+	ConcatInLoop() : LintRule{"concat-in-loop"} { on(Node::Type::Assignment); }
+
+	void visit(const Node *node, LintContext &context) override
+	{
+		auto a = static_cast<const Assignment *>(node);
+		if (context.loops().empty() || a->isLocal())
+			return;
+
+		const auto &vars = a->varList().vars();
+		const auto &exprs = a->exprList().exprs();
+		for (std::size_t i = 0; i < vars.size() && i < exprs.size(); ++i) {
+			if (vars[i]->lvalueType() == LValue::Type::Name && appends(exprs[i].get(), vars[i]->name()))
+				context.report(*this, vars[i].get(), quoted(vars[i]->name()) + " is built by concatenation in a loop");
+		}
+	}
+
+	static std::string suggest(const Node *node)
+	{
+		const std::string &name = nameOf(node);
+		return "collect the pieces in a table, local parts = {} before the loop and parts[#parts + 1] = piece in it, then "
+			+ name + " = table.concat(parts)";
+	}
+
+private:
+	// whether name is one of the operands of a chain of concatenations
+	bool appends(const Node *e, std::string_view name)
+	{
+		m_stack.assign(1, e);
+		while (!m_stack.empty()) {
+			const Node *n = m_stack.back();
+			m_stack.pop_back();
+			if (n->type() == Node::Type::BinOp && static_cast<const BinOp *>(n)->binOpType() == BinOp::Type::Concat) {
+				m_stack.push_back(&static_cast<const BinOp *>(n)->left());
+				m_stack.push_back(&static_cast<const BinOp *>(n)->right());
+			} else if (isName(n) && nameOf(n) == name) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	std::vector <const Node *> m_stack;
+};
+
+class TableInLoop : public LintRule {
+public:
+	TableInLoop() : LintRule{"table-in-loop"} { on(Node::Type::TableCtor); }
+
+	void visit(const Node *node, LintContext &context) override
+	{
+		if (!context.loops().empty())
+			context.report(*this, node, "table constructor allocates a table on every iteration");
+	}
+
+	static std::string suggest(const Node *)
+	{
+		return "create the table once before the loop and overwrite its fields in it";
+	}
+};
+
+class ClosureInLoop : public LintRule {
+public:
+	ClosureInLoop() : LintRule{"closure-in-loop"} { on(Node::Type::Function); }
+
+	void visit(const Node *node, LintContext &context) override
+	{
+		if (context.loops().empty())
+			return;
+		auto f = static_cast<const Function *>(node);
+		if (f->nameParts().empty())
+			context.report(*this, node, "function is created on every iteration");
+		else
+			context.report(*this, node, "function " + quoted(f->nameParts().back()) + " is created on every iteration");
+	}
+
+	static std::string suggest(const Node *)
+	{
+		return "define the function once before the loop and pass what changes per iteration as arguments";
+	}
+};
+
+// while #t > 0 do, where the length is looked for again on every check
+class LengthInCondition : public LintRule {
+public:
+	LengthInCondition() : LintRule{"length-in-condition"} { on(Node::Type::UnOp); }
+
+	void visit(const Node *node, LintContext &context) override
+	{
+		auto op = static_cast<const UnOp *>(node);
+		if (!context.condition() || op->unOpType() != UnOp::Type::Length)
+			return;
+
+		const char *loop = context.condition()->type() == Node::Type::While ? "while" : "repeat";
+		if (isName(&op->operand()))
+			context.report(*this, node, quoted('#' + nameOf(&op->operand())) + " is computed on every check of a " + loop + " condition");
+		else
+			context.report(*this, node, std::string{"a length is computed on every check of a "} + loop + " condition");
+	}
+
+	static std::string suggest(const Node *node)
+	{
+		auto op = static_cast<const UnOp *>(node);
+		const std::string table = isName(&op->operand()) ? nameOf(&op->operand()) : "t";
+		return "keep the length in a local, local n = #" + table + " before the loop, and update it where the loop adds or removes elements";
+	}
+};
+
+// print(x) or math.floor(x) in a loop, a lookup in the globals (and one in
+// the library) on every call
+class GlobalInLoop : public LintRule {
+public:
+	GlobalInLoop() : LintRule{"global-in-loop"} { on(Node::Type::FunctionCall); }
+
+	void visit(const Node *node, LintContext &context) override
+	{
+		if (context.loops().empty())
+			return;
+
+		const Node *callee = &static_cast<const FunctionCall *>(node)->functionExpr();
+		if (isName(callee)) {
+			if (!context.lookup(nameOf(callee)))
+				context.report(*this, callee, "global function " + quoted(nameOf(callee)) + " is looked up on every call in a loop");
+			return;
+		}
+
+		if (callee->type() != Node::Type::LValue || static_cast<const LValue *>(callee)->lvalueType() != LValue::Type::Dot)
+			return;
+		auto dot = static_cast<const LValue *>(callee);
+		if (isName(dot->tableExpr()) && !context.lookup(nameOf(dot->tableExpr())))
+			context.report(*this, callee, quoted(nameOf(dot->tableExpr()) + '.' + dot->name()) + " is looked up on every call in a loop");
+	}
+
+	static std::string suggest(const Node *node)
+	{
+		auto lv = static_cast<const LValue *>(node);
+		if (lv->lvalueType() == LValue::Type::Name)
+			return "local " + lv->name() + " = " + lv->name() + " before the loop";
+		return "local " + lv->name() + " = " + nameOf(lv->tableExpr()) + '.' + lv->name() + " before the loop";
+	}
+};
+
+struct Pattern {
+	const char *name;
+	// relative cost of one finding
+	unsigned cost;
+	std::unique_ptr <LintRule> (*create)();
+	std::string (*suggest)(const Node *node);
+};
+
+template <typename Rule>
+std::unique_ptr <LintRule> create()
+{
+	return std::make_unique<Rule>();
+}
+
+const Pattern Patterns[] = {
+	{"concat-in-loop", 4, create<ConcatInLoop>, ConcatInLoop::suggest},
+	{"closure-in-loop", 3, create<ClosureInLoop>, ClosureInLoop::suggest},
+	{"table-in-loop", 2, create<TableInLoop>, TableInLoop::suggest},
+	{"length-in-condition", 2, create<LengthInCondition>, LengthInCondition::suggest},
+	{"global-in-loop", 1, create<GlobalInLoop>, GlobalInLoop::suggest},
+};
+
+const Pattern & patternOf(std::string_view name)
+{
+	return *std::find_if(std::begin(Patterns), std::end(Patterns), [name](const Pattern &p) { return name == p.name; });
+}
+
+}
+
+bool Advisor::select(std::string_view names)
+{
+	if (names.empty()) {
+		for (const auto &p : Patterns)
+			m_linter.add(p.create());
+		return true;
+	}
+
+	while (!names.empty()) {
+		const std::size_t n = std::min(names.find(','), names.size());
+		const std::string_view name = names.substr(0, n);
+		auto p = std::find_if(std::begin(Patterns), std::end(Patterns), [name](const Pattern &p) { return name == p.name; });
+		if (p == std::end(Patterns)) {
+			std::cerr << "Unknown pattern: " << name << '\n';
+			return false;
+		}
+		m_linter.add(p->create());
+		names.remove_prefix(std::min(n + 1, names.size()));
+	}
+	return true;
+}
+
+std::vector <Advice> Advisor::run(const ParseResult &result)
+{
+	std::vector <Advice> advice;
+	// the finding merged into, by pattern, message and loop
+	std::map <std::tuple <std::string_view, std::string_view, const Node *>, std::size_t> merged;
+
+	const std::vector <LintDiagnostic> diagnostics = m_linter.run(result);
+	for (const auto &d : diagnostics) {
+		auto found = merged.emplace(std::make_tuple(std::string_view{d.rule}, std::string_view{d.message}, d.loop), advice.size());
+		if (!found.second) {
+			++advice[found.first->second].count;
+			continue;
+		}
+		const Pattern &p = patternOf(d.rule);
+		advice.push_back(Advice{d.rule, d.message, p.suggest(d.node), d.span, d.loopDepth, 1, 0});
+	}
+
+	for (auto &a : advice) {
+		std::uint64_t weight = patternOf(a.pattern).cost;
+		for (unsigned i = 0; i < std::min(a.loopDepth, MaxRankedDepth); ++i)
+			weight *= IterationsPerLoop;
+		a.score = weight * a.count;
+	}
+
+	// diagnostics come in source order, which ties keep
+	std::stable_sort(advice.begin(), advice.end(), [](const Advice &a, const Advice &b) { return a.score > b.score; });
+	return advice;
+}
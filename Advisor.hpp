@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Linter.hpp"
+
+struct Advice {
+	const char *pattern;
+	std::string message;
+	// what to write instead
+	std::string suggestion;
+	// absolute byte range of the first statement concerned
+	Span span;
+	unsigned loopDepth;
+	// findings of the same pattern and message in one loop are merged
+	unsigned count;
+	// count times the cost of the pattern times IterationsPerLoop for
+	// every loop around it
+	std::uint64_t score;
+};
+
+// Finds code patterns known to be slow on Lua interpreters: strings built
+// by concatenation in loops, table constructors and closures evaluated per
+// iteration, lengths taken by while and repeat conditions and global
+// functions looked up in loops. The patterns are lint rules, so a file is
+// walked once for all of them and "-- lint-disable: pattern" turns one off.
+class Advisor {
+public:
+	// iterations assumed for every loop when ranking
+	static constexpr std::uint64_t IterationsPerLoop = 10;
+
+	Advisor() = default;
+	Advisor(const Advisor &) = delete;
+	Advisor & operator = (const Advisor &) = delete;
+
+	// Comma separated pattern names, empty for all of them; false if one is
+	// unknown. Called once before run().
+	bool select(std::string_view names);
+
+	// Findings of result, the highest score first.
+	std::vector <Advice> run(const ParseResult &result);
+
+private:
+	Linter m_linter;
+};
@@ -0,0 +1,612 @@
+#include <algorithm>
+#include <unordered_map>
+
+#include "CallGraph.hpp"
+#include "Traversal.hpp"
+
+// Walks the tree once with its scopes. Names and name paths of callees are
+// resolved after the walk, when every assignment has been seen: a function
+// defined further down can still be called earlier on.
+class CallGraph::Builder {
+public:
+	explicit Builder(CallGraph &graph) : m_graph{graph} {}
+
+	void build(const Chunk *root)
+	{
+		m_pending.emplace_back();
+		m_globals.emplace_back();
+		m_graph.m_functions.push_back(FunctionInfo{nullptr, None});
+		if (root)
+			block(root, 0);
+		finish();
+	}
+
+private:
+	using BindingId = std::uint32_t;
+
+	struct Binding {
+		// the function a local function statement or the initializer gave it
+		FunctionId function = None;
+		// assignments after the declaration
+		unsigned assignments = 0;
+		// path standing for the value, set for self in methods
+		std::string alias;
+	};
+
+	// a call whose target is looked up at the end
+	struct PendingCall {
+		const FunctionCall *node;
+		std::string name;
+		// the local it calls or the path it calls, the other is None or empty
+		BindingId binding;
+		std::string path;
+	};
+
+	struct Definition {
+		FunctionId function = None;
+		unsigned count = 0;
+		// of the last assignment, in walk order
+		unsigned order = 0;
+	};
+
+	BindingId declare(const std::string &name)
+	{
+		m_bindings.emplace_back();
+		const BindingId id = m_bindings.size() - 1;
+		m_scope[name].push_back(id);
+		m_declared.push_back(&m_scope.find(name)->first);
+		return id;
+	}
+
+	std::size_t openScope() const { return m_declared.size(); }
+
+	void closeScope(std::size_t mark)
+	{
+		while (m_declared.size() > mark) {
+			auto it = m_scope.find(*m_declared.back());
+			it->second.pop_back();
+			if (it->second.empty())
+				m_scope.erase(it);
+			m_declared.pop_back();
+		}
+	}
+
+	BindingId lookup(const std::string &name) const
+	{
+		const auto it = m_scope.find(name);
+		return it == m_scope.end() ? None : it->second.back();
+	}
+
+	// The name path e stands for, rooted at a global name or at "#n" for
+	// local n. Empty if e is no name or field of one.
+	std::string path(const Node *e) const
+	{
+		if (e->type() != Node::Type::LValue)
+			return {};
+
+		auto lv = static_cast<const LValue *>(e);
+		switch (lv->lvalueType()) {
+			case LValue::Type::Name: {
+				const BindingId b = lookup(lv->name());
+				if (b == None)
+					return lv->name();
+				if (!m_bindings[b].alias.empty())
+					return m_bindings[b].alias;
+				return '#' + std::to_string(b);
+			}
+			case LValue::Type::Dot: {
+				std::string base = path(lv->tableExpr());
+				if (base.empty())
+					return {};
+				return base + '.' + lv->name();
+			}
+			default:
+				return {};
+		}
+	}
+
+	// e as written, for unresolved calls
+	static std::string source(const Node *e)
+	{
+		if (e->type() != Node::Type::LValue)
+			return {};
+
+		auto lv = static_cast<const LValue *>(e);
+		switch (lv->lvalueType()) {
+			case LValue::Type::Name:
+				return lv->name();
+			case LValue::Type::Dot: {
+				std::string base = source(lv->tableExpr());
+				return base.empty() ? base : base + '.' + lv->name();
+			}
+			default:
+				return {};
+		}
+	}
+
+	void define(const std::string &path, FunctionId f)
+	{
+		Definition &d = m_definitions[path];
+		d.function = f;
+		++d.count;
+		d.order = ++m_assignments;
+	}
+
+	// What assigning value to path defines: a function or the functions in
+	// a table constructor, keyed by their field names.
+	void defineValue(const std::string &path, const Node *value, FunctionId f)
+	{
+		define(path, f);
+		if (!value || value->type() != Node::Type::TableCtor)
+			return;
+
+		std::vector <std::pair <std::string, const TableCtor *> > tables{{path, static_cast<const TableCtor *>(value)}};
+		while (!tables.empty()) {
+			const auto [base, table] = tables.back();
+			tables.pop_back();
+
+			for (const auto &field : table->fields()) {
+				if (field->fieldType() != Field::Type::Literal)
+					continue;
+				const std::string fieldPath = base + '.' + field->fieldName();
+				const Node *v = field->valueExpr();
+				define(fieldPath, v->type() == Node::Type::Function ? m_functionIds.at(static_cast<const Function *>(v)) : None);
+				if (v->type() == Node::Type::TableCtor)
+					tables.emplace_back(fieldPath, static_cast<const TableCtor *>(v));
+			}
+		}
+	}
+
+	FunctionId valueFunction(const Node *value) const
+	{
+		if (!value || value->type() != Node::Type::Function)
+			return None;
+		return m_functionIds.at(static_cast<const Function *>(value));
+	}
+
+	FunctionId newFunction(const Function *node, FunctionId parent)
+	{
+		m_graph.m_functions.push_back(FunctionInfo{node, parent});
+		m_pending.emplace_back();
+		m_globals.emplace_back();
+		const FunctionId id = m_graph.m_functions.size() - 1;
+		m_functionIds.emplace(node, id);
+		return id;
+	}
+
+	// binding is declared before the body is entered, e.g. for local
+	// function f, self is the path of the table of a method.
+	void function(const Function *node, FunctionId parent, const std::string &self = {})
+	{
+		const FunctionId f = newFunction(node, parent);
+		const std::size_t mark = openScope();
+
+		if (!self.empty())
+			m_bindings[declare("self")].alias = self;
+		for (const auto &param : node->params().names())
+			declare(param);
+		if (node->hasChunk())
+			block(&node->chunk(), f);
+
+		closeScope(mark);
+	}
+
+	// Expressions are walked iteratively, only functions in them recurse.
+	void expression(const Node *e, FunctionId f)
+	{
+		Traversal::walk(e, [this, f](const Node *node)
+		{
+			switch (node->type()) {
+				case Node::Type::Function:
+					function(static_cast<const Function *>(node), f);
+					return false;
+				case Node::Type::FunctionCall:
+				case Node::Type::MethodCall:
+					call(static_cast<const FunctionCall *>(node), f);
+					return true;
+				case Node::Type::LValue: {
+					auto lv = static_cast<const LValue *>(node);
+					if (lv->lvalueType() == LValue::Type::Name && lookup(lv->name()) == None)
+						m_globals[f].push_back(lv);
+					return true;
+				}
+				default:
+					return true;
+			}
+		});
+	}
+
+	void call(const FunctionCall *node, FunctionId f)
+	{
+		const Node *callee = &node->functionExpr();
+		PendingCall pending{node, source(callee), None, {}};
+
+		if (node->type() == Node::Type::MethodCall) {
+			const std::string &method = static_cast<const MethodCall *>(node)->methodName();
+			const std::string base = path(callee);
+			if (!base.empty())
+				pending.path = base + '.' + method;
+			pending.name = pending.name.empty() ? std::string{} : pending.name + ':' + method;
+		} else if (callee->type() == Node::Type::LValue && static_cast<const LValue *>(callee)->lvalueType() == LValue::Type::Name
+			&& lookup(static_cast<const LValue *>(callee)->name()) != None) {
+			const BindingId b = lookup(static_cast<const LValue *>(callee)->name());
+			if (m_bindings[b].alias.empty())
+				pending.binding = b;
+			else
+				pending.path = m_bindings[b].alias;
+		} else {
+			pending.path = path(callee);
+		}
+
+		m_pending[f].push_back(std::move(pending));
+	}
+
+	void block(const Chunk *chunk, FunctionId f)
+	{
+		const std::size_t mark = openScope();
+		for (const auto &s : chunk->children()) {
+			if (s)
+				statement(s.get(), f);
+		}
+		closeScope(mark);
+	}
+
+	void assignment(const Assignment *a, FunctionId f)
+	{
+		const auto &exprs = a->exprList().exprs();
+		for (const auto &e : exprs)
+			expression(e.get(), f);
+
+		const auto &vars = a->varList().vars();
+		if (a->isLocal()) {
+			for (std::size_t i = 0; i < vars.size(); ++i) {
+				const Node *value = i < exprs.size() ? exprs[i].get() : nullptr;
+				const BindingId b = declare(vars[i]->name());
+				m_bindings[b].function = valueFunction(value);
+				if (value && value->type() == Node::Type::TableCtor)
+					defineValue('#' + std::to_string(b), value, None);
+			}
+			return;
+		}
+
+		for (std::size_t i = 0; i < vars.size(); ++i) {
+			const LValue *var = vars[i].get();
+			const Node *value = i < exprs.size() ? exprs[i].get() : nullptr;
+
+			// the table and key expressions of the target are evaluated too
+			if (var->tableExpr())
+				expression(var->tableExpr(), f);
+			if (var->keyExpr())
+				expression(var->keyExpr(), f);
+
+			if (var->lvalueType() == LValue::Type::Name) {
+				const BindingId b = lookup(var->name());
+				if (b != None) {
+					++m_bindings[b].assignments;
+					continue;
+				}
+				m_globals[f].push_back(var);
+			}
+
+			const std::string p = path(var);
+			if (!p.empty())
+				defineValue(p, value, valueFunction(value));
+		}
+	}
+
+	void statement(const Node *s, FunctionId f)
+	{
+		switch (s->type()) {
+			case Node::Type::Assignment:
+				assignment(static_cast<const Assignment *>(s), f);
+				break;
+			case Node::Type::Function: {
+				auto fn = static_cast<const Function *>(s);
+				const auto &parts = fn->nameParts();
+				if (parts.empty()) {
+					function(fn, f);
+					break;
+				}
+
+				if (fn->isLocal()) {
+					// visible in its own body
+					const BindingId b = declare(parts[0]);
+					function(fn, f);
+					m_bindings[b].function = m_functionIds.at(fn);
+					break;
+				}
+
+				std::string p;
+				const BindingId root = lookup(parts[0]);
+				if (root == None) {
+					p = parts[0];
+				} else if (parts.size() == 1 && fn->methodName().empty()) {
+					// function f() assigns the local f
+					++m_bindings[root].assignments;
+				} else {
+					p = m_bindings[root].alias.empty() ? '#' + std::to_string(root) : m_bindings[root].alias;
+				}
+				for (std::size_t i = 1; i < parts.size(); ++i)
+					p += '.' + parts[i];
+
+				const std::string table = p;
+				if (!fn->methodName().empty())
+					p += '.' + fn->methodName();
+
+				function(fn, f, fn->methodName().empty() ? std::string{} : table);
+				if (!table.empty())
+					define(p, m_functionIds.at(fn));
+				break;
+			}
+			case Node::Type::Chunk:
+				block(static_cast<const Chunk *>(s), f);
+				break;
+			case Node::Type::If:
+				for (auto i = static_cast<const If *>(s); i; i = i->nextIf()) {
+					expression(&i->condition(), f);
+					if (i->chunk())
+						statement(i->chunk(), f);
+					if (i->elseChunk())
+						block(i->elseChunk(), f);
+				}
+				break;
+			case Node::Type::While: {
+				auto w = static_cast<const While *>(s);
+				expression(&w->condition(), f);
+				if (w->chunk())
+					block(w->chunk(), f);
+				break;
+			}
+			case Node::Type::Repeat: {
+				// the condition sees the locals of the body
+				auto r = static_cast<const Repeat *>(s);
+				const std::size_t mark = openScope();
+				if (r->chunk()) {
+					for (const auto &c : r->chunk()->children()) {
+						if (c)
+							statement(c.get(), f);
+					}
+				}
+				expression(&r->condition(), f);
+				closeScope(mark);
+				break;
+			}
+			case Node::Type::For: {
+				auto loop = static_cast<const For *>(s);
+				expression(&loop->start(), f);
+				expression(&loop->limit(), f);
+				if (loop->step())
+					expression(loop->step(), f);
+				const std::size_t mark = openScope();
+				declare(loop->iterator());
+				if (loop->chunk())
+					block(loop->chunk(), f);
+				closeScope(mark);
+				break;
+			}
+			case Node::Type::ForEach: {
+				auto loop = static_cast<const ForEach *>(s);
+				expression(&loop->exprs(), f);
+				const std::size_t mark = openScope();
+				for (const auto &name : loop->iterators().names())
+					declare(name);
+				if (loop->chunk())
+					block(loop->chunk(), f);
+				closeScope(mark);
+				break;
+			}
+			default:
+				expression(s, f);
+				break;
+		}
+	}
+
+	FunctionId resolve(const PendingCall &call) const
+	{
+		if (call.binding != None) {
+			const Binding &b = m_bindings[call.binding];
+			return b.assignments == 0 ? b.function : None;
+		}
+		if (call.path.empty())
+			return None;
+
+		// a path under a local that gets assigned again is unknown
+		if (call.path[0] == '#') {
+			const BindingId root = std::stoul(call.path.substr(1));
+			if (m_bindings[root].assignments > 0)
+				return None;
+		}
+
+		const auto it = m_definitions.find(call.path);
+		if (it == m_definitions.end() || it->second.count != 1)
+			return None;
+
+		// as is one under a global or field assigned again after it, e.g.
+		// M.f once M = require("other") has replaced the table
+		for (std::size_t dot = call.path.find('.'); dot != std::string::npos; dot = call.path.find('.', dot + 1)) {
+			const auto table = m_definitions.find(call.path.substr(0, dot));
+			if (table != m_definitions.end() && table->second.order > it->second.order)
+				return None;
+		}
+		return it->second.function;
+	}
+
+	void finish()
+	{
+		CallGraph &g = m_graph;
+		g.m_callStarts.push_back(0);
+		g.m_globalStarts.push_back(0);
+		for (FunctionId f = 0; f < g.m_functions.size(); ++f) {
+			for (const PendingCall &call : m_pending[f])
+				g.m_calls.push_back(Call{call.node, resolve(call), call.name});
+			g.m_callStarts.push_back(g.m_calls.size());
+			g.m_globals.insert(g.m_globals.end(), m_globals[f].begin(), m_globals[f].end());
+			g.m_globalStarts.push_back(g.m_globals.size());
+		}
+
+		g.computeEdges();
+		g.computeComponents();
+	}
+
+	CallGraph &m_graph;
+	std::vector <Binding> m_bindings;
+	std::unordered_map <std::string, std::vector <BindingId> > m_scope;
+	// names in order of declaration, to close scopes
+	std::vector <const std::string *> m_declared;
+	std::unordered_map <const Function *, FunctionId> m_functionIds;
+	std::unordered_map <std::string, Definition> m_definitions;
+	unsigned m_assignments = 0;
+	std::vector <std::vector <PendingCall> > m_pending;
+	std::vector <std::vector <const LValue *> > m_globals;
+};
+
+CallGraph::CallGraph(const Chunk *root)
+{
+	Builder{*this}.build(root);
+}
+
+std::string CallGraph::name(FunctionId f) const
+{
+	const Function *node = m_functions[f].node;
+	return node ? node->fullName() : "main chunk";
+}
+
+CallGraph::Range <CallGraph::Call> CallGraph::calls(FunctionId f) const
+{
+	const Call *base = m_calls.data();
+	return Range <Call>{base + m_callStarts[f], base + m_callStarts[f + 1]};
+}
+
+CallGraph::Range <CallGraph::FunctionId> CallGraph::callees(FunctionId f) const
+{
+	const FunctionId *base = m_callees.data();
+	return Range <FunctionId>{base + m_calleeStarts[f], base + m_calleeStarts[f + 1]};
+}
+
+CallGraph::Range <CallGraph::FunctionId> CallGraph::callers(FunctionId f) const
+{
+	const FunctionId *base = m_callers.data();
+	return Range <FunctionId>{base + m_callerStarts[f], base + m_callerStarts[f + 1]};
+}
+
+CallGraph::Range <const LValue *> CallGraph::globals(FunctionId f) const
+{
+	const LValue * const *base = m_globals.data();
+	return Range <const LValue *>{base + m_globalStarts[f], base + m_globalStarts[f + 1]};
+}
+
+CallGraph::Range <CallGraph::FunctionId> CallGraph::members(ComponentId c) const
+{
+	const FunctionId *base = m_members.data();
+	return Range <FunctionId>{base + m_componentStarts[c], base + m_componentStarts[c + 1]};
+}
+
+void CallGraph::computeEdges()
+{
+	const std::size_t n = m_functions.size();
+	std::vector <std::pair <FunctionId, FunctionId> > edges;
+	for (FunctionId f = 0; f < n; ++f) {
+		for (const Call &call : calls(f)) {
+			if (call.callee != None)
+				edges.emplace_back(f, call.callee);
+		}
+	}
+	std::sort(edges.begin(), edges.end());
+	edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+	// counting sort into both directions
+	m_calleeStarts.assign(n + 1, 0);
+	m_callerStarts.assign(n + 1, 0);
+	for (const auto &e : edges) {
+		++m_calleeStarts[e.first + 1];
+		++m_callerStarts[e.second + 1];
+	}
+	for (std::size_t i = 0; i < n; ++i) {
+		m_calleeStarts[i + 1] += m_calleeStarts[i];
+		m_callerStarts[i + 1] += m_callerStarts[i];
+	}
+
+	m_callees.resize(edges.size());
+	m_callers.resize(edges.size());
+	std::vector <std::uint32_t> calleeFill(m_calleeStarts.begin(), m_calleeStarts.end() - 1);
+	std::vector <std::uint32_t> callerFill(m_callerStarts.begin(), m_callerStarts.end() - 1);
+	for (const auto &e : edges) {
+		m_callees[calleeFill[e.first]++] = e.second;
+		m_callers[callerFill[e.second]++] = e.first;
+	}
+}
+
+// Tarjan's algorithm with an explicit stack. It completes components in
+// reverse topological order of the condensed graph, which is callees first.
+void CallGraph::computeComponents()
+{
+	const std::size_t n = m_functions.size();
+	constexpr std::uint32_t Unvisited = std::numeric_limits<std::uint32_t>::max();
+
+	std::vector <std::uint32_t> index(n, Unvisited), low(n, 0);
+	std::vector <bool> onStack(n, false);
+	std::vector <FunctionId> stack;
+	// function and position in its callees
+	std::vector <std::pair <FunctionId, std::uint32_t> > dfs;
+	std::uint32_t counter = 0;
+
+	m_component.assign(n, 0);
+	m_componentStarts.assign(1, 0);
+	m_members.clear();
+	m_recursive.clear();
+
+	for (FunctionId root = 0; root < n; ++root) {
+		if (index[root] != Unvisited)
+			continue;
+
+		dfs.emplace_back(root, 0);
+		while (!dfs.empty()) {
+			auto &[f, next] = dfs.back();
+			if (next == 0 && index[f] == Unvisited) {
+				index[f] = low[f] = counter++;
+				stack.push_back(f);
+				onStack[f] = true;
+			}
+
+			const Range <FunctionId> out = callees(f);
+			if (next < out.size()) {
+				const FunctionId g = out[next++];
+				if (index[g] == Unvisited)
+					dfs.emplace_back(g, 0);
+				else if (onStack[g])
+					low[f] = std::min(low[f], index[g]);
+				continue;
+			}
+
+			if (low[f] == index[f]) {
+				const ComponentId c = m_componentStarts.size() - 1;
+				bool recursive = false;
+				FunctionId g;
+				do {
+					g = stack.back();
+					stack.pop_back();
+					onStack[g] = false;
+					m_component[g] = c;
+					m_members.push_back(g);
+				} while (g != f);
+				m_componentStarts.push_back(m_members.size());
+
+				const Range <FunctionId> functions = members(c);
+				if (functions.size() > 1) {
+					recursive = true;
+				} else {
+					const Range <FunctionId> self = callees(f);
+					recursive = std::binary_search(self.begin(), self.end(), f);
+				}
+				m_recursive.push_back(recursive);
+			}
+
+			const FunctionId done = f;
+			dfs.pop_back();
+			if (!dfs.empty()) {
+				const FunctionId parent = dfs.back().first;
+				low[parent] = std::min(low[parent], low[done]);
+			}
+		}
+	}
+}
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "AST.hpp"
+#include "ThreadPool.hpp"
+
+// Calls between the main chunk and all functions of a tree, with the
+// targets resolved where that is possible without running the code:
+// local functions, functions stored under a global or local name path
+// (function M.f(), M.f = function, M = {f = function}) and method calls
+// on such paths, including self:m() inside function M:f(). A target counts
+// as known only if its name is given a value exactly once and none of the
+// tables on its path is assigned again after that.
+//
+// Functions are grouped into strongly connected components, numbered
+// callees first, so summaries can be computed bottom-up.
+class CallGraph {
+public:
+	using FunctionId = std::uint32_t;
+	using ComponentId = std::uint32_t;
+	static constexpr FunctionId None = std::numeric_limits<FunctionId>::max();
+
+	template <typename T>
+	class Range {
+	public:
+		Range(const T *begin, const T *end) : m_begin{begin}, m_end{end} {}
+
+		const T * begin() const { return m_begin; }
+		const T * end() const { return m_end; }
+		std::size_t size() const { return m_end - m_begin; }
+		bool empty() const { return m_begin == m_end; }
+		const T & operator [] (std::size_t i) const { return m_begin[i]; }
+
+	private:
+		const T *m_begin;
+		const T *m_end;
+	};
+
+	struct Call {
+		const FunctionCall *node;
+		// None if unknown
+		FunctionId callee;
+		// e.g. "string.format" or "obj:m", empty if the callee is no name
+		std::string name;
+	};
+
+	// The main chunk is function 0, its node is null.
+	explicit CallGraph(const Chunk *root);
+
+	std::size_t size() const { return m_functions.size(); }
+	const Function * function(FunctionId f) const { return m_functions[f].node; }
+	// None for the main chunk
+	FunctionId parent(FunctionId f) const { return m_functions[f].parent; }
+	std::string name(FunctionId f) const;
+
+	// Calls made directly in the body of f, in source order.
+	Range <Call> calls(FunctionId f) const;
+	// Known callees of f and known callers, without duplicates.
+	Range <FunctionId> callees(FunctionId f) const;
+	Range <FunctionId> callers(FunctionId f) const;
+	// Names f reads or assigns which are no local in scope.
+	Range <const LValue *> globals(FunctionId f) const;
+
+	std::size_t componentCount() const { return m_componentStarts.size() - 1; }
+	ComponentId component(FunctionId f) const { return m_component[f]; }
+	Range <FunctionId> members(ComponentId c) const;
+	// whether the functions of c call each other (or the one itself)
+	bool recursive(ComponentId c) const { return m_recursive[c]; }
+
+	// Computes a summary of every function from the summaries of the
+	// functions it calls: compute(f, summaries) returns the one of f and may
+	// read those of callees(f). Components run callees first. Within a
+	// recursive one summaries start out as Summary{} and compute() is rerun
+	// for all members until none changes, so it has to be monotone.
+	// Components whose callees are done run in parallel on pool, if given.
+	template <typename Summary, typename Compute>
+	std::vector <Summary> summarize(Compute &&compute, ThreadPool *pool = nullptr) const;
+
+private:
+	class Builder;
+	friend class Builder;
+
+	struct FunctionInfo {
+		const Function *node;
+		FunctionId parent;
+	};
+
+	template <typename Summary, typename Compute>
+	void summarize(ComponentId c, Compute &compute, std::vector <Summary> &summaries) const;
+
+	void computeEdges();
+	void computeComponents();
+
+	std::vector <FunctionInfo> m_functions;
+	// the calls of function f are [starts[f], starts[f + 1])
+	std::vector <std::uint32_t> m_callStarts;
+	std::vector <Call> m_calls;
+	std::vector <std::uint32_t> m_calleeStarts;
+	std::vector <FunctionId> m_callees;
+	std::vector <std::uint32_t> m_callerStarts;
+	std::vector <FunctionId> m_callers;
+	std::vector <std::uint32_t> m_globalStarts;
+	std::vector <const LValue *> m_globals;
+	std::vector <ComponentId> m_component;
+	std::vector <std::uint32_t> m_componentStarts;
+	std::vector <FunctionId> m_members;
+	std::vector <bool> m_recursive;
+};
+
+template <typename Summary, typename Compute>
+void CallGraph::summarize(ComponentId c, Compute &compute, std::vector <Summary> &summaries) const
+{
+	const Range <FunctionId> functions = members(c);
+	if (!m_recursive[c]) {
+		summaries[functions[0]] = compute(functions[0], static_cast<const std::vector <Summary> &>(summaries));
+		return;
+	}
+
+	for (bool changed = true; changed;) {
+		changed = false;
+		for (FunctionId f : functions) {
+			Summary s = compute(f, static_cast<const std::vector <Summary> &>(summaries));
+			if (!(s == summaries[f])) {
+				summaries[f] = std::move(s);
+				changed = true;
+			}
+		}
+	}
+}
+
+template <typename Summary, typename Compute>
+std::vector <Summary> CallGraph::summarize(Compute &&compute, ThreadPool *pool) const
+{
+	// tasks write the summaries of different functions at the same time
+	static_assert(!std::is_same_v<Summary, bool>, "std::vector <bool> can't be written concurrently");
+
+	std::vector <Summary> summaries(size());
+	const ComponentId count = componentCount();
+
+	if (!pool || pool->size() < 2) {
+		for (ComponentId c = 0; c < count; ++c)
+			summarize(c, compute, summaries);
+		return summaries;
+	}
+
+	// number of callee components each component still waits for
+	std::vector <std::uint32_t> waiting(count, 0);
+	std::vector <std::vector <ComponentId> > dependents(count);
+	for (ComponentId c = 0; c < count; ++c) {
+		for (FunctionId f : members(c)) {
+			for (FunctionId g : callees(f)) {
+				const ComponentId d = m_component[g];
+				if (d != c && (dependents[d].empty() || dependents[d].back() != c)) {
+					dependents[d].push_back(c);
+					++waiting[c];
+				}
+			}
+		}
+	}
+
+	std::mutex mutex;
+	std::condition_variable cond;
+	std::vector <ComponentId> finished;
+
+	auto start = [&](ComponentId c)
+	{
+		pool->post([&, c]
+		{
+			summarize(c, compute, summaries);
+			std::lock_guard <std::mutex> lock{mutex};
+			finished.push_back(c);
+			cond.notify_one();
+		});
+	};
+
+	for (ComponentId c = 0; c < count; ++c) {
+		if (waiting[c] == 0)
+			start(c);
+	}
+
+	std::vector <ComponentId> ready;
+	for (ComponentId done = 0; done < count;) {
+		{
+			std::unique_lock <std::mutex> lock{mutex};
+			cond.wait(lock, [&finished]{ return !finished.empty(); });
+			ready.swap(finished);
+		}
+
+		for (ComponentId c : ready) {
+			++done;
+			for (ComponentId d : dependents[c]) {
+				if (--waiting[d] == 0)
+					start(d);
+			}
+		}
+		ready.clear();
+	}
+
+	return summaries;
+}
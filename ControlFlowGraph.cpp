@@ -0,0 +1,557 @@
+#include <algorithm>
+#include <numeric>
+
+#include "ControlFlowGraph.hpp"
+#include "Traversal.hpp"
+
+namespace {
+
+// Whether expr is a literal, and if so whether it counts as true.
+bool constant(const Node *expr, bool &truthy)
+{
+	if (expr->type() != Node::Type::Value)
+		return false;
+
+	switch (static_cast<const Value *>(expr)->valueType()) {
+		case ValueType::Nil:
+			truthy = false;
+			break;
+		case ValueType::Boolean:
+			truthy = static_cast<const BooleanValue *>(expr)->value();
+			break;
+		default:
+			truthy = true;
+			break;
+	}
+	return true;
+}
+
+}
+
+// Lowers the statements in source order. A block is filled in one go, so
+// its statements are a contiguous range and all statements of the graph
+// stay in source order.
+class ControlFlowGraph::Builder {
+public:
+	explicit Builder(ControlFlowGraph &graph) : m_graph{graph} {}
+
+	void build(const Chunk *body, std::uint32_t base)
+	{
+		newBlock();
+		newBlock();
+		enter(m_graph.entry());
+		chunk(body, base);
+		jump(m_graph.exit());
+
+		m_graph.computeEdges(m_edges);
+		m_graph.computeDominators();
+	}
+
+private:
+	BlockId newBlock()
+	{
+		m_graph.m_blocks.emplace_back();
+		return m_graph.m_blocks.size() - 1;
+	}
+
+	void enter(BlockId b)
+	{
+		Block &block = m_graph.m_blocks[b];
+		block.first = block.last = m_graph.m_statements.size();
+		m_current = b;
+	}
+
+	// The block being filled. After a return or break there is none until
+	// the next statement, which starts an unreachable one.
+	BlockId current()
+	{
+		if (m_current == None)
+			enter(newBlock());
+		return m_current;
+	}
+
+	void edge(BlockId from, BlockId to)
+	{
+		m_edges.emplace_back(from, to);
+	}
+
+	void jump(BlockId to)
+	{
+		if (m_current != None)
+			edge(m_current, to);
+		m_current = None;
+	}
+
+	void branch(const Node *expr, BlockId onTrue, BlockId onFalse)
+	{
+		const BlockId b = current();
+		m_graph.m_blocks[b].branch = expr;
+		edge(b, onTrue);
+		edge(b, onFalse);
+		m_current = None;
+	}
+
+	void add(const Node *statement, std::uint32_t offset)
+	{
+		const BlockId b = current();
+		m_graph.m_statements.push_back(Statement{statement, offset});
+		m_graph.m_blocks[b].last = m_graph.m_statements.size();
+	}
+
+	void chunk(const Chunk *c, std::uint32_t base)
+	{
+		if (!c)
+			return;
+
+		const auto &children = c->children();
+		const auto &spans = c->spans();
+		for (std::size_t i = 0; i < children.size(); ++i)
+			statement(children[i].get(), base + spans[i].begin);
+	}
+
+	// Chunks of a statement are relative to its offset, which is also where
+	// the bodies of functions defined in it start from.
+	void statement(const Node *node, std::uint32_t offset)
+	{
+		// 'do end'
+		if (!node)
+			return;
+
+		switch (node->type()) {
+			case Node::Type::Chunk:
+				add(node, offset);
+				chunk(static_cast<const Chunk *>(node), offset);
+				break;
+			case Node::Type::Assignment: {
+				auto a = static_cast<const Assignment *>(node);
+				value(&a->varList(), offset);
+				value(&a->exprList(), offset);
+				add(node, offset);
+				break;
+			}
+			case Node::Type::FunctionCall:
+			case Node::Type::MethodCall:
+				value(node, offset);
+				add(node, offset);
+				break;
+			case Node::Type::Function:
+				add(node, offset);
+				m_graph.m_functions.push_back(NestedFunction{static_cast<const Function *>(node), offset});
+				break;
+			case Node::Type::Return:
+				value(static_cast<const Return *>(node)->exprList(), offset);
+				add(node, offset);
+				jump(m_graph.exit());
+				break;
+			case Node::Type::Break:
+				add(node, offset);
+				jump(m_loopExits.empty() ? m_graph.exit() : m_loopExits.back());
+				break;
+			case Node::Type::If:
+				ifStatement(static_cast<const If *>(node), offset);
+				break;
+			case Node::Type::While: {
+				auto w = static_cast<const While *>(node);
+				const BlockId header = newBlock();
+				const BlockId body = newBlock();
+				const BlockId done = newBlock();
+				jump(header);
+				enter(header);
+				add(node, offset);
+				condition(&w->condition(), body, done, offset);
+				loop(body, header, done, w->chunk(), offset);
+				break;
+			}
+			case Node::Type::Repeat: {
+				auto r = static_cast<const Repeat *>(node);
+				const BlockId body = newBlock();
+				const BlockId done = newBlock();
+				jump(body);
+				enter(body);
+				add(node, offset);
+				m_loopExits.push_back(done);
+				chunk(r->chunk(), offset);
+				m_loopExits.pop_back();
+				condition(&r->condition(), done, body, offset);
+				enter(done);
+				break;
+			}
+			case Node::Type::For: {
+				auto f = static_cast<const For *>(node);
+				value(&f->start(), offset);
+				value(&f->limit(), offset);
+				value(f->step(), offset);
+				forLoop(node, f->chunk(), offset);
+				break;
+			}
+			case Node::Type::ForEach: {
+				auto f = static_cast<const ForEach *>(node);
+				value(&f->exprs(), offset);
+				forLoop(node, f->chunk(), offset);
+				break;
+			}
+			default:
+				add(node, offset);
+				break;
+		}
+	}
+
+	void ifStatement(const If *top, std::uint32_t offset)
+	{
+		add(top, offset);
+
+		const BlockId join = newBlock();
+		for (const If *i = top; i; i = i->nextIf()) {
+			const BlockId then = newBlock();
+			const BlockId next = i->nextIf() || top->elseChunk() ? newBlock() : join;
+			condition(&i->condition(), then, next, offset);
+
+			enter(then);
+			chunk(static_cast<const Chunk *>(i->chunk()), offset);
+			jump(join);
+
+			if (next == join)
+				break;
+			enter(next);
+		}
+
+		if (top->elseChunk()) {
+			chunk(top->elseChunk(), offset);
+			jump(join);
+		}
+		enter(join);
+	}
+
+	// The loop statement is in the header, which tests whether there is
+	// another iteration.
+	void forLoop(const Node *node, const Chunk *body, std::uint32_t offset)
+	{
+		const BlockId header = newBlock();
+		const BlockId first = newBlock();
+		const BlockId done = newBlock();
+		jump(header);
+		enter(header);
+		add(node, offset);
+		branch(node, first, done);
+		loop(first, header, done, body, offset);
+	}
+
+	void loop(BlockId first, BlockId header, BlockId done, const Chunk *body, std::uint32_t offset)
+	{
+		enter(first);
+		m_loopExits.push_back(done);
+		chunk(body, offset);
+		m_loopExits.pop_back();
+		jump(header);
+		enter(done);
+	}
+
+	// Ends the current block with a test of expr. The operands of and, or
+	// and not are tested one at a time, as they are evaluated.
+	void condition(const Node *expr, BlockId onTrue, BlockId onFalse, std::uint32_t offset)
+	{
+		m_tests.push_back(Test{expr, onTrue, onFalse, None});
+
+		while (!m_tests.empty()) {
+			const Test t = m_tests.back();
+			m_tests.pop_back();
+			if (t.first != None)
+				enter(t.first);
+
+			bool truthy;
+			if (constant(t.expr, truthy)) {
+				current();
+				jump(truthy ? t.onTrue : t.onFalse);
+				continue;
+			}
+
+			if (t.expr->type() == Node::Type::UnOp) {
+				auto op = static_cast<const UnOp *>(t.expr);
+				if (op->unOpType() == UnOp::Type::Not) {
+					m_tests.push_back(Test{&op->operand(), t.onFalse, t.onTrue, None});
+					continue;
+				}
+			}
+
+			if (t.expr->type() == Node::Type::BinOp) {
+				auto op = static_cast<const BinOp *>(t.expr);
+				if (op->binOpType() == BinOp::Type::And || op->binOpType() == BinOp::Type::Or) {
+					const BlockId right = newBlock();
+					m_tests.push_back(Test{&op->right(), t.onTrue, t.onFalse, right});
+					if (op->binOpType() == BinOp::Type::And)
+						m_tests.push_back(Test{&op->left(), right, t.onFalse, None});
+					else
+						m_tests.push_back(Test{&op->left(), t.onTrue, right, None});
+					continue;
+				}
+			}
+
+			value(t.expr, offset);
+			branch(t.expr, t.onTrue, t.onFalse);
+		}
+	}
+
+	// Evaluates expr in the current block, splitting it wherever and or or
+	// may skip their right operand.
+	void value(const Node *expr, std::uint32_t offset)
+	{
+		if (!expr)
+			return;
+		m_steps.push_back(Step{expr, Step::Stage::Visit, None});
+
+		while (!m_steps.empty()) {
+			const Step step = m_steps.back();
+			m_steps.pop_back();
+
+			if (step.stage == Step::Stage::Joined) {
+				jump(step.join);
+				enter(step.join);
+				continue;
+			}
+
+			if (step.node->type() == Node::Type::Function) {
+				m_graph.m_functions.push_back(NestedFunction{static_cast<const Function *>(step.node), offset});
+				continue;
+			}
+
+			const BinOp *op = step.node->type() == Node::Type::BinOp ? static_cast<const BinOp *>(step.node) : nullptr;
+			const bool shortCircuit = op && (op->binOpType() == BinOp::Type::And || op->binOpType() == BinOp::Type::Or);
+
+			if (!shortCircuit) {
+				const std::size_t size = m_steps.size();
+				Traversal::forEachChild(step.node, [this](const Node *n) { m_steps.push_back(Step{n, Step::Stage::Visit, None}); });
+				std::reverse(m_steps.begin() + size, m_steps.end());
+			} else if (step.stage == Step::Stage::Visit) {
+				m_steps.push_back(Step{op, Step::Stage::LeftDone, None});
+				m_steps.push_back(Step{&op->left(), Step::Stage::Visit, None});
+			} else {
+				const bool isAnd = op->binOpType() == BinOp::Type::And;
+				const BlockId right = newBlock();
+				const BlockId join = newBlock();
+				bool truthy;
+				if (constant(&op->left(), truthy)) {
+					current();
+					jump(truthy == isAnd ? right : join);
+				} else {
+					branch(&op->left(), isAnd ? right : join, isAnd ? join : right);
+				}
+
+				enter(right);
+				m_steps.push_back(Step{op, Step::Stage::Joined, join});
+				m_steps.push_back(Step{&op->right(), Step::Stage::Visit, None});
+			}
+		}
+	}
+
+	struct Test {
+		const Node *expr;
+		BlockId onTrue;
+		BlockId onFalse;
+		// block to start before testing
+		BlockId first;
+	};
+
+	struct Step {
+		enum class Stage {
+			Visit,
+			LeftDone,
+			Joined,
+		};
+
+		const Node *node;
+		Stage stage;
+		BlockId join;
+	};
+
+	ControlFlowGraph &m_graph;
+	std::vector <std::pair <BlockId, BlockId> > m_edges;
+	std::vector <BlockId> m_loopExits;
+	// work stacks of condition() and value(), expressions can be very deep
+	std::vector <Test> m_tests;
+	std::vector <Step> m_steps;
+	BlockId m_current = None;
+};
+
+ControlFlowGraph::ControlFlowGraph(const Chunk *body, std::uint32_t base, const Function *function)
+	: m_function{function}
+{
+	Builder{*this}.build(body, base);
+}
+
+ControlFlowGraph::Range <ControlFlowGraph::Statement> ControlFlowGraph::statements(BlockId b) const
+{
+	const Statement *data = m_statements.data();
+	return Range <Statement>{data + m_blocks[b].first, data + m_blocks[b].last};
+}
+
+ControlFlowGraph::Range <ControlFlowGraph::BlockId> ControlFlowGraph::successors(BlockId b) const
+{
+	const BlockId *data = m_successors.data();
+	return Range <BlockId>{data + m_successorStarts[b], data + m_successorStarts[b + 1]};
+}
+
+ControlFlowGraph::Range <ControlFlowGraph::BlockId> ControlFlowGraph::predecessors(BlockId b) const
+{
+	const BlockId *data = m_predecessors.data();
+	return Range <BlockId>{data + m_predecessorStarts[b], data + m_predecessorStarts[b + 1]};
+}
+
+bool ControlFlowGraph::dominates(BlockId a, BlockId b) const
+{
+	if (!reachable(a) || !reachable(b))
+		return false;
+	return m_treeBegin[a] <= m_treeBegin[b] && m_treeEnd[b] <= m_treeEnd[a];
+}
+
+std::vector <ControlFlowGraph::Statement> ControlFlowGraph::unreachable() const
+{
+	std::vector <bool> dead(m_statements.size());
+	for (BlockId b = 0; b < m_blocks.size(); ++b) {
+		if (!reachable(b))
+			std::fill(dead.begin() + m_blocks[b].first, dead.begin() + m_blocks[b].last, true);
+	}
+
+	std::vector <Statement> result;
+	for (std::size_t i = 0; i < dead.size(); ++i) {
+		if (dead[i] && (i == 0 || !dead[i - 1]))
+			result.push_back(m_statements[i]);
+	}
+	return result;
+}
+
+void ControlFlowGraph::computeEdges(std::vector <std::pair <BlockId, BlockId> > &edges)
+{
+	// counting sort, which keeps the true edge of a branch first
+	const std::size_t n = m_blocks.size();
+	m_successorStarts.assign(n + 1, 0);
+	m_predecessorStarts.assign(n + 1, 0);
+	for (const auto &e : edges) {
+		++m_successorStarts[e.first + 1];
+		++m_predecessorStarts[e.second + 1];
+	}
+	std::partial_sum(m_successorStarts.begin(), m_successorStarts.end(), m_successorStarts.begin());
+	std::partial_sum(m_predecessorStarts.begin(), m_predecessorStarts.end(), m_predecessorStarts.begin());
+
+	std::vector <std::uint32_t> nextSuccessor(m_successorStarts.begin(), m_successorStarts.end() - 1);
+	std::vector <std::uint32_t> nextPredecessor(m_predecessorStarts.begin(), m_predecessorStarts.end() - 1);
+	m_successors.resize(edges.size());
+	m_predecessors.resize(edges.size());
+	for (const auto &e : edges) {
+		m_successors[nextSuccessor[e.first]++] = e.second;
+		m_predecessors[nextPredecessor[e.second]++] = e.first;
+	}
+}
+
+// Semi-NCA: semidominators as in Lengauer and Tarjan, then the immediate
+// dominator of a block is the nearest common ancestor of its parent and
+// semidominator in the dominator tree built so far. Unlike the iterative
+// algorithms this stays near linear on long if-elseif chains.
+void ControlFlowGraph::computeDominators()
+{
+	const std::size_t n = m_blocks.size();
+
+	// depth first search from the entry, blocks are numbered in pre-order
+	std::vector <std::uint32_t> number(n, None);
+	std::vector <BlockId> vertex;
+	std::vector <std::uint32_t> parent;
+	std::vector <std::pair <BlockId, std::uint32_t> > stack;
+	stack.emplace_back(entry(), 0);
+	number[entry()] = 0;
+	vertex.push_back(entry());
+	parent.push_back(0);
+	while (!stack.empty()) {
+		const BlockId b = stack.back().first;
+		const auto next = successors(b);
+		if (stack.back().second < next.size()) {
+			const BlockId s = next[stack.back().second++];
+			if (number[s] == None) {
+				number[s] = vertex.size();
+				vertex.push_back(s);
+				parent.push_back(number[b]);
+				stack.emplace_back(s, 0);
+			}
+		} else {
+			m_order.push_back(b);
+			stack.pop_back();
+		}
+	}
+	std::reverse(m_order.begin(), m_order.end());
+
+	// Everything below works on pre-order numbers. ancestor is the forest
+	// of the blocks processed so far, label the number with the smallest
+	// semidominator on the compressed path.
+	const std::uint32_t count = vertex.size();
+	std::vector <std::uint32_t> semi(count), label(count), ancestor(count, None);
+	std::iota(semi.begin(), semi.end(), 0);
+	std::iota(label.begin(), label.end(), 0);
+	std::vector <std::uint32_t> path;
+
+	auto eval = [&](std::uint32_t v)
+	{
+		if (ancestor[v] == None)
+			return v;
+		for (std::uint32_t x = v; ancestor[ancestor[x]] != None; x = ancestor[x])
+			path.push_back(x);
+		while (!path.empty()) {
+			const std::uint32_t x = path.back();
+			path.pop_back();
+			const std::uint32_t a = ancestor[x];
+			if (semi[label[a]] < semi[label[x]])
+				label[x] = label[a];
+			ancestor[x] = ancestor[a];
+		}
+		return label[v];
+	};
+
+	for (std::uint32_t w = count - 1; w > 0; --w) {
+		for (BlockId p : predecessors(vertex[w])) {
+			if (number[p] != None)
+				semi[w] = std::min(semi[w], semi[eval(number[p])]);
+		}
+		ancestor[w] = parent[w];
+	}
+
+	std::vector <std::uint32_t> idom(count, 0);
+	for (std::uint32_t w = 1; w < count; ++w) {
+		std::uint32_t d = parent[w];
+		while (d > semi[w])
+			d = idom[d];
+		idom[w] = d;
+	}
+
+	m_idom.assign(n, None);
+	for (std::uint32_t w = 0; w < count; ++w)
+		m_idom[vertex[w]] = vertex[idom[w]];
+
+	// number the dominator tree depth first, a subtree is an interval
+	std::vector <std::uint32_t> childStarts(n + 1, 0);
+	for (BlockId b : m_order) {
+		if (b != entry())
+			++childStarts[m_idom[b] + 1];
+	}
+	std::partial_sum(childStarts.begin(), childStarts.end(), childStarts.begin());
+	std::vector <BlockId> children(childStarts.back());
+	std::vector <std::uint32_t> nextChild(childStarts.begin(), childStarts.end() - 1);
+	for (BlockId b : m_order) {
+		if (b != entry())
+			children[nextChild[m_idom[b]]++] = b;
+	}
+
+	m_treeBegin.assign(n, 0);
+	m_treeEnd.assign(n, 0);
+	std::uint32_t counter = 0;
+	stack.clear();
+	stack.emplace_back(entry(), childStarts[entry()]);
+	m_treeBegin[entry()] = counter++;
+	while (!stack.empty()) {
+		const BlockId b = stack.back().first;
+		if (stack.back().second < childStarts[b + 1]) {
+			const BlockId c = children[stack.back().second++];
+			m_treeBegin[c] = counter++;
+			stack.emplace_back(c, childStarts[c]);
+		} else {
+			m_treeEnd[b] = counter;
+			stack.pop_back();
+		}
+	}
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "AST.hpp"
+
+// Control flow graph of the main chunk or of one function body. Blocks,
+// their statements and the edges between them live in flat arrays, the
+// edges of a block are a contiguous range. Functions nested in the body
+// are not entered, functions() lists them so each gets a graph of its own.
+class ControlFlowGraph {
+public:
+	using BlockId = std::uint32_t;
+	static constexpr BlockId None = std::numeric_limits<BlockId>::max();
+
+	template <typename T>
+	class Range {
+	public:
+		Range(const T *begin, const T *end) : m_begin{begin}, m_end{end} {}
+
+		const T * begin() const { return m_begin; }
+		const T * end() const { return m_end; }
+		std::size_t size() const { return m_end - m_begin; }
+		bool empty() const { return m_begin == m_end; }
+		const T & operator [] (std::size_t i) const { return m_begin[i]; }
+
+	private:
+		const T *m_begin;
+		const T *m_end;
+	};
+
+	struct Block {
+		// statements [first, last)
+		std::uint32_t first = 0;
+		std::uint32_t last = 0;
+		// If set, the block ends by testing this expression (or for loop):
+		// the first successor is taken if it is true, the second otherwise.
+		// A constant condition is no branch, only the edge taken is there.
+		const Node *branch = nullptr;
+	};
+
+	struct Statement {
+		const Node *node;
+		// absolute offset of the statement in the source
+		std::uint32_t offset;
+	};
+
+	struct NestedFunction {
+		const Function *function;
+		// absolute offset the spans of its body are relative to
+		std::uint32_t base;
+	};
+
+	// body may be null for an empty function. base is what the spans of
+	// body are relative to.
+	explicit ControlFlowGraph(const Chunk *body, std::uint32_t base = 0, const Function *function = nullptr);
+
+	const Function * function() const { return m_function; }
+
+	BlockId entry() const { return 0; }
+	// every return leads here, it has no statements
+	BlockId exit() const { return 1; }
+
+	std::size_t size() const { return m_blocks.size(); }
+	std::size_t edgeCount() const { return m_successors.size(); }
+
+	const Block & block(BlockId b) const { return m_blocks[b]; }
+	Range <Statement> statements(BlockId b) const;
+	Range <BlockId> successors(BlockId b) const;
+	Range <BlockId> predecessors(BlockId b) const;
+
+	bool reachable(BlockId b) const { return b == entry() || m_idom[b] != None; }
+	// None for the entry and for unreachable blocks
+	BlockId immediateDominator(BlockId b) const { return b == entry() ? None : m_idom[b]; }
+	bool dominates(BlockId a, BlockId b) const;
+
+	// Reachable blocks in reverse post-order, starting with the entry.
+	const std::vector <BlockId> & order() const { return m_order; }
+
+	// First statement of every stretch of statements which can never run.
+	std::vector <Statement> unreachable() const;
+
+	const std::vector <NestedFunction> & functions() const { return m_functions; }
+
+private:
+	class Builder;
+	friend class Builder;
+
+	void computeEdges(std::vector <std::pair <BlockId, BlockId> > &edges);
+	void computeDominators();
+
+	const Function *m_function;
+	std::vector <Block> m_blocks;
+	std::vector <Statement> m_statements;
+	// block b's edges are [starts[b], starts[b + 1])
+	std::vector <std::uint32_t> m_successorStarts;
+	std::vector <BlockId> m_successors;
+	std::vector <std::uint32_t> m_predecessorStarts;
+	std::vector <BlockId> m_predecessors;
+	std::vector <BlockId> m_order;
+	std::vector <BlockId> m_idom;
+	// dominator tree intervals, a dominates b iff b's lies in a's
+	std::vector <std::uint32_t> m_treeBegin;
+	std::vector <std::uint32_t> m_treeEnd;
+	std::vector <NestedFunction> m_functions;
+};
@@ -0,0 +1,712 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+
+#include "DataLoader.hpp"
+#include "Driver.hpp"
+#include "OutputBuffer.hpp"
+
+namespace {
+
+using token = yy::Parser::token;
+
+// The same key for t[1.0] and t[1].
+DataValue normalKey(DataValue key)
+{
+	if (key.type == DataValue::Type::Real && key.real == std::trunc(key.real)
+		&& key.real >= -9.2e18 && key.real <= 9.2e18)
+		return DataValue::makeInteger(static_cast<long>(key.real));
+	return key;
+}
+
+void writeBigEndian(OutputBuffer &out, unsigned char tag, std::uint64_t value, int bytes)
+{
+	char buf[9];
+	buf[0] = static_cast<char>(tag);
+	for (int i = 0; i < bytes; ++i)
+		buf[1 + i] = static_cast<char>(value >> (8 * (bytes - 1 - i)));
+	out.write(buf, 1 + bytes);
+}
+
+// tag for a size below 16, 8 bit tag for up to 255 or 0 if there is none
+void writeSize(OutputBuffer &out, std::size_t size, unsigned char fix, std::size_t fixLimit,
+	unsigned char tag8, unsigned char tag16, unsigned char tag32)
+{
+	if (size < fixLimit)
+		out.put(static_cast<char>(fix | size));
+	else if (tag8 && size <= 0xFF)
+		writeBigEndian(out, tag8, size, 1);
+	else if (size <= 0xFFFF)
+		writeBigEndian(out, tag16, size, 2);
+	else
+		writeBigEndian(out, tag32, size, 4);
+}
+
+// Walks the live entries of a table, array part first.
+struct Cursor {
+	const DataValue *array;
+	std::size_t arraySize;
+	const DataEntry *hash;
+	std::size_t hashSize;
+	std::size_t next;
+	bool object;
+	bool first;
+	// value of the entry whose key is being written
+	DataValue pending = {};
+	bool hasPending = false;
+};
+
+// t[key] is in the array part, which hides the hash part
+bool shadowed(std::size_t arraySize, DataValue key)
+{
+	return key.type == DataValue::Type::Integer && key.integer >= 1
+		&& static_cast<std::size_t>(key.integer) <= arraySize;
+}
+
+// live entries of the hash part
+std::size_t liveSize(const Cursor &c)
+{
+	std::size_t size = 0;
+	for (std::size_t i = 0; i < c.hashSize; ++i) {
+		if (!c.hash[i].second.isNil() && !shadowed(c.arraySize, c.hash[i].first))
+			++size;
+	}
+	return size;
+}
+
+bool nextEntry(Cursor &c, DataValue &key, DataValue &value)
+{
+	while (c.next < c.arraySize + c.hashSize) {
+		const std::size_t i = c.next++;
+		if (i < c.arraySize) {
+			key = DataValue::makeInteger(i + 1);
+			value = c.array[i];
+			return true;
+		}
+
+		const DataEntry &entry = c.hash[i - c.arraySize];
+		if (!entry.second.isNil() && !shadowed(c.arraySize, entry.first)) {
+			key = entry.first;
+			value = entry.second;
+			return true;
+		}
+	}
+	return false;
+}
+
+}
+
+bool DataValue::operator == (const DataValue &other) const
+{
+	if (type != other.type)
+		return false;
+
+	switch (type) {
+		case Type::Nil:
+			return true;
+		case Type::Boolean:
+			return boolean == other.boolean;
+		case Type::Integer:
+			return integer == other.integer;
+		case Type::Real:
+			return real == other.real;
+		case Type::String:
+		case Type::Table:
+			return index == other.index;
+	}
+	return false;
+}
+
+std::size_t DataDocument::SlotHash::operator () (const Slot &slot) const
+{
+	// the constructor zeroes all bytes of the payload
+	std::uint64_t bits;
+	std::memcpy(&bits, &slot.key.integer, sizeof(bits));
+	return std::hash<std::uint64_t>{}(bits ^ (static_cast<std::uint64_t>(slot.key.type) << 56)
+		^ (static_cast<std::uint64_t>(slot.table) * 0x9E3779B97F4A7C15ull));
+}
+
+void DataDocument::clear()
+{
+	m_strings.clear();
+	m_stringIndex.clear();
+	m_tables.clear();
+	m_values.clear();
+	m_entries.clear();
+	m_openArray.clear();
+	m_openHash.clear();
+	m_slots.clear();
+	m_result = DataValue{};
+	m_returned = false;
+	// the globals, closed by DataLoader::load()
+	openTable();
+}
+
+std::uint32_t DataDocument::intern(std::string_view s)
+{
+	const auto it = m_stringIndex.find(s);
+	if (it != m_stringIndex.end())
+		return it->second;
+
+	m_strings.emplace_back(s);
+	const std::uint32_t index = m_strings.size() - 1;
+	m_stringIndex.emplace(m_strings.back(), index);
+	return index;
+}
+
+// Small hash parts are searched, larger ones get their keys indexed.
+std::size_t DataDocument::find(const DataEntry *hash, std::size_t size, std::uint32_t table, DataValue key) const
+{
+	if (size <= MaxUnindexed) {
+		for (std::size_t i = 0; i < size; ++i) {
+			if (hash[i].first == key)
+				return i;
+		}
+		return None;
+	}
+
+	const auto it = m_slots.find(Slot{table, key});
+	return it == m_slots.end() ? None : it->second;
+}
+
+std::uint32_t DataDocument::openTable()
+{
+	m_tables.emplace_back();
+	return m_tables.size() - 1;
+}
+
+void DataDocument::set(std::uint32_t table, std::size_t hashBegin, DataValue key, DataValue value)
+{
+	key = normalKey(key);
+	const std::size_t size = m_openHash.size() - hashBegin;
+	const std::size_t i = find(m_openHash.data() + hashBegin, size, table, key);
+	if (i != None) {
+		m_openHash[hashBegin + i].second = value;
+		return;
+	}
+
+	m_openHash.emplace_back(key, value);
+	if (size == MaxUnindexed) {
+		for (std::size_t j = 0; j <= size; ++j)
+			m_slots.emplace(Slot{table, m_openHash[hashBegin + j].first}, j);
+	} else if (size > MaxUnindexed) {
+		m_slots.emplace(Slot{table, key}, size);
+	}
+}
+
+void DataDocument::closeTable(std::uint32_t table, std::size_t arrayBegin, std::size_t hashBegin)
+{
+	DataTable &t = m_tables[table];
+
+	t.arrayBegin = m_values.size();
+	t.arraySize = m_openArray.size() - arrayBegin;
+	m_values.insert(m_values.end(), m_openArray.begin() + arrayBegin, m_openArray.end());
+	m_openArray.resize(arrayBegin);
+
+	t.hashBegin = m_entries.size();
+	t.hashSize = m_openHash.size() - hashBegin;
+	m_entries.insert(m_entries.end(), m_openHash.begin() + hashBegin, m_openHash.end());
+	m_openHash.resize(hashBegin);
+}
+
+DataValue DataDocument::get(DataValue t, DataValue key) const
+{
+	if (t.type != DataValue::Type::Table)
+		return DataValue{};
+
+	key = normalKey(key);
+	const DataTable &table = m_tables[t.index];
+	if (shadowed(table.arraySize, key))
+		return array(table)[key.integer - 1];
+
+	const std::size_t i = find(hash(table), table.hashSize, t.index, key);
+	return i == None ? DataValue{} : hash(table)[i].second;
+}
+
+DataValue DataDocument::get(DataValue t, std::string_view key) const
+{
+	const auto it = m_stringIndex.find(key);
+	if (it == m_stringIndex.end())
+		return DataValue{};
+	return get(t, DataValue::makeString(it->second));
+}
+
+// Nesting is only bounded by the number of tables, since a name can put a
+// whole nest into another table. Both writers use an explicit stack.
+void DataDocument::writeJson(OutputBuffer &out, DataValue v) const
+{
+	std::vector <Cursor> stack;
+
+	auto writeScalar = [&out, this](DataValue v)
+	{
+		switch (v.type) {
+			case DataValue::Type::Nil:
+				out.write("null");
+				break;
+			case DataValue::Type::Boolean:
+				out.write(v.boolean ? "true" : "false");
+				break;
+			case DataValue::Type::Integer:
+				out.writeInt(v.integer);
+				break;
+			case DataValue::Type::Real:
+				// JSON has no infinity, this reads back as one
+				if (std::isinf(v.real))
+					out.write(v.real < 0 ? "-1e999" : "1e999");
+				else
+					out.writeShortestReal(v.real);
+				break;
+			case DataValue::Type::String:
+				out.writeJsonString(m_strings[v.index]);
+				break;
+			case DataValue::Type::Table:
+				break;
+		}
+	};
+
+	auto open = [&](DataValue v)
+	{
+		if (v.type != DataValue::Type::Table) {
+			writeScalar(v);
+			return;
+		}
+		const DataTable &t = m_tables[v.index];
+		Cursor c{array(t), t.arraySize, hash(t), t.hashSize, 0, false, true};
+		c.object = liveSize(c) > 0;
+		out.put(c.object ? '{' : '[');
+		stack.push_back(c);
+	};
+
+	open(v);
+	while (!stack.empty()) {
+		Cursor &c = stack.back();
+		DataValue key, value;
+		if (!nextEntry(c, key, value)) {
+			out.put(c.object ? '}' : ']');
+			stack.pop_back();
+			continue;
+		}
+
+		if (!c.first)
+			out.put(',');
+		c.first = false;
+
+		if (c.object) {
+			switch (key.type) {
+				case DataValue::Type::String:
+					out.writeJsonString(m_strings[key.index]);
+					break;
+				case DataValue::Type::Table:
+					out.write("\"table: ");
+					out.writeInt(key.index);
+					out.put('"');
+					break;
+				default:
+					out.put('"');
+					writeScalar(key);
+					out.put('"');
+					break;
+			}
+			out.put(':');
+		}
+		open(value);
+	}
+}
+
+void DataDocument::writeMessagePack(OutputBuffer &out, DataValue v) const
+{
+	std::vector <Cursor> stack;
+
+	auto write = [&](DataValue v)
+	{
+		switch (v.type) {
+			case DataValue::Type::Nil:
+				out.put(static_cast<char>(0xC0));
+				break;
+			case DataValue::Type::Boolean:
+				out.put(static_cast<char>(v.boolean ? 0xC3 : 0xC2));
+				break;
+			case DataValue::Type::Integer: {
+				const long i = v.integer;
+				if (i >= -32 && i <= 127)
+					out.put(static_cast<char>(i));
+				else if (i >= 0)
+					writeBigEndian(out, i <= 0xFF ? 0xCC : i <= 0xFFFF ? 0xCD : i <= 0xFFFFFFFFl ? 0xCE : 0xCF,
+						i, i <= 0xFF ? 1 : i <= 0xFFFF ? 2 : i <= 0xFFFFFFFFl ? 4 : 8);
+				else
+					writeBigEndian(out, i >= -0x80 ? 0xD0 : i >= -0x8000 ? 0xD1 : i >= -0x80000000l ? 0xD2 : 0xD3,
+						static_cast<std::uint64_t>(i), i >= -0x80 ? 1 : i >= -0x8000 ? 2 : i >= -0x80000000l ? 4 : 8);
+				break;
+			}
+			case DataValue::Type::Real: {
+				std::uint64_t bits;
+				std::memcpy(&bits, &v.real, sizeof(bits));
+				writeBigEndian(out, 0xCB, bits, 8);
+				break;
+			}
+			case DataValue::Type::String: {
+				const std::string &s = m_strings[v.index];
+				writeSize(out, s.size(), 0xA0, 32, 0xD9, 0xDA, 0xDB);
+				out.write(s);
+				break;
+			}
+			case DataValue::Type::Table: {
+				const DataTable &t = m_tables[v.index];
+				Cursor c{array(t), t.arraySize, hash(t), t.hashSize, 0, false, true};
+				const std::size_t live = liveSize(c);
+				c.object = live > 0;
+				if (c.object)
+					writeSize(out, t.arraySize + live, 0x80, 16, 0, 0xDE, 0xDF);
+				else
+					writeSize(out, t.arraySize, 0x90, 16, 0, 0xDC, 0xDD);
+				stack.push_back(c);
+				break;
+			}
+		}
+	};
+
+	write(v);
+	while (!stack.empty()) {
+		Cursor &c = stack.back();
+		if (c.hasPending) {
+			c.hasPending = false;
+			write(c.pending);
+			continue;
+		}
+
+		DataValue key, value;
+		if (!nextEntry(c, key, value)) {
+			stack.pop_back();
+			continue;
+		}
+
+		if (c.object) {
+			// a table as key is written in full before the value
+			c.pending = value;
+			c.hasPending = true;
+			write(key);
+		} else {
+			write(value);
+		}
+	}
+}
+
+bool DataLoader::load(std::string_view source, const std::string &name, DataDocument &document)
+{
+	document.clear();
+	m_document = &document;
+	m_filename = name;
+	m_names.clear();
+	m_error.message.clear();
+	m_nesting = 0;
+
+	m_preprocessor.reset();
+	m_preprocessor.setInput(name, source);
+	m_preprocessor.preprocess();
+	if (!m_preprocessor.error().empty()) {
+		yy::position pos = m_preprocessor.errorPosition();
+		pos.filename = &m_filename;
+		return fail(yy::location{pos, pos}, m_preprocessor.error());
+	}
+
+	m_scanner.reset(m_preprocessor.data(), &m_filename);
+	next();
+
+	bool ok = true;
+	while (ok && m_token != token::END_OF_INPUT) {
+		if (m_token == token::RETURN) {
+			next();
+			document.m_returned = true;
+			if (m_token != token::END_OF_INPUT && m_token != token::SEMICOLON)
+				ok = value(document.m_result);
+			if (ok && m_token == token::SEMICOLON)
+				next();
+			if (ok && m_token != token::END_OF_INPUT)
+				ok = fail("'return' must be the last statement");
+			break;
+		}
+
+		ok = statement();
+		if (ok && m_token == token::SEMICOLON)
+			next();
+	}
+
+	m_names.clear();
+	if (ok)
+		document.closeTable(0, 0, 0);
+	else
+		document.clear();
+	return ok;
+}
+
+void DataLoader::next()
+{
+	m_token = m_scanner.scan(m_length);
+	m_text = m_preprocessor.data().data() + m_scanner.offset();
+	m_position = m_scanner.position();
+	m_scanner.skip(m_length);
+}
+
+yy::location DataLoader::location() const
+{
+	yy::position end = m_position;
+	end.columns(m_length);
+	return yy::location{m_position, end};
+}
+
+bool DataLoader::fail(const yy::location &at, const std::string &message)
+{
+	m_error = Diagnostic{at, message};
+	return false;
+}
+
+bool DataLoader::expect(Token token, const char *text)
+{
+	if (m_token != token)
+		return fail(std::string{"expected "} + text);
+	next();
+	return true;
+}
+
+// [local] name {, name} [= value {, value}]
+bool DataLoader::statement()
+{
+	const bool local = m_token == token::LOCAL;
+	if (local)
+		next();
+
+	std::vector <std::pair <std::string_view, yy::location> > names;
+	for (;;) {
+		if (m_token != token::ID)
+			return fail(names.empty() && !local ? "only assignments of constants are allowed" : "expected a name");
+		names.emplace_back(std::string_view{m_text, m_length}, location());
+		next();
+		if (m_token != token::COMMA)
+			break;
+		next();
+	}
+
+	std::vector <DataValue> values;
+	if (m_token == token::ASSIGN) {
+		next();
+		for (;;) {
+			DataValue v;
+			if (!value(v))
+				return false;
+			values.push_back(v);
+			if (m_token != token::COMMA)
+				break;
+			next();
+		}
+	} else if (!local) {
+		return fail("expected '='");
+	}
+	values.resize(std::max(values.size(), names.size()));
+
+	for (std::size_t i = 0; i < names.size(); ++i) {
+		const std::string_view name = names[i].first;
+		const auto it = m_names.find(name);
+		// assigning to a local keeps it local
+		const bool isLocal = local || (it != m_names.end() && it->second.local);
+		m_names[name] = Binding{values[i], isLocal};
+		if (!isLocal)
+			m_document->set(0, 0, DataValue::makeString(m_document->intern(name)), values[i]);
+	}
+
+	return true;
+}
+
+bool DataLoader::value(DataValue &v)
+{
+	switch (m_token) {
+		case token::NIL:
+			v = DataValue{};
+			break;
+		case token::TRUE:
+		case token::FALSE:
+			v = DataValue::makeBoolean(m_token == token::TRUE);
+			break;
+		case token::INT_VALUE:
+			v = DataValue::makeInteger(FastScanner::intValue(m_text, m_length));
+			break;
+		case token::REAL_VALUE:
+			v = DataValue::makeReal(FastScanner::realValue(m_text, m_length));
+			break;
+		case token::MINUS: {
+			bool negate = false;
+			for (; m_token == token::MINUS; next())
+				negate = !negate;
+			if (m_token == token::INT_VALUE) {
+				const long i = FastScanner::intValue(m_text, m_length);
+				v = DataValue::makeInteger(negate ? -i : i);
+			} else if (m_token == token::REAL_VALUE) {
+				const double r = FastScanner::realValue(m_text, m_length);
+				v = DataValue::makeReal(negate ? -r : r);
+			} else {
+				return fail("expected a number after '-'");
+			}
+			break;
+		}
+		case token::STRING_VALUE:
+			if (!string(v))
+				return false;
+			break;
+		case token::LBRACE:
+			return table(v) && constantEnd();
+		case token::ID: {
+			const std::string_view name{m_text, m_length};
+			const yy::location at = location();
+			next();
+			return reference(name, at, v);
+		}
+		default:
+			return fail("expected a constant value");
+	}
+
+	next();
+	return constantEnd();
+}
+
+bool DataLoader::reference(std::string_view name, const yy::location &at, DataValue &v)
+{
+	const auto it = m_names.find(name);
+	if (it == m_names.end())
+		return fail(at, "'" + std::string{name} + "' is not a constant");
+	v = it->second.value;
+	return constantEnd();
+}
+
+// Fails if the value just read is an operand or gets indexed or called.
+bool DataLoader::constantEnd()
+{
+	switch (m_token) {
+		case token::DOT:
+		case token::COLON:
+		case token::LBRACKET:
+		case token::LPAREN:
+		case token::STRING_VALUE:
+		case token::LBRACE:
+		case token::OR:
+		case token::AND:
+		case token::EQ:
+		case token::NE:
+		case token::LT:
+		case token::LE:
+		case token::GT:
+		case token::GE:
+		case token::CONCAT:
+		case token::PLUS:
+		case token::MINUS:
+		case token::MUL:
+		case token::DIV:
+		case token::MOD:
+		case token::POWER:
+			return fail("expression is not constant");
+		default:
+			return true;
+	}
+}
+
+bool DataLoader::table(DataValue &v)
+{
+	if (++m_nesting > Driver::MaxNesting)
+		return fail("nesting deeper than " + std::to_string(Driver::MaxNesting) + " levels");
+
+	const std::uint32_t index = m_document->openTable();
+	const std::size_t arrayBegin = m_document->m_openArray.size();
+	const std::size_t hashBegin = m_document->m_openHash.size();
+	next();
+
+	while (m_token != token::RBRACE) {
+		DataValue key, value;
+
+		if (m_token == token::LBRACKET) {
+			next();
+			const yy::location at = location();
+			if (!this->value(key) || !expect(token::RBRACKET, "']'") || !expect(token::ASSIGN, "'='"))
+				return false;
+			if (key.isNil())
+				return fail(at, "table index is nil");
+			if (!this->value(value))
+				return false;
+			m_document->set(index, hashBegin, key, value);
+		} else if (m_token == token::ID) {
+			const std::string_view name{m_text, m_length};
+			const yy::location at = location();
+			next();
+			if (m_token == token::ASSIGN) {
+				next();
+				if (!this->value(value))
+					return false;
+				m_document->set(index, hashBegin, DataValue::makeString(m_document->intern(name)), value);
+			} else {
+				if (!reference(name, at, value))
+					return false;
+				m_document->m_openArray.push_back(value);
+			}
+		} else {
+			if (!this->value(value))
+				return false;
+			m_document->m_openArray.push_back(value);
+		}
+
+		if (m_token == token::COMMA || m_token == token::SEMICOLON)
+			next();
+		else if (m_token != token::RBRACE)
+			return fail("expected ',' or '}'");
+	}
+	next();
+
+	m_document->closeTable(index, arrayBegin, hashBegin);
+	--m_nesting;
+	v = DataValue::makeTable(index);
+	return true;
+}
+
+// Decodes the escapes of Lua 5.1: the C ones, \ddd and any other character
+// standing for itself.
+bool DataLoader::string(DataValue &v)
+{
+	const std::string_view literal{m_text + 1, m_length - 2};
+	if (literal.find('\\') == std::string_view::npos) {
+		v = DataValue::makeString(m_document->intern(literal));
+		return true;
+	}
+
+	m_buffer.clear();
+	for (std::size_t i = 0; i < literal.size(); ++i) {
+		if (literal[i] != '\\') {
+			m_buffer.push_back(literal[i]);
+			continue;
+		}
+
+		// the scanner guarantees a character after every backslash
+		const char c = literal[++i];
+		switch (c) {
+			case 'a': m_buffer.push_back('\a'); break;
+			case 'b': m_buffer.push_back('\b'); break;
+			case 'f': m_buffer.push_back('\f'); break;
+			case 'n': m_buffer.push_back('\n'); break;
+			case 'r': m_buffer.push_back('\r'); break;
+			case 't': m_buffer.push_back('\t'); break;
+			case 'v': m_buffer.push_back('\v'); break;
+			default:
+				if (c >= '0' && c <= '9') {
+					int code = 0;
+					for (int digits = 0; digits < 3 && i < literal.size() && literal[i] >= '0' && literal[i] <= '9'; ++digits)
+						code = code * 10 + (literal[i++] - '0');
+					--i;
+					if (code > 255)
+						return fail("escape sequence too large");
+					m_buffer.push_back(static_cast<char>(code));
+				} else {
+					m_buffer.push_back(c);
+				}
+				break;
+		}
+	}
+
+	v = DataValue::makeString(m_document->intern(m_buffer));
+	return true;
+}
@@ -0,0 +1,190 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "FastScanner.hpp"
+#include "ParseResult.hpp"
+#include "Preprocessor.hpp"
+
+class OutputBuffer;
+
+// A constant Lua value. Strings and tables are indices into the
+// DataDocument the value belongs to.
+struct DataValue {
+	enum class Type : std::uint8_t {
+		Nil,
+		Boolean,
+		Integer,
+		Real,
+		String,
+		Table,
+	};
+
+	Type type = Type::Nil;
+	union {
+		bool boolean;
+		long integer;
+		double real;
+		std::uint32_t index;
+	};
+
+	DataValue() : integer{0} {}
+
+	static DataValue makeBoolean(bool b) { DataValue v; v.type = Type::Boolean; v.boolean = b; return v; }
+	static DataValue makeInteger(long i) { DataValue v; v.type = Type::Integer; v.integer = i; return v; }
+	static DataValue makeReal(double r) { DataValue v; v.type = Type::Real; v.real = r; return v; }
+	static DataValue makeString(std::uint32_t i) { DataValue v; v.type = Type::String; v.index = i; return v; }
+	static DataValue makeTable(std::uint32_t i) { DataValue v; v.type = Type::Table; v.index = i; return v; }
+
+	bool isNil() const { return type == Type::Nil; }
+
+	bool operator == (const DataValue &other) const;
+	bool operator != (const DataValue &other) const { return !(*this == other); }
+};
+
+using DataEntry = std::pair <DataValue, DataValue>;
+
+// Positional fields make up the array part, its first value being t[1].
+// All other fields are in the hash part in the order of the source, with
+// unique keys; a key assigned twice keeps its first place and its last
+// value. Entries set to nil and integer keys the array part covers are
+// kept, but lookups and the writers ignore them, as Lua would. The parts
+// of all tables are stored one after another in their DataDocument.
+struct DataTable {
+	std::uint32_t arrayBegin = 0;
+	std::uint32_t arraySize = 0;
+	std::uint32_t hashBegin = 0;
+	std::uint32_t hashSize = 0;
+};
+
+// The values a data chunk produced. Equal strings are stored once.
+class DataDocument {
+public:
+	DataDocument() { clear(); }
+
+	// What the chunk returned, or the table of its globals if it has no
+	// return statement.
+	DataValue root() const { return m_returned ? m_result : DataValue::makeTable(0); }
+	DataValue result() const { return m_result; }
+	const DataTable & globals() const { return m_tables.front(); }
+
+	std::string_view string(DataValue v) const { return m_strings[v.index]; }
+	const DataTable & table(DataValue v) const { return m_tables[v.index]; }
+	const DataValue * array(const DataTable &t) const { return m_values.data() + t.arrayBegin; }
+	const DataEntry * hash(const DataTable &t) const { return m_entries.data() + t.hashBegin; }
+	std::size_t stringCount() const { return m_strings.size(); }
+	std::size_t tableCount() const { return m_tables.size(); }
+
+	// t[key], nil if the value is no table or has no such key.
+	DataValue get(DataValue t, DataValue key) const;
+	DataValue get(DataValue t, std::string_view key) const;
+	DataValue get(DataValue t, long key) const { return get(t, DataValue::makeInteger(key)); }
+
+	void clear();
+
+	// JSON: tables with only an array part become arrays, all others
+	// objects with keys written as strings.
+	void writeJson(OutputBuffer &out, DataValue v) const;
+	// MessagePack: the same, but keys keep their type.
+	void writeMessagePack(OutputBuffer &out, DataValue v) const;
+
+private:
+	friend class DataLoader;
+
+	struct Slot {
+		std::uint32_t table;
+		DataValue key;
+
+		bool operator == (const Slot &other) const { return table == other.table && key == other.key; }
+	};
+
+	struct SlotHash {
+		std::size_t operator () (const Slot &slot) const;
+	};
+
+	static constexpr std::size_t MaxUnindexed = 8;
+	static constexpr std::size_t None = static_cast<std::size_t>(-1);
+
+	std::size_t find(const DataEntry *hash, std::size_t size, std::uint32_t table, DataValue key) const;
+	std::uint32_t intern(std::string_view s);
+
+	// A table is built at the end of m_openArray and m_openHash, from
+	// arrayBegin and hashBegin on; closing it moves the fields into place.
+	std::uint32_t openTable();
+	void set(std::uint32_t table, std::size_t hashBegin, DataValue key, DataValue value);
+	void closeTable(std::uint32_t table, std::size_t arrayBegin, std::size_t hashBegin);
+
+	std::deque <std::string> m_strings;
+	std::unordered_map <std::string_view, std::uint32_t> m_stringIndex;
+	std::vector <DataTable> m_tables;
+	std::vector <DataValue> m_values;
+	std::vector <DataEntry> m_entries;
+	std::vector <DataValue> m_openArray;
+	std::vector <DataEntry> m_openHash;
+	// position of every key in the hash parts with more than MaxUnindexed
+	std::unordered_map <Slot, std::uint32_t, SlotHash> m_slots;
+	DataValue m_result;
+	bool m_returned = false;
+};
+
+// Evaluates chunks that only assign constants to names and return one,
+// e.g. "return {...}" or "config = {...}", straight from the tokens into a
+// DataDocument without building an AST. Constants are nil, booleans,
+// numbers with any number of minus signs, strings, table constructors and
+// names assigned earlier in the chunk, which share their value just like
+// in Lua. Anything else is rejected with the location of the first token
+// that isn't constant.
+class DataLoader {
+public:
+	DataLoader() = default;
+	DataLoader(const DataLoader &) = delete;
+	DataLoader & operator = (const DataLoader &) = delete;
+
+	// The document is left empty if this fails.
+	bool load(std::string_view source, const std::string &name, DataDocument &document);
+
+	// Valid until the next load().
+	const Diagnostic & error() const { return m_error; }
+
+private:
+	using Token = yy::Parser::token_kind_type;
+
+	struct Binding {
+		DataValue value;
+		bool local;
+	};
+
+	void next();
+	yy::location location() const;
+	bool fail(const std::string &message) { return fail(location(), message); }
+	bool fail(const yy::location &at, const std::string &message);
+	bool expect(Token token, const char *text);
+
+	bool statement();
+	bool value(DataValue &v);
+	bool reference(std::string_view name, const yy::location &at, DataValue &v);
+	bool constantEnd();
+	bool table(DataValue &v);
+	bool string(DataValue &v);
+
+	Preprocessor m_preprocessor;
+	FastScanner m_scanner;
+	DataDocument *m_document = nullptr;
+	std::string m_filename;
+	std::string m_buffer;
+	// names assigned so far, the views point into the preprocessed source
+	std::unordered_map <std::string_view, Binding> m_names;
+	Diagnostic m_error;
+
+	// the current token
+	Token m_token;
+	const char *m_text = nullptr;
+	std::size_t m_length = 0;
+	yy::position m_position;
+	int m_nesting = 0;
+};
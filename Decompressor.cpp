@@ -0,0 +1,250 @@
+#include <cstring>
+#include <istream>
+
+#ifdef LUAPARSE_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef LUAPARSE_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "Decompressor.hpp"
+
+namespace {
+
+const std::size_t BufferSize = 64 * 1024;
+
+const unsigned char GzipMagic[] = {0x1F, 0x8B};
+const unsigned char ZstdMagic[] = {0x28, 0xB5, 0x2F, 0xFD};
+
+}
+
+class Decompressor::Stream {
+public:
+	explicit Stream(std::istream *input) : m_input{input}, m_in(BufferSize) {}
+	virtual ~Stream() = default;
+
+	// Decompresses up to size bytes into out, returns how many; 0 at the end
+	// of the input or after an error.
+	virtual std::size_t read(char *out, std::size_t size, std::string &error) = 0;
+
+	std::uint64_t consumed() const { return m_consumed; }
+
+protected:
+	// Reads the next piece of compressed input, false at its end.
+	bool fill()
+	{
+		m_input->read(m_in.data(), m_in.size());
+		m_inSize = m_input->gcount();
+		m_inPos = 0;
+		m_consumed += m_inSize;
+		return m_inSize > 0;
+	}
+
+	std::istream *m_input;
+	std::vector <char> m_in;
+	std::size_t m_inSize = 0;
+	std::size_t m_inPos = 0;
+	std::uint64_t m_consumed = 0;
+};
+
+namespace {
+
+#ifdef LUAPARSE_HAVE_ZLIB
+class GzipStream : public Decompressor::Stream {
+public:
+	explicit GzipStream(std::istream *input) : Stream{input}
+	{
+		std::memset(&m_z, 0, sizeof(m_z));
+		m_ready = inflateInit2(&m_z, 15 + 16) == Z_OK;
+	}
+
+	~GzipStream() override
+	{
+		if (m_ready)
+			inflateEnd(&m_z);
+	}
+
+	std::size_t read(char *out, std::size_t size, std::string &error) override
+	{
+		if (!m_ready) {
+			error = "Unable to initialize zlib";
+			return 0;
+		}
+
+		m_z.next_out = reinterpret_cast<Bytef *>(out);
+		m_z.avail_out = size;
+		while (m_z.avail_out > 0 && !m_trailing) {
+			if (m_inPos == m_inSize && !fill()) {
+				if (!m_ended)
+					error = "Unexpected end of gzip data";
+				break;
+			}
+
+			// another member follows, or the zeros tar and dd pad with or
+			// other junk, which gzip -d ignores as well
+			if (m_ended) {
+				if (static_cast<unsigned char>(m_in[m_inPos]) != GzipMagic[0]) {
+					m_trailing = true;
+					break;
+				}
+				inflateReset(&m_z);
+				m_ended = false;
+			}
+
+			m_z.next_in = reinterpret_cast<Bytef *>(m_in.data() + m_inPos);
+			m_z.avail_in = m_inSize - m_inPos;
+			const int status = inflate(&m_z, Z_NO_FLUSH);
+			m_inPos = m_inSize - m_z.avail_in;
+
+			if (status == Z_STREAM_END) {
+				m_ended = true;
+			} else if (status != Z_OK) {
+				error = std::string{"Corrupt gzip data: "} + (m_z.msg ? m_z.msg : zError(status));
+				break;
+			}
+		}
+
+		return size - m_z.avail_out;
+	}
+
+private:
+	z_stream m_z;
+	bool m_ready;
+	bool m_ended = false;
+	// what follows the last member is not read
+	bool m_trailing = false;
+};
+#endif
+
+#ifdef LUAPARSE_HAVE_ZSTD
+class ZstdStream : public Decompressor::Stream {
+public:
+	explicit ZstdStream(std::istream *input) : Stream{input}, m_context{ZSTD_createDStream()} {}
+
+	~ZstdStream() override { ZSTD_freeDStream(m_context); }
+
+	std::size_t read(char *out, std::size_t size, std::string &error) override
+	{
+		if (!m_context) {
+			error = "Unable to initialize zstd";
+			return 0;
+		}
+
+		ZSTD_outBuffer output{out, size, 0};
+		while (output.pos < output.size) {
+			if (m_inPos == m_inSize && !fill()) {
+				if (!m_ended)
+					error = "Unexpected end of zstd data";
+				break;
+			}
+
+			ZSTD_inBuffer input{m_in.data(), m_inSize, m_inPos};
+			const std::size_t status = ZSTD_decompressStream(m_context, &output, &input);
+			m_inPos = input.pos;
+
+			if (ZSTD_isError(status)) {
+				error = std::string{"Corrupt zstd data: "} + ZSTD_getErrorName(status);
+				break;
+			}
+			// a frame is complete, the next one starts with the next byte
+			m_ended = status == 0;
+		}
+
+		return output.pos;
+	}
+
+private:
+	ZSTD_DStream *m_context;
+	bool m_ended = true;
+};
+#endif
+
+}
+
+Decompressor::Decompressor() = default;
+
+Decompressor::~Decompressor() = default;
+
+Decompressor::Format Decompressor::detect(std::istream &input)
+{
+	unsigned char magic[sizeof(ZstdMagic)] = {};
+	input.read(reinterpret_cast<char *>(magic), sizeof(magic));
+	const std::size_t read = input.gcount();
+	input.clear();
+	input.seekg(0);
+
+	if (read >= sizeof(GzipMagic) && std::memcmp(magic, GzipMagic, sizeof(GzipMagic)) == 0)
+		return Format::Gzip;
+	if (read >= sizeof(ZstdMagic) && std::memcmp(magic, ZstdMagic, sizeof(ZstdMagic)) == 0)
+		return Format::Zstd;
+	return Format::None;
+}
+
+const char * Decompressor::name(Format format)
+{
+	switch (format) {
+		case Format::Gzip:
+			return "gzip";
+		case Format::Zstd:
+			return "zstd";
+		default:
+			return "plain";
+	}
+}
+
+bool Decompressor::open(std::istream *input, Format format)
+{
+	close();
+	m_format = format;
+
+	switch (format) {
+#ifdef LUAPARSE_HAVE_ZLIB
+		case Format::Gzip:
+			m_stream.reset(new GzipStream{input});
+			break;
+#endif
+#ifdef LUAPARSE_HAVE_ZSTD
+		case Format::Zstd:
+			m_stream.reset(new ZstdStream{input});
+			break;
+#endif
+		default:
+			m_error = std::string{"Reading "} + name(format) + " input is not supported by this build";
+			return false;
+	}
+
+	m_buffer.resize(BufferSize);
+	return true;
+}
+
+void Decompressor::close()
+{
+	m_stream.reset();
+	m_format = Format::None;
+	m_error.clear();
+	m_decompressed = 0;
+	setg(nullptr, nullptr, nullptr);
+}
+
+std::uint64_t Decompressor::compressedBytes() const
+{
+	return m_stream ? m_stream->consumed() : 0;
+}
+
+int Decompressor::underflow()
+{
+	if (gptr() < egptr())
+		return traits_type::to_int_type(*gptr());
+	if (!m_stream || !m_error.empty())
+		return traits_type::eof();
+
+	const std::size_t size = m_stream->read(m_buffer.data(), m_buffer.size(), m_error);
+	if (size == 0)
+		return traits_type::eof();
+
+	m_decompressed += size;
+	setg(m_buffer.data(), m_buffer.data(), m_buffer.data() + size);
+	return traits_type::to_int_type(m_buffer[0]);
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+// Reads the decompressed contents of a gzip or zstd compressed stream
+// through fixed size buffers, the whole input is never held in memory.
+// Concatenated members and frames are read one after another; bytes after a
+// gzip member which start no other one, such as the zeros of tar padding,
+// end the input as they do for gzip -d. gzip needs a build with
+// LUAPARSE_HAVE_ZLIB, zstd one with LUAPARSE_HAVE_ZSTD.
+class Decompressor : public std::streambuf {
+public:
+	enum class Format {
+		None,
+		Gzip,
+		Zstd,
+	};
+
+	class Stream;
+
+	Decompressor();
+	~Decompressor() override;
+	Decompressor(const Decompressor &) = delete;
+	Decompressor & operator = (const Decompressor &) = delete;
+
+	// Format of a seekable input by its first bytes, leaves it at its start.
+	static Format detect(std::istream &input);
+	static const char * name(Format format);
+
+	// False with error() if the format is not supported by this build.
+	bool open(std::istream *input, Format format);
+	void close();
+
+	Format format() const { return m_format; }
+	// Set if the input is corrupt or ends early, the text read before the
+	// error is still returned.
+	const std::string & error() const { return m_error; }
+
+	std::uint64_t compressedBytes() const;
+	std::uint64_t decompressedBytes() const { return m_decompressed; }
+
+private:
+	int underflow() override;
+
+	std::unique_ptr <Stream> m_stream;
+	std::vector <char> m_buffer;
+	Format m_format = Format::None;
+	std::string m_error;
+	std::uint64_t m_decompressed = 0;
+};
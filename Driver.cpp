@@ -1,9 +1,97 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstring>
+#include <iterator>
+#include <random>
+#include <sstream>
 
 #include "Driver.hpp"
+#include "Emitter.hpp"
+#include "Incremental.hpp"
+#include "LuaEmitter.hpp"
+#include "MemoryProfile.hpp"
+#include "Segmenter.hpp"
+#include "Traversal.hpp"
+#include "TreeDiff.hpp"
+
+namespace {
+
+// smallest piece worth a thread of its own
+const std::size_t MinSegment = 64 * 1024;
+
+bool samePosition(const yy::position &a, const yy::position &b)
+{
+	return a.line == b.line && a.column == b.column;
+}
+
+bool sameToken(const yy::Parser::symbol_type &a, const yy::Parser::symbol_type &b)
+{
+	if (a.kind() != b.kind() || !samePosition(a.location.begin, b.location.begin) || !samePosition(a.location.end, b.location.end))
+		return false;
+
+	switch (a.kind()) {
+		case yy::Parser::symbol_kind::S_ID:
+		case yy::Parser::symbol_kind::S_STRING_VALUE:
+			return a.value.as<std::string>() == b.value.as<std::string>();
+		case yy::Parser::symbol_kind::S_INT_VALUE:
+			return a.value.as<long>() == b.value.as<long>();
+		case yy::Parser::symbol_kind::S_REAL_VALUE:
+			return a.value.as<double>() == b.value.as<double>();
+		default:
+			return true;
+	}
+}
+
+bool isIdent(char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+// A return or break takes a following expression, and can't be followed
+// by another one.
+bool endsChunk(const Node *statement)
+{
+	return statement && (statement->type() == Node::Type::Return || statement->type() == Node::Type::Break);
+}
+
+std::string dumpResult(const ParseResult &result)
+{
+	std::string out;
+	for (const auto &d : result.diagnostics) {
+		std::ostringstream os;
+		os << d << '\n';
+		out += os.str();
+	}
+
+	OutputBuffer buffer{out};
+	auto emitter = Emitter::create(OutputFormat::Sexpr, buffer);
+	for (const auto &chunk : result.chunks)
+		emitter->emit(chunk.get());
+	buffer.flush();
+	return out;
+}
+
+template <typename Next>
+void benchmarkLexer(const char *name, Next next)
+{
+	const auto start = std::chrono::steady_clock::now();
+	std::size_t count = 0;
+	while (next().kind() != yy::Parser::symbol_kind::S_YYEOF)
+		++count;
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	std::cout << name << ": " << count << " tokens in " << elapsed.count() * 1000.0 << " ms ("
+		<< (elapsed.count() > 0 ? count / elapsed.count() / 1e6 : 0.0) << " Mtok/s)\n";
+}
+
+}
 
 Driver::Driver()
-	: m_parser{*this}, m_scanner{*this}, m_inputStream{&m_preprocessor}, m_filename{"<stdin>"}, m_position{&m_filename, 1, 1}
+	: m_parser{*this}, m_scanner{*this}, m_lexer{Lexer::Flex}, m_inputStream{&m_preprocessor},
+	m_decompressedStream{&m_decompressor}, m_functionHead{FunctionHead::None}, m_lazyFunctions{false},
+	m_sharedLines{nullptr}, m_threads{1}, m_filename{new std::string{"<stdin>"}}, m_position{m_filename.get(), 1, 1},
+	m_started{false}, m_nesting{0}, m_bodyNesting{0}, m_tooDeep{false}
 {
 }
 
@@ -24,8 +112,679 @@ const std::vector <std::unique_ptr <Chunk> > & Driver::chunks() const
 
 int Driver::parse()
 {
-	m_scanner.switch_streams(&m_inputStream);
-	return m_parser.parse();
+	m_blocks.clear();
+	m_lineStarts.clear();
+	resetNesting();
+
+	int result;
+	if (m_lexer == Lexer::Fast) {
+		m_preprocessor.preprocess();
+		if (!m_preprocessor.error().empty()) {
+			result = 1;
+		} else if (m_lazyFunctions) {
+			// the bodies outlive the preprocessor's buffer
+			auto source = std::make_shared<LazySource>();
+			source->text = m_preprocessor.data();
+			source->lineStarts = lineStarts();
+			source->filename = *m_filename;
+			source->parse = &Driver::parseBody;
+			m_lazySource = std::move(source);
+
+			m_fastScanner.reset(m_lazySource->text, m_filename.get());
+			result = m_parser.parse();
+			m_lazySource.reset();
+			m_lazyBodies.clear();
+		} else if (parseParallel()) {
+			result = 0;
+		} else {
+			m_fastScanner.reset(m_preprocessor.data(), m_filename.get());
+			result = m_parser.parse();
+		}
+	} else {
+		// the first input installs the flex buffer, later ones only rewind it
+		if (m_started)
+			m_scanner.yyrestart(&m_inputStream);
+		else
+			m_scanner.switch_streams(&m_inputStream);
+		result = m_parser.parse();
+	}
+	m_started = true;
+
+	if (!m_preprocessor.error().empty()) {
+		yy::position pos = m_preprocessor.errorPosition();
+		pos.filename = m_filename.get();
+		error(yy::location{pos, pos}, m_preprocessor.error());
+		result = 1;
+	}
+
+	if (!m_decompressor.error().empty()) {
+		// where the decompressed text stops
+		const std::vector <std::uint32_t> &lines = lineStarts();
+		const std::size_t offset = m_decompressor.decompressedBytes();
+		const std::size_t line = std::upper_bound(lines.begin(), lines.end(), offset) - lines.begin();
+		const yy::position pos{m_filename.get(), static_cast<yy::position::counter_type>(line),
+			static_cast<yy::position::counter_type>(offset - lines[line - 1] + 1)};
+		error(yy::location{pos, pos}, m_decompressor.error());
+		result = 1;
+	}
+
+	return result;
+}
+
+bool Driver::parseParallel()
+{
+	const std::string &data = m_preprocessor.data();
+	const std::size_t pieces = std::min<std::size_t>(m_threads * 4, data.size() / MinSegment);
+	// irregular lines would shift the positions of later pieces
+	if (m_threads < 2 || pieces < 2 || !m_preprocessor.regularLines())
+		return false;
+
+	std::vector <std::size_t> cuts = Segmenter::split(data, pieces);
+	if (cuts.empty())
+		return false;
+	cuts.insert(cuts.begin(), 0);
+	cuts.push_back(data.size());
+
+	const std::vector <std::uint32_t> &lines = lineStarts();
+	const std::size_t count = cuts.size() - 1;
+	std::vector <std::unique_ptr <Chunk> > chunks(count);
+	std::atomic <std::size_t> next{0};
+	std::atomic <bool> failed{false};
+
+	if (!m_pool || m_pool->size() != m_threads)
+		m_pool.reset(new ThreadPool{m_threads});
+	while (m_workers.size() < m_threads) {
+		m_workers.emplace_back(new Driver);
+		m_workers.back()->setLexer(Lexer::Fast);
+	}
+
+	std::vector <std::future <void> > done;
+	for (unsigned t = 0; t < m_threads; ++t) {
+		done.push_back(m_pool->submit([&, worker = m_workers[t].get()]{
+			for (std::size_t i; !failed && (i = next++) < count;) {
+				const std::size_t line = std::upper_bound(lines.begin(), lines.end(), cuts[i]) - lines.begin();
+				const yy::position start{m_filename.get(), static_cast<yy::position::counter_type>(line),
+					static_cast<yy::position::counter_type>(cuts[i] - lines[line - 1] + 1)};
+				if (!worker->parseSegment(data.data() + cuts[i], data.data() + cuts[i + 1], start, lines, chunks[i]))
+					failed = true;
+			}
+		}));
+	}
+	for (auto &f : done)
+		f.wait();
+
+	// any error is reported by the sequential parse
+	if (failed || !chunks.front())
+		return false;
+
+	// spans are absolute already, the statements only move over
+	Chunk *root = chunks.front().get();
+	for (std::size_t i = 1; i < count; ++i) {
+		if (!chunks[i])
+			continue;
+		const std::size_t size = root->children().size();
+		root->splice(size, size, *chunks[i], 0, chunks[i]->children().size(), 0, 0);
+	}
+	m_chunks.push_back(std::move(chunks.front()));
+
+	return true;
+}
+
+bool Driver::parseSegment(const char *begin, const char *end, const yy::position &start,
+	const std::vector <std::uint32_t> &lines, std::unique_ptr <Chunk> &chunk)
+{
+	m_sharedLines = &lines;
+	m_fastScanner.reset(begin, end, start);
+	resetNesting();
+
+	const bool ok = m_parser.parse() == 0 && m_diagnostics.empty();
+	if (ok && !m_chunks.empty())
+		chunk = std::move(m_chunks.front());
+
+	m_sharedLines = nullptr;
+	m_chunks.clear();
+	m_diagnostics.clear();
+	m_blocks.clear();
+	return ok;
+}
+
+ParseResult Driver::parse(std::string_view source, const std::string &name)
+{
+	reset();
+	setInput(source, name);
+	parse();
+
+	ParseResult result = takeResult();
+	result.source.assign(source);
+	result.exactSpans = m_preprocessor.regularLines();
+	return result;
+}
+
+bool Driver::reparse(ParseResult &result, const std::vector <TextEdit> &edits)
+{
+	bool incremental = result.success() && result.exactSpans && result.chunk();
+
+	for (const auto &edit : edits) {
+		const std::size_t offset = std::min(edit.offset, result.source.size());
+		const std::size_t removed = std::min(edit.removed, result.source.size() - offset);
+		result.source.replace(offset, removed, edit.inserted);
+
+		if (incremental)
+			incremental = reparse(result, offset, removed, edit.inserted.size());
+	}
+
+	if (!incremental) {
+		const std::string source = std::move(result.source);
+		const std::string name = *result.filename;
+		result = parse(source, name);
+	}
+
+	return incremental;
+}
+
+bool Driver::reparse(ParseResult &result, std::size_t offset, std::size_t removed, std::size_t inserted)
+{
+	const std::string &source = result.source;
+	const std::int64_t delta = static_cast<std::int64_t>(inserted) - static_cast<std::int64_t>(removed);
+	const std::size_t oldSize = source.size() - delta;
+
+	Incremental::Region region;
+	for (const bool includeNext : {false, true}) {
+		Incremental::locate(*result.chunks.front(), oldSize, offset, offset + removed, includeNext, region);
+		if (region.begin == 0 && region.end == oldSize)
+			return false;
+
+		// the last token must not run into the first one of the next statement
+		const std::size_t end = region.end + delta;
+		if (!region.next && end < source.size() && end > 0 && isIdent(source[end - 1]))
+			continue;
+
+		std::unique_ptr <Chunk> chunk;
+		if (!parseRegion(std::string_view{source}.substr(region.begin, end - region.begin), *result.filename, chunk))
+			return false;
+		if (!chunk)
+			chunk.reset(new Chunk{});
+
+		const auto &spans = region.chunk->spans();
+		const auto &reparsed = chunk->spans();
+		std::size_t from = 0;
+		std::size_t to = reparsed.size();
+
+		if (region.next) {
+			// The next statement still starts where it did, so it's parsed
+			// just like before and the old one can stay.
+			const Span &next = spans[region.last - 1];
+			if (to == 0 || reparsed[to - 1].begin != region.base + next.begin + delta - region.begin)
+				return false;
+			--to;
+			--region.last;
+		} else if (region.last < spans.size() && to > 0 && endsChunk(chunk->children()[to - 1].get())) {
+			continue;
+		}
+
+		if (region.previous && from < to && reparsed[0].end == spans[region.first].end - spans[region.first].begin) {
+			++from;
+			++region.first;
+		}
+
+		region.chunk->splice(region.first, region.last, *chunk, from, to, region.begin - region.base, delta);
+		Incremental::shiftEnclosing(region, delta);
+
+		return true;
+	}
+
+	return false;
+}
+
+bool Driver::parseRegion(std::string_view text, const std::string &name, std::unique_ptr <Chunk> &chunk)
+{
+	setInput(text, name);
+	parse();
+
+	const bool ok = m_diagnostics.empty() && m_preprocessor.balanced() && m_preprocessor.regularLines();
+	if (ok && !m_chunks.empty())
+		chunk = std::move(m_chunks.front());
+
+	reset();
+	return ok;
+}
+
+bool Driver::checkIncremental(std::string_view source, const std::string &name, unsigned edits)
+{
+	ParseResult result = parse(source, name);
+	if (!result.success()) {
+		for (const auto &d : result.diagnostics)
+			std::cerr << "Parse error: " << d << '\n';
+		return false;
+	}
+
+	static const char *Inserts[] = {" ", "\n", "x = 1\n", "local y = x\n", "f()\n", "(g)", "0", "a", ".b", "--", "\"", "end\n", "return\n"};
+
+	std::mt19937 random{1};
+	auto pick = [&random](std::size_t max) { return std::uniform_int_distribution <std::size_t>{0, max}(random); };
+
+	std::size_t incremental = 0;
+	std::size_t valid = 0;
+	std::chrono::duration<double> incrementalTime{0};
+	std::chrono::duration<double> fullTime{0};
+
+	for (unsigned i = 0; i < edits; ++i) {
+		const std::string previous = result.source;
+
+		TextEdit edit{pick(previous.size()), 0, {}};
+		switch (pick(3)) {
+			case 0:
+				edit.inserted = Inserts[pick(std::size(Inserts) - 1)];
+				break;
+			case 1:
+				edit.removed = 1 + pick(3);
+				break;
+			case 2:
+				// retype what is there
+				edit.removed = std::min<std::size_t>(1 + pick(7), previous.size() - edit.offset);
+				edit.inserted = previous.substr(edit.offset, edit.removed);
+				break;
+			default:
+				// new statement on the next line
+				edit.offset = std::min(previous.find('\n', edit.offset), previous.size());
+				edit.inserted = "\nz = z + 1";
+				break;
+		}
+
+		const auto start = std::chrono::steady_clock::now();
+		const bool done = reparse(result, {edit});
+		const auto reparseEnd = std::chrono::steady_clock::now();
+		const ParseResult full = parse(result.source, name);
+		const auto parseEnd = std::chrono::steady_clock::now();
+
+		if (done) {
+			++incremental;
+			incrementalTime += reparseEnd - start;
+			fullTime += parseEnd - reparseEnd;
+		}
+
+		if (dumpResult(result) != dumpResult(full) || !Incremental::sameSpans(result.chunk(), full.chunk())) {
+			std::cerr << "Incremental parse differs after edit " << i << ": offset " << edit.offset << ", removed "
+				<< edit.removed << ", inserted \"" << edit.inserted << "\"\n";
+			return false;
+		}
+
+		// keep editing a valid source the spans are exact for
+		if (result.success() && result.exactSpans)
+			++valid;
+		else
+			result = parse(previous, name);
+	}
+
+	std::cout << incremental << " of " << valid << " valid edits (" << edits << " total) re-parsed incrementally in "
+		<< incrementalTime.count() * 1000.0 << " ms, full parses of them took " << fullTime.count() * 1000.0 << " ms\n";
+	return true;
+}
+
+bool Driver::checkRoundTrip(std::string_view source, const std::string &name)
+{
+	// sources the emitter has to take care with, checked before the input
+	static const char *Cases[] = {
+		"return (f())\n",
+		"t = {(f()), (a:b())}\n",
+		"function v(...) g((...)) return (...) end\n",
+		"x = (f()).y (g())()\n",
+		"f();\n(g()).x = 1\n",
+	};
+
+	const auto hash = [](const ParseResult &r) { return r.chunk() ? HashedTree{r.chunk()}.hash(0) : 0; };
+
+	std::vector <std::pair <std::string_view, std::string> > sources;
+	for (const char *c : Cases)
+		sources.emplace_back(c, "<round trip case>");
+	sources.emplace_back(source, name);
+
+	for (const auto &s : sources) {
+		const ParseResult result = parse(s.first, s.second);
+		if (!result.success()) {
+			for (const auto &d : result.diagnostics)
+				std::cerr << "Parse error: " << d << '\n';
+			return false;
+		}
+
+		for (const auto style : {LuaEmitter::Style::Pretty, LuaEmitter::Style::Minified}) {
+			std::string lua;
+			OutputBuffer buffer{lua};
+			LuaEmitter emitter{buffer, style, false};
+			emitter.emit(result.chunk());
+			buffer.flush();
+
+			const ParseResult again = parse(lua, s.second);
+			if (!again.success() || hash(again) != hash(result)) {
+				std::cerr << "Round trip through " << (style == LuaEmitter::Style::Pretty ? "--dump=lua" : "--dump=lua-min")
+					<< " gives another tree for " << s.second << ":\n" << lua;
+				return false;
+			}
+		}
+	}
+
+	std::cout << sources.size() << " sources round-tripped through Lua\n";
+	return true;
+}
+
+bool Driver::checkLazy(std::string_view source, const std::string &name)
+{
+	// functions nested past MaxNesting, which every body has to count on
+	// from the depth it is at
+	std::string deep = "local f = ";
+	for (int i = 0; i < 2 * MaxNesting; ++i)
+		deep += "function() return ";
+	deep += "nil";
+	for (int i = 0; i < 2 * MaxNesting; ++i)
+		deep += " end";
+	deep += '\n';
+
+	// the first error, of the parse or of a body once it is parsed
+	const auto firstError = [](const ParseResult &r)
+	{
+		std::ostringstream message;
+		if (!r.diagnostics.empty()) {
+			message << r.diagnostics.front();
+			return message.str();
+		}
+		for (const auto &chunk : r.chunks) {
+			Traversal::walk(chunk.get(), [&message](const Node *node)
+			{
+				if (message.tellp() != 0)
+					return false;
+				if (node->type() == Node::Type::Function && !static_cast<const Function *>(node)->bodyError().empty())
+					message << static_cast<const Function *>(node)->bodyError();
+				return message.tellp() == 0;
+			});
+		}
+		return message.str();
+	};
+
+	const Lexer lexer = m_lexer;
+	const bool lazy = m_lazyFunctions;
+	m_lexer = Lexer::Fast;
+
+	bool ok = true;
+	const std::pair <std::string_view, std::string> sources[] = {{deep, "<deep functions>"}, {source, name}};
+	for (const auto &s : sources) {
+		m_lazyFunctions = false;
+		const ParseResult eager = parse(s.first, s.second);
+		m_lazyFunctions = true;
+		const ParseResult lazyResult = parse(s.first, s.second);
+
+		const std::string eagerError = firstError(eager);
+		const std::string lazyError = firstError(lazyResult);
+		if (eagerError != lazyError) {
+			std::cerr << "Lazy parse of " << s.second << " differs: \"" << lazyError << "\" instead of \"" << eagerError << "\"\n";
+			ok = false;
+		} else if (eagerError.empty() && (dumpResult(eager) != dumpResult(lazyResult)
+				|| !Incremental::sameSpans(eager.chunk(), lazyResult.chunk()))) {
+			std::cerr << "Lazy parse of " << s.second << " gives another tree\n";
+			ok = false;
+		}
+	}
+
+	m_lexer = lexer;
+	m_lazyFunctions = lazy;
+	if (ok)
+		std::cout << std::size(sources) << " sources parse the same with lazy function bodies\n";
+	return ok;
+}
+
+Driver::PhaseCosts Driver::measurePhases(std::string_view source, const std::string &name)
+{
+	using Clock = std::chrono::steady_clock;
+	const auto seconds = [](Clock::time_point start) { return std::chrono::duration<double>(Clock::now() - start).count(); };
+
+	PhaseCosts costs;
+	setInput(source, name);
+
+	auto start = Clock::now();
+	m_preprocessor.preprocess();
+	costs.preprocess = seconds(start);
+	if (!m_preprocessor.error().empty())
+		return costs;
+
+	const std::string &data = m_preprocessor.data();
+	costs.bufferBytes = data.size();
+
+	m_fastScanner.reset(data, m_filename.get());
+	start = Clock::now();
+	while (m_fastScanner.token().kind() != yy::Parser::symbol_kind::S_YYEOF)
+		++costs.tokens;
+	costs.scan = seconds(start);
+
+	const Lexer lexer = m_lexer;
+	m_lexer = Lexer::Fast;
+	resetNesting();
+	m_fastScanner.reset(data, m_filename.get());
+	start = Clock::now();
+	costs.success = m_parser.parse() == 0 && m_diagnostics.empty();
+	costs.parse = seconds(start);
+	m_lexer = lexer;
+
+	MemoryProfile profile;
+	for (const auto &chunk : m_chunks)
+		profile.add(chunk.get());
+	costs.treeBytes = profile.total().totalBytes();
+	return costs;
+}
+
+void Driver::reset()
+{
+	if (m_inputFile.is_open())
+		m_inputFile.close();
+	m_inputFile.clear();
+	m_inputStream.clear();
+	m_decompressor.close();
+	m_decompressedStream.clear();
+	m_preprocessor.reset();
+	m_chunks.clear();
+	m_diagnostics.clear();
+	m_blocks.clear();
+	m_lazyBodies.clear();
+	m_lazySource.reset();
+	m_functionHead = FunctionHead::None;
+	m_lineStarts.clear();
+	m_position.initialize(m_filename.get());
+}
+
+ParseResult Driver::takeResult()
+{
+	ParseResult result;
+	result.chunks = std::move(m_chunks);
+	result.diagnostics = std::move(m_diagnostics);
+	m_chunks.clear();
+	m_diagnostics.clear();
+
+	// the locations handed out so far point to the current name, give it away
+	result.filename = std::move(m_filename);
+	m_filename.reset(new std::string{*result.filename});
+	m_position.filename = m_filename.get();
+
+	return result;
+}
+
+void Driver::appendStatement(Chunk *chunk, Node *statement, const yy::location &location)
+{
+	const Span span = this->span(location);
+
+	// blocks finished since the statement started are its own, their
+	// statements are stored relative to it
+	while (!m_blocks.empty() && m_blocks.back()->spans().front().begin >= span.begin) {
+		m_blocks.back()->rebase(span.begin);
+		m_blocks.pop_back();
+	}
+	while (!m_lazyBodies.empty() && m_lazyBodies.back()->lazyBody()->range.begin >= span.begin) {
+		m_lazyBodies.back()->setBase(span.begin);
+		m_lazyBodies.pop_back();
+	}
+
+	chunk->append(statement, span);
+}
+
+void Driver::closeBlock(Chunk *block)
+{
+	if (block)
+		m_blocks.push_back(block);
+}
+
+Function * Driver::lazyFunction(ParamList *params, Span body, const yy::location &location)
+{
+	auto lazy = std::make_unique<Function::LazyBody>();
+	lazy->source = m_lazySource;
+	lazy->range = body;
+	lazy->line = location.begin.line;
+	lazy->column = location.begin.column;
+	lazy->nesting = m_bodyNesting;
+
+	Function *function = new Function{params, std::move(lazy)};
+	m_lazyBodies.push_back(function);
+	return function;
+}
+
+std::unique_ptr <Chunk> Driver::parseBody(const std::shared_ptr <const LazySource> &source, Span body,
+	std::uint32_t line, std::uint32_t column, int nesting, std::string &error)
+{
+	// bodies are parsed whenever they are first looked at, on any thread
+	static thread_local Driver driver;
+
+	driver.reset();
+	*driver.m_filename = source->filename;
+	driver.m_sharedLines = &source->lineStarts;
+	driver.m_lazySource = source;
+	const yy::position start{driver.m_filename.get(), static_cast<yy::position::counter_type>(line),
+		static_cast<yy::position::counter_type>(column)};
+	driver.m_fastScanner.reset(source->text.data() + body.begin, source->text.data() + body.end, start);
+	driver.m_lexer = Lexer::Fast;
+	// the body goes on from the depth it has in the file
+	driver.resetNesting();
+	driver.m_nesting = nesting;
+
+	std::unique_ptr <Chunk> chunk;
+	if (driver.m_parser.parse() == 0 && driver.m_diagnostics.empty()) {
+		if (!driver.m_chunks.empty())
+			chunk = std::move(driver.m_chunks.front());
+	} else if (!driver.m_diagnostics.empty()) {
+		std::ostringstream message;
+		message << driver.m_diagnostics.front();
+		error = message.str();
+	} else {
+		error = "syntax error";
+	}
+
+	driver.m_sharedLines = nullptr;
+	driver.reset();
+	return chunk;
+}
+
+Span Driver::span(const yy::location &location)
+{
+	const std::vector <std::uint32_t> &lines = lineStarts();
+
+	auto offset = [&lines](const yy::position &p)
+	{
+		const std::size_t line = std::min<std::size_t>(p.line - 1, lines.size() - 1);
+		return static_cast<std::uint32_t>(lines[line] + p.column - 1);
+	};
+
+	return Span{offset(location.begin), offset(location.end)};
+}
+
+const std::vector <std::uint32_t> & Driver::lineStarts()
+{
+	if (m_sharedLines)
+		return *m_sharedLines;
+
+	// the preprocessor keeps every byte where it was, so a line table over
+	// its output maps positions to source offsets
+	if (m_lineStarts.empty()) {
+		const std::string &data = m_preprocessor.data();
+		m_lineStarts.push_back(0);
+		for (const char *p = data.data(), *end = p + data.size(); (p = static_cast<const char *>(std::memchr(p, '\n', end - p)));)
+			m_lineStarts.push_back(++p - data.data());
+	}
+
+	return m_lineStarts;
+}
+
+void Driver::error(const yy::location &location, const std::string &message)
+{
+	// the syntax error at the end of input handed out for it
+	if (m_tooDeep)
+		return;
+	m_diagnostics.push_back(Diagnostic{location, message});
+}
+
+bool Driver::checkLexers()
+{
+	m_preprocessor.preprocess();
+	const std::string &data = m_preprocessor.data();
+
+	// numbers beyond the range of a double, which overflow to an infinity
+	// and underflow to a denormal or zero
+	const std::string ranges = "x = 1" + std::string(400, '0') + ".0\ny = 0." + std::string(310, '0') + "15\nz = 0."
+		+ std::string(400, '0') + "1\n";
+	const bool result = sameTokens(ranges) && sameTokens(data);
+
+	std::istringstream flexInput{data};
+	m_scanner.switch_streams(&flexInput);
+	m_position.initialize(m_filename.get());
+	benchmarkLexer("flex", [this]{ return m_scanner.token(); });
+
+	m_fastScanner.reset(data, m_filename.get());
+	benchmarkLexer("fast", [this]{ return m_fastScanner.token(); });
+
+	if (!m_inputFile.is_open())
+		return result;
+	return sameStreamSpans(data) && result;
+}
+
+// flex reads a file through the preprocessor as a stream, which is asked
+// again at its end; the spans come from what it read before
+bool Driver::sameStreamSpans(const std::string &data)
+{
+	const std::string text = data;
+	const std::string name = *m_filename;
+	const Lexer lexer = m_lexer;
+	if (!setInputFile(name.c_str()))
+		return false;
+
+	m_lexer = Lexer::Flex;
+	parse();
+	ParseResult streamed = takeResult();
+	streamed.exactSpans = m_preprocessor.regularLines();
+	m_lexer = Lexer::Fast;
+	const ParseResult inMemory = parse(text, name);
+	m_lexer = lexer;
+
+	if (dumpResult(streamed) != dumpResult(inMemory) || streamed.exactSpans != inMemory.exactSpans
+		|| !Incremental::sameSpans(streamed.chunk(), inMemory.chunk())) {
+		std::cerr << "Statement spans of " << name << " differ when it is read as a stream\n";
+		return false;
+	}
+	return true;
+}
+
+bool Driver::sameTokens(const std::string &data)
+{
+	std::istringstream flexInput{data};
+	m_scanner.switch_streams(&flexInput);
+	m_position.initialize(m_filename.get());
+	m_fastScanner.reset(data, m_filename.get());
+
+	for (;;) {
+		const yy::Parser::symbol_type expected = m_scanner.token();
+		const yy::Parser::symbol_type actual = m_fastScanner.token();
+		if (!sameToken(expected, actual)) {
+			std::cerr << "Lexer mismatch at " << expected.location << ": flex returned " << expected.name()
+				<< ", fast scanner returned " << actual.name() << " at " << actual.location << '\n';
+			return false;
+		}
+
+		if (expected.kind() == yy::Parser::symbol_kind::S_YYEOF)
+			return true;
+	}
 }
 
 yy::location Driver::location(const char *s)
@@ -36,6 +795,133 @@ yy::location Driver::location(const char *s)
 	return result;
 }
 
+yy::Parser::symbol_type Driver::nextToken()
+{
+	if (m_functionHead == FunctionHead::Body) {
+		m_functionHead = FunctionHead::None;
+		Span range;
+		yy::location location;
+		if (skipBody(range, location)) {
+			m_bodyNesting = m_nesting;
+			return yy::Parser::make_BODY(range, location);
+		}
+	}
+
+	yy::Parser::symbol_type token = m_lexer == Lexer::Fast ? m_fastScanner.token() : m_scanner.token();
+
+	switch (token.kind()) {
+		case yy::Parser::symbol_kind::S_LPAREN:
+		case yy::Parser::symbol_kind::S_LBRACKET:
+		case yy::Parser::symbol_kind::S_LBRACE:
+		case yy::Parser::symbol_kind::S_FUNCTION:
+		case yy::Parser::symbol_kind::S_DO:
+		case yy::Parser::symbol_kind::S_IF:
+		case yy::Parser::symbol_kind::S_REPEAT:
+			if (++m_nesting > MaxNesting) {
+				// Inside an open bracket or block the end of input is a syntax
+				// error, which stops the parser and frees what it has built.
+				if (!m_tooDeep)
+					error(token.location, "nesting deeper than " + std::to_string(MaxNesting) + " levels");
+				m_tooDeep = true;
+				return yy::Parser::make_END_OF_INPUT(token.location);
+			}
+			break;
+		case yy::Parser::symbol_kind::S_RPAREN:
+		case yy::Parser::symbol_kind::S_RBRACKET:
+		case yy::Parser::symbol_kind::S_RBRACE:
+		case yy::Parser::symbol_kind::S_END:
+		case yy::Parser::symbol_kind::S_UNTIL:
+			--m_nesting;
+			break;
+		default:
+			break;
+	}
+
+	if (m_lazySource)
+		trackFunctionHead(token.kind());
+	return token;
+}
+
+void Driver::trackFunctionHead(yy::Parser::symbol_kind_type kind)
+{
+	switch (kind) {
+		case yy::Parser::symbol_kind::S_FUNCTION:
+			m_functionHead = FunctionHead::Name;
+			break;
+		case yy::Parser::symbol_kind::S_ID:
+		case yy::Parser::symbol_kind::S_DOT:
+		case yy::Parser::symbol_kind::S_COLON:
+		case yy::Parser::symbol_kind::S_COMMA:
+		case yy::Parser::symbol_kind::S_ELLIPSIS:
+			if (m_functionHead != FunctionHead::Name && m_functionHead != FunctionHead::Params)
+				m_functionHead = FunctionHead::None;
+			break;
+		case yy::Parser::symbol_kind::S_LPAREN:
+			m_functionHead = m_functionHead == FunctionHead::Name ? FunctionHead::Params : FunctionHead::None;
+			break;
+		case yy::Parser::symbol_kind::S_RPAREN:
+			m_functionHead = m_functionHead == FunctionHead::Params ? FunctionHead::Body : FunctionHead::None;
+			break;
+		default:
+			m_functionHead = FunctionHead::None;
+	}
+}
+
+bool Driver::skipBody(Span &range, yy::location &location)
+{
+	const FastScanner::State start = m_fastScanner.state();
+	const char *text = m_lazySource->text.data();
+	yy::position begin;
+	std::size_t length;
+
+	// blocks opened, strings and comments are single tokens to the scanner
+	int depth = 1;
+	for (bool first = true;; first = false) {
+		const yy::Parser::token_kind_type kind = m_fastScanner.scan(length);
+		if (first) {
+			range.begin = m_fastScanner.state().cur - text;
+			begin = m_fastScanner.position();
+		}
+
+		switch (kind) {
+			case yy::Parser::token::FUNCTION:
+			case yy::Parser::token::DO:
+			case yy::Parser::token::IF:
+			case yy::Parser::token::REPEAT:
+				++depth;
+				break;
+			case yy::Parser::token::END:
+			case yy::Parser::token::UNTIL:
+				--depth;
+				break;
+			case yy::Parser::token::END_OF_INPUT:
+				// the parser reports it
+				m_fastScanner.restore(start);
+				return false;
+			default:
+				break;
+		}
+
+		if (depth == 0) {
+			if (kind != yy::Parser::token::END || first) {
+				m_fastScanner.restore(start);
+				return false;
+			}
+			range.end = m_fastScanner.state().cur - text;
+			location = yy::location{begin, m_fastScanner.position()};
+			return true;
+		}
+
+		m_fastScanner.skip(length);
+	}
+}
+
+void Driver::resetNesting()
+{
+	m_nesting = 0;
+	m_tooDeep = false;
+}
+
 void Driver::nextLine()
 {
 	m_position.lines(1);
@@ -48,15 +934,33 @@ void Driver::step()
 
 bool Driver::setInputFile(const char *filename)
 {
-	m_filename = filename;
-	m_inputFile.open(m_filename);
+	reset();
+	*m_filename = filename;
+	m_inputFile.open(*m_filename);
 	if (m_inputFile.fail()) {
-		std::cerr << "Unable to open file for reading: " << m_filename.c_str() << '\n';
+		std::cerr << "Unable to open file for reading: " << m_filename->c_str() << '\n';
 		return false;
 	}
 
-	m_position.initialize(&m_filename);
-	m_preprocessor.setInputFile(m_filename, &m_inputFile);
+	m_position.initialize(m_filename.get());
+	const Decompressor::Format format = Decompressor::detect(m_inputFile);
+	if (format == Decompressor::Format::None) {
+		m_preprocessor.setInputFile(*m_filename, &m_inputFile);
+	} else {
+		if (!m_decompressor.open(&m_inputFile, format)) {
+			std::cerr << m_decompressor.error() << ": " << m_filename->c_str() << '\n';
+			return false;
+		}
+		m_preprocessor.setInputFile(*m_filename, &m_decompressedStream);
+	}
 
 	return true;
 }
+
+void Driver::setInput(std::string_view source, const std::string &name)
+{
+	reset();
+	*m_filename = name;
+	m_position.initialize(m_filename.get());
+	m_preprocessor.setInput(*m_filename, source);
+}
@@ -1,16 +1,32 @@
 #pragma once
 
+#include <cstdint>
 #include <fstream>
 #include <memory>
+#include <string_view>
 #include <vector>
 
 #include "AST.hpp"
+#include "Decompressor.hpp"
+#include "FastScanner.hpp"
+#include "ParseResult.hpp"
 #include "Preprocessor.hpp"
 #include "Scanner.hpp"
+#include "ThreadPool.hpp"
 
 class Driver {
 	friend class yy::Parser;
 public:
+	enum class Lexer {
+		Flex,
+		Fast,
+	};
+
+	// Deepest nesting of brackets and function, do, if and repeat blocks.
+	// Analyses recurse once per block, this keeps their stack use bounded;
+	// expressions are walked iteratively and their length has no limit.
+	static constexpr int MaxNesting = 1000;
+
 	Driver();
 
 	void addChunk(Chunk *chunk);
@@ -18,21 +34,132 @@ public:
 	const std::vector <std::unique_ptr <Chunk> > & chunks() const;
 
 	int parse();
+	ParseResult parse(std::string_view source, const std::string &name = "<buffer>");
+	bool checkLexers();
+
+	// Applies edits to a result of parse(source) and re-parses only the
+	// statements they touch. The result is the same as a full parse of the
+	// edited source, which is what happens if the edits can't be handled
+	// incrementally; returns whether they could.
+	bool reparse(ParseResult &result, const std::vector <TextEdit> &edits);
+	bool checkIncremental(std::string_view source, const std::string &name, unsigned edits);
+	// Emits source, and a few tricky cases, as Lua in both styles and checks
+	// that parsing the output gives the same tree.
+	bool checkRoundTrip(std::string_view source, const std::string &name);
+	// Parses source, and functions nested too deep, with lazy function bodies
+	// and without, and checks that the trees or first errors are the same.
+	bool checkLazy(std::string_view source, const std::string &name);
+
+	struct PhaseCosts {
+		// seconds
+		double preprocess = 0.0;
+		double scan = 0.0;
+		// scanning included, the parser pulls its own tokens
+		double parse = 0.0;
+		std::size_t tokens = 0;
+		// size of the preprocessed text and of the tree built
+		std::size_t bufferBytes = 0;
+		std::size_t treeBytes = 0;
+		bool success = false;
+	};
+
+	// Times each phase of parsing source on this thread with the fast
+	// scanner. Scanning and parsing are skipped if preprocessing fails.
+	PhaseCosts measurePhases(std::string_view source, const std::string &name = "<buffer>");
+
+	// Drops the current input and results but keeps all buffers, so the next
+	// parse can reuse them.
+	void reset();
+	ParseResult takeResult();
+
+	void error(const yy::location &location, const std::string &message);
+	const std::vector <Diagnostic> & diagnostics() const { return m_diagnostics; }
+
+	void appendStatement(Chunk *chunk, Node *statement, const yy::location &location);
+	void closeBlock(Chunk *block);
+	Function * lazyFunction(ParamList *params, Span body, const yy::location &location);
 
 	yy::location location(const char *s);
 	void nextLine();
 	void step();
 
+	// gzip and zstd compressed files are decompressed while they are read,
+	// locations refer to the decompressed text.
 	bool setInputFile(const char *filename);
+	// what the last input file was compressed with, and how much of it was read
+	const Decompressor & decompressor() const { return m_decompressor; }
+	void setInput(std::string_view source, const std::string &name = "<buffer>");
+	void setLexer(Lexer lexer) { m_lexer = lexer; }
+	// With the fast lexer, large inputs are cut at top-level statements and
+	// the pieces parsed on this many threads.
+	void setThreads(unsigned threads) { m_threads = threads; }
+	// With the fast lexer, function bodies are only scanned for their end
+	// and parsed the first time Function::chunk() or hasChunk() is called.
+	// Syntax errors inside them only show then, in Function::bodyError().
+	void setLazyFunctions(bool lazy) { m_lazyFunctions = lazy; }
 
 private:
+	// how far into a function header the last tokens went
+	enum class FunctionHead {
+		None,
+		Name,
+		Params,
+		// the body follows
+		Body,
+	};
+
+	yy::Parser::symbol_type nextToken();
+	// Whether both lexers give the same tokens for data.
+	bool sameTokens(const std::string &data);
+	// Whether a parse of the input file with flex gives the statement spans
+	// of one of data, the file preprocessed, in memory.
+	bool sameStreamSpans(const std::string &data);
+	void trackFunctionHead(yy::Parser::symbol_kind_type kind);
+	// Scans a function body up to its end, false if it is empty or has none.
+	bool skipBody(Span &range, yy::location &location);
+	static std::unique_ptr <Chunk> parseBody(const std::shared_ptr <const LazySource> &source, Span body,
+		std::uint32_t line, std::uint32_t column, int nesting, std::string &error);
+	void resetNesting();
+
+	Span span(const yy::location &location);
+	const std::vector <std::uint32_t> & lineStarts();
+	bool parseParallel();
+	bool parseSegment(const char *begin, const char *end, const yy::position &start,
+		const std::vector <std::uint32_t> &lines, std::unique_ptr <Chunk> &chunk);
+	bool reparse(ParseResult &result, std::size_t offset, std::size_t removed, std::size_t inserted);
+	bool parseRegion(std::string_view text, const std::string &name, std::unique_ptr <Chunk> &chunk);
+
 	Preprocessor m_preprocessor;
 	yy::Parser m_parser;
 	Scanner m_scanner;
+	FastScanner m_fastScanner;
+	Lexer m_lexer;
 	std::istream m_inputStream;
 	std::ifstream m_inputFile;
+	Decompressor m_decompressor;
+	std::istream m_decompressedStream;
 
 	std::vector <std::unique_ptr <Chunk> > m_chunks;
-	std::string m_filename;
+	std::vector <Diagnostic> m_diagnostics;
+	// finished blocks whose statement is still being parsed
+	std::vector <Chunk *> m_blocks;
+	// the same for lazy function bodies
+	std::vector <Function *> m_lazyBodies;
+	// set while parsing with lazy function bodies
+	std::shared_ptr <const LazySource> m_lazySource;
+	FunctionHead m_functionHead;
+	bool m_lazyFunctions;
+	std::vector <std::uint32_t> m_lineStarts;
+	// line table of the whole input while parsing a piece of it
+	const std::vector <std::uint32_t> *m_sharedLines;
+	unsigned m_threads;
+	std::unique_ptr <ThreadPool> m_pool;
+	std::vector <std::unique_ptr <Driver> > m_workers;
+	std::unique_ptr <std::string> m_filename;
 	yy::position m_position;
+	bool m_started;
+	int m_nesting;
+	// m_nesting at the last BODY token
+	int m_bodyNesting;
+	bool m_tooDeep;
 };
@@ -0,0 +1,884 @@
+#include <cmath>
+
+#include "Emitter.hpp"
+#include "LuaEmitter.hpp"
+
+namespace {
+
+const char * valueTypeName(ValueType vt)
+{
+	static const char *s[] = {"Invalid", "Unknown", "Nil", "Boolean", "Integer", "Real", "String", "Table", "Function"};
+	return s[toUnderlying(vt)];
+}
+
+}
+
+std::unique_ptr <Emitter> Emitter::create(OutputFormat format, OutputBuffer &out)
+{
+	switch (format) {
+		case OutputFormat::Text:
+			return std::make_unique<TextEmitter>(out);
+		case OutputFormat::Json:
+			return std::make_unique<JsonEmitter>(out);
+		case OutputFormat::Sexpr:
+			return std::make_unique<SexprEmitter>(out);
+		case OutputFormat::Lua:
+			return std::make_unique<LuaEmitter>(out, LuaEmitter::Style::Pretty);
+		case OutputFormat::LuaMinified:
+			return std::make_unique<LuaEmitter>(out, LuaEmitter::Style::Minified);
+	}
+	return nullptr;
+}
+
+void Emitter::run(const Node *root, int indent)
+{
+	m_stack.clear();
+	m_pending.clear();
+	m_stack.push_back(Task{Task::Kind::Node, indent, root, {}});
+
+	while (!m_stack.empty()) {
+		const Task task = m_stack.back();
+		m_stack.pop_back();
+
+		switch (task.kind) {
+			case Task::Kind::Node:
+				emitNode(task.node, task.indent);
+				m_stack.insert(m_stack.end(), m_pending.rbegin(), m_pending.rend());
+				m_pending.clear();
+				break;
+			case Task::Kind::Write:
+				m_out.write(task.text);
+				break;
+			case Task::Kind::JsonString:
+				m_out.writeJsonString(task.text);
+				break;
+			case Task::Kind::Indent:
+				m_out.indent(task.indent);
+				break;
+			case Task::Kind::Action:
+				action(task.code, task.node, task.text, task.indent);
+				break;
+		}
+	}
+}
+
+void Emitter::queue(const Task &task)
+{
+	m_pending.push_back(task);
+}
+
+void Emitter::schedule(const Node *node, int indent)
+{
+	queue(Task{Task::Kind::Node, indent, node, {}});
+}
+
+void Emitter::write(std::string_view s)
+{
+	if (m_pending.empty())
+		m_out.write(s);
+	else
+		queue(Task{Task::Kind::Write, 0, nullptr, s});
+}
+
+void Emitter::writeJsonString(std::string_view s)
+{
+	if (m_pending.empty())
+		m_out.writeJsonString(s);
+	else
+		queue(Task{Task::Kind::JsonString, 0, nullptr, s});
+}
+
+void Emitter::writeIndent(int indent)
+{
+	if (m_pending.empty())
+		m_out.indent(indent);
+	else
+		queue(Task{Task::Kind::Indent, indent, nullptr, {}});
+}
+
+void Emitter::perform(int code, const Node *node, std::string_view text, int indent)
+{
+	if (m_pending.empty())
+		action(code, node, text, indent);
+	else
+		queue(Task{Task::Kind::Action, indent, node, text, code});
+}
+
+void Node::print(int indent) const
+{
+	std::string out;
+	OutputBuffer buffer{out};
+	TextEmitter{buffer}.emit(this, indent);
+	buffer.flush();
+	std::cout << out;
+}
+
+void TextEmitter::line(int indent, std::string_view s)
+{
+	writeIndent(indent);
+	write(s);
+	write("\n");
+}
+
+void TextEmitter::emitNode(const Node *node, int indent)
+{
+	if (!node) {
+		line(indent, "<empty>");
+		return;
+	}
+
+	switch (node->type()) {
+		case Node::Type::Chunk: {
+			line(indent, "Chunk:");
+			for (const auto &n : static_cast<const Chunk *>(node)->children())
+				schedule(n.get(), indent + 1);
+			break;
+		}
+		case Node::Type::ExprList: {
+			line(indent, "Expression list: [");
+			for (const auto &n : static_cast<const ExprList *>(node)->exprs())
+				schedule(n.get(), indent + 1);
+			line(indent, "]");
+			break;
+		}
+		case Node::Type::VarList: {
+			line(indent, "Variable list: [");
+			for (const auto &lv : static_cast<const VarList *>(node)->vars())
+				schedule(lv.get(), indent + 1);
+			line(indent, "]");
+			break;
+		}
+		case Node::Type::ParamList: {
+			auto pl = static_cast<const ParamList *>(node);
+			writeIndent(indent);
+			write("Name list: ");
+			bool first = true;
+			for (const auto &name : pl->names()) {
+				if (!first)
+					write(", ");
+				write(name);
+				first = false;
+			}
+			if (pl->hasEllipsis())
+				write("...");
+			write("\n");
+			break;
+		}
+		case Node::Type::Ellipsis:
+			line(indent, "Ellipsis (...)");
+			break;
+		case Node::Type::LValue: {
+			auto lv = static_cast<const LValue *>(node);
+			writeIndent(indent);
+			write("LValue");
+			switch (lv->lvalueType()) {
+				case LValue::Type::Bracket:
+					write(" bracket operator:\n");
+					schedule(lv->tableExpr(), indent + 1);
+					schedule(lv->keyExpr(), indent + 1);
+					break;
+				case LValue::Type::Dot:
+					write(" dot operator:\n");
+					schedule(lv->tableExpr(), indent + 1);
+					writeIndent(indent + 1);
+					write("Field name: ");
+					write(lv->name());
+					write("\n");
+					break;
+				case LValue::Type::Name:
+					write("\n");
+					line(indent + 1, lv->name());
+					break;
+			}
+			break;
+		}
+		case Node::Type::FunctionCall: {
+			auto fc = static_cast<const FunctionCall *>(node);
+			line(indent, "Function call:");
+			schedule(&fc->functionExpr(), indent + 1);
+			line(indent, "Args:");
+			schedule(&fc->args(), indent + 1);
+			break;
+		}
+		case Node::Type::MethodCall: {
+			auto mc = static_cast<const MethodCall *>(node);
+			line(indent, "Method call:");
+			schedule(&mc->functionExpr(), indent + 1);
+			writeIndent(indent);
+			write("Method name: ");
+			write(mc->methodName());
+			write("\n");
+			schedule(&mc->args(), indent + 1);
+			break;
+		}
+		case Node::Type::Assignment: {
+			auto a = static_cast<const Assignment *>(node);
+			line(indent, a->isLocal() ? "local assignment:" : "assignment:");
+			schedule(&a->varList(), indent + 1);
+			if (!a->exprList().exprs().empty())
+				schedule(&a->exprList(), indent + 1);
+			else
+				line(indent + 1, "nil");
+			break;
+		}
+		case Node::Type::Value: {
+			auto v = static_cast<const Value *>(node);
+			writeIndent(indent);
+			switch (v->valueType()) {
+				case ValueType::Nil:
+					write("nil");
+					break;
+				case ValueType::Boolean:
+					write(static_cast<const BooleanValue *>(v)->value() ? "true" : "false");
+					break;
+				case ValueType::String:
+					write("String: ");
+					write(static_cast<const StringValue *>(v)->value());
+					break;
+				case ValueType::Integer:
+					write("Int: ");
+					m_out.writeInt(static_cast<const IntValue *>(v)->value());
+					break;
+				case ValueType::Real:
+					write("Real: ");
+					m_out.writeReal(static_cast<const RealValue *>(v)->value());
+					break;
+				default:
+					write("Node");
+			}
+			write("\n");
+			break;
+		}
+		case Node::Type::TableCtor: {
+			line(indent, "Table:");
+			for (const auto &f : static_cast<const TableCtor *>(node)->fields())
+				schedule(f.get(), indent + 1);
+			break;
+		}
+		case Node::Type::Field: {
+			auto f = static_cast<const Field *>(node);
+			switch (f->fieldType()) {
+				case Field::Type::Brackets:
+					line(indent, "Expr to expr:");
+					schedule(f->keyExpr(), indent + 1);
+					break;
+				case Field::Type::Literal:
+					line(indent, "Name to expr:");
+					line(indent + 1, f->fieldName());
+					break;
+				case Field::Type::NoIndex:
+					line(indent, "Expr:");
+					break;
+			}
+			schedule(f->valueExpr(), indent + 1);
+			break;
+		}
+		case Node::Type::BinOp: {
+			auto op = static_cast<const BinOp *>(node);
+			writeIndent(indent);
+			write("BinOp: ");
+			write(op->toString());
+			write("\n");
+			schedule(&op->left(), indent + 1);
+			schedule(&op->right(), indent + 1);
+			break;
+		}
+		case Node::Type::UnOp: {
+			auto op = static_cast<const UnOp *>(node);
+			writeIndent(indent);
+			write("UnOp: ");
+			write(op->toString());
+			write("\n");
+			schedule(&op->operand(), indent + 1);
+			break;
+		}
+		case Node::Type::Break:
+			line(indent, "break");
+			break;
+		case Node::Type::Return: {
+			line(indent, "return");
+			if (auto exprs = static_cast<const Return *>(node)->exprList())
+				schedule(exprs, indent + 1);
+			break;
+		}
+		case Node::Type::Function: {
+			auto f = static_cast<const Function *>(node);
+			writeIndent(indent);
+			if (f->isLocal())
+				write("local ");
+			write("function ");
+			write(f->fullName());
+			write("\n");
+
+			line(indent, "params:");
+			if (f->hasParams())
+				schedule(&f->params(), indent + 1);
+			else
+				line(indent + 1, "<no params>");
+
+			line(indent, "body:");
+			schedule(f->hasChunk() ? &f->chunk() : nullptr, indent + 1);
+			break;
+		}
+		case Node::Type::If: {
+			auto i = static_cast<const If *>(node);
+			line(indent, "if:");
+			schedule(&i->condition(), indent + 1);
+			schedule(i->chunk(), indent + 1);
+			if (i->nextIf()) {
+				line(indent, "else:");
+				schedule(i->nextIf(), indent);
+			}
+			if (i->elseChunk()) {
+				line(indent, "else:");
+				schedule(i->elseChunk(), indent + 1);
+			}
+			break;
+		}
+		case Node::Type::While: {
+			auto w = static_cast<const While *>(node);
+			line(indent, "while:");
+			schedule(&w->condition(), indent + 1);
+			schedule(w->chunk(), indent + 1);
+			break;
+		}
+		case Node::Type::Repeat: {
+			auto r = static_cast<const Repeat *>(node);
+			line(indent, "repeat:");
+			schedule(r->chunk(), indent + 1);
+			schedule(&r->condition(), indent + 1);
+			break;
+		}
+		case Node::Type::For: {
+			auto f = static_cast<const For *>(node);
+			line(indent, "for:");
+			writeIndent(indent);
+			write("iterator: ");
+			write(f->iterator());
+			write("\n");
+			line(indent, "start:");
+			schedule(&f->start(), indent + 1);
+			line(indent, "limit:");
+			schedule(&f->limit(), indent + 1);
+			if (f->step()) {
+				line(indent, "step:");
+				schedule(f->step(), indent + 1);
+			}
+			line(indent, "do:");
+			schedule(f->chunk(), indent + 1);
+			break;
+		}
+		case Node::Type::ForEach: {
+			auto f = static_cast<const ForEach *>(node);
+			line(indent, "for_each:");
+			schedule(&f->iterators(), indent + 1);
+			line(indent, "in:");
+			schedule(&f->exprs(), indent + 1);
+			line(indent, "do:");
+			schedule(f->chunk(), indent + 1);
+			break;
+		}
+		case Node::Type::_last:
+			break;
+	}
+}
+
+void JsonEmitter::key(std::string_view name)
+{
+	write(",");
+	write("\"");
+	write(name);
+	write("\":");
+}
+
+void JsonEmitter::begin(std::string_view type)
+{
+	write("{\"type\":\"");
+	write(type);
+	write("\"");
+}
+
+void JsonEmitter::names(const std::vector <std::string> &names)
+{
+	write("[");
+	bool first = true;
+	for (const auto &name : names) {
+		if (!first)
+			write(",");
+		writeJsonString(name);
+		first = false;
+	}
+	write("]");
+}
+
+void JsonEmitter::emitNode(const Node *node, int)
+{
+	if (!node) {
+		write("null");
+		return;
+	}
+
+	auto list = [this](std::string_view name, const auto &nodes)
+	{
+		key(name);
+		write("[");
+		bool first = true;
+		for (const auto &n : nodes) {
+			if (!first)
+				write(",");
+			schedule(n.get());
+			first = false;
+		}
+		write("]");
+	};
+
+	auto field = [this](std::string_view name, const Node *n)
+	{
+		key(name);
+		schedule(n);
+	};
+
+	switch (node->type()) {
+		case Node::Type::Chunk:
+			begin("Chunk");
+			list("children", static_cast<const Chunk *>(node)->children());
+			break;
+		case Node::Type::ExprList:
+			begin("ExprList");
+			list("exprs", static_cast<const ExprList *>(node)->exprs());
+			break;
+		case Node::Type::VarList:
+			begin("VarList");
+			list("vars", static_cast<const VarList *>(node)->vars());
+			break;
+		case Node::Type::ParamList: {
+			auto pl = static_cast<const ParamList *>(node);
+			begin("ParamList");
+			key("names");
+			names(pl->names());
+			key("ellipsis");
+			write(pl->hasEllipsis() ? "true" : "false");
+			break;
+		}
+		case Node::Type::Ellipsis:
+			begin("Ellipsis");
+			break;
+		case Node::Type::LValue: {
+			auto lv = static_cast<const LValue *>(node);
+			begin("LValue");
+			key("kind");
+			switch (lv->lvalueType()) {
+				case LValue::Type::Bracket:
+					write("\"Bracket\"");
+					field("table", lv->tableExpr());
+					field("key", lv->keyExpr());
+					break;
+				case LValue::Type::Dot:
+					write("\"Dot\"");
+					field("table", lv->tableExpr());
+					key("name");
+					writeJsonString(lv->name());
+					break;
+				case LValue::Type::Name:
+					write("\"Name\"");
+					key("name");
+					writeJsonString(lv->name());
+					break;
+			}
+			break;
+		}
+		case Node::Type::FunctionCall: {
+			auto fc = static_cast<const FunctionCall *>(node);
+			begin("FunctionCall");
+			field("function", &fc->functionExpr());
+			field("args", &fc->args());
+			break;
+		}
+		case Node::Type::MethodCall: {
+			auto mc = static_cast<const MethodCall *>(node);
+			begin("MethodCall");
+			field("object", &mc->functionExpr());
+			key("method");
+			writeJsonString(mc->methodName());
+			field("args", &mc->args());
+			break;
+		}
+		case Node::Type::Assignment: {
+			auto a = static_cast<const Assignment *>(node);
+			begin("Assignment");
+			key("local");
+			write(a->isLocal() ? "true" : "false");
+			field("vars", &a->varList());
+			field("exprs", &a->exprList());
+			break;
+		}
+		case Node::Type::Value: {
+			auto v = static_cast<const Value *>(node);
+			begin("Value");
+			key("valueType");
+			write("\"");
+			write(valueTypeName(v->valueType()));
+			write("\"");
+			switch (v->valueType()) {
+				case ValueType::Boolean:
+					key("value");
+					write(static_cast<const BooleanValue *>(v)->value() ? "true" : "false");
+					break;
+				case ValueType::String:
+					key("literal");
+					writeJsonString(static_cast<const StringValue *>(v)->value());
+					break;
+				case ValueType::Integer:
+					key("value");
+					m_out.writeInt(static_cast<const IntValue *>(v)->value());
+					break;
+				case ValueType::Real: {
+					const double d = static_cast<const RealValue *>(v)->value();
+					key("value");
+					if (std::isfinite(d))
+						m_out.writeShortestReal(d);
+					else
+						write("null");
+					break;
+				}
+				default:
+					break;
+			}
+			break;
+		}
+		case Node::Type::TableCtor:
+			begin("TableCtor");
+			list("fields", static_cast<const TableCtor *>(node)->fields());
+			break;
+		case Node::Type::Field: {
+			auto f = static_cast<const Field *>(node);
+			begin("Field");
+			key("kind");
+			switch (f->fieldType()) {
+				case Field::Type::Brackets:
+					write("\"Brackets\"");
+					field("key", f->keyExpr());
+					break;
+				case Field::Type::Literal:
+					write("\"Literal\"");
+					key("name");
+					writeJsonString(f->fieldName());
+					break;
+				case Field::Type::NoIndex:
+					write("\"NoIndex\"");
+					break;
+			}
+			field("value", f->valueExpr());
+			break;
+		}
+		case Node::Type::BinOp: {
+			auto op = static_cast<const BinOp *>(node);
+			begin("BinOp");
+			key("op");
+			writeJsonString(op->toString());
+			field("left", &op->left());
+			field("right", &op->right());
+			break;
+		}
+		case Node::Type::UnOp: {
+			auto op = static_cast<const UnOp *>(node);
+			begin("UnOp");
+			key("op");
+			writeJsonString(op->toString());
+			field("operand", &op->operand());
+			break;
+		}
+		case Node::Type::Break:
+			begin("Break");
+			break;
+		case Node::Type::Return:
+			begin("Return");
+			field("exprs", static_cast<const Return *>(node)->exprList());
+			break;
+		case Node::Type::Function: {
+			auto f = static_cast<const Function *>(node);
+			begin("Function");
+			key("local");
+			write(f->isLocal() ? "true" : "false");
+			key("name");
+			names(f->nameParts());
+			key("method");
+			if (f->methodName().empty())
+				write("null");
+			else
+				writeJsonString(f->methodName());
+			field("params", f->hasParams() ? &f->params() : nullptr);
+			field("body", f->hasChunk() ? &f->chunk() : nullptr);
+			break;
+		}
+		case Node::Type::If: {
+			auto i = static_cast<const If *>(node);
+			begin("If");
+			field("condition", &i->condition());
+			field("body", i->chunk());
+			field("next", i->nextIf());
+			field("else", i->elseChunk());
+			break;
+		}
+		case Node::Type::While: {
+			auto w = static_cast<const While *>(node);
+			begin("While");
+			field("condition", &w->condition());
+			field("body", w->chunk());
+			break;
+		}
+		case Node::Type::Repeat: {
+			auto r = static_cast<const Repeat *>(node);
+			begin("Repeat");
+			field("body", r->chunk());
+			field("condition", &r->condition());
+			break;
+		}
+		case Node::Type::For: {
+			auto f = static_cast<const For *>(node);
+			begin("For");
+			key("iterator");
+			writeJsonString(f->iterator());
+			field("start", &f->start());
+			field("limit", &f->limit());
+			field("step", f->step());
+			field("body", f->chunk());
+			break;
+		}
+		case Node::Type::ForEach: {
+			auto f = static_cast<const ForEach *>(node);
+			begin("ForEach");
+			field("iterators", &f->iterators());
+			field("exprs", &f->exprs());
+			field("body", f->chunk());
+			break;
+		}
+		case Node::Type::_last:
+			write("{");
+			break;
+	}
+	end();
+}
+
+void SexprEmitter::begin(std::string_view head)
+{
+	write("(");
+	write(head);
+}
+
+void SexprEmitter::child(const Node *node)
+{
+	write(" ");
+	schedule(node);
+}
+
+void SexprEmitter::atom(std::string_view s)
+{
+	write(" ");
+	writeJsonString(s);
+}
+
+void SexprEmitter::emitNode(const Node *node, int)
+{
+	if (!node) {
+		write("nil");
+		return;
+	}
+
+	auto children = [this](const auto &nodes)
+	{
+		for (const auto &n : nodes)
+			child(n.get());
+	};
+
+	switch (node->type()) {
+		case Node::Type::Chunk:
+			begin("chunk");
+			children(static_cast<const Chunk *>(node)->children());
+			break;
+		case Node::Type::ExprList:
+			begin("exprs");
+			children(static_cast<const ExprList *>(node)->exprs());
+			break;
+		case Node::Type::VarList:
+			begin("vars");
+			children(static_cast<const VarList *>(node)->vars());
+			break;
+		case Node::Type::ParamList: {
+			auto pl = static_cast<const ParamList *>(node);
+			begin("params");
+			for (const auto &name : pl->names())
+				atom(name);
+			if (pl->hasEllipsis())
+				write(" ...");
+			break;
+		}
+		case Node::Type::Ellipsis:
+			write("...");
+			return;
+		case Node::Type::LValue: {
+			auto lv = static_cast<const LValue *>(node);
+			switch (lv->lvalueType()) {
+				case LValue::Type::Bracket:
+					begin("index");
+					child(lv->tableExpr());
+					child(lv->keyExpr());
+					break;
+				case LValue::Type::Dot:
+					begin("dot");
+					child(lv->tableExpr());
+					atom(lv->name());
+					break;
+				case LValue::Type::Name:
+					begin("name");
+					atom(lv->name());
+					break;
+			}
+			break;
+		}
+		case Node::Type::FunctionCall: {
+			auto fc = static_cast<const FunctionCall *>(node);
+			begin("call");
+			child(&fc->functionExpr());
+			child(&fc->args());
+			break;
+		}
+		case Node::Type::MethodCall: {
+			auto mc = static_cast<const MethodCall *>(node);
+			begin("method-call");
+			child(&mc->functionExpr());
+			atom(mc->methodName());
+			child(&mc->args());
+			break;
+		}
+		case Node::Type::Assignment: {
+			auto a = static_cast<const Assignment *>(node);
+			begin(a->isLocal() ? "local" : "set");
+			child(&a->varList());
+			child(&a->exprList());
+			break;
+		}
+		case Node::Type::Value: {
+			auto v = static_cast<const Value *>(node);
+			switch (v->valueType()) {
+				case ValueType::Nil:
+					write("nil");
+					break;
+				case ValueType::Boolean:
+					write(static_cast<const BooleanValue *>(v)->value() ? "true" : "false");
+					break;
+				case ValueType::String:
+					begin("string");
+					atom(static_cast<const StringValue *>(v)->value());
+					end();
+					break;
+				case ValueType::Integer:
+					m_out.writeInt(static_cast<const IntValue *>(v)->value());
+					break;
+				case ValueType::Real:
+					m_out.writeShortestReal(static_cast<const RealValue *>(v)->value());
+					break;
+				default:
+					write("?");
+			}
+			return;
+		}
+		case Node::Type::TableCtor:
+			begin("table");
+			children(static_cast<const TableCtor *>(node)->fields());
+			break;
+		case Node::Type::Field: {
+			auto f = static_cast<const Field *>(node);
+			switch (f->fieldType()) {
+				case Field::Type::Brackets:
+					begin("field");
+					child(f->keyExpr());
+					break;
+				case Field::Type::Literal:
+					begin("field");
+					atom(f->fieldName());
+					break;
+				case Field::Type::NoIndex:
+					begin("item");
+					break;
+			}
+			child(f->valueExpr());
+			break;
+		}
+		case Node::Type::BinOp: {
+			auto op = static_cast<const BinOp *>(node);
+			begin(op->toString());
+			child(&op->left());
+			child(&op->right());
+			break;
+		}
+		case Node::Type::UnOp: {
+			auto op = static_cast<const UnOp *>(node);
+			begin(op->toString());
+			child(&op->operand());
+			break;
+		}
+		case Node::Type::Break:
+			write("(break)");
+			return;
+		case Node::Type::Return: {
+			begin("return");
+			if (auto exprs = static_cast<const Return *>(node)->exprList())
+				child(exprs);
+			break;
+		}
+		case Node::Type::Function: {
+			auto f = static_cast<const Function *>(node);
+			begin(f->isLocal() ? "local-function" : "function");
+			atom(f->fullName());
+			child(f->hasParams() ? &f->params() : nullptr);
+			child(f->hasChunk() ? &f->chunk() : nullptr);
+			break;
+		}
+		case Node::Type::If: {
+			auto i = static_cast<const If *>(node);
+			begin("if");
+			child(&i->condition());
+			child(i->chunk());
+			child(i->nextIf());
+			child(i->elseChunk());
+			break;
+		}
+		case Node::Type::While: {
+			auto w = static_cast<const While *>(node);
+			begin("while");
+			child(&w->condition());
+			child(w->chunk());
+			break;
+		}
+		case Node::Type::Repeat: {
+			auto r = static_cast<const Repeat *>(node);
+			begin("repeat");
+			child(r->chunk());
+			child(&r->condition());
+			break;
+		}
+		case Node::Type::For: {
+			auto f = static_cast<const For *>(node);
+			begin("for");
+			atom(f->iterator());
+			child(&f->start());
+			child(&f->limit());
+			child(f->step());
+			child(f->chunk());
+			break;
+		}
+		case Node::Type::ForEach: {
+			auto f = static_cast<const ForEach *>(node);
+			begin("for-each");
+			child(&f->iterators());
+			child(&f->exprs());
+			child(f->chunk());
+			break;
+		}
+		case Node::Type::_last:
+			write("(");
+			break;
+	}
+	end();
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include "AST.hpp"
+#include "OutputBuffer.hpp"
+
+enum class OutputFormat {
+	Text,
+	Json,
+	Sexpr,
+	Lua,
+	LuaMinified,
+};
+
+// Writes an AST into an OutputBuffer. The text format is the one of
+// Node::print(), the JSON and S-expression formats are streamed out as the
+// tree is walked. Nodes are visited with an explicit stack, so trees of any
+// depth can be written.
+class Emitter {
+public:
+	explicit Emitter(OutputBuffer &out) : m_out{out} {}
+	virtual ~Emitter() = default;
+
+	Emitter(const Emitter &) = delete;
+	Emitter & operator = (const Emitter &) = delete;
+
+	void emit(const Node &node) { emit(&node); }
+	void emit(const Node *node)
+	{
+		prepare(node);
+		run(node, 0);
+	}
+
+	static std::unique_ptr <Emitter> create(OutputFormat format, OutputBuffer &out);
+
+protected:
+	// Writes one node. What it writes before its first schedule() goes out
+	// right away, everything after that is queued behind the child, so the
+	// strings must outlive the emit() call unless they come first.
+	virtual void emitNode(const Node *node, int indent) = 0;
+	// Called by emit() before the tree is walked.
+	virtual void prepare(const Node *root) {}
+	// Runs a step queued with perform().
+	virtual void action(int code, const Node *node, std::string_view text, int indent) {}
+
+	void run(const Node *root, int indent);
+	void schedule(const Node *node, int indent = 0);
+	void write(std::string_view s);
+	void writeJsonString(std::string_view s);
+	void writeIndent(int indent);
+	// Like write(), for output which depends on what was written before it.
+	void perform(int code, const Node *node = nullptr, std::string_view text = {}, int indent = 0);
+
+	OutputBuffer &m_out;
+
+private:
+	struct Task {
+		enum class Kind {
+			Node,
+			Write,
+			JsonString,
+			Indent,
+			Action,
+		};
+
+		Kind kind;
+		int indent;
+		const Node *node;
+		std::string_view text;
+		int code = 0;
+	};
+
+	void queue(const Task &task);
+
+	std::vector <Task> m_stack;
+	// tasks of the node being emitted, in order
+	std::vector <Task> m_pending;
+};
+
+class TextEmitter : public Emitter {
+public:
+	using Emitter::Emitter;
+	using Emitter::emit;
+
+	void emit(const Node *node, int indent) { run(node, indent); }
+
+protected:
+	void emitNode(const Node *node, int indent) override;
+
+private:
+	void line(int indent, std::string_view s);
+};
+
+class JsonEmitter : public Emitter {
+public:
+	using Emitter::Emitter;
+
+protected:
+	void emitNode(const Node *node, int indent) override;
+
+private:
+	void key(std::string_view name);
+	void begin(std::string_view type);
+	void end() { write("}"); }
+	void names(const std::vector <std::string> &names);
+};
+
+class SexprEmitter : public Emitter {
+public:
+	using Emitter::Emitter;
+
+protected:
+	void emitNode(const Node *node, int indent) override;
+
+private:
+	void begin(std::string_view head);
+	void end() { write(")"); }
+	void child(const Node *node);
+	void atom(std::string_view s);
+};
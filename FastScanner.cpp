@@ -0,0 +1,352 @@
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "FastScanner.hpp"
+#include "Keywords.hpp"
+
+namespace {
+
+inline bool isIdentStart(unsigned char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+inline bool isDigit(unsigned char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+inline bool isHexDigit(unsigned char c)
+{
+	return isDigit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+inline bool isIdent(unsigned char c)
+{
+	return isIdentStart(c) || isDigit(c);
+}
+
+inline bool isBlank(unsigned char c)
+{
+	return c == ' ' || c == '\t';
+}
+
+#ifdef __SSE2__
+inline __m128i inRange(__m128i v, char lo, char hi)
+{
+	return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(lo - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8(hi + 1)));
+}
+
+inline unsigned identMask(__m128i v)
+{
+	__m128i m = _mm_or_si128(inRange(v, 'a', 'z'), inRange(v, 'A', 'Z'));
+	m = _mm_or_si128(m, inRange(v, '0', '9'));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+	return _mm_movemask_epi8(m);
+}
+
+inline unsigned digitMask(__m128i v)
+{
+	return _mm_movemask_epi8(inRange(v, '0', '9'));
+}
+
+inline unsigned blankMask(__m128i v)
+{
+	return _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))));
+}
+
+inline unsigned stringStopMask(__m128i v, char delim)
+{
+	return _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(delim)), _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))));
+}
+#endif
+
+// Length of the longest prefix of [p, end) whose characters all satisfy Pred.
+// Full 16 byte blocks are checked with SIMD, the tail byte by byte.
+template <typename Pred, typename Mask>
+inline std::size_t run(const char *p, const char *end, Pred pred, Mask mask)
+{
+	const char *start = p;
+#ifdef __SSE2__
+	while (end - p >= 16) {
+		const unsigned m = mask(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)));
+		if (m != 0xFFFF)
+			return p - start + __builtin_ctz(~m);
+		p += 16;
+	}
+#else
+	(void)mask;
+#endif
+	while (p != end && pred(*p))
+		++p;
+	return p - start;
+}
+
+#ifdef __SSE2__
+#define SCANNER_MASK(name) [](__m128i v) { return name(v); }
+#else
+#define SCANNER_MASK(name) nullptr
+#endif
+
+inline std::size_t identRun(const char *p, const char *end)
+{
+	return run(p, end, [](unsigned char c) { return isIdent(c); }, SCANNER_MASK(identMask));
+}
+
+inline std::size_t digitRun(const char *p, const char *end)
+{
+	return run(p, end, [](unsigned char c) { return isDigit(c); }, SCANNER_MASK(digitMask));
+}
+
+inline std::size_t blankRun(const char *p, const char *end)
+{
+	return run(p, end, [](unsigned char c) { return isBlank(c); }, SCANNER_MASK(blankMask));
+}
+
+#undef SCANNER_MASK
+
+}
+
+void FastScanner::reset(const char *begin, const char *end, std::string *filename)
+{
+	m_begin = begin;
+	m_cur = begin;
+	m_end = end;
+	m_position.initialize(filename);
+}
+
+void FastScanner::reset(const char *begin, const char *end, const yy::position &start)
+{
+	m_begin = begin;
+	m_cur = begin;
+	m_end = end;
+	m_position = start;
+}
+
+yy::location FastScanner::advance(std::size_t length)
+{
+	const yy::position begin = m_position;
+	skip(length);
+	return yy::location{begin, m_position};
+}
+
+// Mirrors the Flex pattern \"(\\.|[^\\"])*\"|\'(\\.|[^\\'])*\'. Returns false
+// if the literal is not terminated, in which case the opening quote is an
+// unmatched character, just like for the generated scanner.
+bool FastScanner::stringLength(std::size_t &length) const
+{
+	const char delim = *m_cur;
+	const char *p = m_cur + 1;
+
+	for (;;) {
+#ifdef __SSE2__
+		while (m_end - p >= 16) {
+			const unsigned m = stringStopMask(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)), delim);
+			if (m != 0) {
+				p += __builtin_ctz(m);
+				break;
+			}
+			p += 16;
+		}
+#endif
+		while (p != m_end && *p != delim && *p != '\\')
+			++p;
+
+		if (p == m_end)
+			return false;
+
+		if (*p == delim) {
+			length = p + 1 - m_cur;
+			return true;
+		}
+
+		// backslash: '.' in Flex does not match a newline
+		if (p + 1 == m_end || p[1] == '\n')
+			return false;
+		p += 2;
+	}
+}
+
+yy::Parser::token_kind_type FastScanner::number(std::size_t &length) const
+{
+	const char *p = m_cur;
+
+	if (p[0] == '0' && m_end - p > 2 && (p[1] == 'x' || p[1] == 'X') && isHexDigit(p[2])) {
+		length = 2;
+		while (p + length != m_end && isHexDigit(p[length]))
+			++length;
+		return yy::Parser::token::INT_VALUE;
+	}
+
+	length = digitRun(p, m_end);
+	if (p + length != m_end && p[length] == '.') {
+		++length;
+		length += digitRun(p + length, m_end);
+		return yy::Parser::token::REAL_VALUE;
+	}
+	return yy::Parser::token::INT_VALUE;
+}
+
+long FastScanner::intValue(const char *p, std::size_t length)
+{
+	if (length > 2 && (p[1] == 'x' || p[1] == 'X')) {
+		char buf[64];
+		std::string big;
+		const char *text = buf;
+		if (length < sizeof(buf)) {
+			std::memcpy(buf, p, length);
+			buf[length] = '\0';
+		} else {
+			big.assign(p, length);
+			text = big.c_str();
+		}
+		return std::strtol(text, nullptr, 16);
+	}
+
+	if (length <= 18) {
+		long value = 0;
+		for (std::size_t i = 0; i < length; ++i)
+			value = value * 10 + (p[i] - '0');
+		return value;
+	}
+
+	// strtol saturates on overflow, keep that behaviour
+	const std::string text{p, length};
+	return std::strtol(text.c_str(), nullptr, 10);
+}
+
+double FastScanner::realValue(const char *p, std::size_t length)
+{
+	double value = 0.0;
+	if (std::from_chars(p, p + length, value).ec != std::errc::result_out_of_range)
+		return value;
+
+	// an infinity or what is left of an underflow, as flex gets from strtod
+	const std::string text{p, length};
+	return std::strtod(text.c_str(), nullptr);
+}
+
+yy::Parser::token_kind_type FastScanner::scan(std::size_t &length)
+{
+	while (m_cur != m_end) {
+		const unsigned char c = *m_cur;
+
+		if (isIdentStart(c)) {
+			length = identRun(m_cur, m_end);
+			if (const Keywords::Keyword *kw = Keywords::lookup(m_cur, length))
+				return kw->token;
+			return yy::Parser::token::ID;
+		}
+
+		if (isDigit(c))
+			return number(length);
+
+		length = 1;
+		switch (c) {
+			case ' ':
+			case '\t':
+				skip(blankRun(m_cur, m_end));
+				continue;
+			case '\n':
+				m_position.lines(1);
+				++m_cur;
+				continue;
+			case '\r':
+				++m_cur;
+				continue;
+			case '"':
+			case '\'':
+				if (!stringLength(length))
+					break;
+				return yy::Parser::token::STRING_VALUE;
+			case '.':
+				if (m_end - m_cur > 1 && m_cur[1] == '.') {
+					if (m_end - m_cur > 2 && m_cur[2] == '.') {
+						length = 3;
+						return yy::Parser::token::ELLIPSIS;
+					}
+					length = 2;
+					return yy::Parser::token::CONCAT;
+				}
+				if (m_end - m_cur > 1 && isDigit(m_cur[1]))
+					return number(length);
+				return yy::Parser::token::DOT;
+			case '=':
+				if (m_end - m_cur > 1 && m_cur[1] == '=') {
+					length = 2;
+					return yy::Parser::token::EQ;
+				}
+				return yy::Parser::token::ASSIGN;
+			case '~':
+				if (m_end - m_cur > 1 && m_cur[1] == '=') {
+					length = 2;
+					return yy::Parser::token::NE;
+				}
+				break;
+			case '<':
+				if (m_end - m_cur > 1 && m_cur[1] == '=') {
+					length = 2;
+					return yy::Parser::token::LE;
+				}
+				return yy::Parser::token::LT;
+			case '>':
+				if (m_end - m_cur > 1 && m_cur[1] == '=') {
+					length = 2;
+					return yy::Parser::token::GE;
+				}
+				return yy::Parser::token::GT;
+			case '+': return yy::Parser::token::PLUS;
+			case '-': return yy::Parser::token::MINUS;
+			case '*': return yy::Parser::token::MUL;
+			case '/': return yy::Parser::token::DIV;
+			case '%': return yy::Parser::token::MOD;
+			case '^': return yy::Parser::token::POWER;
+			case '#': return yy::Parser::token::HASH;
+			case '(': return yy::Parser::token::LPAREN;
+			case ')': return yy::Parser::token::RPAREN;
+			case '[': return yy::Parser::token::LBRACKET;
+			case ']': return yy::Parser::token::RBRACKET;
+			case '{': return yy::Parser::token::LBRACE;
+			case '}': return yy::Parser::token::RBRACE;
+			case ',': return yy::Parser::token::COMMA;
+			case ';': return yy::Parser::token::SEMICOLON;
+			case ':': return yy::Parser::token::COLON;
+			default:
+				break;
+		}
+
+		// Unmatched character. Flex's default rule echoes it without touching
+		// the location, we just drop it.
+		++m_cur;
+	}
+
+	length = 0;
+	return yy::Parser::token::END_OF_INPUT;
+}
+
+yy::Parser::symbol_type FastScanner::token()
+{
+	std::size_t length;
+	const yy::Parser::token_kind_type kind = scan(length);
+	const char *start = m_cur;
+
+	switch (kind) {
+		case yy::Parser::token::END_OF_INPUT:
+			return yy::Parser::make_END_OF_INPUT(yy::location{m_position, m_position});
+		case yy::Parser::token::ID:
+			return yy::Parser::make_ID(std::string{start, length}, advance(length));
+		case yy::Parser::token::STRING_VALUE:
+			return yy::Parser::make_STRING_VALUE(std::string{start, length}, advance(length));
+		case yy::Parser::token::INT_VALUE:
+			return yy::Parser::make_INT_VALUE(intValue(start, length), advance(length));
+		case yy::Parser::token::REAL_VALUE:
+			return yy::Parser::make_REAL_VALUE(realValue(start, length), advance(length));
+		default:
+			return yy::Parser::symbol_type{kind, advance(length)};
+	}
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include "Parser.hpp"
+
+// Hand-written replacement for the Flex generated Scanner. It works on an
+// in-memory (already preprocessed) buffer and produces exactly the same
+// token stream, including locations, as scanner.ll. Runs of identifier,
+// digit and blank characters are classified 16 bytes at a time when SSE2
+// is available.
+class FastScanner {
+public:
+	FastScanner() = default;
+	FastScanner(const FastScanner &) = delete;
+	FastScanner & operator = (const FastScanner &) = delete;
+
+	void reset(const char *begin, const char *end, std::string *filename);
+	void reset(const std::string &data, std::string *filename) { reset(data.data(), data.data() + data.size(), filename); }
+	// Scans a piece of a larger buffer, begin is at start.
+	void reset(const char *begin, const char *end, const yy::position &start);
+
+	yy::Parser::symbol_type token();
+
+	// Skips to the next token and returns its kind and length without
+	// building its value or moving past it; skip() does that. The token
+	// starts at offset().
+	yy::Parser::token_kind_type scan(std::size_t &length);
+	void skip(std::size_t length)
+	{
+		m_position.columns(length);
+		m_cur += length;
+	}
+	std::size_t offset() const { return m_cur - m_begin; }
+
+	// where scanning is, to come back to it
+	struct State {
+		const char *cur;
+		yy::position position;
+	};
+	State state() const { return State{m_cur, m_position}; }
+	void restore(const State &state)
+	{
+		m_cur = state.cur;
+		m_position = state.position;
+	}
+
+	// Values of INT_VALUE and REAL_VALUE tokens.
+	static long intValue(const char *p, std::size_t length);
+	static double realValue(const char *p, std::size_t length);
+
+	const yy::position & position() const { return m_position; }
+
+private:
+	yy::location advance(std::size_t length);
+
+	yy::Parser::token_kind_type number(std::size_t &length) const;
+	bool stringLength(std::size_t &length) const;
+
+	const char *m_begin = nullptr;
+	const char *m_cur = nullptr;
+	const char *m_end = nullptr;
+	yy::position m_position;
+};
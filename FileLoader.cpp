@@ -0,0 +1,510 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include "FileLoader.hpp"
+
+namespace {
+
+// what a file of unknown size is read in pieces of
+const std::size_t ReadSize = 64 * 1024;
+const unsigned MaxPreadThreads = 16;
+
+}
+
+#ifdef HAVE_IO_URING
+
+// The submission and completion queues of an io_uring, set up and used with
+// raw system calls.
+class FileLoader::Ring {
+public:
+	explicit Ring(unsigned entries)
+	{
+		io_uring_params params;
+		std::memset(&params, 0, sizeof(params));
+		m_fd = syscall(__NR_io_uring_setup, entries, &params);
+		if (m_fd < 0)
+			return;
+
+		m_sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		m_cqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+		const bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+		if (single)
+			m_sqSize = m_cqSize = std::max(m_sqSize, m_cqSize);
+		m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+
+		m_sq = mmap(nullptr, m_sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+		m_cq = single ? m_sq : mmap(nullptr, m_cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+		m_sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+		if (m_sq == MAP_FAILED || m_cq == MAP_FAILED || m_sqes == MAP_FAILED) {
+			unmap();
+			::close(m_fd);
+			m_fd = -1;
+			return;
+		}
+
+		char *sq = static_cast<char *>(m_sq);
+		m_sqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+		m_sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+		m_sqMask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+		m_sqEntries = params.sq_entries;
+		m_sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+		m_tail = *m_sqTail;
+
+		char *cq = static_cast<char *>(m_cq);
+		m_cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+		m_cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+		m_cqMask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+		m_cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+	}
+
+	~Ring()
+	{
+		if (m_fd < 0)
+			return;
+		unmap();
+		::close(m_fd);
+	}
+
+	bool valid() const { return m_fd >= 0; }
+
+	// A cleared submission entry, flushing the queue to the kernel first if
+	// it is full.
+	io_uring_sqe * get()
+	{
+		if (m_tail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE) >= m_sqEntries)
+			submit(0);
+
+		const unsigned index = m_tail & m_sqMask;
+		io_uring_sqe *sqe = static_cast<io_uring_sqe *>(m_sqes) + index;
+		std::memset(sqe, 0, sizeof(*sqe));
+		m_sqArray[index] = index;
+		++m_tail;
+		return sqe;
+	}
+
+	// Submits the queued entries and waits for wait completions.
+	void submit(unsigned wait)
+	{
+		__atomic_store_n(m_sqTail, m_tail, __ATOMIC_RELEASE);
+		for (;;) {
+			const unsigned pending = m_tail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+			const long result = syscall(__NR_io_uring_enter, m_fd, pending, wait, wait ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+			if (result >= 0 || (errno != EINTR && errno != EAGAIN && errno != EBUSY))
+				return;
+		}
+	}
+
+	// Calls f(user data, result) for every completion there is.
+	template <typename F>
+	void complete(F f)
+	{
+		unsigned head = *m_cqHead;
+		for (;;) {
+			const unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+			if (head == tail)
+				break;
+			for (; head != tail; ++head) {
+				const io_uring_cqe &cqe = m_cqes[head & m_cqMask];
+				f(cqe.user_data, cqe.res);
+			}
+			__atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+		}
+	}
+
+private:
+	void unmap()
+	{
+		if (m_sqes != MAP_FAILED)
+			munmap(m_sqes, m_sqesSize);
+		if (m_cq != MAP_FAILED && m_cq != m_sq)
+			munmap(m_cq, m_cqSize);
+		if (m_sq != MAP_FAILED)
+			munmap(m_sq, m_sqSize);
+	}
+
+	int m_fd = -1;
+	void *m_sq = MAP_FAILED;
+	void *m_cq = MAP_FAILED;
+	void *m_sqes = MAP_FAILED;
+	std::size_t m_sqSize = 0;
+	std::size_t m_cqSize = 0;
+	std::size_t m_sqesSize = 0;
+
+	unsigned *m_sqHead = nullptr;
+	unsigned *m_sqTail = nullptr;
+	unsigned *m_sqArray = nullptr;
+	unsigned m_sqMask = 0;
+	unsigned m_sqEntries = 0;
+	// entries queued but not yet published end at this
+	unsigned m_tail = 0;
+
+	unsigned *m_cqHead = nullptr;
+	unsigned *m_cqTail = nullptr;
+	unsigned m_cqMask = 0;
+	io_uring_cqe *m_cqes = nullptr;
+};
+
+#else
+
+class FileLoader::Ring {
+public:
+	explicit Ring(unsigned entries) {}
+	bool valid() const { return false; }
+};
+
+#endif
+
+FileLoader::FileLoader(std::vector <const char *> paths, unsigned window, Backend backend)
+	: m_paths{std::move(paths)}, m_files(m_paths.size()), m_ready(m_paths.size()), m_window{std::max(window, 1u)},
+	m_backend{Backend::Pread}
+{
+	for (std::size_t i = 0; i < m_paths.size(); ++i) {
+		m_files[i].index = i;
+		m_files[i].name = m_paths[i];
+	}
+
+	if (backend != Backend::Pread) {
+		// an open and a stat, then a read, for every file of the window
+		m_ring.reset(new Ring{2 * m_window});
+		if (m_ring->valid()) {
+			m_backend = Backend::IoUring;
+			m_ringThread = std::thread{[this]{ readRing(); }};
+			return;
+		}
+		m_ring.reset();
+	}
+
+	m_pool.reset(new ThreadPool{std::min(m_window, MaxPreadThreads)});
+	std::lock_guard <std::mutex> lock{m_mutex};
+	for (auto &[i, buffer] : admit())
+		m_pool->post([this, i = i, buffer = std::move(buffer)]() mutable { readPread(i, std::move(buffer)); });
+}
+
+FileLoader::~FileLoader()
+{
+	{
+		std::lock_guard <std::mutex> lock{m_mutex};
+		m_stop = true;
+	}
+	m_cond.notify_all();
+
+	if (m_ringThread.joinable())
+		m_ringThread.join();
+	m_pool.reset();
+}
+
+const char * FileLoader::name(Backend backend)
+{
+	switch (backend) {
+		case Backend::IoUring:
+			return "io_uring";
+		case Backend::Pread:
+			return "pread";
+		default:
+			return "auto";
+	}
+}
+
+bool FileLoader::next(File &file)
+{
+	std::unique_lock <std::mutex> lock{m_mutex};
+	if (m_next >= m_files.size())
+		return false;
+
+	const std::size_t i = m_next++;
+	m_cond.wait(lock, [this, i]{ return m_ready[i]; });
+	file = std::move(m_files[i]);
+	return true;
+}
+
+void FileLoader::release(File &file)
+{
+	Admitted admitted;
+	{
+		std::lock_guard <std::mutex> lock{m_mutex};
+		file.data.clear();
+		m_buffers.push_back(std::move(file.data));
+		file.data = std::string{};
+		--m_active;
+		if (m_pool)
+			admitted = admit();
+	}
+
+	if (!m_pool) {
+		m_cond.notify_all();
+		return;
+	}
+
+	for (auto &[i, buffer] : admitted)
+		m_pool->post([this, i = i, buffer = std::move(buffer)]() mutable { readPread(i, std::move(buffer)); });
+}
+
+FileLoader::Admitted FileLoader::admit()
+{
+	Admitted admitted;
+	while (!m_stop && m_active < m_window && m_started < m_paths.size()) {
+		std::string buffer;
+		if (!m_buffers.empty()) {
+			buffer = std::move(m_buffers.back());
+			m_buffers.pop_back();
+		}
+		admitted.emplace_back(m_started++, std::move(buffer));
+		++m_active;
+	}
+
+	return admitted;
+}
+
+void FileLoader::finish(std::size_t i, std::string data, std::string error)
+{
+	{
+		std::lock_guard <std::mutex> lock{m_mutex};
+		m_files[i].data = std::move(data);
+		m_files[i].error = std::move(error);
+		m_ready[i] = true;
+	}
+	m_cond.notify_all();
+}
+
+void FileLoader::readPread(std::size_t i, std::string data)
+{
+	const bool input = m_paths[i] == nullptr;
+	const int fd = input ? STDIN_FILENO : ::open(m_paths[i], O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		finish(i, std::string{}, std::strerror(errno));
+		return;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		const int error = errno;
+		if (!input)
+			::close(fd);
+		finish(i, std::string{}, std::strerror(error));
+		return;
+	}
+
+	// pipes and files like those in /proc claim to be empty and are read
+	// until EOF
+	const bool sized = S_ISREG(st.st_mode) && st.st_size > 0;
+	data.resize(sized ? st.st_size : ReadSize);
+	std::size_t offset = 0;
+	int error = 0;
+	for (;;) {
+		if (offset == data.size()) {
+			if (sized)
+				break;
+			data.resize(data.size() * 2);
+		}
+
+		const ssize_t n = input ? ::read(fd, data.data() + offset, data.size() - offset)
+			: ::pread(fd, data.data() + offset, data.size() - offset, offset);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			error = errno;
+		if (n <= 0)
+			break;
+		offset += n;
+	}
+
+	if (!input)
+		::close(fd);
+	data.resize(offset);
+	finish(i, error ? std::string{} : std::move(data), error ? std::strerror(error) : std::string{});
+}
+
+#ifdef HAVE_IO_URING
+
+void FileLoader::readRing()
+{
+	enum Operation : std::uint64_t {
+		Open,
+		Stat,
+		Read,
+	};
+
+	// a file being read, user data of its operations is its slot and the
+	// operation
+	struct Load {
+		std::size_t file = 0;
+		int fd = -1;
+		int error = 0;
+		bool sized = false;
+		// an operation returned EINVAL, the kernel may lack it
+		bool unsupported = false;
+		unsigned pending = 0;
+		std::size_t offset = 0;
+		std::string data;
+		struct statx stat;
+	};
+
+	std::vector <Load> loads(m_window);
+	std::vector <unsigned> free;
+	for (unsigned s = m_window; s-- > 0;)
+		free.push_back(s);
+	unsigned inFlight = 0;
+
+	auto read = [&](unsigned s)
+	{
+		Load &load = loads[s];
+		if (load.offset == load.data.size())
+			load.data.resize(load.data.size() * 2);
+
+		io_uring_sqe *sqe = m_ring->get();
+		sqe->opcode = IORING_OP_READ;
+		sqe->fd = load.fd;
+		sqe->addr = reinterpret_cast<std::uint64_t>(load.data.data() + load.offset);
+		sqe->len = std::min<std::size_t>(load.data.size() - load.offset, 1u << 30);
+		sqe->off = load.offset;
+		sqe->user_data = static_cast<std::uint64_t>(s) << 2 | Read;
+		++inFlight;
+	};
+
+	auto done = [&](unsigned s)
+	{
+		Load &load = loads[s];
+		if (load.fd >= 0)
+			::close(load.fd);
+		load.fd = -1;
+
+		if (load.unsupported) {
+			readPread(load.file, std::move(load.data));
+		} else if (load.error) {
+			finish(load.file, std::string{}, std::strerror(load.error));
+		} else {
+			load.data.resize(load.offset);
+			finish(load.file, std::move(load.data), std::string{});
+		}
+		free.push_back(s);
+	};
+
+	auto completed = [&](std::uint64_t userData, int result)
+	{
+		--inFlight;
+		const unsigned s = userData >> 2;
+		Load &load = loads[s];
+
+		switch (userData & 3) {
+			case Open:
+			case Stat:
+				if (result == -EINVAL)
+					load.unsupported = true;
+				else if (result < 0 && !load.error)
+					load.error = -result;
+				else if ((userData & 3) == Open && result >= 0)
+					load.fd = result;
+
+				if (--load.pending > 0)
+					return;
+				if (load.error || load.unsupported) {
+					done(s);
+					return;
+				}
+
+				load.sized = S_ISREG(load.stat.stx_mode) && load.stat.stx_size > 0;
+				load.data.resize(load.sized ? load.stat.stx_size : ReadSize);
+				read(s);
+				return;
+			default:
+				if (result == -EINTR || result == -EAGAIN) {
+					read(s);
+					return;
+				}
+				if (result < 0)
+					load.error = -result;
+				else
+					load.offset += result;
+
+				if (result <= 0 || (load.sized && load.offset == load.data.size()))
+					done(s);
+				else
+					read(s);
+		}
+	};
+
+	for (;;) {
+		Admitted admitted;
+		{
+			std::unique_lock <std::mutex> lock{m_mutex};
+			if (inFlight == 0)
+				m_cond.wait(lock, [this]{ return m_stop || m_started == m_paths.size() || m_active < m_window; });
+			if (m_stop || (inFlight == 0 && m_started == m_paths.size()))
+				break;
+			admitted = admit();
+		}
+
+		for (auto &[i, buffer] : admitted) {
+			if (!m_paths[i]) {
+				readPread(i, std::move(buffer));
+				continue;
+			}
+
+			const unsigned s = free.back();
+			free.pop_back();
+
+			Load &load = loads[s];
+			load.file = i;
+			load.error = 0;
+			load.unsupported = false;
+			load.pending = 2;
+			load.offset = 0;
+			load.data = std::move(buffer);
+
+			io_uring_sqe *sqe = m_ring->get();
+			sqe->opcode = IORING_OP_OPENAT;
+			sqe->fd = AT_FDCWD;
+			sqe->addr = reinterpret_cast<std::uint64_t>(m_paths[i]);
+			sqe->open_flags = O_RDONLY | O_CLOEXEC;
+			sqe->user_data = static_cast<std::uint64_t>(s) << 2 | Open;
+
+			sqe = m_ring->get();
+			sqe->opcode = IORING_OP_STATX;
+			sqe->fd = AT_FDCWD;
+			sqe->addr = reinterpret_cast<std::uint64_t>(m_paths[i]);
+			sqe->len = STATX_TYPE | STATX_SIZE;
+			sqe->off = reinterpret_cast<std::uint64_t>(&load.stat);
+			sqe->user_data = static_cast<std::uint64_t>(s) << 2 | Stat;
+			inFlight += 2;
+		}
+
+		if (inFlight > 0) {
+			m_ring->submit(1);
+			m_ring->complete(completed);
+		}
+	}
+
+	// the kernel may still write into the loads
+	while (inFlight > 0) {
+		m_ring->submit(1);
+		m_ring->complete([&](std::uint64_t userData, int result) {
+			--inFlight;
+			if ((userData & 3) == Open && result >= 0)
+				::close(result);
+		});
+	}
+	for (const Load &load : loads) {
+		if (load.fd >= 0)
+			::close(load.fd);
+	}
+}
+
+#else
+
+void FileLoader::readRing()
+{
+}
+
+#endif
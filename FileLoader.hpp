@@ -0,0 +1,87 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "ThreadPool.hpp"
+
+// Reads a list of files ahead of the code parsing them. With io_uring the
+// opens, stats and reads of many files are submitted in batches from one
+// thread; where the kernel lacks it a thread pool reads them with pread.
+// At most window files are being read, waiting or held by a caller at any
+// time, their buffers are handed over and taken back by moving them.
+class FileLoader {
+public:
+	enum class Backend {
+		Auto,
+		IoUring,
+		Pread,
+	};
+
+	struct File {
+		std::size_t index = 0;
+		// null for standard input
+		const char *name = nullptr;
+		std::string data;
+		// empty if the file was read
+		std::string error;
+	};
+
+	static constexpr unsigned DefaultWindow = 64;
+
+	// A null path reads standard input.
+	explicit FileLoader(std::vector <const char *> paths, unsigned window = DefaultWindow, Backend backend = Backend::Auto);
+	~FileLoader();
+	FileLoader(const FileLoader &) = delete;
+	FileLoader & operator = (const FileLoader &) = delete;
+
+	// The next file in the order of the paths, false after the last one.
+	// Waits until it is read; any number of threads may call it.
+	bool next(File &file);
+	// Gives back a file taken with next() so that its buffer can be reused
+	// and another file read; files not released stall the loader.
+	void release(File &file);
+
+	// IoUring or Pread, whichever is used
+	Backend backend() const { return m_backend; }
+
+	static const char * name(Backend backend);
+
+private:
+	class Ring;
+
+	using Admitted = std::vector <std::pair <std::size_t, std::string> >;
+
+	// Takes the next files to read while the window allows it, each with a
+	// buffer to read into; called with m_mutex held.
+	Admitted admit();
+	void finish(std::size_t i, std::string data, std::string error);
+	void readRing();
+	void readPread(std::size_t i, std::string data);
+
+	std::vector <const char *> m_paths;
+	std::vector <File> m_files;
+	std::vector <bool> m_ready;
+	std::vector <std::string> m_buffers;
+	const unsigned m_window;
+	Backend m_backend;
+
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+	std::size_t m_next = 0;
+	std::size_t m_started = 0;
+	// files being read, waiting or held
+	unsigned m_active = 0;
+	bool m_stop = false;
+
+	std::unique_ptr <Ring> m_ring;
+	std::thread m_ringThread;
+	// destroyed first, its jobs use the members above
+	std::unique_ptr <ThreadPool> m_pool;
+};
@@ -0,0 +1,197 @@
+#include <algorithm>
+
+#include "Incremental.hpp"
+#include "Traversal.hpp"
+
+namespace Incremental {
+
+namespace {
+
+// The nested chunk of statement (which starts at base) that has statements
+// strictly before and after [editBegin, editEnd], if any.
+Chunk * innerChunk(const Node *statement, std::uint32_t base, std::size_t editBegin, std::size_t editEnd)
+{
+	std::vector <const Chunk *> chunks;
+	nestedChunks(statement, chunks);
+
+	for (const Chunk *c : chunks) {
+		const auto &spans = c->spans();
+		if (base + spans.front().end < editBegin && base + spans.back().begin > editEnd) {
+			// the tree belongs to the ParseResult being edited
+			return const_cast<Chunk *>(c);
+		}
+	}
+
+	return nullptr;
+}
+
+}
+
+void locate(Chunk &root, std::size_t size, std::size_t editBegin, std::size_t editEnd, bool includeNext, Region &region)
+{
+	region = Region{};
+	region.chunk = &root;
+
+	for (;;) {
+		const auto &spans = region.chunk->spans();
+		const std::uint32_t base = region.base;
+
+		// statements touching [editBegin, editEnd]
+		region.first = std::partition_point(spans.begin(), spans.end(),
+			[&](const Span &s) { return base + s.end < editBegin; }) - spans.begin();
+		region.last = std::partition_point(spans.begin(), spans.end(),
+			[&](const Span &s) { return base + s.begin <= editEnd; }) - spans.begin();
+
+		if (region.last - region.first != 1)
+			break;
+
+		const Span &s = spans[region.first];
+		if (base + s.begin >= editBegin || editEnd >= base + s.end)
+			break;
+
+		Chunk *inner = innerChunk(region.chunk->children()[region.first].get(), base + s.begin, editBegin, editEnd);
+		if (!inner)
+			break;
+
+		region.path.push_back(Level{region.chunk, region.first});
+		region.chunk = inner;
+		region.base = base + s.begin;
+	}
+
+	// Only the root chunk can run out of statements on either side, nested
+	// chunks are entered only if there are untouched ones.
+	const auto &spans = region.chunk->spans();
+	const auto &children = region.chunk->children();
+
+	if (region.first == 0) {
+		region.begin = 0;
+	} else if (closed(children[region.first - 1].get())) {
+		region.begin = region.base + spans[region.first - 1].end;
+	} else {
+		--region.first;
+		region.begin = region.base + spans[region.first].begin;
+		region.previous = true;
+	}
+
+	if (region.last == spans.size()) {
+		region.end = size;
+	} else if (!includeNext && startsStatement(children[region.last].get())) {
+		region.end = region.base + spans[region.last].begin;
+	} else {
+		region.end = region.base + spans[region.last].end;
+		++region.last;
+		region.next = true;
+	}
+}
+
+void shiftEnclosing(const Region &region, std::int64_t delta)
+{
+	std::vector <const Chunk *> chunks;
+
+	for (std::size_t i = 0; i < region.path.size(); ++i) {
+		const Level &level = region.path[i];
+		const Chunk *inner = i + 1 < region.path.size() ? region.path[i + 1].chunk : region.chunk;
+
+		level.chunk->resize(level.index, delta);
+		level.chunk->shift(level.index + 1, delta);
+
+		// e.g. the else block after an edited then block
+		chunks.clear();
+		nestedChunks(level.chunk->children()[level.index].get(), chunks);
+		for (const Chunk *c : chunks) {
+			if (c->spans().front().begin > inner->spans().front().begin)
+				const_cast<Chunk *>(c)->shift(0, delta);
+		}
+	}
+}
+
+void nestedChunks(const Node *statement, std::vector <const Chunk *> &chunks)
+{
+	Traversal::walk(statement, [&chunks](const Node *node)
+	{
+		if (node->type() != Node::Type::Chunk)
+			return true;
+		chunks.push_back(static_cast<const Chunk *>(node));
+		return false;
+	});
+}
+
+bool sameSpans(const Chunk *a, const Chunk *b)
+{
+	if (!a || !b)
+		return a == b;
+
+	const auto &sa = a->spans();
+	const auto &sb = b->spans();
+	if (sa.size() != sb.size())
+		return false;
+
+	std::vector <const Chunk *> ca, cb;
+	for (std::size_t i = 0; i < sa.size(); ++i) {
+		if (sa[i].begin != sb[i].begin || sa[i].end != sb[i].end)
+			return false;
+
+		const Node *na = a->children()[i].get();
+		const Node *nb = b->children()[i].get();
+		if (!na || !nb) {
+			if (na != nb)
+				return false;
+			continue;
+		}
+
+		ca.clear();
+		cb.clear();
+		nestedChunks(na, ca);
+		nestedChunks(nb, cb);
+		if (ca.size() != cb.size())
+			return false;
+		for (std::size_t j = 0; j < ca.size(); ++j) {
+			if (!sameSpans(ca[j], cb[j]))
+				return false;
+		}
+	}
+
+	return true;
+}
+
+bool closed(const Node *statement)
+{
+	// 'do end' has no node
+	if (!statement)
+		return true;
+
+	switch (statement->type()) {
+		case Node::Type::Chunk:
+		case Node::Type::Function:
+		case Node::Type::If:
+		case Node::Type::While:
+		case Node::Type::For:
+		case Node::Type::ForEach:
+			return true;
+		default:
+			return false;
+	}
+}
+
+bool startsStatement(const Node *statement)
+{
+	if (!statement)
+		return true;
+
+	switch (statement->type()) {
+		case Node::Type::Chunk:
+		case Node::Type::Function:
+		case Node::Type::If:
+		case Node::Type::While:
+		case Node::Type::Repeat:
+		case Node::Type::For:
+		case Node::Type::ForEach:
+			return true;
+		case Node::Type::Assignment:
+			return static_cast<const Assignment *>(statement)->isLocal();
+		default:
+			return false;
+	}
+}
+
+}
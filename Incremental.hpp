@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "AST.hpp"
+
+// Tree surgery behind Driver::reparse(). An edit is re-parsed in the
+// innermost chunk which has an untouched statement on both sides of it.
+// Only the statements the edit touches are re-parsed, plus a neighbour
+// whenever a changed token could extend into it (or it into them).
+namespace Incremental {
+
+// The statement at index of chunk encloses the region.
+struct Level {
+	Chunk *chunk;
+	std::size_t index;
+};
+
+struct Region {
+	std::vector <Level> path;
+	Chunk *chunk = nullptr;
+	// absolute offset the spans of chunk are relative to
+	std::uint32_t base = 0;
+	// statements [first, last) are replaced
+	std::size_t first = 0;
+	std::size_t last = 0;
+	// absolute byte range [begin, end) of the old source which is re-parsed
+	std::size_t begin = 0;
+	std::size_t end = 0;
+	// the untouched neighbours which had to be re-parsed with the edit
+	bool previous = false;
+	bool next = false;
+};
+
+// Finds the region to re-parse for replacing [editBegin, editEnd) of a
+// source of the given size. With includeNext the statement following the
+// edit is always re-parsed as well.
+void locate(Chunk &root, std::size_t size, std::size_t editBegin, std::size_t editEnd, bool includeNext, Region &region);
+
+// Moves everything behind the edit in the chunks enclosing region.chunk:
+// the following statements and the later chunks of the statements on the
+// path.
+void shiftEnclosing(const Region &region, std::int64_t delta);
+
+// Chunks directly belonging to a statement, i.e. not nested in another
+// statement inside it.
+void nestedChunks(const Node *statement, std::vector <const Chunk *> &chunks);
+
+bool sameSpans(const Chunk *a, const Chunk *b);
+
+// A statement ending with 'end', no following token can continue it.
+bool closed(const Node *statement);
+
+// A statement starting with a keyword which can't continue the statement
+// in front of it, unless that is a return or break.
+bool startsStatement(const Node *statement);
+
+}
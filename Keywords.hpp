@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+#include "Parser.hpp"
+
+// Compile-time perfect hash over the 21 reserved words. The hash only looks
+// at the first and last character and the length of the word, which is
+// enough to give every keyword its own slot in a 64 entry table. The
+// static_assert below guarantees that no two keywords ever collide, so a
+// lookup is one hash, one length check and one memcmp.
+namespace Keywords {
+
+struct Keyword {
+	std::string_view text;
+	yy::Parser::token_type token;
+};
+
+constexpr Keyword List[] = {
+	{"and", yy::Parser::token::AND},
+	{"break", yy::Parser::token::BREAK},
+	{"do", yy::Parser::token::DO},
+	{"else", yy::Parser::token::ELSE},
+	{"elseif", yy::Parser::token::ELSEIF},
+	{"end", yy::Parser::token::END},
+	{"false", yy::Parser::token::FALSE},
+	{"for", yy::Parser::token::FOR},
+	{"function", yy::Parser::token::FUNCTION},
+	{"if", yy::Parser::token::IF},
+	{"in", yy::Parser::token::IN},
+	{"local", yy::Parser::token::LOCAL},
+	{"nil", yy::Parser::token::NIL},
+	{"not", yy::Parser::token::NOT},
+	{"or", yy::Parser::token::OR},
+	{"repeat", yy::Parser::token::REPEAT},
+	{"return", yy::Parser::token::RETURN},
+	{"then", yy::Parser::token::THEN},
+	{"true", yy::Parser::token::TRUE},
+	{"until", yy::Parser::token::UNTIL},
+	{"while", yy::Parser::token::WHILE},
+};
+
+constexpr std::size_t Count = sizeof(List) / sizeof(List[0]);
+constexpr std::size_t MinLength = 2;
+constexpr std::size_t MaxLength = 8;
+constexpr std::size_t TableSize = 64;
+
+constexpr std::size_t hash(const char *s, std::size_t len)
+{
+	return (static_cast<unsigned char>(s[0]) * 3u + static_cast<unsigned char>(s[len - 1]) * 13u + len) & (TableSize - 1);
+}
+
+struct Table {
+	// index into List plus one, 0 means empty slot
+	unsigned char slots[TableSize] = {};
+	bool perfect = true;
+};
+
+constexpr Table buildTable()
+{
+	Table t;
+	for (std::size_t i = 0; i < Count; ++i) {
+		auto &slot = t.slots[hash(List[i].text.data(), List[i].text.size())];
+		if (slot != 0)
+			t.perfect = false;
+		slot = i + 1;
+	}
+	return t;
+}
+
+constexpr Table HashTable = buildTable();
+static_assert(Count == 21, "Lua 5.1 has 21 reserved words");
+static_assert(HashTable.perfect, "keyword hash is not perfect, pick new multipliers");
+
+// Returns the keyword token for [s, s + len) or nullptr if it is a plain identifier.
+inline const Keyword * lookup(const char *s, std::size_t len)
+{
+	if (len < MinLength || len > MaxLength)
+		return nullptr;
+
+	const unsigned char slot = HashTable.slots[hash(s, len)];
+	if (slot == 0)
+		return nullptr;
+
+	const Keyword &kw = List[slot - 1];
+	if (kw.text.size() != len || std::char_traits<char>::compare(kw.text.data(), s, len) != 0)
+		return nullptr;
+	return &kw;
+}
+
+}
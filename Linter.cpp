@@ -0,0 +1,613 @@
+#include <algorithm>
+#include <unordered_set>
+
+#include "Linter.hpp"
+#include "Traversal.hpp"
+
+namespace {
+
+const Chunk * chunkOf(const Node *node)
+{
+	return static_cast<const Chunk *>(node);
+}
+
+bool empty(const Chunk *chunk)
+{
+	return !chunk || chunk->children().empty();
+}
+
+std::string quoted(std::string_view name)
+{
+	std::string result{"'"};
+	result += name;
+	result += '\'';
+	return result;
+}
+
+bool isName(const Node *node)
+{
+	return node->type() == Node::Type::LValue && static_cast<const LValue *>(node)->lvalueType() == LValue::Type::Name;
+}
+
+class UnusedLocal : public LintRule {
+public:
+	UnusedLocal() : LintRule{"unused-local"} { onScopes(); }
+
+	void leaveScope(const LintLocal *begin, const LintLocal *end, LintContext &context) override
+	{
+		for (const LintLocal *l = begin; l != end; ++l) {
+			if (l->reads > 0 || l->name[0] == '_')
+				continue;
+			if (l->kind != LintLocal::Kind::Local && l->kind != LintLocal::Kind::Function)
+				continue;
+			context.report(*this, l->declaration, (l->writes > 0 ? "local " + quoted(l->name) + " is assigned but never read"
+				: "unused local " + quoted(l->name)), l->span);
+		}
+	}
+};
+
+class ShadowedLocal : public LintRule {
+public:
+	ShadowedLocal() : LintRule{"shadowed-local"} { onScopes(); }
+
+	void declared(const LintLocal &local, const LintLocal *shadowed, LintContext &context) override
+	{
+		if (!shadowed || local.name == "_" || local.kind == LintLocal::Kind::Self)
+			return;
+		context.report(*this, local.declaration, quoted(local.name) + " shadows a local of the same name", local.span);
+	}
+};
+
+// Names assigned in a function without being declared local, the most
+// common reason being a forgotten local.
+class GlobalAssignment : public LintRule {
+public:
+	GlobalAssignment() : LintRule{"global-assignment"}
+	{
+		on(Node::Type::Assignment);
+		on(Node::Type::Function);
+	}
+
+	void visit(const Node *node, LintContext &context) override
+	{
+		if (!context.function())
+			return;
+
+		if (node->type() == Node::Type::Function) {
+			auto f = static_cast<const Function *>(node);
+			if (!f->isLocal() && f->nameParts().size() == 1 && f->methodName().empty() && !context.lookup(f->nameParts()[0]))
+				context.report(*this, node, "function " + quoted(f->nameParts()[0]) + " is defined as a global in a function");
+			return;
+		}
+
+		auto a = static_cast<const Assignment *>(node);
+		if (a->isLocal())
+			return;
+		for (const auto &var : a->varList().vars()) {
+			if (var->lvalueType() == LValue::Type::Name && !context.lookup(var->name()))
+				context.report(*this, var.get(), "assignment to global " + quoted(var->name()) + " in a function");
+		}
+	}
+};
+
+class SelfOutsideMethod : public LintRule {
+public:
+	SelfOutsideMethod() : LintRule{"self-outside-method"} { on(Node::Type::LValue); }
+
+	void visit(const Node *node, LintContext &context) override
+	{
+		auto lv = static_cast<const LValue *>(node);
+		if (lv->lvalueType() == LValue::Type::Name && lv->name() == "self" && !context.lookup("self"))
+			context.report(*this, node, "'self' used outside a method");
+	}
+};
+
+// a.f(a, ...) where a:f(...) was meant
+class ExplicitSelf : public LintRule {
+public:
+	ExplicitSelf() : LintRule{"explicit-self"} { on(Node::Type::FunctionCall); }
+
+	void visit(const Node *node, LintContext &context) override
+	{
+		auto call = static_cast<const FunctionCall *>(node);
+		const Node *callee = &call->functionExpr();
+		const auto &args = call->args().exprs();
+		if (args.empty() || callee->type() != Node::Type::LValue || !isName(args[0].get()))
+			return;
+
+		auto dot = static_cast<const LValue *>(callee);
+		if (dot->lvalueType() != LValue::Type::Dot || !isName(dot->tableExpr()))
+			return;
+
+		const std::string &object = static_cast<const LValue *>(dot->tableExpr())->name();
+		if (object == static_cast<const LValue *>(args[0].get())->name())
+			context.report(*this, node, object + '.' + dot->name() + '(' + object + ", ...) can be written as " + object + ':' + dot->name() + "(...)");
+	}
+};
+
+class UnreachableCode : public LintRule {
+public:
+	UnreachableCode() : LintRule{"unreachable-code"} { on(Node::Type::Chunk); }
+
+	void visit(const Node *node, LintContext &context) override
+	{
+		auto chunk = static_cast<const Chunk *>(node);
+		const auto &children = chunk->children();
+		for (std::size_t i = 0; i + 1 < children.size(); ++i) {
+			if (!children[i])
+				continue;
+			const Node::Type t = children[i]->type();
+			if (t == Node::Type::Return || t == Node::Type::Break) {
+				context.report(*this, children[i + 1].get(), std::string{"unreachable code after "} + (t == Node::Type::Return ? "return" : "break"),
+					context.child(chunk, i + 1));
+				return;
+			}
+		}
+	}
+};
+
+class EmptyBlock : public LintRule {
+public:
+	EmptyBlock() : LintRule{"empty-block"}
+	{
+		on(Node::Type::If);
+		on(Node::Type::While);
+		on(Node::Type::For);
+		on(Node::Type::ForEach);
+	}
+
+	void visit(const Node *node, LintContext &context) override
+	{
+		switch (node->type()) {
+			case Node::Type::If: {
+				auto i = static_cast<const If *>(node);
+				if (empty(chunkOf(i->chunk())))
+					context.report(*this, node, "empty if branch");
+				if (i->elseChunk() && empty(i->elseChunk()))
+					context.report(*this, node, "empty else branch");
+				break;
+			}
+			case Node::Type::While:
+				if (empty(static_cast<const While *>(node)->chunk()))
+					context.report(*this, node, "empty while loop");
+				break;
+			case Node::Type::For:
+				if (empty(static_cast<const For *>(node)->chunk()))
+					context.report(*this, node, "empty for loop");
+				break;
+			case Node::Type::ForEach:
+				if (empty(static_cast<const ForEach *>(node)->chunk()))
+					context.report(*this, node, "empty for loop");
+				break;
+			default:
+				break;
+		}
+	}
+};
+
+class SelfAssignment : public LintRule {
+public:
+	SelfAssignment() : LintRule{"self-assignment"} { on(Node::Type::Assignment); }
+
+	void visit(const Node *node, LintContext &context) override
+	{
+		// local x = x is the usual way to cache a global
+		auto a = static_cast<const Assignment *>(node);
+		if (a->isLocal())
+			return;
+
+		const auto &vars = a->varList().vars();
+		const auto &exprs = a->exprList().exprs();
+		for (std::size_t i = 0; i < vars.size() && i < exprs.size(); ++i) {
+			if (vars[i]->lvalueType() == LValue::Type::Name && isName(exprs[i].get())
+				&& vars[i]->name() == static_cast<const LValue *>(exprs[i].get())->name())
+				context.report(*this, vars[i].get(), quoted(vars[i]->name()) + " is assigned to itself");
+		}
+	}
+};
+
+class DuplicateField : public LintRule {
+public:
+	DuplicateField() : LintRule{"duplicate-field"} { on(Node::Type::TableCtor); }
+
+	void visit(const Node *node, LintContext &context) override
+	{
+		const auto &fields = static_cast<const TableCtor *>(node)->fields();
+		if (fields.size() < 2)
+			return;
+
+		m_seen.clear();
+		for (const auto &field : fields) {
+			if (field->fieldType() == Field::Type::Literal && !m_seen.insert(field->fieldName()).second)
+				context.report(*this, field.get(), "field " + quoted(field->fieldName()) + " is set twice in a table constructor");
+		}
+	}
+
+private:
+	std::unordered_set <std::string_view> m_seen;
+};
+
+struct RuleFactory {
+	const char *name;
+	std::unique_ptr <LintRule> (*create)();
+};
+
+template <typename Rule>
+std::unique_ptr <LintRule> create()
+{
+	return std::make_unique<Rule>();
+}
+
+const RuleFactory Rules[] = {
+	{"unused-local", create<UnusedLocal>},
+	{"shadowed-local", create<ShadowedLocal>},
+	{"global-assignment", create<GlobalAssignment>},
+	{"self-outside-method", create<SelfOutsideMethod>},
+	{"explicit-self", create<ExplicitSelf>},
+	{"unreachable-code", create<UnreachableCode>},
+	{"empty-block", create<EmptyBlock>},
+	{"self-assignment", create<SelfAssignment>},
+	{"duplicate-field", create<DuplicateField>},
+};
+
+}
+
+const LintLocal * LintContext::lookup(std::string_view name) const
+{
+	for (auto l = m_locals.rbegin(); l != m_locals.rend(); ++l) {
+		if (l->name == name)
+			return &*l;
+	}
+	return nullptr;
+}
+
+LintLocal * LintContext::find(std::string_view name)
+{
+	return const_cast<LintLocal *>(lookup(name));
+}
+
+Span LintContext::child(const Chunk *chunk, std::size_t i) const
+{
+	const Span s = chunk->spans()[i];
+	return Span{m_base + s.begin, m_base + s.end};
+}
+
+void LintContext::report(const LintRule &rule, const Node *node, std::string message, Span span)
+{
+	m_diagnostics->push_back(LintDiagnostic{rule.name(), std::move(message), span, node, m_loops.empty() ? nullptr : m_loops.back(),
+		static_cast<unsigned>(m_loops.size())});
+}
+
+void Linter::add(std::unique_ptr <LintRule> rule)
+{
+	m_rules.push_back(std::move(rule));
+}
+
+void Linter::addDefaultRules()
+{
+	for (const auto &r : Rules)
+		add(r.create());
+}
+
+bool Linter::addRule(std::string_view name)
+{
+	for (const auto &r : Rules) {
+		if (name == r.name) {
+			add(r.create());
+			return true;
+		}
+	}
+	return false;
+}
+
+std::vector <LintDiagnostic> Linter::run(const ParseResult &result)
+{
+	std::vector <LintDiagnostic> diagnostics;
+
+	suppress(result.source);
+	for (auto &rules : m_dispatch)
+		rules.clear();
+	m_scopeRules.clear();
+	for (std::size_t i = 0; i < m_rules.size(); ++i) {
+		if (m_disabled[i])
+			continue;
+		for (Node::Type t : m_rules[i]->types())
+			m_dispatch[static_cast<std::size_t>(t)].push_back(m_rules[i].get());
+		if (m_rules[i]->scopes())
+			m_scopeRules.push_back(m_rules[i].get());
+	}
+
+	m_context.m_locals.clear();
+	m_context.m_functions.clear();
+	m_context.m_loops.clear();
+	m_context.m_condition = nullptr;
+	m_context.m_statement = Span{};
+	m_context.m_diagnostics = &diagnostics;
+
+	if (result.chunk())
+		block(result.chunk(), 0);
+
+	m_context.m_diagnostics = nullptr;
+	std::stable_sort(diagnostics.begin(), diagnostics.end(), [](const LintDiagnostic &a, const LintDiagnostic &b)
+	{
+		return a.span.begin < b.span.begin;
+	});
+	return diagnostics;
+}
+
+// Looks for "-- lint-disable" and "-- lint-disable: a, b" comments.
+void Linter::suppress(std::string_view source)
+{
+	static constexpr std::string_view Marker = "lint-disable";
+	m_disabled.assign(m_rules.size(), false);
+
+	for (std::size_t at = source.find(Marker); at != std::string_view::npos; at = source.find(Marker, at + 1)) {
+		std::size_t dash = at;
+		while (dash > 0 && (source[dash - 1] == ' ' || source[dash - 1] == '\t'))
+			--dash;
+		if (dash < 2 || source.substr(dash - 2, 2) != "--")
+			continue;
+
+		std::size_t end = source.find('\n', at);
+		if (end == std::string_view::npos)
+			end = source.size();
+		std::string_view rest = source.substr(at + Marker.size(), end - at - Marker.size());
+		while (!rest.empty() && (rest.back() == ' ' || rest.back() == '\t' || rest.back() == '\r'))
+			rest.remove_suffix(1);
+
+		if (rest.empty()) {
+			m_disabled.assign(m_rules.size(), true);
+			return;
+		}
+		if (rest[0] != ':')
+			continue;
+
+		rest.remove_prefix(1);
+		while (!rest.empty()) {
+			const std::size_t n = std::min(rest.find(','), rest.size());
+			std::string_view name = rest.substr(0, n);
+			while (!name.empty() && name.front() == ' ')
+				name.remove_prefix(1);
+			while (!name.empty() && name.back() == ' ')
+				name.remove_suffix(1);
+
+			for (std::size_t i = 0; i < m_rules.size(); ++i) {
+				if (name == m_rules[i]->name())
+					m_disabled[i] = true;
+			}
+			rest.remove_prefix(std::min(n + 1, rest.size()));
+		}
+	}
+}
+
+void Linter::dispatch(const Node *node)
+{
+	for (LintRule *rule : m_dispatch[static_cast<std::size_t>(node->type())])
+		rule->visit(node, m_context);
+}
+
+void Linter::declare(std::string_view name, LintLocal::Kind kind, const Node *declaration)
+{
+	auto &locals = m_context.m_locals;
+	const LintLocal *visible = m_context.lookup(name);
+	const std::size_t shadowed = visible ? visible - locals.data() : locals.size();
+
+	locals.push_back(LintLocal{name, kind, declaration, m_context.m_statement});
+	for (LintRule *rule : m_scopeRules)
+		rule->declared(locals.back(), shadowed < locals.size() - 1 ? &locals[shadowed] : nullptr, m_context);
+}
+
+void Linter::closeScope(std::size_t mark)
+{
+	auto &locals = m_context.m_locals;
+	if (mark == locals.size())
+		return;
+	for (LintRule *rule : m_scopeRules)
+		rule->leaveScope(locals.data() + mark, locals.data() + locals.size(), m_context);
+	locals.resize(mark);
+}
+
+void Linter::read(const LValue *name)
+{
+	if (LintLocal *l = m_context.find(name->name()))
+		++l->reads;
+}
+
+void Linter::write(std::string_view name)
+{
+	if (LintLocal *l = m_context.find(name))
+		++l->writes;
+}
+
+void Linter::function(const Function *node)
+{
+	m_context.m_functions.push_back(node);
+	// the loops around it run its creation, not its body
+	std::vector <const Node *> loops;
+	std::swap(loops, m_context.m_loops);
+	const Node *condition = m_context.m_condition;
+	m_context.m_condition = nullptr;
+	const std::size_t mark = openScope();
+
+	if (!node->methodName().empty())
+		declare("self", LintLocal::Kind::Self, node);
+	for (const auto &param : node->params().names())
+		declare(param, LintLocal::Kind::Parameter, node);
+	// the body is relative to the statement the function is in
+	if (node->hasChunk())
+		block(&node->chunk(), m_context.m_statement.begin);
+
+	closeScope(mark);
+	m_context.m_condition = condition;
+	std::swap(loops, m_context.m_loops);
+	m_context.m_functions.pop_back();
+}
+
+void Linter::expression(const Node *e)
+{
+	Traversal::walk(e, [this](const Node *node)
+	{
+		dispatch(node);
+		switch (node->type()) {
+			case Node::Type::Function:
+				function(static_cast<const Function *>(node));
+				return false;
+			case Node::Type::LValue:
+				if (isName(node))
+					read(static_cast<const LValue *>(node));
+				return true;
+			default:
+				return true;
+		}
+	});
+}
+
+void Linter::block(const Chunk *chunk, std::uint32_t base)
+{
+	const std::size_t mark = openScope();
+	statements(chunk, base);
+	closeScope(mark);
+}
+
+void Linter::statements(const Chunk *chunk, std::uint32_t base)
+{
+	const std::uint32_t outerBase = m_context.m_base;
+	const Span outer = m_context.m_statement;
+	m_context.m_base = base;
+	dispatch(chunk);
+
+	const auto &children = chunk->children();
+	const auto &spans = chunk->spans();
+	for (std::size_t i = 0; i < children.size(); ++i) {
+		if (!children[i])
+			continue;
+		m_context.m_statement = Span{base + spans[i].begin, base + spans[i].end};
+		statement(children[i].get());
+	}
+
+	m_context.m_statement = outer;
+	m_context.m_base = outerBase;
+}
+
+void Linter::assignment(const Assignment *a)
+{
+	expression(&a->exprList());
+
+	const auto &vars = a->varList().vars();
+	if (a->isLocal()) {
+		for (const auto &var : vars)
+			declare(var->name(), LintLocal::Kind::Local, a);
+		return;
+	}
+
+	dispatch(&a->varList());
+	for (const auto &var : vars) {
+		dispatch(var.get());
+		if (var->lvalueType() == LValue::Type::Name) {
+			write(var->name());
+		} else {
+			if (var->tableExpr())
+				expression(var->tableExpr());
+			if (var->keyExpr())
+				expression(var->keyExpr());
+		}
+	}
+}
+
+void Linter::statement(const Node *s)
+{
+	const std::uint32_t offset = m_context.m_statement.begin;
+	if (s->type() != Node::Type::Chunk)
+		dispatch(s);
+
+	switch (s->type()) {
+		case Node::Type::Assignment:
+			assignment(static_cast<const Assignment *>(s));
+			break;
+		case Node::Type::Function: {
+			auto fn = static_cast<const Function *>(s);
+			const auto &parts = fn->nameParts();
+			if (fn->isLocal() && !parts.empty()) {
+				// visible in its own body
+				declare(parts[0], LintLocal::Kind::Function, fn);
+			} else if (parts.size() == 1 && fn->methodName().empty()) {
+				write(parts[0]);
+			} else if (!parts.empty()) {
+				if (LintLocal *l = m_context.find(parts[0]))
+					++l->reads;
+			}
+			function(fn);
+			break;
+		}
+		case Node::Type::Chunk:
+			block(static_cast<const Chunk *>(s), offset);
+			break;
+		case Node::Type::If:
+			for (auto i = static_cast<const If *>(s); i; i = i->nextIf()) {
+				if (i != s)
+					dispatch(i);
+				expression(&i->condition());
+				if (i->chunk())
+					block(chunkOf(i->chunk()), offset);
+				if (i->elseChunk())
+					block(i->elseChunk(), offset);
+			}
+			break;
+		case Node::Type::While: {
+			auto w = static_cast<const While *>(s);
+			m_context.m_loops.push_back(s);
+			m_context.m_condition = s;
+			expression(&w->condition());
+			m_context.m_condition = nullptr;
+			if (w->chunk())
+				block(w->chunk(), offset);
+			m_context.m_loops.pop_back();
+			break;
+		}
+		case Node::Type::Repeat: {
+			// the condition sees the locals of the body
+			auto r = static_cast<const Repeat *>(s);
+			m_context.m_loops.push_back(s);
+			const std::size_t mark = openScope();
+			if (r->chunk())
+				statements(r->chunk(), offset);
+			m_context.m_condition = s;
+			expression(&r->condition());
+			m_context.m_condition = nullptr;
+			closeScope(mark);
+			m_context.m_loops.pop_back();
+			break;
+		}
+		case Node::Type::For: {
+			auto loop = static_cast<const For *>(s);
+			expression(&loop->start());
+			expression(&loop->limit());
+			if (loop->step())
+				expression(loop->step());
+			m_context.m_loops.push_back(s);
+			const std::size_t mark = openScope();
+			declare(loop->iterator(), LintLocal::Kind::Loop, s);
+			if (loop->chunk())
+				block(loop->chunk(), offset);
+			closeScope(mark);
+			m_context.m_loops.pop_back();
+			break;
+		}
+		case Node::Type::ForEach: {
+			auto loop = static_cast<const ForEach *>(s);
+			expression(&loop->exprs());
+			m_context.m_loops.push_back(s);
+			const std::size_t mark = openScope();
+			for (const auto &name : loop->iterators().names())
+				declare(name, LintLocal::Kind::Loop, s);
+			if (loop->chunk())
+				block(loop->chunk(), offset);
+			closeScope(mark);
+			m_context.m_loops.pop_back();
+			break;
+		}
+		default:
+			Traversal::forEachChild(s, [this](const Node *n) { expression(n); });
+			break;
+	}
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "AST.hpp"
+#include "ParseResult.hpp"
+
+class LintContext;
+
+struct LintLocal {
+	enum class Kind : std::uint8_t {
+		Local,
+		Function,
+		Parameter,
+		Loop,
+		// self of a method
+		Self,
+	};
+
+	std::string_view name;
+	Kind kind;
+	// the statement, function or loop declaring it
+	const Node *declaration;
+	// absolute byte range of the declaring statement
+	Span span;
+	unsigned reads = 0;
+	unsigned writes = 0;
+};
+
+struct LintDiagnostic {
+	const char *rule;
+	std::string message;
+	// absolute byte range of the statement concerned
+	Span span;
+	const Node *node;
+	// innermost loop around it in its function, null outside loops
+	const Node *loop;
+	unsigned loopDepth;
+};
+
+// A check run during the single walk of a Linter. The constructor states
+// what the rule wants: visit() is called for the node types given to on(),
+// declared() and leaveScope() only if onScopes() was called. Rules only
+// pay for the nodes they asked for.
+class LintRule {
+public:
+	explicit LintRule(const char *name) : m_name{name} {}
+	virtual ~LintRule() = default;
+
+	const char * name() const { return m_name; }
+	const std::vector <Node::Type> & types() const { return m_types; }
+	bool scopes() const { return m_scopes; }
+
+	virtual void visit(const Node *node, LintContext &context) {}
+	// shadowed is the local of the same name visible before, if any
+	virtual void declared(const LintLocal &local, const LintLocal *shadowed, LintContext &context) {}
+	// the locals of the scope being closed, in order of declaration
+	virtual void leaveScope(const LintLocal *begin, const LintLocal *end, LintContext &context) {}
+
+protected:
+	void on(Node::Type type) { m_types.push_back(type); }
+	void onScopes() { m_scopes = true; }
+
+private:
+	const char *m_name;
+	std::vector <Node::Type> m_types;
+	bool m_scopes = false;
+};
+
+// What the walk knows at the node a rule is called for.
+class LintContext {
+public:
+	// the innermost local called name in scope, null for a global
+	const LintLocal * lookup(std::string_view name) const;
+
+	// null in the main chunk
+	const Function * function() const { return m_functions.empty() ? nullptr : m_functions.back(); }
+	// Loops of the innermost function running the node on every iteration,
+	// the innermost last; for bounds and iterated expressions are outside.
+	const std::vector <const Node *> & loops() const { return m_loops; }
+	// the while or repeat loop whose condition is being walked, null elsewhere
+	const Node * condition() const { return m_condition; }
+	// absolute byte range of the innermost statement
+	Span statement() const { return m_statement; }
+	// absolute byte range of child i of chunk, for a chunk being visited
+	Span child(const Chunk *chunk, std::size_t i) const;
+
+	void report(const LintRule &rule, const Node *node, std::string message) { report(rule, node, std::move(message), m_statement); }
+	void report(const LintRule &rule, const Node *node, std::string message, Span span);
+
+private:
+	friend class Linter;
+
+	LintLocal * find(std::string_view name);
+
+	std::vector <LintLocal> m_locals;
+	std::vector <const Function *> m_functions;
+	std::vector <const Node *> m_loops;
+	const Node *m_condition = nullptr;
+	Span m_statement;
+	// what the spans of the innermost chunk are relative to
+	std::uint32_t m_base = 0;
+	std::vector <LintDiagnostic> *m_diagnostics = nullptr;
+};
+
+// Runs any number of rules in one walk of a tree: every node is dispatched
+// to the rules registered for its type, scopes are tracked once for all of
+// them. Blocks recurse, expressions are walked iteratively.
+//
+// A comment "-- lint-disable: rule, ..." anywhere in a file turns the rules
+// named off for the file, a bare "-- lint-disable" all of them.
+class Linter {
+public:
+	Linter() = default;
+	Linter(const Linter &) = delete;
+	Linter & operator = (const Linter &) = delete;
+
+	void add(std::unique_ptr <LintRule> rule);
+	// unused-local, shadowed-local, global-assignment, self-outside-method,
+	// explicit-self, unreachable-code, empty-block, self-assignment and
+	// duplicate-field
+	void addDefaultRules();
+	// false if there is no such rule
+	bool addRule(std::string_view name);
+
+	const std::vector <std::unique_ptr <LintRule> > & rules() const { return m_rules; }
+
+	// Diagnostics of result in source order. Suppressions are read from
+	// result.source.
+	std::vector <LintDiagnostic> run(const ParseResult &result);
+
+private:
+	void dispatch(const Node *node);
+	void declare(std::string_view name, LintLocal::Kind kind, const Node *declaration);
+	std::size_t openScope() const { return m_context.m_locals.size(); }
+	void closeScope(std::size_t mark);
+
+	void read(const LValue *name);
+	void write(std::string_view name);
+	void function(const Function *node);
+	void expression(const Node *e);
+	void block(const Chunk *chunk, std::uint32_t base);
+	void statements(const Chunk *chunk, std::uint32_t base);
+	void statement(const Node *s);
+	void assignment(const Assignment *a);
+
+	void suppress(std::string_view source);
+
+	std::vector <std::unique_ptr <LintRule> > m_rules;
+	// rules by the node types they visit, for the current file
+	std::array <std::vector <LintRule *>, static_cast<std::size_t>(Node::Type::_last)> m_dispatch;
+	std::vector <LintRule *> m_scopeRules;
+	std::vector <bool> m_disabled;
+	LintContext m_context;
+};
@@ -0,0 +1,808 @@
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <numeric>
+
+#include "Keywords.hpp"
+#include "LuaEmitter.hpp"
+
+namespace {
+
+constexpr int Atom = 10;
+
+// How tightly an expression binds, after the precedence lines of grammar.yy.
+int precedence(const Node *node)
+{
+	if (node->type() == Node::Type::UnOp)
+		return static_cast<const UnOp *>(node)->unOpType() == UnOp::Type::Negate ? 8 : 7;
+	if (node->type() != Node::Type::BinOp)
+		return Atom;
+
+	switch (static_cast<const BinOp *>(node)->binOpType()) {
+		case BinOp::Type::Or:
+			return 1;
+		case BinOp::Type::And:
+			return 2;
+		case BinOp::Type::Concat:
+			return 4;
+		case BinOp::Type::Plus:
+		case BinOp::Type::Minus:
+			return 5;
+		case BinOp::Type::Times:
+		case BinOp::Type::Divide:
+		case BinOp::Type::Modulo:
+			return 6;
+		case BinOp::Type::Exponentation:
+			return 9;
+		default:
+			return 3;
+	}
+}
+
+bool isIdent(char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+// A call or ... in parentheses, which the node writes itself.
+bool isTruncated(const Node *node)
+{
+	switch (node->type()) {
+		case Node::Type::FunctionCall:
+		case Node::Type::MethodCall:
+			return static_cast<const FunctionCall *>(node)->isTruncated();
+		case Node::Type::Ellipsis:
+			return static_cast<const Ellipsis *>(node)->isTruncated();
+		default:
+			return false;
+	}
+}
+
+// Whether node can be called or indexed without parentheses around it.
+bool isPrefix(const Node *node)
+{
+	switch (node->type()) {
+		case Node::Type::LValue:
+		case Node::Type::FunctionCall:
+		case Node::Type::MethodCall:
+			return true;
+		default:
+			return isTruncated(node);
+	}
+}
+
+// A statement starting with '(' would continue a call at the end of the one
+// in front of it.
+bool startsWithParen(const Node *statement)
+{
+	const Node *node = statement;
+	if (!node)
+		return false;
+
+	if (node->type() == Node::Type::Assignment) {
+		auto a = static_cast<const Assignment *>(node);
+		if (a->isLocal())
+			return false;
+		node = a->varList().vars().front().get();
+	} else if (node->type() != Node::Type::FunctionCall && node->type() != Node::Type::MethodCall) {
+		return false;
+	}
+
+	for (;;) {
+		switch (node->type()) {
+			case Node::Type::FunctionCall:
+			case Node::Type::MethodCall:
+				if (isTruncated(node))
+					return true;
+				node = &static_cast<const FunctionCall *>(node)->functionExpr();
+				break;
+			case Node::Type::LValue: {
+				auto lv = static_cast<const LValue *>(node);
+				if (lv->lvalueType() == LValue::Type::Name)
+					return false;
+				node = lv->tableExpr();
+				break;
+			}
+			default:
+				return true;
+		}
+	}
+}
+
+// The k-th shortest identifier: a to _, then aa, ba and so on.
+std::string candidate(std::size_t k)
+{
+	static const char First[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_";
+	static const char Rest[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_0123456789";
+	constexpr std::size_t FirstCount = sizeof(First) - 1;
+	constexpr std::size_t RestCount = sizeof(Rest) - 1;
+
+	std::string name{First[k % FirstCount]};
+	for (k /= FirstCount; k > 0; k /= RestCount) {
+		--k;
+		name.push_back(Rest[k % RestCount]);
+	}
+	return name;
+}
+
+}
+
+LuaEmitter::LuaEmitter(OutputBuffer &out, Style style, bool rename)
+	: Emitter{out}, m_style{style}, m_rename{rename && style == Style::Minified}
+{
+}
+
+void LuaEmitter::prepare(const Node *root)
+{
+	m_root = root;
+
+	// The first pass resolves every name without writing anything. It finds
+	// the globals, which no local may be renamed to, and counts the uses of
+	// every local so the busiest ones get the shortest names.
+	if (m_rename) {
+		m_globals.clear();
+		m_scopeTree.clear();
+		m_declarations.clear();
+		m_collecting = true;
+		run(root, 0);
+		m_collecting = false;
+		nameSlots();
+	}
+
+	m_locals.clear();
+	m_scopes.clear();
+	m_bindings.clear();
+	m_nextDeclaration = 0;
+	m_started = false;
+	m_last = ' ';
+	m_lastNumber = false;
+}
+
+void LuaEmitter::action(int code, const Node *, std::string_view text, int indent)
+{
+	switch (code) {
+		case Token:
+			put(text, false);
+			break;
+		case Newline:
+			if (m_style == Style::Pretty && m_started && !m_collecting) {
+				m_out.put('\n');
+				m_out.indent(indent);
+				m_last = '\n';
+				m_lastNumber = false;
+			}
+			break;
+		case OpenScope:
+			if (!m_rename)
+				break;
+			if (m_collecting)
+				m_scopeTree.push_back(ScopeInfo{m_scopes.empty() ? None : m_scopes.back().id});
+			m_scopes.push_back(Scope{m_locals.size(), m_scopeTree.size() - 1});
+			break;
+		case CloseScope:
+			if (!m_rename)
+				break;
+			while (m_locals.size() > m_scopes.back().firstLocal) {
+				const Local &local = m_locals.back();
+				if (local.active)
+					m_bindings[local.name].pop_back();
+				m_locals.pop_back();
+			}
+			m_scopes.pop_back();
+			break;
+		case Activate:
+			if (!m_rename)
+				break;
+			for (std::size_t i = m_locals.size() - indent; i < m_locals.size(); ++i) {
+				m_locals[i].active = true;
+				m_bindings[m_locals[i].name].push_back(i);
+			}
+			break;
+	}
+}
+
+void LuaEmitter::put(std::string_view s, bool number)
+{
+	if (m_collecting || s.empty())
+		return;
+
+	// keep tokens apart which would otherwise run into one, or into a comment
+	const char first = s.front();
+	if ((isIdent(m_last) && isIdent(first)) || (m_lastNumber && (isIdent(first) || first == '.'))
+			|| (m_last == '.' && first == '.') || (m_last == '-' && first == '-'))
+		m_out.put(' ');
+
+	m_out.write(s);
+	m_last = s.back();
+	m_lastNumber = number;
+	m_started = true;
+}
+
+void LuaEmitter::space()
+{
+	if (m_style == Style::Pretty)
+		token(" ");
+}
+
+void LuaEmitter::separator(std::string_view s)
+{
+	if (m_style == Style::Pretty && s != ",")
+		token(" ");
+	token(s);
+	space();
+}
+
+std::string_view LuaEmitter::declare(std::string_view name)
+{
+	if (!m_rename)
+		return name;
+
+	if (m_collecting) {
+		const std::size_t scope = m_scopes.back().id;
+		std::size_t index = m_scopeTree[scope].size;
+
+		// Nothing after a local can refer to one of the same name and scope
+		// it hides, so it may as well take over its slot.
+		auto binding = m_bindings.find(name);
+		if (binding != m_bindings.end() && !binding->second.empty() && binding->second.back() >= m_scopes.back().firstLocal
+				&& m_locals[binding->second.back()].declaration != None)
+			index = m_declarations[m_locals[binding->second.back()].declaration].index;
+		else
+			++m_scopeTree[scope].size;
+
+		m_declarations.push_back(Declaration{scope, index});
+		m_locals.push_back(Local{name, name, m_declarations.size() - 1, false});
+		return name;
+	}
+
+	// declarations come in the same order in both passes
+	const std::size_t declaration = m_nextDeclaration++;
+	const std::string_view renamed = m_slotNames[m_declarations[declaration].slot];
+	m_locals.push_back(Local{name, renamed, declaration, false});
+	return renamed;
+}
+
+std::string_view LuaEmitter::declareFixed(std::string_view name)
+{
+	if (m_rename)
+		m_locals.push_back(Local{name, name, None, false});
+	return name;
+}
+
+std::string_view LuaEmitter::resolve(std::string_view name)
+{
+	if (!m_rename)
+		return name;
+
+	auto binding = m_bindings.find(name);
+	if (binding != m_bindings.end() && !binding->second.empty()) {
+		const Local &local = m_locals[binding->second.back()];
+		if (m_collecting && local.declaration != None)
+			++m_declarations[local.declaration].uses;
+		return local.renamed;
+	}
+
+	if (m_collecting)
+		m_globals.insert(name);
+	return name;
+}
+
+// The locals of a scope take the slots after those of all the scopes around
+// it, so two locals sharing a slot are never visible at the same time and
+// every slot can have a name of its own. Sibling scopes share slots, the
+// shortest names which are neither keywords nor globals go to the slots
+// used most.
+void LuaEmitter::nameSlots()
+{
+	for (auto &scope : m_scopeTree) {
+		if (scope.parent != None)
+			scope.base = m_scopeTree[scope.parent].base + m_scopeTree[scope.parent].size;
+	}
+
+	std::vector <std::size_t> uses;
+	for (auto &d : m_declarations) {
+		d.slot = m_scopeTree[d.scope].base + d.index;
+		if (d.slot >= uses.size())
+			uses.resize(d.slot + 1, 0);
+		uses[d.slot] += d.uses;
+	}
+
+	std::vector <std::size_t> order(uses.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&uses](std::size_t a, std::size_t b)
+	{
+		return uses[a] > uses[b];
+	});
+
+	m_slotNames.resize(uses.size());
+	std::size_t k = 0;
+	for (std::size_t slot : order) {
+		for (;; ++k) {
+			if (k == m_candidates.size())
+				m_candidates.push_back(candidate(k));
+			const std::string &c = m_candidates[k];
+			if (!Keywords::lookup(c.data(), c.size()) && c != "self" && m_globals.count(c) == 0)
+				break;
+		}
+		m_slotNames[slot] = m_candidates[k++];
+	}
+}
+
+void LuaEmitter::block(const Node *chunk, int indent)
+{
+	if (!chunk)
+		return;
+
+	const auto &children = static_cast<const Chunk *>(chunk)->children();
+	for (std::size_t i = 0; i < children.size(); ++i) {
+		newline(indent);
+		if (i > 0 && startsWithParen(children[i].get()))
+			token(";");
+		schedule(children[i].get(), indent);
+
+		// grammar.yy lets statements follow a return, which would take the
+		// first of them for its value
+		if (children[i] && children[i]->type() == Node::Type::Return && i + 1 < children.size())
+			token(";");
+	}
+}
+
+void LuaEmitter::expression(const Node *node, int indent, bool parens)
+{
+	if (parens)
+		token("(");
+	schedule(node, indent);
+	if (parens)
+		token(")");
+}
+
+void LuaEmitter::prefix(const Node *node, int indent)
+{
+	expression(node, indent, !isPrefix(node));
+}
+
+// An operand of an operator binding with level. tie tells whether an operand
+// binding just as tightly needs parentheses, leading whether it comes first.
+void LuaEmitter::operand(const Node *node, int indent, int level, bool tie, bool leading)
+{
+	bool parens;
+	if (node->type() == Node::Type::UnOp) {
+		// '#' has no precedence in grammar.yy, it takes in any operator
+		// following its operand. A unary operator after another operator
+		// can't be misread.
+		if (static_cast<const UnOp *>(node)->unOpType() == UnOp::Type::Length)
+			parens = true;
+		else
+			parens = leading && precedence(node) < level;
+	} else {
+		const int p = precedence(node);
+		parens = p < level || (p == level && tie);
+	}
+	expression(node, indent, parens);
+}
+
+void LuaEmitter::exprs(const ExprList &list, int indent)
+{
+	bool first = true;
+	for (const auto &e : list.exprs()) {
+		if (!first)
+			separator(",");
+		expression(e.get(), indent);
+		first = false;
+	}
+}
+
+void LuaEmitter::args(const ExprList &list, int indent)
+{
+	const auto &e = list.exprs();
+	if (m_style == Style::Minified && e.size() == 1) {
+		const Node *arg = e.front().get();
+		const bool string = arg->isValue() && static_cast<const Value *>(arg)->valueType() == ValueType::String;
+		if (string || arg->type() == Node::Type::TableCtor) {
+			schedule(arg, indent);
+			return;
+		}
+	}
+
+	token("(");
+	exprs(list, indent);
+	token(")");
+}
+
+void LuaEmitter::function(const Function *f, int indent)
+{
+	if (f->isLocal()) {
+		token("local");
+		space();
+		token("function");
+		space();
+		token(declare(f->nameParts().front()));
+		activate(1);
+	} else {
+		token("function");
+		const auto &parts = f->nameParts();
+		if (!parts.empty()) {
+			space();
+			token(resolve(parts.front()));
+			for (auto part = parts.begin() + 1; part != parts.end(); ++part) {
+				token(".");
+				token(*part);
+			}
+			if (!f->methodName().empty()) {
+				token(":");
+				token(f->methodName());
+			}
+		}
+	}
+
+	openScope();
+	int count = 0;
+	if (!f->methodName().empty()) {
+		declareFixed("self");
+		++count;
+	}
+
+	token("(");
+	const ParamList &params = f->params();
+	for (const auto &name : params.names()) {
+		if (&name != &params.names().front())
+			separator(",");
+		token(declare(name));
+		++count;
+	}
+	if (params.hasEllipsis()) {
+		if (!params.names().empty())
+			separator(",");
+		token("...");
+	}
+	token(")");
+	activate(count);
+
+	block(f->hasChunk() ? &f->chunk() : nullptr, indent + 1);
+	closeScope();
+	newline(indent);
+	token("end");
+}
+
+void LuaEmitter::number(const Value *v)
+{
+	char buf[400];
+	std::size_t length;
+
+	if (v->valueType() == ValueType::Integer) {
+		length = std::to_chars(buf, buf + sizeof(buf), static_cast<const IntValue *>(v)->value()).ptr - buf;
+		put(std::string_view{buf, length}, true);
+		return;
+	}
+
+	// There are no exponents, every real is written out in full. The
+	// scanners only make an infinity of more than 309 digits.
+	const double d = static_cast<const RealValue *>(v)->value();
+	if (std::isinf(d)) {
+		length = 310;
+		std::fill(buf, buf + length, '9');
+	} else {
+		length = std::to_chars(buf, buf + sizeof(buf), d, std::chars_format::fixed).ptr - buf;
+	}
+
+	std::string_view s{buf, length};
+	if (s.find('.') == std::string_view::npos) {
+		buf[length++] = '.';
+		if (m_style == Style::Pretty)
+			buf[length++] = '0';
+		s = std::string_view{buf, length};
+	} else if (m_style == Style::Minified && s.size() > 2 && s[0] == '0' && s[1] == '.') {
+		s.remove_prefix(1);
+	}
+	put(s, true);
+}
+
+void LuaEmitter::emitNode(const Node *node, int indent)
+{
+	if (node == m_root && (!node || node->type() == Node::Type::Chunk)) {
+		openScope();
+		block(node, indent);
+		closeScope();
+		return;
+	}
+
+	// 'do end'
+	if (!node) {
+		token("do");
+		space();
+		token("end");
+		return;
+	}
+
+	switch (node->type()) {
+		case Node::Type::Chunk:
+			token("do");
+			openScope();
+			block(node, indent + 1);
+			closeScope();
+			newline(indent);
+			token("end");
+			break;
+		case Node::Type::ExprList:
+			exprs(*static_cast<const ExprList *>(node), indent);
+			break;
+		case Node::Type::VarList: {
+			bool first = true;
+			for (const auto &lv : static_cast<const VarList *>(node)->vars()) {
+				if (!first)
+					separator(",");
+				schedule(lv.get(), indent);
+				first = false;
+			}
+			break;
+		}
+		case Node::Type::ParamList: {
+			auto pl = static_cast<const ParamList *>(node);
+			bool first = true;
+			for (const auto &name : pl->names()) {
+				if (!first)
+					separator(",");
+				token(name);
+				first = false;
+			}
+			if (pl->hasEllipsis()) {
+				if (!first)
+					separator(",");
+				token("...");
+			}
+			break;
+		}
+		case Node::Type::Ellipsis:
+			token(isTruncated(node) ? "(...)" : "...");
+			break;
+		case Node::Type::LValue: {
+			auto lv = static_cast<const LValue *>(node);
+			switch (lv->lvalueType()) {
+				case LValue::Type::Bracket:
+					prefix(lv->tableExpr(), indent);
+					token("[");
+					expression(lv->keyExpr(), indent);
+					token("]");
+					break;
+				case LValue::Type::Dot:
+					prefix(lv->tableExpr(), indent);
+					token(".");
+					token(lv->name());
+					break;
+				case LValue::Type::Name:
+					token(resolve(lv->name()));
+					break;
+			}
+			break;
+		}
+		case Node::Type::FunctionCall: {
+			auto fc = static_cast<const FunctionCall *>(node);
+			if (fc->isTruncated())
+				token("(");
+			prefix(&fc->functionExpr(), indent);
+			args(fc->args(), indent);
+			if (fc->isTruncated())
+				token(")");
+			break;
+		}
+		case Node::Type::MethodCall: {
+			auto mc = static_cast<const MethodCall *>(node);
+			if (mc->isTruncated())
+				token("(");
+			prefix(&mc->functionExpr(), indent);
+			token(":");
+			token(mc->methodName());
+			args(mc->args(), indent);
+			if (mc->isTruncated())
+				token(")");
+			break;
+		}
+		case Node::Type::Assignment: {
+			auto a = static_cast<const Assignment *>(node);
+			const auto &vars = a->varList().vars();
+			if (!a->isLocal()) {
+				schedule(&a->varList(), indent);
+				separator("=");
+				exprs(a->exprList(), indent);
+				break;
+			}
+
+			// the new locals are only visible after the expressions
+			token("local");
+			space();
+			for (std::size_t i = 0; i < vars.size(); ++i) {
+				if (i > 0)
+					separator(",");
+				token(declare(vars[i]->name()));
+			}
+			if (!a->exprList().exprs().empty()) {
+				separator("=");
+				exprs(a->exprList(), indent);
+			}
+			activate(vars.size());
+			break;
+		}
+		case Node::Type::Value: {
+			auto v = static_cast<const Value *>(node);
+			switch (v->valueType()) {
+				case ValueType::Nil:
+					token("nil");
+					break;
+				case ValueType::Boolean:
+					token(static_cast<const BooleanValue *>(v)->value() ? "true" : "false");
+					break;
+				case ValueType::String:
+					// the literal is kept as written, quotes and escapes included
+					token(static_cast<const StringValue *>(v)->value());
+					break;
+				case ValueType::Integer:
+				case ValueType::Real:
+					number(v);
+					break;
+				default:
+					break;
+			}
+			break;
+		}
+		case Node::Type::TableCtor: {
+			token("{");
+			bool first = true;
+			for (const auto &f : static_cast<const TableCtor *>(node)->fields()) {
+				if (!first)
+					separator(",");
+				schedule(f.get(), indent);
+				first = false;
+			}
+			token("}");
+			break;
+		}
+		case Node::Type::Field: {
+			auto f = static_cast<const Field *>(node);
+			switch (f->fieldType()) {
+				case Field::Type::Brackets:
+					token("[");
+					expression(f->keyExpr(), indent);
+					token("]");
+					separator("=");
+					break;
+				case Field::Type::Literal:
+					token(f->fieldName());
+					separator("=");
+					break;
+				case Field::Type::NoIndex:
+					break;
+			}
+			expression(f->valueExpr(), indent);
+			break;
+		}
+		case Node::Type::BinOp: {
+			auto op = static_cast<const BinOp *>(node);
+			const int level = precedence(op);
+			const bool right = op->binOpType() == BinOp::Type::Exponentation;
+			operand(&op->left(), indent, level, right, true);
+			separator(op->toString());
+			operand(&op->right(), indent, level, !right, false);
+			break;
+		}
+		case Node::Type::UnOp: {
+			auto op = static_cast<const UnOp *>(node);
+			token(op->toString());
+			operand(&op->operand(), indent, precedence(op), false, false);
+			break;
+		}
+		case Node::Type::Break:
+			token("break");
+			break;
+		case Node::Type::Return: {
+			token("return");
+			auto list = static_cast<const Return *>(node)->exprList();
+			if (list && !list->exprs().empty()) {
+				space();
+				exprs(*list, indent);
+			}
+			break;
+		}
+		case Node::Type::Function:
+			function(static_cast<const Function *>(node), indent);
+			break;
+		case Node::Type::If: {
+			auto top = static_cast<const If *>(node);
+			for (const If *i = top; i; i = i->nextIf()) {
+				token(i == top ? "if" : "elseif");
+				space();
+				expression(&i->condition(), indent);
+				space();
+				token("then");
+				openScope();
+				block(i->chunk(), indent + 1);
+				closeScope();
+				newline(indent);
+			}
+			if (top->elseChunk()) {
+				token("else");
+				openScope();
+				block(top->elseChunk(), indent + 1);
+				closeScope();
+				newline(indent);
+			}
+			token("end");
+			break;
+		}
+		case Node::Type::While: {
+			auto w = static_cast<const While *>(node);
+			token("while");
+			space();
+			expression(&w->condition(), indent);
+			space();
+			token("do");
+			openScope();
+			block(w->chunk(), indent + 1);
+			closeScope();
+			newline(indent);
+			token("end");
+			break;
+		}
+		case Node::Type::Repeat: {
+			// locals of the body are visible in the condition
+			auto r = static_cast<const Repeat *>(node);
+			token("repeat");
+			openScope();
+			block(r->chunk(), indent + 1);
+			newline(indent);
+			token("until");
+			space();
+			expression(&r->condition(), indent);
+			closeScope();
+			break;
+		}
+		case Node::Type::For: {
+			auto f = static_cast<const For *>(node);
+			token("for");
+			space();
+			openScope();
+			token(declare(f->iterator()));
+			separator("=");
+			expression(&f->start(), indent);
+			separator(",");
+			expression(&f->limit(), indent);
+			if (f->step()) {
+				separator(",");
+				expression(f->step(), indent);
+			}
+			space();
+			token("do");
+			activate(1);
+			block(f->chunk(), indent + 1);
+			closeScope();
+			newline(indent);
+			token("end");
+			break;
+		}
+		case Node::Type::ForEach: {
+			auto f = static_cast<const ForEach *>(node);
+			const auto &names = f->iterators().names();
+			token("for");
+			space();
+			openScope();
+			for (std::size_t i = 0; i < names.size(); ++i) {
+				if (i > 0)
+					separator(",");
+				token(declare(names[i]));
+			}
+			space();
+			token("in");
+			space();
+			exprs(f->exprs(), indent);
+			space();
+			token("do");
+			activate(names.size());
+			block(f->chunk(), indent + 1);
+			closeScope();
+			newline(indent);
+			token("end");
+			break;
+		}
+		case Node::Type::_last:
+			break;
+	}
+}
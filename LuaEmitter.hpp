@@ -0,0 +1,113 @@
+#pragma once
+
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "Emitter.hpp"
+
+// Writes an AST back out as Lua source which parses into the same tree.
+// Pretty output puts every statement on a line of its own, indented with
+// tabs. Minified output has only the whitespace and parentheses needed to
+// read it back, and local variables get the shortest names which neither
+// hide a global nor another local in scope.
+class LuaEmitter : public Emitter {
+public:
+	enum class Style {
+		Pretty,
+		Minified,
+	};
+
+	LuaEmitter(OutputBuffer &out, Style style, bool rename = true);
+
+protected:
+	void emitNode(const Node *node, int indent) override;
+	void prepare(const Node *root) override;
+	void action(int code, const Node *node, std::string_view text, int indent) override;
+
+private:
+	enum Action {
+		Token,
+		Newline,
+		OpenScope,
+		CloseScope,
+		Activate,
+	};
+
+	struct Local {
+		std::string_view name;
+		std::string_view renamed;
+		// index into m_declarations, None for self which keeps its name
+		std::size_t declaration;
+		bool active;
+	};
+
+	struct Scope {
+		std::size_t firstLocal;
+		std::size_t id;
+	};
+
+	// what the first pass finds out about every scope and every local
+	struct ScopeInfo {
+		std::size_t parent;
+		std::size_t size = 0;
+		std::size_t base = 0;
+	};
+
+	struct Declaration {
+		std::size_t scope;
+		std::size_t index;
+		std::size_t uses = 1;
+		std::size_t slot = 0;
+	};
+
+	static constexpr std::size_t None = static_cast<std::size_t>(-1);
+
+	void token(std::string_view s) { perform(Token, nullptr, s); }
+	void space();
+	void newline(int indent) { perform(Newline, nullptr, {}, indent); }
+	void separator(std::string_view s);
+
+	void block(const Node *chunk, int indent);
+	void expression(const Node *node, int indent, bool parens = false);
+	void prefix(const Node *node, int indent);
+	void operand(const Node *node, int indent, int level, bool tie, bool leading);
+	void exprs(const ExprList &list, int indent);
+	void args(const ExprList &list, int indent);
+	void function(const Function *f, int indent);
+	void number(const Value *v);
+	void put(std::string_view s, bool number);
+
+	// Scopes. declare() names a local at once, activate() makes the last
+	// count declared ones visible to the code following it.
+	void openScope() { perform(OpenScope); }
+	void closeScope() { perform(CloseScope); }
+	std::string_view declare(std::string_view name);
+	std::string_view declareFixed(std::string_view name);
+	void activate(int count) { perform(Activate, nullptr, {}, count); }
+	std::string_view resolve(std::string_view name);
+	void nameSlots();
+
+	Style m_style;
+	bool m_rename;
+	const Node *m_root = nullptr;
+	// true during the first pass, which only resolves names
+	bool m_collecting = false;
+	bool m_started = false;
+	char m_last = ' ';
+	bool m_lastNumber = false;
+
+	std::vector <Local> m_locals;
+	std::vector <Scope> m_scopes;
+	std::unordered_map <std::string_view, std::vector <std::size_t> > m_bindings;
+	std::unordered_set <std::string_view> m_globals;
+	std::vector <ScopeInfo> m_scopeTree;
+	std::vector <Declaration> m_declarations;
+	std::size_t m_nextDeclaration = 0;
+	std::vector <std::string_view> m_slotNames;
+	// the shortest names in order
+	std::deque <std::string> m_candidates;
+};
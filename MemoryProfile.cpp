@@ -0,0 +1,377 @@
+#include <charconv>
+
+#include <sys/resource.h>
+
+#include "MemoryProfile.hpp"
+
+namespace {
+
+void column(OutputBuffer &out, std::size_t value, std::size_t width)
+{
+	char buf[24];
+	const auto result = std::to_chars(buf, buf + sizeof(buf), value);
+	const std::size_t length = result.ptr - buf;
+	if (length < width)
+		out.repeat(' ', width - length);
+	out.write(buf, length);
+}
+
+void column(OutputBuffer &out, std::string_view text, std::size_t width)
+{
+	out.write(text);
+	if (text.size() < width)
+		out.repeat(' ', width - text.size());
+}
+
+void header(OutputBuffer &out, std::string_view text, std::size_t width)
+{
+	if (text.size() < width)
+		out.repeat(' ', width - text.size());
+	out.write(text);
+}
+
+void row(OutputBuffer &out, std::string_view name, const MemoryProfile::Usage &u)
+{
+	column(out, name, 14);
+	column(out, u.nodes, 12);
+	column(out, u.objectBytes, 14);
+	column(out, u.stringBytes, 14);
+	column(out, u.vectorBytes, 14);
+	column(out, u.slackBytes, 14);
+	column(out, u.allocations, 12);
+	column(out, u.totalBytes(), 14);
+	out.put('\n');
+}
+
+void jsonUsage(OutputBuffer &out, const MemoryProfile::Usage &u)
+{
+	auto field = [&out](std::string_view name, std::size_t value, bool last = false)
+	{
+		out.put('"');
+		out.write(name);
+		out.write("\":");
+		out.writeInt(value);
+		if (!last)
+			out.put(',');
+	};
+
+	out.put('{');
+	field("nodes", u.nodes);
+	field("objectBytes", u.objectBytes);
+	field("stringBytes", u.stringBytes);
+	field("vectorBytes", u.vectorBytes);
+	field("slackBytes", u.slackBytes);
+	field("allocations", u.allocations);
+	field("totalBytes", u.totalBytes(), true);
+	out.put('}');
+}
+
+}
+
+MemoryProfile::Usage & MemoryProfile::Usage::operator += (const Usage &other)
+{
+	nodes += other.nodes;
+	objectBytes += other.objectBytes;
+	stringBytes += other.stringBytes;
+	vectorBytes += other.vectorBytes;
+	slackBytes += other.slackBytes;
+	allocations += other.allocations;
+	return *this;
+}
+
+void MemoryProfile::addString(Usage &u, const std::string &s)
+{
+	// small strings live inside the std::string object itself
+	const char *object = reinterpret_cast<const char *>(&s);
+	if (s.data() >= object && s.data() < object + sizeof(s))
+		return;
+
+	u.stringBytes += s.capacity() + 1;
+	u.slackBytes += s.capacity() - s.size();
+	++u.allocations;
+}
+
+template <typename T>
+void MemoryProfile::addVector(Usage &u, const std::vector <T> &v)
+{
+	if (v.capacity() == 0)
+		return;
+
+	u.vectorBytes += v.capacity() * sizeof(T);
+	u.slackBytes += (v.capacity() - v.size()) * sizeof(T);
+	++u.allocations;
+}
+
+void MemoryProfile::add(const Node *root)
+{
+	std::vector <const Node *> stack;
+	stack.push_back(root);
+
+	auto push = [&stack](const Node *n)
+	{
+		if (n)
+			stack.push_back(n);
+	};
+
+	auto pushAll = [&push](const auto &nodes)
+	{
+		for (const auto &n : nodes)
+			push(n.get());
+	};
+
+	while (!stack.empty()) {
+		const Node *node = stack.back();
+		stack.pop_back();
+		if (!node)
+			continue;
+
+		Usage &u = m_usage[toUnderlying(node->type())];
+		++u.nodes;
+		++u.allocations;
+
+		switch (node->type()) {
+			case Node::Type::Chunk: {
+				auto c = static_cast<const Chunk *>(node);
+				u.objectBytes += sizeof(Chunk);
+				addVector(u, c->children());
+				addVector(u, c->spans());
+				pushAll(c->children());
+				break;
+			}
+			case Node::Type::ExprList: {
+				auto el = static_cast<const ExprList *>(node);
+				u.objectBytes += sizeof(ExprList);
+				addVector(u, el->exprs());
+				pushAll(el->exprs());
+				break;
+			}
+			case Node::Type::VarList: {
+				auto vl = static_cast<const VarList *>(node);
+				u.objectBytes += sizeof(VarList);
+				addVector(u, vl->vars());
+				pushAll(vl->vars());
+				break;
+			}
+			case Node::Type::ParamList: {
+				auto pl = static_cast<const ParamList *>(node);
+				u.objectBytes += sizeof(ParamList);
+				addVector(u, pl->names());
+				for (const auto &name : pl->names())
+					addString(u, name);
+				break;
+			}
+			case Node::Type::Ellipsis:
+				u.objectBytes += sizeof(Ellipsis);
+				break;
+			case Node::Type::LValue: {
+				auto lv = static_cast<const LValue *>(node);
+				u.objectBytes += sizeof(LValue);
+				addString(u, lv->name());
+				push(lv->tableExpr());
+				push(lv->keyExpr());
+				break;
+			}
+			case Node::Type::FunctionCall: {
+				auto fc = static_cast<const FunctionCall *>(node);
+				u.objectBytes += sizeof(FunctionCall);
+				push(&fc->functionExpr());
+				push(&fc->args());
+				break;
+			}
+			case Node::Type::MethodCall: {
+				auto mc = static_cast<const MethodCall *>(node);
+				u.objectBytes += sizeof(MethodCall);
+				addString(u, mc->methodName());
+				push(&mc->functionExpr());
+				push(&mc->args());
+				break;
+			}
+			case Node::Type::Assignment: {
+				auto a = static_cast<const Assignment *>(node);
+				u.objectBytes += sizeof(Assignment);
+				push(&a->varList());
+				push(&a->exprList());
+				break;
+			}
+			case Node::Type::Value: {
+				auto v = static_cast<const Value *>(node);
+				switch (v->valueType()) {
+					case ValueType::Nil:
+						u.objectBytes += sizeof(NilValue);
+						break;
+					case ValueType::Boolean:
+						u.objectBytes += sizeof(BooleanValue);
+						break;
+					case ValueType::String:
+						u.objectBytes += sizeof(StringValue);
+						addString(u, static_cast<const StringValue *>(v)->value());
+						break;
+					case ValueType::Integer:
+						u.objectBytes += sizeof(IntValue);
+						break;
+					case ValueType::Real:
+						u.objectBytes += sizeof(RealValue);
+						break;
+					default:
+						u.objectBytes += sizeof(Value);
+				}
+				break;
+			}
+			case Node::Type::TableCtor: {
+				auto t = static_cast<const TableCtor *>(node);
+				u.objectBytes += sizeof(TableCtor);
+				addVector(u, t->fields());
+				pushAll(t->fields());
+				break;
+			}
+			case Node::Type::Field: {
+				auto f = static_cast<const Field *>(node);
+				u.objectBytes += sizeof(Field);
+				addString(u, f->fieldName());
+				push(f->keyExpr());
+				push(f->valueExpr());
+				break;
+			}
+			case Node::Type::BinOp: {
+				auto op = static_cast<const BinOp *>(node);
+				u.objectBytes += sizeof(BinOp);
+				push(&op->left());
+				push(&op->right());
+				break;
+			}
+			case Node::Type::UnOp:
+				u.objectBytes += sizeof(UnOp);
+				push(&static_cast<const UnOp *>(node)->operand());
+				break;
+			case Node::Type::Break:
+				u.objectBytes += sizeof(Break);
+				break;
+			case Node::Type::Return:
+				u.objectBytes += sizeof(Return);
+				push(static_cast<const Return *>(node)->exprList());
+				break;
+			case Node::Type::Function: {
+				auto f = static_cast<const Function *>(node);
+				u.objectBytes += sizeof(Function);
+				addVector(u, f->nameParts());
+				for (const auto &part : f->nameParts())
+					addString(u, part);
+				addString(u, f->methodName());
+				if (f->hasParams())
+					push(&f->params());
+				// a body not parsed yet costs only its range
+				if (f->isLazy())
+					u.objectBytes += sizeof(Function::LazyBody);
+				else if (f->hasChunk())
+					push(&f->chunk());
+				break;
+			}
+			case Node::Type::If: {
+				auto i = static_cast<const If *>(node);
+				u.objectBytes += sizeof(If);
+				push(&i->condition());
+				push(i->chunk());
+				push(i->nextIf());
+				push(i->elseChunk());
+				break;
+			}
+			case Node::Type::While: {
+				auto w = static_cast<const While *>(node);
+				u.objectBytes += sizeof(While);
+				push(&w->condition());
+				push(w->chunk());
+				break;
+			}
+			case Node::Type::Repeat: {
+				auto r = static_cast<const Repeat *>(node);
+				u.objectBytes += sizeof(Repeat);
+				push(&r->condition());
+				push(r->chunk());
+				break;
+			}
+			case Node::Type::For: {
+				auto f = static_cast<const For *>(node);
+				u.objectBytes += sizeof(For);
+				addString(u, f->iterator());
+				push(&f->start());
+				push(&f->limit());
+				push(f->step());
+				push(f->chunk());
+				break;
+			}
+			case Node::Type::ForEach: {
+				auto f = static_cast<const ForEach *>(node);
+				u.objectBytes += sizeof(ForEach);
+				push(&f->iterators());
+				push(&f->exprs());
+				push(f->chunk());
+				break;
+			}
+			case Node::Type::_last:
+				break;
+		}
+	}
+}
+
+MemoryProfile::Usage MemoryProfile::total() const
+{
+	Usage result;
+	for (const auto &u : m_usage)
+		result += u;
+	return result;
+}
+
+std::size_t MemoryProfile::peakRss()
+{
+	struct rusage ru;
+	if (getrusage(RUSAGE_SELF, &ru) != 0)
+		return 0;
+	// ru_maxrss is reported in kilobytes on Linux
+	return static_cast<std::size_t>(ru.ru_maxrss) * 1024;
+}
+
+void MemoryProfile::writeTable(OutputBuffer &out) const
+{
+	column(out, "Type", 14);
+	header(out, "Nodes", 12);
+	header(out, "Object B", 14);
+	header(out, "String B", 14);
+	header(out, "Vector B", 14);
+	header(out, "Slack B", 14);
+	header(out, "Allocs", 12);
+	header(out, "Total B", 14);
+	out.put('\n');
+
+	for (int i = 0; i < toUnderlying(Node::Type::_last); ++i) {
+		if (m_usage[i].nodes != 0)
+			row(out, Node::toString(static_cast<Node::Type>(i)), m_usage[i]);
+	}
+
+	row(out, "Total", total());
+
+	out.write("Peak RSS: ");
+	out.writeInt(peakRss());
+	out.write(" bytes\n");
+}
+
+void MemoryProfile::writeJson(OutputBuffer &out) const
+{
+	out.write("{\"types\":{");
+	bool first = true;
+	for (int i = 0; i < toUnderlying(Node::Type::_last); ++i) {
+		if (m_usage[i].nodes == 0)
+			continue;
+		if (!first)
+			out.put(',');
+		out.put('"');
+		out.write(Node::toString(static_cast<Node::Type>(i)));
+		out.write("\":");
+		jsonUsage(out, m_usage[i]);
+		first = false;
+	}
+	out.write("},\"total\":");
+	jsonUsage(out, total());
+	out.write(",\"peakRssBytes\":");
+	out.writeInt(peakRss());
+	out.write("}\n");
+}
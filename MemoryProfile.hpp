@@ -0,0 +1,44 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+
+#include "AST.hpp"
+#include "OutputBuffer.hpp"
+
+// Memory accounting of an AST, broken down by Node::Type. Owned strings
+// only count when they spilled out of the small string buffer, vectors
+// count their whole capacity and the unused part of it is reported
+// separately as slack.
+class MemoryProfile {
+public:
+	struct Usage {
+		std::size_t nodes = 0;
+		std::size_t objectBytes = 0;
+		std::size_t stringBytes = 0;
+		std::size_t vectorBytes = 0;
+		std::size_t slackBytes = 0;
+		std::size_t allocations = 0;
+
+		std::size_t totalBytes() const { return objectBytes + stringBytes + vectorBytes; }
+		Usage & operator += (const Usage &other);
+	};
+
+	void add(const Node *root);
+
+	const Usage & usage(Node::Type t) const { return m_usage[toUnderlying(t)]; }
+	Usage total() const;
+
+	// Peak resident set size of the whole process, in bytes
+	static std::size_t peakRss();
+
+	void writeTable(OutputBuffer &out) const;
+	void writeJson(OutputBuffer &out) const;
+
+private:
+	template <typename T>
+	void addVector(Usage &u, const std::vector <T> &v);
+	void addString(Usage &u, const std::string &s);
+
+	std::array <Usage, toUnderlying(Node::Type::_last)> m_usage;
+};
@@ -0,0 +1,1603 @@
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "Optimizer.hpp"
+#include "Traversal.hpp"
+
+namespace {
+
+constexpr std::size_t None = static_cast<std::size_t>(-1);
+
+// locals put in front of one loop at most, Lua allows 200 in a function
+constexpr std::size_t MaxLocals = 32;
+
+// What evaluating an expression may do.
+enum class Type {
+	// anything: fail, call a metamethod or have an effect
+	Unknown,
+	// none of that, but of no one type
+	Value,
+	Boolean,
+	Number,
+	String,
+};
+
+// present in every Lua version
+const char * const Libraries[] = {"coroutine", "io", "math", "os", "string", "table"};
+
+const char * const BaseFunctions[] = {"assert", "error", "getmetatable", "ipairs", "next", "pairs", "pcall", "print",
+	"rawequal", "rawget", "rawlen", "rawset", "select", "setmetatable", "tonumber", "tostring", "type", "unpack", "xpcall"};
+
+// Ways to reach variables and globals which the tree does not show.
+const char * const DynamicNames[] = {"_ENV", "_G", "debug", "dofile", "getfenv", "load", "loadfile", "loadstring", "setfenv"};
+
+// A library function which can neither fail nor have an effect when all its
+// arguments have the type args, and returns a single value.
+struct PureFunction {
+	const char *library;
+	const char *name;
+	std::size_t minArgs;
+	std::size_t maxArgs;
+	Type args;
+	Type result;
+};
+
+const PureFunction PureFunctions[] = {
+	{"math", "abs", 1, 1, Type::Number, Type::Number},
+	{"math", "acos", 1, 1, Type::Number, Type::Number},
+	{"math", "asin", 1, 1, Type::Number, Type::Number},
+	{"math", "atan", 1, 1, Type::Number, Type::Number},
+	{"math", "ceil", 1, 1, Type::Number, Type::Number},
+	{"math", "cos", 1, 1, Type::Number, Type::Number},
+	{"math", "deg", 1, 1, Type::Number, Type::Number},
+	{"math", "exp", 1, 1, Type::Number, Type::Number},
+	{"math", "floor", 1, 1, Type::Number, Type::Number},
+	{"math", "log", 1, 1, Type::Number, Type::Number},
+	{"math", "max", 1, None, Type::Number, Type::Number},
+	{"math", "min", 1, None, Type::Number, Type::Number},
+	{"math", "rad", 1, 1, Type::Number, Type::Number},
+	{"math", "sin", 1, 1, Type::Number, Type::Number},
+	{"math", "sqrt", 1, 1, Type::Number, Type::Number},
+	{"math", "tan", 1, 1, Type::Number, Type::Number},
+	{"string", "len", 1, 1, Type::String, Type::Number},
+	{"string", "lower", 1, 1, Type::String, Type::String},
+	{"string", "reverse", 1, 1, Type::String, Type::String},
+	{"string", "upper", 1, 1, Type::String, Type::String},
+};
+
+template <std::size_t N>
+bool contains(const char * const (&names)[N], std::string_view name)
+{
+	return std::find_if(std::begin(names), std::end(names), [name](const char *n) { return name == n; }) != std::end(names);
+}
+
+bool isName(const Node *node)
+{
+	return node && node->type() == Node::Type::LValue && static_cast<const LValue *>(node)->lvalueType() == LValue::Type::Name;
+}
+
+const std::string & nameOf(const Node *node)
+{
+	return static_cast<const LValue *>(node)->name();
+}
+
+// Expressions which give any number of values at the end of a list, unless
+// parentheses cut them to one.
+bool isMulti(const Node *node)
+{
+	switch (node->type()) {
+		case Node::Type::FunctionCall:
+		case Node::Type::MethodCall:
+			return !static_cast<const FunctionCall *>(node)->isTruncated();
+		case Node::Type::Ellipsis:
+			return !static_cast<const Ellipsis *>(node)->isTruncated();
+		default:
+			return false;
+	}
+}
+
+bool isNumber(const Node *node)
+{
+	if (!node->isValue())
+		return false;
+	const ValueType type = static_cast<const Value *>(node)->valueType();
+	return type == ValueType::Integer || type == ValueType::Real;
+}
+
+bool isNonZero(const Node *node)
+{
+	if (!isNumber(node))
+		return false;
+	auto value = static_cast<const Value *>(node);
+	if (value->valueType() == ValueType::Integer)
+		return static_cast<const IntValue *>(value)->value() != 0;
+	return static_cast<const RealValue *>(value)->value() != 0.0;
+}
+
+// The part of an expression evaluated first.
+const Node * leadingLeaf(const Node *node)
+{
+	for (;;) {
+		if (node->type() == Node::Type::BinOp)
+			node = &static_cast<const BinOp *>(node)->left();
+		else if (node->type() == Node::Type::UnOp)
+			node = &static_cast<const UnOp *>(node)->operand();
+		else
+			return node;
+	}
+}
+
+struct Variable {
+	std::string_view name;
+	// the statement, function or loop declaring it
+	const Node *declaration;
+	// the expression it starts with, null if there is none of its own
+	const Node *value;
+	// innermost loop of its function around the declaration
+	std::size_t loop;
+	// a numeric for variable
+	bool counter;
+	unsigned reads = 0;
+	unsigned writes = 0;
+	// Unknown for variables assigned after their declaration
+	Type type = Type::Unknown;
+};
+
+struct Loop {
+	const Node *node;
+	// the loop around it in the same function
+	std::size_t parent;
+};
+
+struct FunctionInfo {
+	// its parameters are the first variables declared in it
+	std::size_t first = 0;
+	// names it uses from outside, with their variable or None for globals
+	std::vector <std::pair <std::string_view, std::size_t> > outer;
+	// within the inline limit
+	bool small = false;
+	// contains a call which may be inlined
+	bool callsInlinable = false;
+	bool done = false;
+};
+
+struct GlobalInfo {
+	bool written = false;
+	// used other than by reading one of its fields
+	bool escapes = false;
+};
+
+// Resolves every name of a tree to the local it refers to or to a global,
+// and sums up what the passes need to know of variables, loops and
+// functions. Blocks recurse, expressions are walked iteratively.
+class Analysis {
+public:
+	Analysis(const Chunk &root, std::size_t inlineLimit);
+	Analysis(const Analysis &) = delete;
+	Analysis & operator = (const Analysis &) = delete;
+
+	// variable a name refers to, None for a global
+	std::size_t binding(const Node *name) const
+	{
+		auto found = m_names.find(name);
+		return found == m_names.end() ? None : found->second;
+	}
+
+	const Variable & variable(std::size_t v) const { return m_variables[v]; }
+	const Loop & loop(std::size_t l) const { return m_loops[l]; }
+	std::size_t loopOf(const Node *loop) const { return m_loopIndex.at(loop); }
+	// whether loop l is outer or inside it
+	bool within(std::size_t l, std::size_t outer) const;
+	const FunctionInfo & function(const Function *f) const { return m_functions.at(f); }
+
+	// Calls of local functions whose outer names mean the same at the call,
+	// with the variable holding the function.
+	const std::unordered_map <const Node *, std::size_t> & calls() const { return m_calls; }
+	bool isStatement(const Node *call) const { return m_statements.count(call) > 0; }
+
+	// The file reaches variables in ways the tree does not show.
+	bool dynamic() const { return m_dynamic; }
+	// A standard library table which the file never changes nor passes around.
+	bool isLibrary(std::string_view name) const;
+	// A standard function in a global the file never assigns.
+	bool isBaseFunction(std::string_view name) const;
+	// whether the tree has an identifier of this name
+	bool used(std::string_view name) const { return m_identifiers.count(name) > 0; }
+
+	Type type(const Node *e);
+
+private:
+	void block(const Chunk *chunk);
+	void statements(const Chunk *chunk);
+	void statement(const Node *s);
+	void assignment(const Assignment *a);
+	void expression(const Node *e);
+	void function(const Function *f);
+	void call(const FunctionCall *c);
+
+	void declare(std::string_view name, const Node *declaration, const Node *value, bool counter = false);
+	void closeScope(std::size_t mark);
+	void enterLoop(const Node *loop);
+	void leaveLoop() { m_loop = m_loops[m_loop].parent; }
+	std::size_t lookup(std::string_view name) const;
+	std::size_t resolve(std::string_view name);
+	void read(const LValue *name);
+	void write(std::string_view name, const LValue *node);
+
+	Type typeOf(const Node *node) const;
+	Type nodeType(const Node *node) const { return m_types.at(node); }
+
+	std::size_t m_inlineLimit;
+	std::vector <Variable> m_variables;
+	// variables in scope, innermost last
+	std::vector <std::size_t> m_scope;
+	std::unordered_map <std::string_view, std::vector <std::size_t> > m_bindings;
+	std::unordered_map <const Node *, std::size_t> m_names;
+	std::unordered_map <std::string_view, GlobalInfo> m_globals;
+	std::unordered_set <std::string_view> m_identifiers;
+	// names read only for one of their fields
+	std::unordered_set <const Node *> m_fieldTables;
+	std::vector <Loop> m_loops;
+	std::unordered_map <const Node *, std::size_t> m_loopIndex;
+	std::size_t m_loop = None;
+	std::unordered_map <const Function *, FunctionInfo> m_functions;
+	std::vector <FunctionInfo *> m_frames;
+	std::unordered_map <const Node *, std::size_t> m_calls;
+	std::unordered_set <const Node *> m_statements;
+	std::unordered_map <const Node *, Type> m_types;
+	bool m_dynamic = false;
+};
+
+Analysis::Analysis(const Chunk &root, std::size_t inlineLimit) : m_inlineLimit{inlineLimit}
+{
+	block(&root);
+
+	for (const char *name : DynamicNames) {
+		if (m_globals.count(name) > 0)
+			m_dynamic = true;
+	}
+
+	// a variable starts with what was declared before it
+	for (auto &v : m_variables) {
+		if (v.writes > 0)
+			continue;
+		if (v.counter)
+			v.type = Type::Number;
+		else if (v.value)
+			v.type = type(v.value);
+	}
+}
+
+bool Analysis::within(std::size_t l, std::size_t outer) const
+{
+	for (; l != None; l = m_loops[l].parent) {
+		if (l == outer)
+			return true;
+	}
+	return false;
+}
+
+bool Analysis::isLibrary(std::string_view name) const
+{
+	if (m_dynamic || !contains(Libraries, name))
+		return false;
+	auto global = m_globals.find(name);
+	return global == m_globals.end() || (!global->second.written && !global->second.escapes);
+}
+
+bool Analysis::isBaseFunction(std::string_view name) const
+{
+	if (m_dynamic || !contains(BaseFunctions, name))
+		return false;
+	auto global = m_globals.find(name);
+	return global == m_globals.end() || !global->second.written;
+}
+
+void Analysis::block(const Chunk *chunk)
+{
+	const std::size_t mark = m_scope.size();
+	statements(chunk);
+	closeScope(mark);
+}
+
+void Analysis::statements(const Chunk *chunk)
+{
+	if (!chunk)
+		return;
+	for (const auto &s : chunk->children()) {
+		if (s)
+			statement(s.get());
+	}
+}
+
+void Analysis::statement(const Node *s)
+{
+	switch (s->type()) {
+		case Node::Type::Assignment:
+			assignment(static_cast<const Assignment *>(s));
+			break;
+		case Node::Type::Function: {
+			auto f = static_cast<const Function *>(s);
+			const auto &parts = f->nameParts();
+			if (f->isLocal()) {
+				// visible in its own body
+				declare(parts[0], f, f);
+			} else if (parts.size() == 1 && f->methodName().empty()) {
+				write(parts[0], nullptr);
+			} else {
+				const std::size_t v = resolve(parts[0]);
+				if (v != None)
+					++m_variables[v].reads;
+				else
+					m_globals[parts[0]].written = true;
+			}
+			function(f);
+			break;
+		}
+		case Node::Type::Chunk:
+			block(static_cast<const Chunk *>(s));
+			break;
+		case Node::Type::If:
+			for (auto i = static_cast<const If *>(s); i; i = i->nextIf()) {
+				expression(&i->condition());
+				block(static_cast<const Chunk *>(i->chunk()));
+				if (i->elseChunk())
+					block(i->elseChunk());
+			}
+			break;
+		case Node::Type::While: {
+			auto w = static_cast<const While *>(s);
+			enterLoop(w);
+			expression(&w->condition());
+			block(w->chunk());
+			leaveLoop();
+			break;
+		}
+		case Node::Type::Repeat: {
+			// the condition sees the locals of the body
+			auto r = static_cast<const Repeat *>(s);
+			enterLoop(r);
+			const std::size_t mark = m_scope.size();
+			statements(r->chunk());
+			expression(&r->condition());
+			closeScope(mark);
+			leaveLoop();
+			break;
+		}
+		case Node::Type::For: {
+			auto loop = static_cast<const For *>(s);
+			expression(&loop->start());
+			expression(&loop->limit());
+			if (loop->step())
+				expression(loop->step());
+			enterLoop(loop);
+			const std::size_t mark = m_scope.size();
+			declare(loop->iterator(), loop, nullptr, true);
+			block(loop->chunk());
+			closeScope(mark);
+			leaveLoop();
+			break;
+		}
+		case Node::Type::ForEach: {
+			auto loop = static_cast<const ForEach *>(s);
+			expression(&loop->exprs());
+			enterLoop(loop);
+			const std::size_t mark = m_scope.size();
+			for (const auto &name : loop->iterators().names())
+				declare(name, loop, nullptr);
+			block(loop->chunk());
+			closeScope(mark);
+			leaveLoop();
+			break;
+		}
+		case Node::Type::FunctionCall:
+		case Node::Type::MethodCall:
+			m_statements.insert(s);
+			expression(s);
+			break;
+		default:
+			Traversal::forEachChild(s, [this](const Node *n) { expression(n); });
+			break;
+	}
+}
+
+void Analysis::assignment(const Assignment *a)
+{
+	expression(&a->exprList());
+
+	const auto &vars = a->varList().vars();
+	const auto &exprs = a->exprList().exprs();
+	if (a->isLocal()) {
+		for (std::size_t i = 0; i < vars.size(); ++i)
+			declare(vars[i]->name(), a, i < exprs.size() ? exprs[i].get() : nullptr);
+		return;
+	}
+
+	for (const auto &var : vars) {
+		if (var->lvalueType() == LValue::Type::Name) {
+			write(var->name(), var.get());
+			continue;
+		}
+
+		// a field of a global table changes the table
+		const Node *table = var->tableExpr();
+		while (table->type() == Node::Type::LValue && !isName(table))
+			table = static_cast<const LValue *>(table)->tableExpr();
+		if (isName(table) && lookup(nameOf(table)) == None)
+			m_globals[nameOf(table)].written = true;
+
+		expression(var->tableExpr());
+		if (var->keyExpr())
+			expression(var->keyExpr());
+	}
+}
+
+void Analysis::expression(const Node *e)
+{
+	Traversal::walk(e, [this](const Node *node)
+	{
+		switch (node->type()) {
+			case Node::Type::Function:
+				function(static_cast<const Function *>(node));
+				return false;
+			case Node::Type::LValue: {
+				auto lv = static_cast<const LValue *>(node);
+				if (lv->lvalueType() == LValue::Type::Name)
+					read(lv);
+				else if (lv->lvalueType() == LValue::Type::Dot && isName(lv->tableExpr()))
+					m_fieldTables.insert(lv->tableExpr());
+				return true;
+			}
+			case Node::Type::FunctionCall:
+				call(static_cast<const FunctionCall *>(node));
+				return true;
+			default:
+				return true;
+		}
+	});
+}
+
+void Analysis::function(const Function *f)
+{
+	FunctionInfo &info = m_functions[f];
+	info.first = m_variables.size();
+
+	std::size_t size = 0;
+	if (f->hasChunk())
+		Traversal::walk(&f->chunk(), [this, &size](const Node *) { return ++size <= m_inlineLimit; });
+	info.small = size <= m_inlineLimit;
+
+	m_frames.push_back(&info);
+	const std::size_t loop = m_loop;
+	m_loop = None;
+	const std::size_t mark = m_scope.size();
+
+	if (!f->methodName().empty())
+		declare("self", f, nullptr);
+	for (const auto &param : f->params().names())
+		declare(param, f, nullptr);
+	if (f->hasChunk())
+		block(&f->chunk());
+
+	closeScope(mark);
+	m_loop = loop;
+	m_frames.pop_back();
+
+	// what comes from outside this one may come from outside the one around
+	std::sort(info.outer.begin(), info.outer.end());
+	info.outer.erase(std::unique(info.outer.begin(), info.outer.end()), info.outer.end());
+	if (!m_frames.empty()) {
+		FunctionInfo &around = *m_frames.back();
+		for (const auto &use : info.outer) {
+			if (use.second == None || use.second < around.first)
+				around.outer.push_back(use);
+		}
+	}
+	info.done = true;
+}
+
+void Analysis::call(const FunctionCall *c)
+{
+	const Node *callee = &c->functionExpr();
+	if (!isName(callee))
+		return;
+
+	const std::size_t v = lookup(nameOf(callee));
+	if (v == None || !m_variables[v].value || m_variables[v].value->type() != Node::Type::Function)
+		return;
+
+	// a call from its own body sees it unfinished
+	auto info = m_functions.find(static_cast<const Function *>(m_variables[v].value));
+	if (info == m_functions.end() || !info->second.done || !info->second.small)
+		return;
+
+	for (const auto &use : info->second.outer) {
+		if (use.second == v || lookup(use.first) != use.second)
+			return;
+	}
+
+	m_calls.emplace(c, v);
+	for (FunctionInfo *frame : m_frames)
+		frame->callsInlinable = true;
+}
+
+void Analysis::declare(std::string_view name, const Node *declaration, const Node *value, bool counter)
+{
+	m_identifiers.insert(name);
+	m_scope.push_back(m_variables.size());
+	m_bindings[name].push_back(m_variables.size());
+	m_variables.push_back(Variable{name, declaration, value, m_loop, counter});
+}
+
+void Analysis::closeScope(std::size_t mark)
+{
+	while (m_scope.size() > mark) {
+		m_bindings[m_variables[m_scope.back()].name].pop_back();
+		m_scope.pop_back();
+	}
+}
+
+void Analysis::enterLoop(const Node *loop)
+{
+	m_loopIndex[loop] = m_loops.size();
+	m_loops.push_back(Loop{loop, m_loop});
+	m_loop = m_loops.size() - 1;
+}
+
+std::size_t Analysis::lookup(std::string_view name) const
+{
+	auto binding = m_bindings.find(name);
+	return binding == m_bindings.end() || binding->second.empty() ? None : binding->second.back();
+}
+
+std::size_t Analysis::resolve(std::string_view name)
+{
+	m_identifiers.insert(name);
+	const std::size_t v = lookup(name);
+	if (!m_frames.empty() && (v == None || v < m_frames.back()->first))
+		m_frames.back()->outer.emplace_back(name, v);
+	return v;
+}
+
+void Analysis::read(const LValue *name)
+{
+	const std::size_t v = resolve(name->name());
+	m_names[name] = v;
+	if (v != None) {
+		++m_variables[v].reads;
+		return;
+	}
+
+	GlobalInfo &global = m_globals[name->name()];
+	if (m_fieldTables.count(name) == 0)
+		global.escapes = true;
+}
+
+void Analysis::write(std::string_view name, const LValue *node)
+{
+	const std::size_t v = resolve(name);
+	if (node)
+		m_names[node] = v;
+	if (v != None)
+		++m_variables[v].writes;
+	else
+		m_globals[name].written = true;
+}
+
+Type Analysis::type(const Node *e)
+{
+	auto found = m_types.find(e);
+	if (found != m_types.end())
+		return found->second;
+
+	// operands before their operators
+	std::vector <const Node *> order;
+	Traversal::walk(e, [this, &order](const Node *node)
+	{
+		if (m_types.count(node) > 0)
+			return false;
+		order.push_back(node);
+		return node->type() != Node::Type::Function;
+	});
+	for (auto node = order.rbegin(); node != order.rend(); ++node)
+		m_types[*node] = typeOf(*node);
+
+	return m_types.at(e);
+}
+
+Type Analysis::typeOf(const Node *node) const
+{
+	switch (node->type()) {
+		case Node::Type::Value:
+			switch (static_cast<const Value *>(node)->valueType()) {
+				case ValueType::Boolean:
+					return Type::Boolean;
+				case ValueType::Integer:
+				case ValueType::Real:
+					return Type::Number;
+				case ValueType::String:
+					return Type::String;
+				default:
+					return Type::Value;
+			}
+		case Node::Type::LValue: {
+			if (!isName(node))
+				return Type::Unknown;
+			const std::size_t v = binding(node);
+			return v == None ? Type::Unknown : m_variables[v].type;
+		}
+		case Node::Type::BinOp: {
+			auto op = static_cast<const BinOp *>(node);
+			const Type left = nodeType(&op->left());
+			const Type right = nodeType(&op->right());
+			if (left == Type::Unknown || right == Type::Unknown)
+				return Type::Unknown;
+
+			switch (op->binOpType()) {
+				case BinOp::Type::Or:
+				case BinOp::Type::And:
+					return left == right ? left : Type::Value;
+				case BinOp::Type::Equal:
+				case BinOp::Type::NotEqual:
+					return Type::Boolean;
+				case BinOp::Type::Less:
+				case BinOp::Type::LessEqual:
+				case BinOp::Type::Greater:
+				case BinOp::Type::GreaterEqual:
+					return left == right && (left == Type::Number || left == Type::String) ? Type::Boolean : Type::Unknown;
+				case BinOp::Type::Concat:
+					return (left == Type::Number || left == Type::String) && (right == Type::Number || right == Type::String)
+						? Type::String : Type::Unknown;
+				case BinOp::Type::Modulo:
+					// an integer modulo by zero fails
+					if (!isNonZero(&op->right()))
+						return Type::Unknown;
+					[[fallthrough]];
+				default:
+					return left == Type::Number && right == Type::Number ? Type::Number : Type::Unknown;
+			}
+		}
+		case Node::Type::UnOp: {
+			auto op = static_cast<const UnOp *>(node);
+			const Type operand = nodeType(&op->operand());
+			switch (op->unOpType()) {
+				case UnOp::Type::Not:
+					return operand == Type::Unknown ? Type::Unknown : Type::Boolean;
+				case UnOp::Type::Negate:
+					return operand == Type::Number ? Type::Number : Type::Unknown;
+				case UnOp::Type::Length:
+					return operand == Type::String ? Type::Number : Type::Unknown;
+			}
+			return Type::Unknown;
+		}
+		case Node::Type::FunctionCall: {
+			auto c = static_cast<const FunctionCall *>(node);
+			if (c->functionExpr().type() != Node::Type::LValue)
+				return Type::Unknown;
+			auto callee = static_cast<const LValue *>(&c->functionExpr());
+			if (callee->lvalueType() != LValue::Type::Dot || !isName(callee->tableExpr()))
+				return Type::Unknown;
+			const std::string &library = nameOf(callee->tableExpr());
+			if (binding(callee->tableExpr()) != None || !isLibrary(library))
+				return Type::Unknown;
+
+			const auto &args = c->args().exprs();
+			for (const auto &f : PureFunctions) {
+				if (library != f.library || callee->name() != f.name)
+					continue;
+				if (args.size() < f.minArgs || args.size() > f.maxArgs)
+					return Type::Unknown;
+				for (const auto &arg : args) {
+					if (nodeType(arg.get()) != f.args)
+						return Type::Unknown;
+				}
+				return f.result;
+			}
+			return Type::Unknown;
+		}
+		default:
+			return Type::Unknown;
+	}
+}
+
+// Decides what a copy of a tree has in place of its nodes.
+class Rewrite {
+public:
+	virtual ~Rewrite() = default;
+
+	// null to copy node as it is
+	virtual Node * replace(const Node *node) { return nullptr; }
+	// whether a statement is left out of its chunk
+	virtual bool drop(const Node *statement) { return false; }
+};
+
+// Copies a tree without recursion: nodes are collected on the way down,
+// asking the rewrite about each, and built bottom up.
+class Copier {
+public:
+	explicit Copier(Rewrite &rewrite) : m_rewrite{rewrite} {}
+
+	Node * copy(const Node *root);
+
+private:
+	Node * take(const Node *node);
+	template <typename T>
+	T * take(const T *node) { return static_cast<T *>(take(static_cast<const Node *>(node))); }
+	Node * build(const Node *node);
+
+	Rewrite &m_rewrite;
+	std::unordered_map <const Node *, Node *> m_copies;
+};
+
+Node * copy(const Node *root, Rewrite &rewrite)
+{
+	return Copier{rewrite}.copy(root);
+}
+
+Node * Copier::copy(const Node *root)
+{
+	if (!root)
+		return nullptr;
+
+	std::vector <const Node *> order;
+	std::vector <const Node *> stack{root};
+	while (!stack.empty()) {
+		const Node *node = stack.back();
+		stack.pop_back();
+
+		if (Node *replacement = m_rewrite.replace(node)) {
+			m_copies[node] = replacement;
+			continue;
+		}
+
+		order.push_back(node);
+		if (node->type() == Node::Type::Chunk) {
+			for (const auto &child : static_cast<const Chunk *>(node)->children()) {
+				if (child && !m_rewrite.drop(child.get()))
+					stack.push_back(child.get());
+			}
+		} else {
+			Traversal::forEachChild(node, [&stack](const Node *n) { stack.push_back(n); });
+		}
+	}
+
+	// every node comes after those under it
+	for (auto node = order.rbegin(); node != order.rend(); ++node)
+		m_copies[*node] = build(*node);
+	return take(root);
+}
+
+Node * Copier::take(const Node *node)
+{
+	if (!node)
+		return nullptr;
+	auto found = m_copies.find(node);
+	Node *result = found->second;
+	m_copies.erase(found);
+	return result;
+}
+
+Node * Copier::build(const Node *node)
+{
+	switch (node->type()) {
+		case Node::Type::Chunk: {
+			auto chunk = static_cast<const Chunk *>(node);
+			auto result = new Chunk;
+			const auto &children = chunk->children();
+			for (std::size_t i = 0; i < children.size(); ++i) {
+				if (!children[i] || !m_rewrite.drop(children[i].get()))
+					result->append(take(children[i].get()), chunk->spans()[i]);
+			}
+			return result;
+		}
+		case Node::Type::ExprList: {
+			auto result = new ExprList;
+			for (const auto &e : static_cast<const ExprList *>(node)->exprs())
+				result->append(take(e.get()));
+			return result;
+		}
+		case Node::Type::VarList: {
+			auto result = new VarList;
+			for (const auto &var : static_cast<const VarList *>(node)->vars())
+				result->append(take(var.get()));
+			return result;
+		}
+		case Node::Type::ParamList: {
+			auto params = static_cast<const ParamList *>(node);
+			auto result = new ParamList;
+			for (const auto &name : params->names())
+				result->append(name);
+			if (params->hasEllipsis())
+				result->setEllipsis();
+			return result;
+		}
+		case Node::Type::Ellipsis: {
+			auto result = new Ellipsis;
+			if (static_cast<const Ellipsis *>(node)->isTruncated())
+				result->setTruncated();
+			return result;
+		}
+		case Node::Type::LValue: {
+			auto lv = static_cast<const LValue *>(node);
+			switch (lv->lvalueType()) {
+				case LValue::Type::Bracket:
+					return new LValue{take(lv->tableExpr()), take(lv->keyExpr())};
+				case LValue::Type::Dot:
+					return new LValue{take(lv->tableExpr()), lv->name()};
+				case LValue::Type::Name:
+					break;
+			}
+			return new LValue{lv->name()};
+		}
+		case Node::Type::FunctionCall: {
+			auto c = static_cast<const FunctionCall *>(node);
+			auto result = new FunctionCall{take(&c->functionExpr()), take(&c->args())};
+			if (c->isTruncated())
+				result->setTruncated();
+			return result;
+		}
+		case Node::Type::MethodCall: {
+			auto c = static_cast<const MethodCall *>(node);
+			auto result = new MethodCall{take(&c->functionExpr()), take(&c->args()), c->methodName()};
+			if (c->isTruncated())
+				result->setTruncated();
+			return result;
+		}
+		case Node::Type::Assignment: {
+			auto a = static_cast<const Assignment *>(node);
+			auto result = new Assignment{take(&a->varList()), take(&a->exprList())};
+			result->setLocal(a->isLocal());
+			return result;
+		}
+		case Node::Type::Value:
+			switch (static_cast<const Value *>(node)->valueType()) {
+				case ValueType::Boolean:
+					return new BooleanValue{static_cast<const BooleanValue *>(node)->value()};
+				case ValueType::Integer:
+					return new IntValue{static_cast<const IntValue *>(node)->value()};
+				case ValueType::Real:
+					return new RealValue{static_cast<const RealValue *>(node)->value()};
+				case ValueType::String:
+					return new StringValue{static_cast<const StringValue *>(node)->value()};
+				default:
+					return new NilValue;
+			}
+		case Node::Type::TableCtor: {
+			auto result = new TableCtor;
+			for (const auto &field : static_cast<const TableCtor *>(node)->fields())
+				result->append(take(field.get()));
+			return result;
+		}
+		case Node::Type::Field: {
+			auto f = static_cast<const Field *>(node);
+			switch (f->fieldType()) {
+				case Field::Type::Brackets:
+					return new Field{take(f->keyExpr()), take(f->valueExpr())};
+				case Field::Type::Literal:
+					return new Field{f->fieldName(), take(f->valueExpr())};
+				case Field::Type::NoIndex:
+					break;
+			}
+			return new Field{take(f->valueExpr())};
+		}
+		case Node::Type::BinOp: {
+			auto op = static_cast<const BinOp *>(node);
+			return new BinOp{op->binOpType(), take(&op->left()), take(&op->right())};
+		}
+		case Node::Type::UnOp: {
+			auto op = static_cast<const UnOp *>(node);
+			return new UnOp{op->unOpType(), take(&op->operand())};
+		}
+		case Node::Type::Break:
+			return new Break;
+		case Node::Type::Return:
+			return new Return{take(static_cast<const Return *>(node)->exprList())};
+		case Node::Type::Function: {
+			auto f = static_cast<const Function *>(node);
+			auto params = f->hasParams() ? take(&f->params()) : nullptr;
+			auto result = new Function{params, f->hasChunk() ? take(&f->chunk()) : nullptr};
+			result->setName(FunctionName{f->nameParts(), f->methodName()});
+			if (f->isLocal())
+				result->setLocal();
+			return result;
+		}
+		case Node::Type::If: {
+			auto i = static_cast<const If *>(node);
+			auto result = new If{take(&i->condition()), take(static_cast<const Chunk *>(i->chunk()))};
+			result->setNextIf(take(i->nextIf()));
+			result->setElse(take(i->elseChunk()));
+			return result;
+		}
+		case Node::Type::While: {
+			auto w = static_cast<const While *>(node);
+			return new While{take(&w->condition()), take(w->chunk())};
+		}
+		case Node::Type::Repeat: {
+			auto r = static_cast<const Repeat *>(node);
+			return new Repeat{take(&r->condition()), take(r->chunk())};
+		}
+		case Node::Type::For: {
+			auto f = static_cast<const For *>(node);
+			return new For{f->iterator(), take(&f->start()), take(&f->limit()), take(f->step()), take(f->chunk())};
+		}
+		case Node::Type::ForEach: {
+			auto f = static_cast<const ForEach *>(node);
+			return new ForEach{take(&f->iterators()), take(&f->exprs()), take(f->chunk())};
+		}
+		case Node::Type::_last:
+			break;
+	}
+	return nullptr;
+}
+
+// Replaces the parameters of an inlined function by the arguments of the
+// call, which are copied by the rewrite of the call.
+class Substitution : public Rewrite {
+public:
+	Substitution(const Analysis &analysis, std::size_t first, std::size_t count, const ExprList &args, Rewrite &outer)
+		: m_analysis{analysis}, m_first{first}, m_count{count}, m_args{args}, m_outer{outer} {}
+
+	Node * replace(const Node *node) override
+	{
+		if (!isName(node))
+			return nullptr;
+		const std::size_t v = m_analysis.binding(node);
+		if (v == None || v < m_first || v >= m_first + m_count)
+			return nullptr;
+
+		const auto &args = m_args.exprs();
+		const std::size_t i = v - m_first;
+		return i < args.size() ? copy(args[i].get(), m_outer) : new NilValue;
+	}
+
+private:
+	const Analysis &m_analysis;
+	std::size_t m_first;
+	std::size_t m_count;
+	const ExprList &m_args;
+	Rewrite &m_outer;
+};
+
+// Puts the bodies of small local functions in place of their calls. A body
+// of a single return takes the place of a call in an expression, any other
+// one without a return becomes a do block in place of a call statement,
+// with the parameters as its locals.
+class Inliner : public Rewrite {
+public:
+	explicit Inliner(const Analysis &analysis) : m_analysis{analysis} {}
+
+	// Decides every call before anything is copied, so declarations whose
+	// every use goes away can be left out.
+	void plan();
+
+	Node * replace(const Node *node) override;
+	bool drop(const Node *statement) override { return m_dropped.count(statement) > 0; }
+
+	unsigned inlined() const { return m_inlined; }
+
+private:
+	struct Body {
+		// the expression returned, if that is all the body does
+		const Node *value = nullptr;
+		// a body which can stand in for a call statement
+		bool statements = false;
+	};
+
+	const Body & body(const Function *f);
+	bool fitsExpression(const FunctionCall *call, const Function *f, const Node *value) const;
+	bool trivial(const Node *arg) const;
+
+	const Analysis &m_analysis;
+	std::unordered_map <const Function *, Body> m_bodies;
+	std::unordered_map <const Node *, std::size_t> m_inline;
+	std::unordered_set <const Node *> m_dropped;
+	unsigned m_inlined = 0;
+};
+
+void Inliner::plan()
+{
+	std::unordered_map <std::size_t, unsigned> inlined;
+	for (const auto &c : m_analysis.calls()) {
+		const Variable &variable = m_analysis.variable(c.second);
+		auto f = static_cast<const Function *>(variable.value);
+		// a body with calls of its own to inline would be copied before them
+		if (variable.writes > 0 || f->params().hasEllipsis() || m_analysis.function(f).callsInlinable)
+			continue;
+
+		auto call = static_cast<const FunctionCall *>(c.first);
+		const Body &b = body(f);
+		bool fits;
+		if (m_analysis.isStatement(call) && b.statements) {
+			// nothing is left to take extra arguments and their effects
+			fits = !f->params().names().empty() || std::all_of(call->args().exprs().begin(), call->args().exprs().end(),
+				[this](const auto &arg) { return trivial(arg.get()); });
+		} else {
+			fits = b.value && (!m_analysis.isStatement(call) || isMulti(b.value)) && fitsExpression(call, f, b.value);
+		}
+
+		if (fits) {
+			m_inline.emplace(call, c.second);
+			++inlined[c.second];
+		}
+	}
+
+	// a function called only where it was inlined is not needed
+	for (const auto &count : inlined) {
+		const Variable &variable = m_analysis.variable(count.first);
+		if (count.second != variable.reads)
+			continue;
+
+		const Node *declaration = variable.declaration;
+		if (declaration->type() == Node::Type::Assignment) {
+			auto a = static_cast<const Assignment *>(declaration);
+			if (a->varList().vars().size() != 1 || a->exprList().exprs().size() != 1)
+				continue;
+		}
+		m_dropped.insert(declaration);
+	}
+}
+
+const Inliner::Body & Inliner::body(const Function *f)
+{
+	auto found = m_bodies.find(f);
+	if (found != m_bodies.end())
+		return found->second;
+
+	Body &b = m_bodies[f];
+	if (!f->hasChunk()) {
+		b.statements = true;
+		return b;
+	}
+
+	const auto &children = f->chunk().children();
+	if (children.size() == 1 && children[0] && children[0]->type() == Node::Type::Return) {
+		auto list = static_cast<const Return *>(children[0].get())->exprList();
+		if (!list || list->exprs().size() != 1)
+			return b;
+
+		// the parameters are the only names it may declare
+		bool plain = true;
+		Traversal::walk(list->exprs().front().get(), [&plain](const Node *node)
+		{
+			if (node->type() == Node::Type::Function || node->type() == Node::Type::Ellipsis)
+				plain = false;
+			return plain;
+		});
+		if (plain)
+			b.value = list->exprs().front().get();
+		return b;
+	}
+
+	// nothing may leave the function, nor a loop around the call
+	bool statements = true;
+	Traversal::walk(&f->chunk(), [&statements](const Node *node)
+	{
+		if (node->type() == Node::Type::Return)
+			statements = false;
+		return statements && node->type() != Node::Type::Function;
+	});
+	Traversal::walk(&f->chunk(), [&statements](const Node *node)
+	{
+		switch (node->type()) {
+			case Node::Type::Break:
+				statements = false;
+				return false;
+			case Node::Type::Function:
+			case Node::Type::While:
+			case Node::Type::Repeat:
+			case Node::Type::For:
+			case Node::Type::ForEach:
+				return false;
+			default:
+				return statements;
+		}
+	});
+	b.statements = statements;
+	return b;
+}
+
+bool Inliner::trivial(const Node *arg) const
+{
+	if (arg->isValue())
+		return true;
+	if (!isName(arg))
+		return false;
+	const std::size_t v = m_analysis.binding(arg);
+	return v != None && m_analysis.variable(v).writes == 0;
+}
+
+// The arguments are evaluated once each and in the order of the call: only
+// one of them may be more than a constant or an unchanging local, used once
+// and before anything else in the value.
+bool Inliner::fitsExpression(const FunctionCall *call, const Function *f, const Node *value) const
+{
+	const std::size_t first = m_analysis.function(f).first;
+	const std::size_t count = f->params().names().size();
+	const auto &args = call->args().exprs();
+
+	// the results of a last call would go to several parameters
+	if (!args.empty() && isMulti(args.back().get()) && args.size() < count)
+		return false;
+
+	std::vector <unsigned> uses(count, 0);
+	Traversal::walk(value, [this, first, count, &uses](const Node *node)
+	{
+		if (isName(node)) {
+			const std::size_t v = m_analysis.binding(node);
+			if (v != None && v >= first && v < first + count)
+				++uses[v - first];
+		}
+		return true;
+	});
+
+	const Node *leading = leadingLeaf(value);
+	bool effects = false;
+	for (std::size_t i = 0; i < args.size(); ++i) {
+		const Node *arg = args[i].get();
+		if (trivial(arg))
+			continue;
+		if (i >= count || effects || uses[i] != 1)
+			return false;
+		if (!isName(leading) || m_analysis.binding(leading) != first + i)
+			return false;
+		// as the whole value a call would give all its results
+		if (leading == value && isMulti(arg))
+			return false;
+		effects = true;
+	}
+	return true;
+}
+
+Node * Inliner::replace(const Node *node)
+{
+	if (node->type() != Node::Type::FunctionCall)
+		return nullptr;
+	auto found = m_inline.find(node);
+	if (found == m_inline.end())
+		return nullptr;
+
+	auto call = static_cast<const FunctionCall *>(node);
+	auto f = static_cast<const Function *>(m_analysis.variable(found->second).value);
+	const Body &b = m_bodies.at(f);
+	const auto &params = f->params().names();
+	++m_inlined;
+
+	if (b.value && !(m_analysis.isStatement(call) && b.statements)) {
+		Substitution substitution{m_analysis, m_analysis.function(f).first, params.size(), call->args(), *this};
+		Node *value = copy(b.value, substitution);
+		// (f()) is still one value where f returns a call
+		if (call->isTruncated() && isMulti(value))
+			static_cast<FunctionCall *>(value)->setTruncated();
+		return value;
+	}
+
+	auto block = new Chunk;
+	if (!params.empty()) {
+		auto names = new ParamList;
+		for (const auto &name : params)
+			names->append(name);
+		block->append(new Assignment{names, static_cast<ExprList *>(copy(&call->args(), *this))}, Span{});
+	}
+	if (f->hasChunk()) {
+		for (const auto &statement : f->chunk().children())
+			block->append(copy(statement.get(), *this), Span{});
+	}
+	return block;
+}
+
+// A local declared in front of a loop.
+struct LoopLocal {
+	std::string name;
+	// the expression moved out of the loop
+	const Node *value;
+	// or the library field read, no field for a base function
+	std::string_view library;
+	std::string_view field;
+};
+
+// Moves invariant expressions and library reads out of loops, into locals
+// of a do block around the outermost loop they can go in front of.
+class LoopMotion : public Rewrite {
+public:
+	LoopMotion(Analysis &analysis, unsigned passes) : m_analysis{analysis}, m_passes{passes} {}
+
+	// Finds what to move.
+	void run(const Chunk &root) { block(&root); }
+
+	Node * replace(const Node *node) override;
+
+	unsigned hoisted() const { return m_hoisted; }
+	unsigned cached() const { return m_cached; }
+
+private:
+	void block(const Chunk *chunk);
+	void statement(const Node *s);
+	void expression(const Node *e);
+	void function(const Function *f);
+	void loop(const Node *loop, const Node *condition, const Chunk *body);
+
+	bool hoist(const Node *node);
+	bool cache(const Node *node);
+	// the local holding key in front of loop, empty if there is no room
+	std::string local(std::size_t loop, const std::string &key, LoopLocal value);
+	std::string key(const Node *node) const;
+	std::string fresh(const std::string &base);
+
+	Analysis &m_analysis;
+	unsigned m_passes;
+	// loops of the function being walked, outermost first
+	std::vector <std::size_t> m_loops;
+	std::unordered_map <const Node *, std::vector <LoopLocal> > m_locals;
+	std::unordered_map <std::string, std::string> m_keys;
+	std::unordered_set <std::string> m_taken;
+	std::unordered_map <const Node *, std::string> m_replaced;
+	std::unordered_set <const Node *> m_wrapped;
+	unsigned m_hoisted = 0;
+	unsigned m_cached = 0;
+};
+
+void LoopMotion::block(const Chunk *chunk)
+{
+	if (!chunk)
+		return;
+	for (const auto &s : chunk->children()) {
+		if (s)
+			statement(s.get());
+	}
+}
+
+void LoopMotion::statement(const Node *s)
+{
+	switch (s->type()) {
+		case Node::Type::Assignment: {
+			auto a = static_cast<const Assignment *>(s);
+			expression(&a->exprList());
+			for (const auto &var : a->varList().vars()) {
+				if (var->tableExpr())
+					expression(var->tableExpr());
+				if (var->keyExpr())
+					expression(var->keyExpr());
+			}
+			break;
+		}
+		case Node::Type::Function:
+			function(static_cast<const Function *>(s));
+			break;
+		case Node::Type::Chunk:
+			block(static_cast<const Chunk *>(s));
+			break;
+		case Node::Type::If:
+			for (auto i = static_cast<const If *>(s); i; i = i->nextIf()) {
+				expression(&i->condition());
+				block(static_cast<const Chunk *>(i->chunk()));
+				block(i->elseChunk());
+			}
+			break;
+		case Node::Type::While: {
+			auto w = static_cast<const While *>(s);
+			loop(w, &w->condition(), w->chunk());
+			break;
+		}
+		case Node::Type::Repeat: {
+			auto r = static_cast<const Repeat *>(s);
+			loop(r, &r->condition(), r->chunk());
+			break;
+		}
+		case Node::Type::For: {
+			// the bounds are evaluated once
+			auto f = static_cast<const For *>(s);
+			expression(&f->start());
+			expression(&f->limit());
+			if (f->step())
+				expression(f->step());
+			loop(f, nullptr, f->chunk());
+			break;
+		}
+		case Node::Type::ForEach: {
+			auto f = static_cast<const ForEach *>(s);
+			expression(&f->exprs());
+			loop(f, nullptr, f->chunk());
+			break;
+		}
+		default:
+			// a call statement stays a call
+			Traversal::forEachChild(s, [this](const Node *n) { expression(n); });
+			break;
+	}
+}
+
+void LoopMotion::loop(const Node *loop, const Node *condition, const Chunk *body)
+{
+	m_loops.push_back(m_analysis.loopOf(loop));
+	if (condition && loop->type() == Node::Type::While)
+		expression(condition);
+	block(body);
+	if (condition && loop->type() == Node::Type::Repeat)
+		expression(condition);
+	m_loops.pop_back();
+}
+
+void LoopMotion::expression(const Node *e)
+{
+	Traversal::walk(e, [this](const Node *node)
+	{
+		if (node->type() == Node::Type::Function) {
+			function(static_cast<const Function *>(node));
+			return false;
+		}
+		return m_loops.empty() || (!hoist(node) && !cache(node));
+	});
+}
+
+void LoopMotion::function(const Function *f)
+{
+	// loops of the function around run it, not the body
+	std::vector <std::size_t> loops;
+	std::swap(loops, m_loops);
+	if (f->hasChunk())
+		block(&f->chunk());
+	std::swap(loops, m_loops);
+}
+
+bool LoopMotion::hoist(const Node *node)
+{
+	if (!(m_passes & Optimizer::Hoist))
+		return false;
+	if (node->type() != Node::Type::BinOp && node->type() != Node::Type::UnOp && node->type() != Node::Type::FunctionCall)
+		return false;
+	if (m_analysis.type(node) == Type::Unknown)
+		return false;
+
+	// constants are folded by the compiler already
+	std::vector <std::size_t> variables;
+	bool calls = false;
+	Traversal::walk(node, [this, &variables, &calls](const Node *n)
+	{
+		// the globals of a typed expression are unchanged libraries
+		if (isName(n) && m_analysis.binding(n) != None)
+			variables.push_back(m_analysis.binding(n));
+		else if (n->type() == Node::Type::FunctionCall)
+			calls = true;
+		return true;
+	});
+	if (variables.empty() && !calls)
+		return false;
+
+	// the outermost loop none of them is declared in
+	for (std::size_t loop : m_loops) {
+		const bool invariant = std::none_of(variables.begin(), variables.end(), [this, loop](std::size_t v)
+		{
+			return m_analysis.within(m_analysis.variable(v).loop, loop);
+		});
+		if (!invariant)
+			continue;
+
+		std::string name = local(loop, key(node), LoopLocal{{}, node, {}, {}});
+		if (name.empty())
+			return false;
+		m_replaced[node] = std::move(name);
+		return true;
+	}
+	return false;
+}
+
+bool LoopMotion::cache(const Node *node)
+{
+	if (!(m_passes & Optimizer::Cache) || node->type() != Node::Type::LValue)
+		return false;
+
+	auto lv = static_cast<const LValue *>(node);
+	LoopLocal read{{}, nullptr, {}, {}};
+	if (lv->lvalueType() == LValue::Type::Name) {
+		if (m_analysis.binding(lv) != None || !m_analysis.isBaseFunction(lv->name()))
+			return false;
+		read.library = lv->name();
+	} else if (lv->lvalueType() == LValue::Type::Dot && isName(lv->tableExpr())) {
+		const std::string &table = nameOf(lv->tableExpr());
+		if (m_analysis.binding(lv->tableExpr()) != None || !m_analysis.isLibrary(table))
+			return false;
+		read.library = table;
+		read.field = lv->name();
+	} else {
+		return false;
+	}
+
+	std::string key{read.library};
+	key += '.';
+	key += read.field;
+	std::string name = local(m_loops.front(), key, read);
+	if (name.empty())
+		return false;
+
+	// a base function keeps its name, its local hides the global
+	if (!read.field.empty())
+		m_replaced[node] = std::move(name);
+	return true;
+}
+
+std::string LoopMotion::local(std::size_t loop, const std::string &key, LoopLocal value)
+{
+	const std::string fullKey = std::to_string(loop) + ' ' + key;
+	auto found = m_keys.find(fullKey);
+	if (found != m_keys.end())
+		return found->second;
+
+	auto &locals = m_locals[m_analysis.loop(loop).node];
+	if (locals.size() >= MaxLocals)
+		return {};
+
+	if (value.value) {
+		value.name = fresh("hoisted");
+		++m_hoisted;
+	} else {
+		value.name = value.field.empty() ? std::string{value.library} : fresh(std::string{value.library} + '_' + std::string{value.field});
+		++m_cached;
+	}
+	locals.push_back(value);
+	m_keys.emplace(fullKey, value.name);
+	return value.name;
+}
+
+// Equal for expressions computing the same from the same variables.
+std::string LoopMotion::key(const Node *node) const
+{
+	std::string key;
+	Traversal::walk(node, [this, &key](const Node *n)
+	{
+		key += std::to_string(static_cast<int>(n->type()));
+		switch (n->type()) {
+			case Node::Type::BinOp:
+				key += ':' + std::to_string(static_cast<int>(static_cast<const BinOp *>(n)->binOpType()));
+				break;
+			case Node::Type::UnOp:
+				key += ':' + std::to_string(static_cast<int>(static_cast<const UnOp *>(n)->unOpType()));
+				break;
+			case Node::Type::ExprList:
+				key += ':' + std::to_string(static_cast<const ExprList *>(n)->exprs().size());
+				break;
+			case Node::Type::LValue: {
+				auto lv = static_cast<const LValue *>(n);
+				if (lv->lvalueType() == LValue::Type::Name)
+					key += '#' + std::to_string(m_analysis.binding(n));
+				else
+					key += '.' + lv->name();
+				break;
+			}
+			case Node::Type::Value: {
+				auto v = static_cast<const Value *>(n);
+				key += ':' + std::to_string(static_cast<int>(v->valueType())) + ':';
+				if (v->valueType() == ValueType::Integer) {
+					key += std::to_string(static_cast<const IntValue *>(v)->value());
+				} else if (v->valueType() == ValueType::Real) {
+					const double d = static_cast<const RealValue *>(v)->value();
+					char bytes[sizeof(d)];
+					std::memcpy(bytes, &d, sizeof(d));
+					key.append(bytes, sizeof(bytes));
+				} else if (v->valueType() == ValueType::String) {
+					const std::string &s = static_cast<const StringValue *>(v)->value();
+					key += std::to_string(s.size()) + ':' + s;
+				} else if (v->valueType() == ValueType::Boolean) {
+					key += static_cast<const BooleanValue *>(v)->value() ? '1' : '0';
+				}
+				break;
+			}
+			default:
+				break;
+		}
+		key += ' ';
+		return true;
+	});
+	return key;
+}
+
+// A name no identifier of the file has.
+std::string LoopMotion::fresh(const std::string &base)
+{
+	std::string name = base;
+	for (unsigned i = 1; m_analysis.used(name) || !m_taken.insert(name).second; ++i)
+		name = base + std::to_string(i);
+	return name;
+}
+
+Node * LoopMotion::replace(const Node *node)
+{
+	auto locals = m_locals.find(node);
+	if (locals != m_locals.end() && m_wrapped.insert(node).second) {
+		Rewrite plain;
+		auto wrapper = new Chunk;
+		for (const auto &local : locals->second) {
+			auto names = new ParamList;
+			names->append(local.name);
+			auto values = new ExprList;
+			if (local.value)
+				values->append(copy(local.value, plain));
+			else if (local.field.empty())
+				values->append(new LValue{std::string{local.library}});
+			else
+				values->append(new LValue{new LValue{std::string{local.library}}, std::string{local.field}});
+			wrapper->append(new Assignment{names, values}, Span{});
+		}
+		// the loop itself, with what it reads replaced
+		wrapper->append(copy(node, *this), Span{});
+		return wrapper;
+	}
+
+	auto replaced = m_replaced.find(node);
+	if (replaced != m_replaced.end())
+		return new LValue{replaced->second};
+	return nullptr;
+}
+
+}
+
+bool Optimizer::select(std::string_view names)
+{
+	static const std::pair <const char *, Pass> Passes[] = {
+		{"inline", Inline},
+		{"hoist", Hoist},
+		{"cache", Cache},
+	};
+
+	if (names.empty()) {
+		m_passes = AllPasses;
+		return true;
+	}
+
+	m_passes = 0;
+	while (!names.empty()) {
+		const std::size_t comma = std::min(names.find(','), names.size());
+		const std::string_view name = names.substr(0, comma);
+		names.remove_prefix(std::min(comma + 1, names.size()));
+
+		auto pass = std::find_if(std::begin(Passes), std::end(Passes), [name](const auto &p) { return name == p.first; });
+		if (pass == std::end(Passes)) {
+			std::cerr << "Unknown optimizer pass: " << name << '\n';
+			return false;
+		}
+		m_passes |= pass->second;
+	}
+
+	return true;
+}
+
+std::unique_ptr <Chunk> Optimizer::run(const Chunk &root)
+{
+	Rewrite plain;
+	std::unique_ptr <Chunk> result;
+
+	// every pass works on the tree the one before made
+	if (m_passes & Inline) {
+		Analysis analysis{root, m_inlineLimit};
+		if (analysis.dynamic())
+			return std::unique_ptr <Chunk>{static_cast<Chunk *>(copy(&root, plain))};
+
+		Inliner inliner{analysis};
+		inliner.plan();
+		result.reset(static_cast<Chunk *>(copy(&root, inliner)));
+		m_stats.inlined += inliner.inlined();
+	}
+
+	if (m_passes & (Hoist | Cache)) {
+		const Chunk &tree = result ? *result : root;
+		Analysis analysis{tree, 0};
+		if (analysis.dynamic())
+			return std::unique_ptr <Chunk>{static_cast<Chunk *>(copy(&tree, plain))};
+
+		LoopMotion motion{analysis, m_passes};
+		motion.run(tree);
+		std::unique_ptr <Chunk> moved{static_cast<Chunk *>(copy(&tree, motion))};
+		result = std::move(moved);
+		m_stats.hoisted += motion.hoisted();
+		m_stats.cached += motion.cached();
+	}
+
+	if (!result)
+		result.reset(static_cast<Chunk *>(copy(&root, plain)));
+	return result;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string_view>
+
+#include "AST.hpp"
+
+// Rewrites a tree into one which runs faster on an interpreter without a
+// JIT, to be written out with LuaEmitter. Every pass proves from the tree
+// alone that it keeps what the program does:
+//
+// - inline replaces calls of small local functions which are never
+//   reassigned and do not call themselves by their body, with parameters
+//   bound to the arguments in an order the call would use;
+// - hoist moves expressions out of loops whose operands are locals never
+//   assigned after their declaration and known to be numbers or strings,
+//   so they can neither fail nor call a metamethod;
+// - cache reads the standard library functions a loop uses into locals in
+//   front of it, for libraries the file never assigns nor passes around.
+//
+// New locals go into a do block around the loop. Files using the debug
+// library, load, setfenv, _G or _ENV are copied unchanged, and other
+// modules are assumed not to replace standard library functions.
+class Optimizer {
+public:
+	enum Pass : unsigned {
+		Inline = 1,
+		Hoist = 2,
+		Cache = 4,
+		AllPasses = Inline | Hoist | Cache,
+	};
+
+	struct Stats {
+		unsigned inlined = 0;
+		unsigned hoisted = 0;
+		unsigned cached = 0;
+	};
+
+	// function bodies of at most this many nodes are inlined
+	static constexpr std::size_t DefaultInlineLimit = 32;
+
+	explicit Optimizer(unsigned passes = AllPasses) : m_passes{passes} {}
+
+	// Comma separated pass names; false if one is unknown.
+	bool select(std::string_view names);
+	void setInlineLimit(std::size_t nodes) { m_inlineLimit = nodes; }
+
+	// A rewritten copy of root, which is left as it is. Statements staying
+	// in their chunk keep their spans, the others have empty ones.
+	std::unique_ptr <Chunk> run(const Chunk &root);
+
+	// counts of everything run() changed so far
+	const Stats & stats() const { return m_stats; }
+
+private:
+	unsigned m_passes;
+	std::size_t m_inlineLimit = DefaultInlineLimit;
+	Stats m_stats;
+};
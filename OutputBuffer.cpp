@@ -0,0 +1,115 @@
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+
+#include <unistd.h>
+
+#include "OutputBuffer.hpp"
+
+OutputBuffer::OutputBuffer(int fd, std::size_t capacity)
+	: m_buffer(capacity), m_fd{fd}
+{
+}
+
+OutputBuffer::OutputBuffer(std::string &sink, std::size_t capacity)
+	: m_buffer(capacity), m_sink{&sink}
+{
+}
+
+OutputBuffer::~OutputBuffer()
+{
+	flush();
+}
+
+void OutputBuffer::repeat(char c, std::size_t count)
+{
+	while (count > 0) {
+		if (m_used == m_buffer.size())
+			flush();
+		const std::size_t n = std::min(count, m_buffer.size() - m_used);
+		std::memset(m_buffer.data() + m_used, c, n);
+		m_used += n;
+		count -= n;
+	}
+}
+
+void OutputBuffer::writeInt(long value)
+{
+	char buf[24];
+	const auto result = std::to_chars(buf, buf + sizeof(buf), value);
+	write(buf, result.ptr - buf);
+}
+
+// Same digits as the default std::ostream formatting (%g, precision 6)
+void OutputBuffer::writeReal(double value)
+{
+	char buf[32];
+	const auto result = std::to_chars(buf, buf + sizeof(buf), value, std::chars_format::general, 6);
+	write(buf, result.ptr - buf);
+}
+
+// Shortest representation that reads back to the same double
+void OutputBuffer::writeShortestReal(double value)
+{
+	char buf[32];
+	const auto result = std::to_chars(buf, buf + sizeof(buf), value);
+	write(buf, result.ptr - buf);
+}
+
+void OutputBuffer::writeJsonString(std::string_view s)
+{
+	static const char Hex[] = "0123456789abcdef";
+
+	put('"');
+	std::size_t plain = 0;
+	for (std::size_t i = 0; i < s.size(); ++i) {
+		const unsigned char c = s[i];
+		if (c >= 0x20 && c != '"' && c != '\\')
+			continue;
+
+		write(s.data() + plain, i - plain);
+		plain = i + 1;
+
+		put('\\');
+		switch (c) {
+			case '"': put('"'); break;
+			case '\\': put('\\'); break;
+			case '\n': put('n'); break;
+			case '\r': put('r'); break;
+			case '\t': put('t'); break;
+			default: {
+				const char esc[] = {'u', '0', '0', Hex[c >> 4], Hex[c & 0xF]};
+				write(esc, sizeof(esc));
+			}
+		}
+	}
+	write(s.data() + plain, s.size() - plain);
+	put('"');
+}
+
+void OutputBuffer::drain(const char *s, std::size_t length)
+{
+	if (m_sink) {
+		m_sink->append(s, length);
+		return;
+	}
+
+	while (length > 0) {
+		const ssize_t written = ::write(m_fd, s, length);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			m_failed = true;
+			return;
+		}
+		s += written;
+		length -= written;
+	}
+}
+
+bool OutputBuffer::flush()
+{
+	drain(m_buffer.data(), m_used);
+	m_used = 0;
+	return !m_failed;
+}
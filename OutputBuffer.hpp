@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Large reusable output buffer. Everything written to it is collected in a
+// fixed size block which is handed over to the sink (a file descriptor or an
+// in-memory string) only when it fills up or on flush(). No iostream is
+// involved, numbers are formatted with std::to_chars.
+class OutputBuffer {
+public:
+	static constexpr std::size_t DefaultCapacity = 1 << 16;
+
+	explicit OutputBuffer(int fd, std::size_t capacity = DefaultCapacity);
+	explicit OutputBuffer(std::string &sink, std::size_t capacity = DefaultCapacity);
+	~OutputBuffer();
+
+	OutputBuffer(const OutputBuffer &) = delete;
+	OutputBuffer & operator = (const OutputBuffer &) = delete;
+
+	void put(char c)
+	{
+		if (m_used == m_buffer.size())
+			flush();
+		m_buffer[m_used++] = c;
+	}
+
+	void write(const char *s, std::size_t length)
+	{
+		if (length > m_buffer.size() - m_used) {
+			flush();
+			if (length > m_buffer.size()) {
+				drain(s, length);
+				return;
+			}
+		}
+		std::memcpy(m_buffer.data() + m_used, s, length);
+		m_used += length;
+	}
+
+	void write(std::string_view s) { write(s.data(), s.size()); }
+
+	void repeat(char c, std::size_t count);
+	void indent(int depth) { repeat('\t', depth); }
+
+	void writeInt(long value);
+	void writeReal(double value);
+	void writeShortestReal(double value);
+
+	// Writes s as a JSON string literal, including the surrounding quotes.
+	void writeJsonString(std::string_view s);
+
+	bool flush();
+	bool failed() const { return m_failed; }
+
+private:
+	void drain(const char *s, std::size_t length);
+
+	std::vector <char> m_buffer;
+	std::size_t m_used = 0;
+	int m_fd = -1;
+	std::string *m_sink = nullptr;
+	bool m_failed = false;
+};
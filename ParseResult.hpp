@@ -0,0 +1,44 @@
+#pragma once
+
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "AST.hpp"
+#include "location.hh"
+
+struct Diagnostic {
+	yy::location location;
+	std::string message;
+};
+
+inline std::ostream & operator << (std::ostream &os, const Diagnostic &d)
+{
+	return os << d.location << " : " << d.message;
+}
+
+// Everything a single parse produced. The result owns the file name all of
+// its locations point to, so it stays valid after the Driver moved on to
+// the next input.
+struct ParseResult {
+	std::unique_ptr <std::string> filename;
+	std::vector <std::unique_ptr <Chunk> > chunks;
+	std::vector <Diagnostic> diagnostics;
+
+	// Kept for parses of in-memory sources, Driver::reparse() edits it.
+	std::string source;
+	// Statement spans are byte exact, see Preprocessor::regularLines().
+	bool exactSpans = false;
+
+	bool success() const { return diagnostics.empty(); }
+	const Chunk * chunk() const { return chunks.empty() ? nullptr : chunks.front().get(); }
+};
+
+// Replaces removed bytes at offset with inserted. Offsets of a list of edits
+// refer to the text after the preceding edits were applied.
+struct TextEdit {
+	std::size_t offset;
+	std::size_t removed;
+	std::string inserted;
+};
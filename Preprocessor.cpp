@@ -1,17 +1,69 @@
 #include <iostream>
 #include <iterator>
+#include <type_traits>
 
 #include "Preprocessor.hpp"
 
+namespace {
+
+// Characters no token starts with, the scanners skip them without moving
+// the column. '~' only starts "~=".
+constexpr bool unmatched(char c)
+{
+	switch (c) {
+		case '!': case '$': case '&': case '?': case '@': case '\\': case '`': case '|':
+			return true;
+		default:
+			return static_cast<unsigned char>(c) >= 0x7F || (c < ' ' && c != '\t' && c != '\n' && c != '\r');
+	}
+}
+
+// Characters outside of string literals which the loop below can copy
+// without a look at them: no comment, string, '\r' or '~' starts with them
+// and the scanners don't skip them.
+struct PlainTable {
+	bool plain[256] = {};
+
+	constexpr PlainTable()
+	{
+		for (int c = 0; c < 256; ++c) {
+			const char ch = static_cast<char>(c);
+			plain[c] = !unmatched(ch) && ch != '-' && ch != '\'' && ch != '"' && ch != '\r' && ch != '~';
+		}
+	}
+};
+
+constexpr PlainTable Plain;
+
+}
+
 bool Preprocessor::preprocess()
 {
-	std::istreambuf_iterator<char> p{m_input->rdbuf()};
-	const std::istreambuf_iterator<char> EOFIter;
+	if (m_source) {
+		const std::string_view source = *m_source;
+		m_source.reset();
+		return preprocess(source.data(), source.data() + source.size());
+	}
+	// an in-memory source ends once it is read
+	if (!m_input)
+		return false;
+
+	return preprocess(std::istreambuf_iterator<char>{m_input->rdbuf()}, std::istreambuf_iterator<char>{});
+}
 
+template <typename Iter>
+bool Preprocessor::preprocess(Iter p, const Iter EOFIter)
+{
+	// the scanner asks again at the end of a stream, the text and what is
+	// known about it stay for the spans
 	if (p == EOFIter)
 		return false;
 
-	std::string result;
+	// build straight into m_data, so a reused Preprocessor keeps its buffer
+	std::string &result = m_data;
+	result.clear();
+	m_balanced = true;
+	m_regularLines = true;
 	char stringDelim = 0;
 
 	auto step = [this, &p]
@@ -53,14 +105,36 @@ bool Preprocessor::preprocess()
 	};
 
 	while (p != EOFIter) {
+		// in-memory input is copied a run of ordinary characters at a time
+		if constexpr (std::is_pointer_v<Iter>) {
+			const Iter begin = p;
+			if (stringDelim != 0) {
+				while (p != EOFIter && *p != stringDelim && *p != '\\' && *p != '\n')
+					++p;
+			} else if (result.empty() || (result.back() != '\r' && result.back() != '~')) {
+				while (p != EOFIter && Plain.plain[static_cast<unsigned char>(*p)])
+					++p;
+			}
+
+			if (p != begin) {
+				result.append(begin, p);
+				m_position += p - begin;
+				continue;
+			}
+		}
+
 		if (stringDelim != 0) {
 			if (*p == '\\') {
 				result.push_back(step());
 				if (p != EOFIter)
 					result.push_back(step());
+				if (result.back() == '\n')
+					m_regularLines = false;
 				continue;
 			}
 
+			if (*p == '\n')
+				m_regularLines = false;
 			result.push_back(*p);
 			if (*p == stringDelim)
 				stringDelim = 0;
@@ -105,7 +179,8 @@ bool Preprocessor::preprocess()
 				}
 
 				if (!endComment) {
-					std::cerr << "Error parsing long comment (EOF reached) started at: " << commentStart;
+					m_error = "Error parsing long comment (EOF reached)";
+					m_errorPosition = commentStart;
 					return false;
 				}
 
@@ -117,17 +192,32 @@ bool Preprocessor::preprocess()
 				m_position.lines(1);
 			}
 		} else {
+			if ((*p != '\n' && !result.empty() && result.back() == '\r') || unmatched(*p)
+				|| (*p != '=' && !result.empty() && result.back() == '~'))
+				m_regularLines = false;
 			if (*p == '\'' || *p == '"')
 				stringDelim = *p;
 			result.push_back(step());
 		}
 	}
 
-	m_data = std::move(result);
-
+	if (!result.empty() && (result.back() == '\r' || result.back() == '~'))
+		m_regularLines = false;
+	m_balanced = stringDelim == 0;
 	return true;
 }
 
+void Preprocessor::reset()
+{
+	m_input = &std::cin;
+	m_source.reset();
+	m_data.clear();
+	m_error.clear();
+	m_balanced = true;
+	m_regularLines = true;
+	setg(nullptr, nullptr, nullptr);
+}
+
 void Preprocessor::setInputFile(const std::string &filename, std::istream *input)
 {
 	m_filename = filename;
@@ -135,6 +225,14 @@ void Preprocessor::setInputFile(const std::string &filename, std::istream *input
 	m_input = input;
 }
 
+void Preprocessor::setInput(const std::string &filename, std::string_view source)
+{
+	m_filename = filename;
+	m_position.initialize(&m_filename);
+	m_input = nullptr;
+	m_source = source;
+}
+
 int Preprocessor::underflow()
 {
 	if (!preprocess())
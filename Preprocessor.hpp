@@ -1,7 +1,9 @@
 #pragma once
 
 #include <iosfwd>
+#include <optional>
 #include <string>
+#include <string_view>
 
 #include "position.hh"
 
@@ -13,13 +15,34 @@ public:
 
 	const std::string & data() const { return m_data; }
 	bool preprocess();
+	void reset();
 	void setInputFile(const std::string &filename, std::istream *input);
+	void setInput(const std::string &filename, std::string_view source);
+
+	const std::string & error() const { return m_error; }
+	const yy::position & errorPosition() const { return m_errorPosition; }
+
+	// False if the last input ended inside a string literal.
+	bool balanced() const { return m_balanced; }
+	// False if token positions can't be mapped back to byte offsets with a
+	// line table: a string literal spans lines, or a lone '\r' or another
+	// character the scanners drop was skipped.
+	bool regularLines() const { return m_regularLines; }
 
 private:
 	int underflow();
 
+	template <typename Iter>
+	bool preprocess(Iter p, const Iter EOFIter);
+
+	// null for an in-memory source, standard input until an input is set
 	std::istream *m_input = &std::cin;
+	std::optional <std::string_view> m_source;
 	std::string m_filename;
 	std::string m_data;
+	std::string m_error;
 	yy::position m_position;
+	yy::position m_errorPosition;
+	bool m_balanced = true;
+	bool m_regularLines = true;
 };
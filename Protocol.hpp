@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include <unistd.h>
+
+// Framing used by the parse server: every message is a 4 byte little endian
+// payload length followed by the payload.
+//
+// Request payload:  "<id> <command> [<format>]\n<body>"
+// Response payload: "<id> ok|error <latency in microseconds>\n<body>"
+//
+// Commands: parse (body is Lua source), parse-file (body is a path),
+// profile, profile-file (memory profile instead of a dump), stats, shutdown.
+// Formats: none (diagnostics only), text, json, sexpr.
+namespace Protocol {
+
+constexpr std::uint32_t MaxFrameSize = 256u << 20;
+
+inline bool readFull(int fd, char *buf, std::size_t length)
+{
+	while (length > 0) {
+		const ssize_t n = ::read(fd, buf, length);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		buf += n;
+		length -= n;
+	}
+	return true;
+}
+
+inline bool writeFull(int fd, const char *buf, std::size_t length)
+{
+	while (length > 0) {
+		const ssize_t n = ::write(fd, buf, length);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		buf += n;
+		length -= n;
+	}
+	return true;
+}
+
+inline bool readFrame(int fd, std::string &payload)
+{
+	unsigned char header[4];
+	if (!readFull(fd, reinterpret_cast<char *>(header), sizeof(header)))
+		return false;
+
+	const std::uint32_t length = header[0] | header[1] << 8 | header[2] << 16 | static_cast<std::uint32_t>(header[3]) << 24;
+	if (length > MaxFrameSize)
+		return false;
+
+	payload.resize(length);
+	return readFull(fd, payload.data(), length);
+}
+
+inline bool writeFrame(int fd, std::string_view payload)
+{
+	const std::uint32_t length = payload.size();
+	const char header[4] = {
+		static_cast<char>(length & 0xFF),
+		static_cast<char>(length >> 8 & 0xFF),
+		static_cast<char>(length >> 16 & 0xFF),
+		static_cast<char>(length >> 24 & 0xFF),
+	};
+	return writeFull(fd, header, sizeof(header)) && writeFull(fd, payload.data(), payload.size());
+}
+
+}
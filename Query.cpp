@@ -0,0 +1,818 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+
+#include "Query.hpp"
+#include "Traversal.hpp"
+
+namespace {
+
+// Node heads as --dump=sexpr writes them. Values have one each so literal
+// patterns can be indexed too.
+namespace Head {
+	enum : std::uint8_t {
+		Chunk,
+		Exprs,
+		Vars,
+		Params,
+		Vararg,
+		Name,
+		Dot,
+		Index,
+		Call,
+		MethodCall,
+		Local,
+		Set,
+		Nil,
+		True,
+		False,
+		String,
+		Integer,
+		Real,
+		Table,
+		Field,
+		Item,
+		Break,
+		Return,
+		Function,
+		LocalFunction,
+		If,
+		While,
+		Repeat,
+		For,
+		ForEach,
+		// BinOp::Type from here
+		BinOp,
+		// UnOp::Type from here
+		UnOp = BinOp + 15,
+		Count = UnOp + 3,
+	};
+}
+
+const char * const HeadNames[] = {"chunk", "exprs", "vars", "params", "vararg", "name", "dot", "index", "call", "method-call",
+	"local", "set", "nil", "true", "false", "string", "integer", "real", "table", "field", "item", "break", "return", "function",
+	"local-function", "if", "while", "repeat", "for", "for-each",
+	"or", "and", "==", "~=", "<", "<=", ">", ">=", "..", "+", "-", "*", "/", "%", "^",
+	"-", "not", "#"};
+
+static_assert(sizeof(HeadNames) / sizeof(HeadNames[0]) == Head::Count);
+
+std::uint8_t headOf(const Node *node)
+{
+	switch (node->type()) {
+		case Node::Type::Chunk:
+			return Head::Chunk;
+		case Node::Type::ExprList:
+			return Head::Exprs;
+		case Node::Type::VarList:
+			return Head::Vars;
+		case Node::Type::ParamList:
+			return Head::Params;
+		case Node::Type::Ellipsis:
+			return Head::Vararg;
+		case Node::Type::LValue:
+			switch (static_cast<const LValue *>(node)->lvalueType()) {
+				case LValue::Type::Name:
+					return Head::Name;
+				case LValue::Type::Dot:
+					return Head::Dot;
+				default:
+					return Head::Index;
+			}
+		case Node::Type::FunctionCall:
+			return Head::Call;
+		case Node::Type::MethodCall:
+			return Head::MethodCall;
+		case Node::Type::Assignment:
+			return static_cast<const Assignment *>(node)->isLocal() ? Head::Local : Head::Set;
+		case Node::Type::Value: {
+			auto v = static_cast<const Value *>(node);
+			switch (v->valueType()) {
+				case ValueType::Boolean:
+					return static_cast<const BooleanValue *>(v)->value() ? Head::True : Head::False;
+				case ValueType::String:
+					return Head::String;
+				case ValueType::Integer:
+					return Head::Integer;
+				case ValueType::Real:
+					return Head::Real;
+				default:
+					return Head::Nil;
+			}
+		}
+		case Node::Type::TableCtor:
+			return Head::Table;
+		case Node::Type::Field:
+			return static_cast<const Field *>(node)->fieldType() == Field::Type::NoIndex ? Head::Item : Head::Field;
+		case Node::Type::BinOp:
+			return Head::BinOp + toUnderlying(static_cast<const BinOp *>(node)->binOpType());
+		case Node::Type::UnOp:
+			return Head::UnOp + toUnderlying(static_cast<const UnOp *>(node)->unOpType());
+		case Node::Type::Break:
+			return Head::Break;
+		case Node::Type::Return:
+			return Head::Return;
+		case Node::Type::Function:
+			return static_cast<const Function *>(node)->isLocal() ? Head::LocalFunction : Head::Function;
+		case Node::Type::If:
+			return Head::If;
+		case Node::Type::While:
+			return Head::While;
+		case Node::Type::Repeat:
+			return Head::Repeat;
+		case Node::Type::For:
+			return Head::For;
+		default:
+			return Head::ForEach;
+	}
+}
+
+// A child of a node as the patterns see it.
+struct Item {
+	enum class Kind : std::uint8_t {
+		Node,
+		Atom,
+		// the full name of node, made on demand
+		FunctionName,
+	};
+
+	Kind kind;
+	// for atoms the node they belong to, which is what capturing one binds
+	const Node *node;
+	std::string_view atom;
+};
+
+// The text of a string literal without its quotes or long brackets.
+std::string_view stringText(std::string_view s)
+{
+	if (s.size() >= 2 && (s[0] == '"' || s[0] == '\'') && s.back() == s[0])
+		return s.substr(1, s.size() - 2);
+	if (s.size() >= 2 && s[0] == '[') {
+		const std::size_t open = s.find('[', 1);
+		if (open != std::string_view::npos && s.size() >= 2 * (open + 1))
+			return s.substr(open + 1, s.size() - 2 * (open + 1));
+	}
+	return s;
+}
+
+// The children of node in the order of --dump=sexpr.
+void items(const Node *node, std::vector <Item> &out)
+{
+	out.clear();
+	auto child = [&out](const Node *n) { out.push_back(Item{Item::Kind::Node, n, {}}); };
+	auto atom = [&out, node](std::string_view s) { out.push_back(Item{Item::Kind::Atom, node, s}); };
+	auto all = [&child](const auto &nodes)
+	{
+		for (const auto &n : nodes)
+			child(n.get());
+	};
+
+	switch (node->type()) {
+		case Node::Type::Chunk:
+			all(static_cast<const Chunk *>(node)->children());
+			break;
+		case Node::Type::ExprList:
+			all(static_cast<const ExprList *>(node)->exprs());
+			break;
+		case Node::Type::VarList:
+			all(static_cast<const VarList *>(node)->vars());
+			break;
+		case Node::Type::ParamList:
+			for (const auto &name : static_cast<const ParamList *>(node)->names())
+				atom(name);
+			break;
+		case Node::Type::LValue: {
+			auto lv = static_cast<const LValue *>(node);
+			switch (lv->lvalueType()) {
+				case LValue::Type::Name:
+					atom(lv->name());
+					break;
+				case LValue::Type::Dot:
+					child(lv->tableExpr());
+					atom(lv->name());
+					break;
+				default:
+					child(lv->tableExpr());
+					child(lv->keyExpr());
+					break;
+			}
+			break;
+		}
+		case Node::Type::FunctionCall: {
+			auto call = static_cast<const FunctionCall *>(node);
+			child(&call->functionExpr());
+			child(&call->args());
+			break;
+		}
+		case Node::Type::MethodCall: {
+			auto call = static_cast<const MethodCall *>(node);
+			child(&call->functionExpr());
+			atom(call->methodName());
+			child(&call->args());
+			break;
+		}
+		case Node::Type::Assignment: {
+			auto a = static_cast<const Assignment *>(node);
+			child(&a->varList());
+			child(&a->exprList());
+			break;
+		}
+		case Node::Type::Value:
+			if (static_cast<const Value *>(node)->valueType() == ValueType::String)
+				atom(stringText(static_cast<const StringValue *>(node)->value()));
+			break;
+		case Node::Type::TableCtor:
+			all(static_cast<const TableCtor *>(node)->fields());
+			break;
+		case Node::Type::Field: {
+			auto f = static_cast<const Field *>(node);
+			if (f->fieldType() == Field::Type::Brackets)
+				child(f->keyExpr());
+			else if (f->fieldType() == Field::Type::Literal)
+				atom(f->fieldName());
+			child(f->valueExpr());
+			break;
+		}
+		case Node::Type::BinOp: {
+			auto op = static_cast<const BinOp *>(node);
+			child(&op->left());
+			child(&op->right());
+			break;
+		}
+		case Node::Type::UnOp:
+			child(&static_cast<const UnOp *>(node)->operand());
+			break;
+		case Node::Type::Return:
+			if (auto exprs = static_cast<const Return *>(node)->exprList())
+				child(exprs);
+			break;
+		case Node::Type::Function: {
+			auto f = static_cast<const Function *>(node);
+			out.push_back(Item{Item::Kind::FunctionName, node, {}});
+			child(f->hasParams() ? &f->params() : nullptr);
+			child(f->hasChunk() ? &f->chunk() : nullptr);
+			break;
+		}
+		case Node::Type::If: {
+			auto i = static_cast<const If *>(node);
+			child(&i->condition());
+			child(i->chunk());
+			child(i->nextIf());
+			child(i->elseChunk());
+			break;
+		}
+		case Node::Type::While: {
+			auto w = static_cast<const While *>(node);
+			child(&w->condition());
+			child(w->chunk());
+			break;
+		}
+		case Node::Type::Repeat: {
+			auto r = static_cast<const Repeat *>(node);
+			child(r->chunk());
+			child(&r->condition());
+			break;
+		}
+		case Node::Type::For: {
+			auto f = static_cast<const For *>(node);
+			atom(f->iterator());
+			child(&f->start());
+			child(&f->limit());
+			child(f->step());
+			child(f->chunk());
+			break;
+		}
+		case Node::Type::ForEach: {
+			auto f = static_cast<const ForEach *>(node);
+			child(&f->iterators());
+			child(&f->exprs());
+			child(f->chunk());
+			break;
+		}
+		default:
+			break;
+	}
+}
+
+}
+
+QuerySet::StringId QuerySet::intern(std::string_view s)
+{
+	const auto it = m_stringIds.find(s);
+	if (it != m_stringIds.end())
+		return it->second;
+
+	m_strings.emplace_back(s);
+	const StringId id = m_strings.size() - 1;
+	m_stringIds.emplace(m_strings.back(), id);
+	return id;
+}
+
+class QuerySet::Parser {
+public:
+	Parser(QuerySet &set, std::string_view text) : m_set{set}, m_text{text} {}
+
+	bool parse()
+	{
+		for (;;) {
+			skip();
+			if (m_pos == m_text.size())
+				return true;
+
+			const std::size_t begin = m_pos;
+			m_captures.clear();
+			PatternId root;
+			if (!pattern(root, false))
+				return false;
+
+			Query query;
+			query.text.assign(m_text.substr(begin, m_pos - begin));
+			query.root = root;
+			query.captures = std::move(m_captures);
+			required(root, query.required);
+			std::sort(query.required.begin(), query.required.end());
+			query.required.erase(std::unique(query.required.begin(), query.required.end()), query.required.end());
+			m_set.m_queries.push_back(std::move(query));
+		}
+	}
+
+private:
+	static constexpr int MaxNesting = 256;
+
+	bool fail(const std::string &message)
+	{
+		m_set.m_error = "offset " + std::to_string(m_pos) + ": " + message;
+		return false;
+	}
+
+	void skip()
+	{
+		while (m_pos < m_text.size()) {
+			const char c = m_text[m_pos];
+			if (c == ';') {
+				while (m_pos < m_text.size() && m_text[m_pos] != '\n')
+					++m_pos;
+			} else if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+				++m_pos;
+			} else {
+				break;
+			}
+		}
+	}
+
+	std::string_view symbol()
+	{
+		const std::size_t begin = m_pos;
+		while (m_pos < m_text.size() && !std::strchr(" \t\r\n()\";@", m_text[m_pos]))
+			++m_pos;
+		return m_text.substr(begin, m_pos - begin);
+	}
+
+	PatternId add(Pattern::Kind kind)
+	{
+		Pattern p;
+		p.kind = kind;
+		m_set.m_patterns.push_back(p);
+		return m_set.m_patterns.size() - 1;
+	}
+
+	bool pattern(PatternId &id, bool inList)
+	{
+		skip();
+		if (m_pos == m_text.size())
+			return fail("pattern expected");
+
+		const char c = m_text[m_pos];
+		if (c == '(') {
+			if (!list(id))
+				return false;
+		} else if (c == '"') {
+			std::string s;
+			if (!string(s))
+				return false;
+			id = add(Pattern::Kind::String);
+			// a literal copied from --dump=sexpr keeps its quotes
+			m_set.m_patterns[id].string = m_set.intern(stringText(s));
+		} else {
+			const std::string_view atom = symbol();
+			if (atom.empty())
+				return fail(std::string{"unexpected '"} + c + '\'');
+			if (!this->atom(atom, inList, id))
+				return false;
+		}
+
+		// a capture, the text of a query ends before what follows otherwise
+		const std::size_t end = m_pos;
+		skip();
+		if (m_pos == m_text.size() || m_text[m_pos] != '@') {
+			m_pos = end;
+			return true;
+		}
+
+		++m_pos;
+		const std::string_view name = symbol();
+		if (name.empty())
+			return fail("capture name expected");
+		if (m_set.m_patterns[id].kind == Pattern::Kind::Rest)
+			return fail("... can't be captured");
+
+		auto it = std::find(m_captures.begin(), m_captures.end(), name);
+		m_set.m_patterns[id].capture = it - m_captures.begin();
+		if (it == m_captures.end())
+			m_captures.emplace_back(name);
+		return true;
+	}
+
+	bool atom(std::string_view atom, bool inList, PatternId &id)
+	{
+		if (atom == "_") {
+			id = add(Pattern::Kind::Any);
+		} else if (atom == "...") {
+			if (!inList)
+				return fail("... outside a list");
+			id = add(Pattern::Kind::Rest);
+		} else if (atom == "nil") {
+			id = add(Pattern::Kind::Nil);
+		} else if (atom == "true" || atom == "false") {
+			id = add(Pattern::Kind::Boolean);
+			m_set.m_patterns[id].boolean = atom == "true";
+		} else if (std::isdigit(static_cast<unsigned char>(atom[0])) || (atom.size() > 1 && atom[0] == '-')) {
+			const std::string s{atom};
+			char *end;
+			if (s.find_first_of(".eExX") == std::string::npos) {
+				const long value = std::strtol(s.c_str(), &end, 10);
+				id = add(Pattern::Kind::Integer);
+				m_set.m_patterns[id].integer = value;
+			} else {
+				const double value = std::strtod(s.c_str(), &end);
+				id = add(Pattern::Kind::Real);
+				m_set.m_patterns[id].real = value;
+			}
+			if (*end)
+				return fail("malformed number " + s);
+		} else {
+			return fail("unknown atom " + std::string{atom});
+		}
+		return true;
+	}
+
+	bool string(std::string &s)
+	{
+		for (++m_pos; m_pos < m_text.size(); ++m_pos) {
+			char c = m_text[m_pos];
+			if (c == '"') {
+				++m_pos;
+				return true;
+			}
+			if (c == '\\' && m_pos + 1 < m_text.size()) {
+				c = m_text[++m_pos];
+				if (c == 'n')
+					c = '\n';
+				else if (c == 't')
+					c = '\t';
+			}
+			s.push_back(c);
+		}
+		return fail("unfinished string");
+	}
+
+	bool list(PatternId &id)
+	{
+		if (++m_nesting > MaxNesting)
+			return fail("pattern nested too deeply");
+
+		++m_pos;
+		skip();
+		const std::string_view head = symbol();
+
+		Pattern p;
+		if (head == "has") {
+			p.kind = Pattern::Kind::Has;
+		} else if (head == "or") {
+			p.kind = Pattern::Kind::Or;
+		} else {
+			p.kind = Pattern::Kind::List;
+			for (std::uint8_t h = 0; h < Head::Count; ++h) {
+				if (head == HeadNames[h] && p.headCount < 2)
+					p.heads[p.headCount++] = h;
+			}
+			if (p.headCount == 0)
+				return fail("unknown head " + std::string{head});
+		}
+
+		// children are parsed into a scratch list first as they add patterns
+		// of their own
+		std::vector <PatternId> children;
+		for (;;) {
+			skip();
+			if (m_pos == m_text.size())
+				return fail("')' expected");
+			if (m_text[m_pos] == ')') {
+				++m_pos;
+				break;
+			}
+			PatternId child;
+			if (!pattern(child, p.kind == Pattern::Kind::List))
+				return false;
+			children.push_back(child);
+		}
+
+		if (p.kind == Pattern::Kind::Has && children.size() != 1)
+			return fail("has takes one pattern");
+		if (p.kind == Pattern::Kind::Or && children.empty())
+			return fail("or takes at least one pattern");
+
+		p.first = m_set.m_children.size();
+		m_set.m_children.insert(m_set.m_children.end(), children.begin(), children.end());
+		p.last = m_set.m_children.size();
+		m_set.m_patterns.push_back(p);
+		id = m_set.m_patterns.size() - 1;
+
+		--m_nesting;
+		return true;
+	}
+
+	// Strings that have to be in a tree for p to match anywhere in it.
+	void required(PatternId p, std::vector <StringId> &out) const
+	{
+		const Pattern &pattern = m_set.m_patterns[p];
+		if (pattern.kind == Pattern::Kind::String) {
+			out.push_back(pattern.string);
+		} else if (pattern.kind == Pattern::Kind::List || pattern.kind == Pattern::Kind::Has) {
+			for (std::uint32_t i = pattern.first; i < pattern.last; ++i)
+				required(m_set.m_children[i], out);
+		}
+	}
+
+	QuerySet &m_set;
+	std::string_view m_text;
+	std::size_t m_pos = 0;
+	int m_nesting = 0;
+	std::vector <std::string> m_captures;
+};
+
+bool QuerySet::add(std::string_view text)
+{
+	const std::size_t queries = m_queries.size();
+	const std::size_t patterns = m_patterns.size();
+	const std::size_t children = m_children.size();
+	m_error.clear();
+
+	if (Parser{*this, text}.parse())
+		return true;
+
+	m_queries.resize(queries);
+	m_patterns.resize(patterns);
+	m_children.resize(children);
+	return false;
+}
+
+// The nodes of a tree by head and the query strings in it.
+class QuerySet::Index {
+public:
+	struct Entry {
+		const Node *node;
+		Span statement;
+		std::uint32_t order;
+	};
+
+	Index(const QuerySet &set, const Chunk *root) : m_byHead(Head::Count), m_strings(set.m_strings.size(), false)
+	{
+		struct Pending {
+			const Node *node;
+			Span statement;
+		};
+
+		std::vector <Pending> stack;
+		if (root)
+			stack.push_back(Pending{root, Span{}});
+
+		std::vector <Item> children;
+		std::string name;
+		while (!stack.empty()) {
+			const Pending p = stack.back();
+			stack.pop_back();
+
+			const Entry entry{p.node, p.statement, static_cast<std::uint32_t>(m_all.size())};
+			m_all.push_back(entry);
+			m_byHead[headOf(p.node)].push_back(entry);
+
+			items(p.node, children);
+			for (const Item &item : children) {
+				if (item.kind == Item::Kind::Atom) {
+					mark(set, item.atom);
+				} else if (item.kind == Item::Kind::FunctionName) {
+					name = static_cast<const Function *>(item.node)->fullName();
+					mark(set, name);
+				}
+			}
+
+			// Statements of a chunk are relative to the statement the chunk
+			// belongs to, which is where everything else below it is.
+			const std::size_t size = stack.size();
+			if (p.node->type() == Node::Type::Chunk) {
+				auto chunk = static_cast<const Chunk *>(p.node);
+				const auto &spans = chunk->spans();
+				for (std::size_t i = 0; i < spans.size(); ++i) {
+					if (chunk->children()[i])
+						stack.push_back(Pending{chunk->children()[i].get(), Span{p.statement.begin + spans[i].begin, p.statement.begin + spans[i].end}});
+				}
+			} else {
+				Traversal::forEachChild(p.node, [&stack, &p](const Node *n) { stack.push_back(Pending{n, p.statement}); });
+			}
+			std::reverse(stack.begin() + size, stack.end());
+		}
+	}
+
+	bool contains(StringId s) const { return m_strings[s]; }
+	const std::vector <Entry> & all() const { return m_all; }
+	const std::vector <Entry> & byHead(std::uint8_t head) const { return m_byHead[head]; }
+
+private:
+	void mark(const QuerySet &set, std::string_view s)
+	{
+		const auto it = set.m_stringIds.find(s);
+		if (it != set.m_stringIds.end())
+			m_strings[it->second] = true;
+	}
+
+	std::vector <Entry> m_all;
+	std::vector <std::vector <Entry> > m_byHead;
+	std::vector <bool> m_strings;
+};
+
+class QuerySet::Matcher {
+public:
+	explicit Matcher(const QuerySet &set) : m_set{set} {}
+
+	std::vector <const Node *> captures;
+
+	bool match(PatternId id, const Item &item, std::size_t depth)
+	{
+		const Pattern &p = m_set.m_patterns[id];
+		if (!matchPattern(p, item, depth))
+			return false;
+		if (p.capture >= 0)
+			captures[p.capture] = item.node;
+		return true;
+	}
+
+private:
+	static const Value * value(const Item &item, ValueType type)
+	{
+		if (item.kind != Item::Kind::Node || !item.node || item.node->type() != Node::Type::Value)
+			return nullptr;
+		auto v = static_cast<const Value *>(item.node);
+		return v->valueType() == type ? v : nullptr;
+	}
+
+	bool matchPattern(const Pattern &p, const Item &item, std::size_t depth)
+	{
+		switch (p.kind) {
+			case Pattern::Kind::Any:
+				return true;
+			case Pattern::Kind::String:
+				if (item.kind == Item::Kind::Atom)
+					return item.atom == m_set.m_strings[p.string];
+				if (item.kind == Item::Kind::FunctionName)
+					return static_cast<const Function *>(item.node)->fullName() == m_set.m_strings[p.string];
+				if (auto v = value(item, ValueType::String))
+					return stringText(static_cast<const StringValue *>(v)->value()) == m_set.m_strings[p.string];
+				return false;
+			case Pattern::Kind::Integer: {
+				auto v = value(item, ValueType::Integer);
+				return v && static_cast<const IntValue *>(v)->value() == p.integer;
+			}
+			case Pattern::Kind::Real: {
+				auto v = value(item, ValueType::Real);
+				return v && static_cast<const RealValue *>(v)->value() == p.real;
+			}
+			case Pattern::Kind::Nil:
+				return item.kind == Item::Kind::Node && (!item.node || value(item, ValueType::Nil));
+			case Pattern::Kind::Boolean: {
+				auto v = value(item, ValueType::Boolean);
+				return v && static_cast<const BooleanValue *>(v)->value() == p.boolean;
+			}
+			case Pattern::Kind::List: {
+				if (item.kind != Item::Kind::Node || !item.node)
+					return false;
+				const std::uint8_t head = headOf(item.node);
+				if (head != p.heads[0] && (p.headCount < 2 || head != p.heads[1]))
+					return false;
+
+				if (m_scratch.size() <= depth)
+					m_scratch.resize(depth + 1);
+				std::vector <Item> &children = m_scratch[depth];
+				items(item.node, children);
+				return list(p.first, p.last, children, 0, depth + 1);
+			}
+			case Pattern::Kind::Has:
+				return has(m_set.m_children[p.first], item, depth);
+			case Pattern::Kind::Or:
+				for (std::uint32_t i = p.first; i < p.last; ++i) {
+					const auto saved = captures;
+					if (match(m_set.m_children[i], item, depth))
+						return true;
+					captures = saved;
+				}
+				return false;
+			default:
+				return false;
+		}
+	}
+
+	// Patterns [first, last) against children [at, end).
+	bool list(std::uint32_t first, std::uint32_t last, const std::vector <Item> &children, std::size_t at, std::size_t depth)
+	{
+		if (first == last)
+			return at == children.size();
+
+		const PatternId id = m_set.m_children[first];
+		if (m_set.m_patterns[id].kind == Pattern::Kind::Rest) {
+			if (first + 1 == last)
+				return true;
+			for (std::size_t i = at; i <= children.size(); ++i) {
+				const auto saved = captures;
+				if (list(first + 1, last, children, i, depth))
+					return true;
+				captures = saved;
+			}
+			return false;
+		}
+
+		if (at == children.size() || !match(id, children[at], depth))
+			return false;
+		return list(first + 1, last, children, at + 1, depth);
+	}
+
+	bool has(PatternId id, const Item &item, std::size_t depth)
+	{
+		if (item.kind != Item::Kind::Node || !item.node)
+			return false;
+
+		std::vector <const Node *> stack{item.node};
+		while (!stack.empty()) {
+			const Node *node = stack.back();
+			stack.pop_back();
+
+			const auto saved = captures;
+			if (match(id, Item{Item::Kind::Node, node, {}}, depth))
+				return true;
+			captures = saved;
+
+			const std::size_t size = stack.size();
+			Traversal::forEachChild(node, [&stack](const Node *n) { stack.push_back(n); });
+			std::reverse(stack.begin() + size, stack.end());
+		}
+		return false;
+	}
+
+	const QuerySet &m_set;
+	// children of the lists being matched, by depth; a deque keeps them in
+	// place while deeper levels are added
+	std::deque <std::vector <Item> > m_scratch;
+};
+
+std::vector <QueryMatch> QuerySet::run(const Chunk *root) const
+{
+	std::vector <QueryMatch> matches;
+	const Index index{*this, root};
+	Matcher matcher{*this};
+	std::vector <Index::Entry> merged;
+
+	for (std::uint32_t q = 0; q < m_queries.size(); ++q) {
+		const Query &query = m_queries[q];
+		if (!std::all_of(query.required.begin(), query.required.end(), [&index](StringId s) { return index.contains(s); }))
+			continue;
+
+		const Pattern &p = m_patterns[query.root];
+		const std::vector <Index::Entry> *candidates = &index.all();
+		if (p.kind == Pattern::Kind::List) {
+			candidates = &index.byHead(p.heads[0]);
+			if (p.headCount == 2) {
+				const auto &a = index.byHead(p.heads[0]);
+				const auto &b = index.byHead(p.heads[1]);
+				merged.clear();
+				std::merge(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(merged),
+					[](const Index::Entry &x, const Index::Entry &y) { return x.order < y.order; });
+				candidates = &merged;
+			}
+		} else if (p.kind == Pattern::Kind::Integer) {
+			candidates = &index.byHead(Head::Integer);
+		} else if (p.kind == Pattern::Kind::Real) {
+			candidates = &index.byHead(Head::Real);
+		} else if (p.kind == Pattern::Kind::Boolean) {
+			candidates = &index.byHead(p.boolean ? Head::True : Head::False);
+		}
+
+		for (const Index::Entry &entry : *candidates) {
+			matcher.captures.assign(query.captures.size(), nullptr);
+			if (matcher.match(query.root, Item{Item::Kind::Node, entry.node, {}}, 0))
+				matches.push_back(QueryMatch{q, entry.node, entry.statement, matcher.captures});
+		}
+	}
+
+	return matches;
+}
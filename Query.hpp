@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "AST.hpp"
+
+struct QueryMatch {
+	std::uint32_t query;
+	const Node *node;
+	// absolute byte range of the statement the node is in
+	Span statement;
+	// by capture index, null for captures the match did not bind
+	std::vector <const Node *> captures;
+};
+
+// Patterns over trees written like the output of --dump=sexpr:
+//
+//   (call (name "pcall") (exprs (function "<anonymous>" ...) ...))
+//   (for ... (has (call (dot (name "ngx") "say") _) @say))
+//
+// A list matches a node with the head given and exactly the children
+// listed, "..." stands for any number of them. Children are patterns,
+// strings (names, fields, methods, function names and the text of string
+// literals), numbers, nil, true and false. _ matches anything, (has P) a
+// node with P anywhere below it or at it, (or P ...) any of the patterns
+// and (vararg) a "...". A pattern followed by @name is captured, a string
+// captures the node it belongs to. ; starts a comment.
+//
+// Queries are compiled into flat pattern arrays. A run indexes the tree once
+// by node heads and by the strings in it: a query only looks at nodes of
+// its root's head, and not at all at trees lacking any string it requires.
+class QuerySet {
+public:
+	QuerySet() = default;
+	QuerySet(const QuerySet &) = delete;
+	QuerySet & operator = (const QuerySet &) = delete;
+
+	// Compiles every pattern in text into a query of its own. Fails with
+	// error() without adding any if one is malformed.
+	bool add(std::string_view text);
+	const std::string & error() const { return m_error; }
+
+	std::size_t size() const { return m_queries.size(); }
+	// the text of query q
+	const std::string & text(std::size_t q) const { return m_queries[q].text; }
+	const std::vector <std::string> & captures(std::size_t q) const { return m_queries[q].captures; }
+
+	// All matches of all queries in root, by query and then in pre-order.
+	std::vector <QueryMatch> run(const Chunk *root) const;
+
+private:
+	class Parser;
+	class Index;
+	class Matcher;
+
+	using PatternId = std::uint32_t;
+	using StringId = std::uint32_t;
+
+	struct Pattern {
+		enum class Kind : std::uint8_t {
+			Any,
+			List,
+			String,
+			Integer,
+			Real,
+			Nil,
+			Boolean,
+			Has,
+			Or,
+			// the "..." of a list
+			Rest,
+		};
+
+		Kind kind;
+		// heads a list matches, "-" being both a unary and a binary minus
+		std::uint8_t heads[2] = {0, 0};
+		std::uint8_t headCount = 0;
+		// -1 if not captured
+		std::int32_t capture = -1;
+		// children [first, last) in m_children
+		std::uint32_t first = 0;
+		std::uint32_t last = 0;
+		union {
+			StringId string;
+			long integer;
+			double real;
+			bool boolean;
+		};
+
+		Pattern() : integer{0} {}
+	};
+
+	struct Query {
+		std::string text;
+		PatternId root;
+		std::vector <std::string> captures;
+		// strings every match contains
+		std::vector <StringId> required;
+	};
+
+	StringId intern(std::string_view s);
+
+	std::vector <Query> m_queries;
+	std::vector <Pattern> m_patterns;
+	std::vector <PatternId> m_children;
+	std::deque <std::string> m_strings;
+	std::unordered_map <std::string_view, StringId> m_stringIds;
+	std::string m_error;
+};
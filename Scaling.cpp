@@ -0,0 +1,339 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+
+#include "Driver.hpp"
+#include "Scaling.hpp"
+
+namespace {
+
+// every size is timed at least this often and for this long, the fastest
+// run counts
+const int MinRuns = 3;
+const int MaxRuns = 100;
+const std::chrono::milliseconds MinTime{20};
+
+const std::size_t Unlimited = static_cast<std::size_t>(-1);
+
+void repeat(std::string &out, std::size_t count, std::string_view s)
+{
+	for (std::size_t i = 0; i < count; ++i)
+		out += s;
+}
+
+void statements(std::string &out, std::size_t count)
+{
+	repeat(out, count, "x = 1\n");
+}
+
+void parens(std::string &out, std::size_t count)
+{
+	out += "x = ";
+	out.append(count, '(');
+	out += '1';
+	out.append(count, ')');
+	out += '\n';
+}
+
+void blocks(std::string &out, std::size_t count)
+{
+	repeat(out, count, "do ");
+	out += "x = 1 ";
+	repeat(out, count, "end ");
+	out += '\n';
+}
+
+void functions(std::string &out, std::size_t count)
+{
+	out += "f = ";
+	repeat(out, count, "function() return ");
+	out += '1';
+	repeat(out, count, " end");
+	out += '\n';
+}
+
+void unary(std::string &out, std::size_t count)
+{
+	static const char *Operators[] = {"not ", "- ", "#"};
+
+	out += "x = ";
+	for (std::size_t i = 0; i < count; ++i)
+		out += Operators[i % 3];
+	out += "t\n";
+}
+
+void power(std::string &out, std::size_t count)
+{
+	out += "x = 2";
+	repeat(out, count, " ^ 2");
+	out += '\n';
+}
+
+void concat(std::string &out, std::size_t count)
+{
+	out += "x = a";
+	repeat(out, count, " .. a");
+	out += '\n';
+}
+
+void arithmetic(std::string &out, std::size_t count)
+{
+	out += "x = 1";
+	repeat(out, count, " + a * 2");
+	out += '\n';
+}
+
+void logic(std::string &out, std::size_t count)
+{
+	out += "x = a";
+	repeat(out, count, " and b == c or d");
+	out += '\n';
+}
+
+void elseifs(std::string &out, std::size_t count)
+{
+	out += "if x == 0 then y = 0\n";
+	for (std::size_t i = 1; i <= count; ++i)
+		out += "elseif x == " + std::to_string(i) + " then y = " + std::to_string(i) + '\n';
+	out += "else y = -1 end\n";
+}
+
+void table(std::string &out, std::size_t count)
+{
+	out += "t = {\n";
+	for (std::size_t i = 0; i < count; ++i) {
+		const std::string n = std::to_string(i);
+		switch (i % 3) {
+			case 0:
+				out += n + ",\n";
+				break;
+			case 1:
+				out += "[" + n + "] = " + n + ";\n";
+				break;
+			default:
+				out += "k" + n + " = " + n + ",\n";
+		}
+	}
+	out += "}\n";
+}
+
+void arguments(std::string &out, std::size_t count)
+{
+	out += "f(";
+	repeat(out, count, "a, ");
+	out += "a)\n";
+}
+
+void suffixes(std::string &out, std::size_t count)
+{
+	out += "x = a";
+	repeat(out, count, ".b[1](c):d(e)");
+	out += '\n';
+}
+
+void names(std::string &out, std::size_t count)
+{
+	out += "local a0";
+	for (std::size_t i = 1; i < count; ++i)
+		out += ", a" + std::to_string(i);
+	out += " = 0";
+	for (std::size_t i = 1; i < count; ++i)
+		out += ", " + std::to_string(i);
+	out += '\n';
+}
+
+void parameters(std::string &out, std::size_t count)
+{
+	out += "function f(a0";
+	for (std::size_t i = 1; i < count; ++i)
+		out += ", a" + std::to_string(i);
+	out += ", ...) end\n";
+}
+
+void string(std::string &out, std::size_t count)
+{
+	out += "x = \"";
+	repeat(out, count, "ab\\n\\\"c'-- ");
+	out += "\"\n";
+}
+
+// every line looks like the end of the comment for a moment
+void unterminatedComment(std::string &out, std::size_t count)
+{
+	out += "x = 1 --[==[";
+	repeat(out, count, "x ]] ]=] ]===] = [[\n");
+}
+
+void unterminatedString(std::string &out, std::size_t count)
+{
+	out += "x = \"";
+	repeat(out, count, "a --[[ ");
+}
+
+// slope of the least squares line through (log x, log y), NaN without two
+// distinct sizes
+double exponent(const std::vector <double> &x, const std::vector <double> &y)
+{
+	double sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0;
+	std::size_t n = 0;
+	for (std::size_t i = 0; i < x.size(); ++i) {
+		if (x[i] <= 0.0 || y[i] <= 0.0)
+			continue;
+		const double lx = std::log(x[i]);
+		const double ly = std::log(y[i]);
+		sx += lx;
+		sy += ly;
+		sxx += lx * lx;
+		sxy += lx * ly;
+		++n;
+	}
+
+	const double d = n * sxx - sx * sx;
+	if (n < 2 || d <= 0.0)
+		return std::nan("");
+	return (n * sxy - sx * sy) / d;
+}
+
+}
+
+const std::vector <ScalingFamily> & Scaling::families()
+{
+	static const std::vector <ScalingFamily> Families = {
+		{"statements", "chunk: chunk statement", Unlimited, true, statements},
+		{"parens", "prefix_expr: LPAREN expr RPAREN", Driver::MaxNesting, true, parens},
+		{"blocks", "statement: DO block END", Driver::MaxNesting, true, blocks},
+		// the parameter list opens one more bracket
+		{"functions", "expr: function", Driver::MaxNesting - 1, true, functions},
+		{"unary", "expr: NOT expr | MINUS expr | LENGTH expr", Unlimited, true, unary},
+		{"power", "expr: expr POWER expr", Unlimited, true, power},
+		{"concat", "expr: expr CONCAT expr", Unlimited, true, concat},
+		{"arithmetic", "expr: expr PLUS expr | expr MUL expr", Unlimited, true, arithmetic},
+		{"logic", "expr: expr AND expr | expr OR expr | expr EQ expr", Unlimited, true, logic},
+		{"elseif", "else_if_list: else_if_list else_if", Unlimited, true, elseifs},
+		{"table", "field_list_base: field_list_base field_separator field", Unlimited, true, table},
+		{"arguments", "expr_list: expr_list COMMA expr", Unlimited, true, arguments},
+		{"suffixes", "var: prefix_expr DOT ID | prefix_expr LBRACKET expr RBRACKET, function_call", Unlimited, true, suffixes},
+		{"names", "name_list: name_list COMMA ID", Unlimited, true, names},
+		{"parameters", "param_list: name_list COMMA ELLIPSIS", Unlimited, true, parameters},
+		{"string", "expr: STRING_VALUE", Unlimited, true, string},
+		{"unterminated-comment", "long comment without its closing bracket", Unlimited, false, unterminatedComment},
+		{"unterminated-string", "STRING_VALUE without its closing quote", Unlimited, false, unterminatedString},
+	};
+
+	return Families;
+}
+
+bool Scaling::select(std::string_view names)
+{
+	m_selected.clear();
+	if (names.empty()) {
+		for (const auto &family : families())
+			m_selected.push_back(&family);
+		return true;
+	}
+
+	while (!names.empty()) {
+		const std::size_t comma = std::min(names.find(','), names.size());
+		const std::string_view name = names.substr(0, comma);
+		names.remove_prefix(std::min(comma + 1, names.size()));
+
+		const auto &all = families();
+		const auto family = std::find_if(all.begin(), all.end(), [name](const ScalingFamily &f) { return name == f.name; });
+		if (family == all.end()) {
+			std::cerr << "Unknown input family: " << name << '\n';
+			return false;
+		}
+		m_selected.push_back(&*family);
+	}
+
+	return true;
+}
+
+bool Scaling::run()
+{
+	if (m_selected.empty())
+		select({});
+
+	std::size_t linear = 0;
+	for (const ScalingFamily *family : m_selected) {
+		if (run(*family))
+			++linear;
+	}
+
+	std::cout << linear << " of " << m_selected.size() << " families grow at most linearly\n";
+	return linear == m_selected.size();
+}
+
+bool Scaling::run(const ScalingFamily &family)
+{
+	static const char *Phases[] = {"preprocess", "scan", "parse", "buffer", "tree"};
+	const std::size_t PhaseCount = std::size(Phases);
+
+	std::cout << family.name << " (" << family.production << ")\n"
+		<< std::setw(10) << "count" << std::setw(12) << "bytes";
+	for (const char *phase : Phases)
+		std::cout << std::setw(13) << phase;
+	std::cout << '\n';
+
+	bool ok = true;
+	std::vector <double> bytes;
+	std::vector <double> costs[PhaseCount];
+	std::string source;
+	for (std::size_t count = 16;; count = std::min(count * 2, family.maxCount)) {
+		source.clear();
+		family.generate(source, count);
+
+		Driver::PhaseCosts best;
+		const auto start = std::chrono::steady_clock::now();
+		for (int run = 0; run < MinRuns || (std::chrono::steady_clock::now() - start < MinTime && run < MaxRuns); ++run) {
+			const Driver::PhaseCosts c = m_driver.measurePhases(source, family.name);
+			if (run == 0) {
+				best = c;
+			} else {
+				best.preprocess = std::min(best.preprocess, c.preprocess);
+				best.scan = std::min(best.scan, c.scan);
+				best.parse = std::min(best.parse, c.parse);
+			}
+		}
+
+		if (best.success != family.valid) {
+			std::cout << "  input of count " << count << (family.valid ? " was rejected\n" : " was accepted\n");
+			ok = false;
+		}
+
+		const double values[] = {best.preprocess, best.scan, best.parse,
+			static_cast<double>(best.bufferBytes), static_cast<double>(best.treeBytes)};
+		bytes.push_back(source.size());
+		std::cout << std::setw(10) << count << std::setw(12) << source.size() << std::fixed;
+		for (std::size_t p = 0; p < PhaseCount; ++p) {
+			costs[p].push_back(values[p]);
+			if (values[p] <= 0.0)
+				std::cout << std::setw(13) << '-';
+			else if (p < 3)
+				std::cout << std::setw(10) << std::setprecision(3) << values[p] * 1000.0 << " ms";
+			else
+				std::cout << std::setw(10) << std::setprecision(1) << values[p] / 1024.0 << " KB";
+		}
+		std::cout << std::defaultfloat << '\n';
+
+		if (count >= family.maxCount || source.size() >= m_maxBytes)
+			break;
+	}
+
+	std::cout << "  growth:";
+	for (std::size_t p = 0; p < PhaseCount; ++p) {
+		const double e = exponent(bytes, costs[p]);
+		if (std::isnan(e))
+			continue;
+		std::cout << ' ' << Phases[p] << " n^" << std::fixed << std::setprecision(2) << e << std::defaultfloat;
+		if (e > MaxExponent) {
+			std::cout << " (superlinear)";
+			ok = false;
+		}
+	}
+	std::cout << '\n';
+
+	return ok;
+}
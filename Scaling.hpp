@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class Driver;
+
+// A family of inputs stretching one production of grammar.yy: count is how
+// many times the production is repeated or nested.
+struct ScalingFamily {
+	const char *name;
+	const char *production;
+	// the nesting families stop below Driver::MaxNesting
+	std::size_t maxCount;
+	// false for inputs that are meant to be rejected
+	bool valid;
+	void (*generate)(std::string &out, std::size_t count);
+};
+
+// Parses each family at doubling sizes and fits time and memory of every
+// phase to a power of the input size. A family growing faster than
+// linearly fails the check.
+class Scaling {
+public:
+	// exponents above this fail the check, leaving room for cache effects
+	static constexpr double MaxExponent = 1.2;
+
+	explicit Scaling(Driver &driver) : m_driver{driver} {}
+
+	static const std::vector <ScalingFamily> & families();
+
+	// Comma separated family names, all of them if empty; false if one is unknown.
+	bool select(std::string_view names);
+	// sizes stop doubling once an input is this large
+	void setMaxBytes(std::size_t bytes) { m_maxBytes = bytes; }
+
+	bool run();
+
+private:
+	bool run(const ScalingFamily &family);
+
+	Driver &m_driver;
+	std::vector <const ScalingFamily *> m_selected;
+	std::size_t m_maxBytes = 2 << 20;
+};
@@ -0,0 +1,146 @@
+#include "Keywords.hpp"
+#include "Segmenter.hpp"
+
+namespace Segmenter {
+
+namespace {
+
+bool isIdentStart(char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+bool isDigit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+bool isHexDigit(char c)
+{
+	return isDigit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+bool isBlank(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+}
+
+std::vector <std::size_t> split(std::string_view data, std::size_t count)
+{
+	std::vector <std::size_t> result;
+	if (count < 2)
+		return result;
+
+	using token = yy::Parser::token;
+
+	const std::size_t step = data.size() / count;
+	std::size_t next = step;
+	// open function, do, if and repeat blocks
+	int depth = 0;
+	int brackets = 0;
+	bool afterEnd = false;
+
+	const char *begin = data.data();
+	const char *end = begin + data.size();
+	const char *p = begin;
+
+	while (p != end) {
+		const char c = *p;
+
+		if (isBlank(c)) {
+			++p;
+			continue;
+		}
+
+		const bool previousEnd = afterEnd;
+		afterEnd = false;
+
+		if (isIdentStart(c)) {
+			const char *word = p;
+			while (p != end && (isIdentStart(*p) || isDigit(*p)))
+				++p;
+
+			const Keywords::Keyword *kw = Keywords::lookup(word, p - word);
+			if (!kw)
+				continue;
+
+			// Keywords no expression can continue with. A function only
+			// starts a statement for sure after an 'end', elsewhere it may
+			// be a function body.
+			bool starts = false;
+			switch (kw->token) {
+				case token::LOCAL:
+				case token::IF:
+				case token::FOR:
+				case token::WHILE:
+				case token::REPEAT:
+					starts = true;
+					break;
+				case token::FUNCTION:
+					starts = previousEnd;
+					break;
+				default:
+					break;
+			}
+
+			if (starts && depth == 0 && brackets == 0 && static_cast<std::size_t>(word - begin) >= next) {
+				result.push_back(word - begin);
+				if (result.size() == count - 1)
+					break;
+				next = word - begin + step;
+			}
+
+			switch (kw->token) {
+				case token::FUNCTION:
+				case token::DO:
+				case token::IF:
+				case token::REPEAT:
+					++depth;
+					break;
+				case token::END:
+					--depth;
+					afterEnd = true;
+					break;
+				case token::UNTIL:
+					--depth;
+					break;
+				default:
+					break;
+			}
+		} else if (isDigit(c)) {
+			// like the scanners, so the x of 0x1f is no identifier
+			if (c == '0' && end - p > 2 && (p[1] == 'x' || p[1] == 'X') && isHexDigit(p[2])) {
+				p += 2;
+				while (p != end && isHexDigit(*p))
+					++p;
+			} else {
+				while (p != end && isDigit(*p))
+					++p;
+				if (p != end && *p == '.') {
+					++p;
+					while (p != end && isDigit(*p))
+						++p;
+				}
+			}
+		} else if (c == '"' || c == '\'') {
+			for (++p; p != end && *p != c && *p != '\n'; ++p) {
+				if (*p == '\\' && p + 1 != end)
+					++p;
+			}
+			if (p != end && *p == c)
+				++p;
+		} else {
+			if (c == '(' || c == '[' || c == '{')
+				++brackets;
+			else if (c == ')' || c == ']' || c == '}')
+				--brackets;
+			++p;
+		}
+	}
+
+	return result;
+}
+
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+// Pre-scan for parsing one input in parallel. It finds offsets in the
+// preprocessed data where a top-level statement starts for sure, so the
+// pieces in between parse on their own and give the same statements as
+// parsing the whole input.
+namespace Segmenter {
+
+// At most count - 1 ascending offsets, close to cutting data into count
+// pieces of the same size.
+std::vector <std::size_t> split(std::string_view data, std::size_t count);
+
+}
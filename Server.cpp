@@ -0,0 +1,354 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <sstream>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "Emitter.hpp"
+#include "MemoryProfile.hpp"
+#include "Protocol.hpp"
+#include "Server.hpp"
+
+namespace {
+
+bool readFile(const std::string &path, std::string &data, struct stat &st, std::string &error)
+{
+	const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0 || ::fstat(fd, &st) != 0) {
+		error = "Unable to open file for reading: " + path;
+		if (fd >= 0)
+			::close(fd);
+		return false;
+	}
+
+	data.resize(st.st_size);
+	const bool ok = Protocol::readFull(fd, data.data(), data.size());
+	::close(fd);
+	if (!ok)
+		error = "Unable to read file: " + path;
+	return ok;
+}
+
+void writeDiagnostics(std::string &out, const ParseResult &result)
+{
+	for (const auto &d : result.diagnostics) {
+		std::ostringstream os;
+		os << d << '\n';
+		out += os.str();
+	}
+}
+
+bool formatFromName(std::string_view name, OutputFormat &format)
+{
+	if (name == "text")
+		format = OutputFormat::Text;
+	else if (name == "json")
+		format = OutputFormat::Json;
+	else if (name == "sexpr")
+		format = OutputFormat::Sexpr;
+	else
+		return false;
+	return true;
+}
+
+void render(std::string &out, const ParseResult &result, std::string_view formatName)
+{
+	writeDiagnostics(out, result);
+
+	OutputFormat format;
+	if (!result.success() || !formatFromName(formatName, format))
+		return;
+
+	OutputBuffer buffer{out};
+	auto emitter = Emitter::create(format, buffer);
+	for (const auto &chunk : result.chunks) {
+		emitter->emit(chunk.get());
+		if (format != OutputFormat::Text)
+			buffer.put('\n');
+	}
+}
+
+void renderProfile(std::string &out, const ParseResult &result)
+{
+	writeDiagnostics(out, result);
+
+	MemoryProfile profile;
+	for (const auto &chunk : result.chunks)
+		profile.add(chunk.get());
+
+	OutputBuffer buffer{out};
+	profile.writeJson(buffer);
+}
+
+}
+
+struct Server::Connection {
+	Connection(int in, int out) : in{in}, out{out} {}
+
+	void begin()
+	{
+		std::lock_guard <std::mutex> lock{mutex};
+		++pending;
+	}
+
+	void end()
+	{
+		std::lock_guard <std::mutex> lock{mutex};
+		if (--pending == 0)
+			idle.notify_all();
+	}
+
+	void waitIdle()
+	{
+		std::unique_lock <std::mutex> lock{mutex};
+		idle.wait(lock, [this]{ return pending == 0; });
+	}
+
+	bool send(std::string_view payload)
+	{
+		std::lock_guard <std::mutex> lock{writeMutex};
+		return Protocol::writeFrame(out, payload);
+	}
+
+	int in;
+	int out;
+	std::mutex mutex;
+	std::mutex writeMutex;
+	std::condition_variable idle;
+	int pending = 0;
+};
+
+Server::Server(const Options &options)
+	: m_options{options}, m_pool{options.threads}
+{
+}
+
+Server::~Server()
+{
+	stop();
+	for (auto &t : m_connectionThreads)
+		t.join();
+}
+
+Driver & Server::driver()
+{
+	static thread_local Driver d;
+	d.setLexer(m_options.lexer);
+	return d;
+}
+
+bool Server::serveSocket(const std::string &path)
+{
+	struct sockaddr_un addr;
+	if (path.size() >= sizeof(addr.sun_path)) {
+		std::cerr << "Socket path too long: " << path << '\n';
+		return false;
+	}
+
+	m_listenFd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (m_listenFd < 0) {
+		std::cerr << "Unable to create socket: " << std::strerror(errno) << '\n';
+		return false;
+	}
+
+	std::memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+	::unlink(path.c_str());
+
+	if (::bind(m_listenFd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0 || ::listen(m_listenFd, 64) != 0) {
+		std::cerr << "Unable to listen on " << path << ": " << std::strerror(errno) << '\n';
+		::close(m_listenFd);
+		m_listenFd = -1;
+		return false;
+	}
+
+	while (!m_stopping) {
+		const int fd = ::accept4(m_listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		std::lock_guard <std::mutex> lock{m_connectionsMutex};
+		if (m_stopping) {
+			::close(fd);
+			break;
+		}
+		// a daemon would otherwise keep a thread for every connection ever made
+		reapConnections();
+		m_connectionFds.insert(fd);
+		m_connectionThreads.emplace_back([this, fd]{
+			serveConnection(fd, fd);
+
+			std::lock_guard <std::mutex> lock{m_connectionsMutex};
+			m_connectionFds.erase(fd);
+			::close(fd);
+			m_finishedThreads.push_back(std::this_thread::get_id());
+		});
+	}
+
+	::close(m_listenFd);
+	m_listenFd = -1;
+	::unlink(path.c_str());
+	return true;
+}
+
+bool Server::serveStdio()
+{
+	serveConnection(STDIN_FILENO, STDOUT_FILENO);
+	return true;
+}
+
+void Server::stop()
+{
+	std::lock_guard <std::mutex> lock{m_connectionsMutex};
+	m_stopping = true;
+	if (m_listenFd >= 0)
+		::shutdown(m_listenFd, SHUT_RDWR);
+	for (int fd : m_connectionFds)
+		::shutdown(fd, SHUT_RD);
+}
+
+void Server::reapConnections()
+{
+	for (std::thread::id id : m_finishedThreads) {
+		auto t = std::find_if(m_connectionThreads.begin(), m_connectionThreads.end(), [id](const std::thread &t) { return t.get_id() == id; });
+		// it only has to return from its function
+		t->join();
+		std::swap(*t, m_connectionThreads.back());
+		m_connectionThreads.pop_back();
+	}
+	m_finishedThreads.clear();
+}
+
+void Server::serveConnection(int in, int out)
+{
+	auto connection = std::make_shared<Connection>(in, out);
+	std::string payload;
+
+	while (Protocol::readFrame(in, payload)) {
+		const auto received = std::chrono::steady_clock::now();
+
+		const std::size_t eol = std::min(payload.find('\n'), payload.size());
+		const std::string header = payload.substr(0, eol);
+		std::string body = payload.substr(std::min(eol + 1, payload.size()));
+
+		std::string_view fields[3];
+		std::size_t count = 0;
+		for (std::size_t pos = 0; pos < header.size() && count < 3;) {
+			const std::size_t space = std::min(header.find(' ', pos), header.size());
+			if (space > pos)
+				fields[count++] = std::string_view{header}.substr(pos, space - pos);
+			pos = space + 1;
+		}
+		const std::string id{fields[0]};
+		const std::string command{fields[1]};
+		const std::string format{count > 2 ? fields[2] : "none"};
+
+		if (command == "shutdown") {
+			connection->send(id + " ok 0\n");
+			stop();
+			break;
+		}
+
+		connection->begin();
+		m_pool.post([this, connection, id, command, format, body = std::move(body), received]{
+			bool ok = true;
+			std::string result = handle(command, format, body, ok);
+
+			const auto latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - received).count();
+			++m_requests;
+			m_totalLatency += latency;
+			for (std::uint64_t max = m_maxLatency; static_cast<std::uint64_t>(latency) > max && !m_maxLatency.compare_exchange_weak(max, latency);)
+				;
+
+			connection->send(id + (ok ? " ok " : " error ") + std::to_string(latency) + '\n' + result);
+			connection->end();
+		});
+	}
+
+	connection->waitIdle();
+}
+
+std::shared_ptr <const ParseResult> Server::parseFile(const std::string &path, std::string &error)
+{
+	struct stat st;
+	if (::stat(path.c_str(), &st) != 0) {
+		error = "Unable to open file for reading: " + path;
+		return nullptr;
+	}
+
+	{
+		std::lock_guard <std::mutex> lock{m_cacheMutex};
+		auto it = m_cache.find(path);
+		if (it != m_cache.end() && it->second.size == st.st_size
+			&& it->second.mtime.tv_sec == st.st_mtim.tv_sec && it->second.mtime.tv_nsec == st.st_mtim.tv_nsec) {
+			++m_cacheHits;
+			return it->second.result;
+		}
+	}
+
+	static thread_local std::string data;
+	if (!readFile(path, data, st, error))
+		return nullptr;
+
+	auto result = std::make_shared<const ParseResult>(driver().parse(data, path));
+
+	std::lock_guard <std::mutex> lock{m_cacheMutex};
+	if (m_cache.size() >= m_options.cacheEntries)
+		m_cache.clear();
+	m_cache[path] = CacheEntry{st.st_mtim, st.st_size, result};
+	return result;
+}
+
+std::string Server::handle(std::string_view command, std::string_view format, std::string_view body, bool &ok)
+{
+	std::string out;
+
+	if (command == "parse" || command == "profile") {
+		const ParseResult result = driver().parse(body, "<request>");
+		if (command == "parse")
+			render(out, result, format);
+		else
+			renderProfile(out, result);
+		ok = result.success();
+	} else if (command == "parse-file" || command == "profile-file") {
+		std::string error;
+		auto result = parseFile(std::string{body}, error);
+		if (!result) {
+			ok = false;
+			return error + '\n';
+		}
+		if (command == "parse-file")
+			render(out, *result, format);
+		else
+			renderProfile(out, *result);
+		ok = result->success();
+	} else if (command == "stats") {
+		out = stats();
+	} else {
+		ok = false;
+		out = "Unknown command: " + std::string{command} + '\n';
+	}
+
+	return out;
+}
+
+std::string Server::stats() const
+{
+	const std::uint64_t requests = m_requests;
+	std::string out;
+	out += "requests " + std::to_string(requests) + '\n';
+	out += "cache_hits " + std::to_string(m_cacheHits.load()) + '\n';
+	out += "mean_latency_us " + std::to_string(requests ? m_totalLatency / requests : 0) + '\n';
+	out += "max_latency_us " + std::to_string(m_maxLatency.load()) + '\n';
+	out += "threads " + std::to_string(m_pool.size()) + '\n';
+	return out;
+}
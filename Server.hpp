@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "Driver.hpp"
+#include "ThreadPool.hpp"
+
+// Long running parse service. Requests (see Protocol.hpp) arrive over a
+// Unix domain socket or stdin and are handled by a pool of workers, each of
+// which keeps its own warm Driver. Results of parse-file requests are cached
+// as long as the file's size and modification time do not change.
+class Server {
+public:
+	struct Options {
+		unsigned threads = 0;
+		std::size_t cacheEntries = 4096;
+		Driver::Lexer lexer = Driver::Lexer::Fast;
+	};
+
+	explicit Server(const Options &options);
+	~Server();
+
+	Server(const Server &) = delete;
+	Server & operator = (const Server &) = delete;
+
+	bool serveSocket(const std::string &path);
+	bool serveStdio();
+
+private:
+	struct Connection;
+
+	struct CacheEntry {
+		struct timespec mtime;
+		off_t size;
+		std::shared_ptr <const ParseResult> result;
+	};
+
+	void serveConnection(int in, int out);
+	void stop();
+	// Joins the connection threads which have finished; called with
+	// m_connectionsMutex held.
+	void reapConnections();
+
+	std::string handle(std::string_view command, std::string_view format, std::string_view body, bool &ok);
+	std::shared_ptr <const ParseResult> parseFile(const std::string &path, std::string &error);
+	std::string stats() const;
+
+	Driver & driver();
+
+	Options m_options;
+	ThreadPool m_pool;
+
+	std::mutex m_cacheMutex;
+	std::unordered_map <std::string, CacheEntry> m_cache;
+
+	std::mutex m_connectionsMutex;
+	std::unordered_set <int> m_connectionFds;
+	std::vector <std::thread> m_connectionThreads;
+	// threads done with their connection, not joined yet
+	std::vector <std::thread::id> m_finishedThreads;
+	int m_listenFd = -1;
+	std::atomic <bool> m_stopping{false};
+
+	std::atomic <std::uint64_t> m_requests{0};
+	std::atomic <std::uint64_t> m_cacheHits{0};
+	std::atomic <std::uint64_t> m_totalLatency{0};
+	std::atomic <std::uint64_t> m_maxLatency{0};
+};
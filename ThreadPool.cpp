@@ -0,0 +1,50 @@
+#include <algorithm>
+
+#include "ThreadPool.hpp"
+
+ThreadPool::ThreadPool(unsigned threads)
+{
+	if (threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+
+	m_workers.reserve(threads);
+	for (unsigned i = 0; i < threads; ++i)
+		m_workers.emplace_back([this]{ work(); });
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard <std::mutex> lock{m_mutex};
+		m_stop = true;
+	}
+	m_cond.notify_all();
+
+	for (auto &t : m_workers)
+		t.join();
+}
+
+void ThreadPool::post(std::function <void()> job)
+{
+	{
+		std::lock_guard <std::mutex> lock{m_mutex};
+		m_jobs.push_back(std::move(job));
+	}
+	m_cond.notify_one();
+}
+
+void ThreadPool::work()
+{
+	for (;;) {
+		std::function <void()> job;
+		{
+			std::unique_lock <std::mutex> lock{m_mutex};
+			m_cond.wait(lock, [this]{ return m_stop || !m_jobs.empty(); });
+			if (m_jobs.empty())
+				return;
+			job = std::move(m_jobs.front());
+			m_jobs.pop_front();
+		}
+		job();
+	}
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed size pool of worker threads fed from a single FIFO queue.
+class ThreadPool {
+public:
+	explicit ThreadPool(unsigned threads = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool & operator = (const ThreadPool &) = delete;
+
+	template <typename F>
+	auto submit(F &&f) -> std::future <decltype(f())>
+	{
+		using Result = decltype(f());
+		auto task = std::make_shared<std::packaged_task<Result()> >(std::forward<F>(f));
+		std::future <Result> result = task->get_future();
+		post([task]{ (*task)(); });
+		return result;
+	}
+
+	void post(std::function <void()> job);
+
+	unsigned size() const { return m_workers.size(); }
+
+private:
+	void work();
+
+	std::vector <std::thread> m_workers;
+	std::deque <std::function <void()> > m_jobs;
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+	bool m_stop = false;
+};
@@ -0,0 +1,94 @@
+#include "OutputBuffer.hpp"
+#include "TokenStream.hpp"
+
+namespace {
+
+void writeU32(OutputBuffer &out, std::uint32_t value)
+{
+	const char bytes[4] = {
+		static_cast<char>(value),
+		static_cast<char>(value >> 8),
+		static_cast<char>(value >> 16),
+		static_cast<char>(value >> 24),
+	};
+	out.write(bytes, sizeof(bytes));
+}
+
+}
+
+long TokenStream::intValue(std::size_t i) const
+{
+	return FastScanner::intValue(m_source.data() + m_offsets[i], m_lengths[i]);
+}
+
+double TokenStream::realValue(std::size_t i) const
+{
+	return FastScanner::realValue(m_source.data() + m_offsets[i], m_lengths[i]);
+}
+
+void TokenStream::clear()
+{
+	m_kinds.clear();
+	m_offsets.clear();
+	m_lengths.clear();
+	m_name.clear();
+	m_source.clear();
+}
+
+void TokenStream::write(OutputBuffer &out) const
+{
+	out.write("LTOK", 4);
+	writeU32(out, 1);
+	writeU32(out, m_kinds.size());
+	writeU32(out, m_source.size());
+	writeU32(out, m_name.size());
+	out.write(m_name);
+
+	out.write(reinterpret_cast<const char *>(m_kinds.data()), m_kinds.size());
+	out.repeat('\0', (4 - (m_name.size() + m_kinds.size()) % 4) % 4);
+
+	for (std::uint32_t offset : m_offsets)
+		writeU32(out, offset);
+	for (std::uint32_t length : m_lengths)
+		writeU32(out, length);
+}
+
+bool Tokenizer::tokenize(std::string_view source, const std::string &name, TokenStream &tokens)
+{
+	tokens.clear();
+	tokens.m_name = name;
+	tokens.m_source.assign(source);
+	// the preprocessor fails on empty input
+	if (source.empty())
+		return true;
+
+	m_preprocessor.reset();
+	m_preprocessor.setInput(name, source);
+	if (!m_preprocessor.preprocess() || !m_preprocessor.error().empty())
+		return false;
+
+	// Comments become blanks of the same length, so offsets into the
+	// preprocessed data are offsets into the source.
+	const std::string &data = m_preprocessor.data();
+	m_scanner.reset(data, nullptr);
+
+	// about one token per 6 bytes in typical code
+	const std::size_t expected = data.size() / 6 + 1;
+	tokens.m_kinds.reserve(expected);
+	tokens.m_offsets.reserve(expected);
+	tokens.m_lengths.reserve(expected);
+
+	for (;;) {
+		std::size_t length;
+		const yy::Parser::token_kind_type token = m_scanner.scan(length);
+		if (token == yy::Parser::token::END_OF_INPUT)
+			break;
+
+		tokens.m_kinds.push_back(yy::Parser::by_kind{token}.kind());
+		tokens.m_offsets.push_back(m_scanner.offset());
+		tokens.m_lengths.push_back(length);
+		m_scanner.skip(length);
+	}
+
+	return true;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "FastScanner.hpp"
+#include "Preprocessor.hpp"
+
+class OutputBuffer;
+
+// The tokens of a source without a parse. Kinds (one byte each), byte
+// offsets and lengths are kept in parallel arrays, values of literals are
+// only decoded when asked for. Offsets point into source(), which must be
+// smaller than 4 GiB.
+class TokenStream {
+public:
+	using Kind = yy::Parser::symbol_kind_type;
+
+	std::size_t size() const { return m_kinds.size(); }
+	bool empty() const { return m_kinds.empty(); }
+
+	Kind kind(std::size_t i) const { return static_cast<Kind>(m_kinds[i]); }
+	std::uint32_t offset(std::size_t i) const { return m_offsets[i]; }
+	std::uint32_t length(std::size_t i) const { return m_lengths[i]; }
+	// For ID and STRING_VALUE tokens this is their value, strings are kept
+	// with their quotes and escapes just like in the AST.
+	std::string_view text(std::size_t i) const { return std::string_view{m_source}.substr(m_offsets[i], m_lengths[i]); }
+	long intValue(std::size_t i) const;
+	double realValue(std::size_t i) const;
+
+	const std::vector <std::uint8_t> & kinds() const { return m_kinds; }
+	const std::vector <std::uint32_t> & offsets() const { return m_offsets; }
+	const std::vector <std::uint32_t> & lengths() const { return m_lengths; }
+
+	const std::string & name() const { return m_name; }
+	const std::string & source() const { return m_source; }
+
+	// Keeps the capacity of all arrays.
+	void clear();
+
+	// Binary dump, all integers little endian:
+	//   "LTOK", u32 version (1), u32 token count, u32 source size,
+	//   u32 name length, name, u8 kind[count], padding to 4 bytes,
+	//   u32 offset[count], u32 length[count]
+	// Kinds are the yy::Parser::symbol_kind_type values of Parser.hpp.
+	void write(OutputBuffer &out) const;
+
+private:
+	friend class Tokenizer;
+
+	std::vector <std::uint8_t> m_kinds;
+	std::vector <std::uint32_t> m_offsets;
+	std::vector <std::uint32_t> m_lengths;
+	std::string m_name;
+	std::string m_source;
+};
+
+// Runs only the preprocessor and the fast scanner, which produce the same
+// tokens as for a parse, and creates no Node at all. A Tokenizer keeps its
+// buffers between inputs; use one per thread.
+class Tokenizer {
+public:
+	Tokenizer() = default;
+	Tokenizer(const Tokenizer &) = delete;
+	Tokenizer & operator = (const Tokenizer &) = delete;
+
+	// False if the source has an unterminated long comment, see error().
+	bool tokenize(std::string_view source, const std::string &name, TokenStream &tokens);
+
+	const std::string & error() const { return m_preprocessor.error(); }
+	const yy::position & errorPosition() const { return m_preprocessor.errorPosition(); }
+
+private:
+	Preprocessor m_preprocessor;
+	FastScanner m_scanner;
+};
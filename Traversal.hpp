@@ -0,0 +1,149 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "AST.hpp"
+
+// Walking an AST without recursion. A tree can be about as deep as its
+// source is long (a .. b .. c .. or a long elseif chain), so whatever
+// visits every node should go through here instead of calling itself for
+// each level.
+namespace Traversal {
+
+// Calls f for each child of node that is set, in source order.
+template <typename F>
+void forEachChild(const Node *node, F &&f)
+{
+	auto child = [&f](const Node *n)
+	{
+		if (n)
+			f(n);
+	};
+
+	auto all = [&child](const auto &nodes)
+	{
+		for (const auto &n : nodes)
+			child(n.get());
+	};
+
+	switch (node->type()) {
+		case Node::Type::Chunk:
+			all(static_cast<const Chunk *>(node)->children());
+			break;
+		case Node::Type::ExprList:
+			all(static_cast<const ExprList *>(node)->exprs());
+			break;
+		case Node::Type::VarList:
+			all(static_cast<const VarList *>(node)->vars());
+			break;
+		case Node::Type::LValue: {
+			auto lv = static_cast<const LValue *>(node);
+			child(lv->tableExpr());
+			child(lv->keyExpr());
+			break;
+		}
+		case Node::Type::FunctionCall:
+		case Node::Type::MethodCall: {
+			auto call = static_cast<const FunctionCall *>(node);
+			child(&call->functionExpr());
+			child(&call->args());
+			break;
+		}
+		case Node::Type::Assignment: {
+			auto a = static_cast<const Assignment *>(node);
+			child(&a->varList());
+			child(&a->exprList());
+			break;
+		}
+		case Node::Type::TableCtor:
+			all(static_cast<const TableCtor *>(node)->fields());
+			break;
+		case Node::Type::Field: {
+			auto f = static_cast<const Field *>(node);
+			child(f->keyExpr());
+			child(f->valueExpr());
+			break;
+		}
+		case Node::Type::BinOp: {
+			auto op = static_cast<const BinOp *>(node);
+			child(&op->left());
+			child(&op->right());
+			break;
+		}
+		case Node::Type::UnOp:
+			child(&static_cast<const UnOp *>(node)->operand());
+			break;
+		case Node::Type::Return:
+			child(static_cast<const Return *>(node)->exprList());
+			break;
+		case Node::Type::Function: {
+			auto f = static_cast<const Function *>(node);
+			if (f->hasParams())
+				child(&f->params());
+			if (f->hasChunk())
+				child(&f->chunk());
+			break;
+		}
+		case Node::Type::If: {
+			auto i = static_cast<const If *>(node);
+			child(&i->condition());
+			child(i->chunk());
+			child(i->nextIf());
+			child(i->elseChunk());
+			break;
+		}
+		case Node::Type::While: {
+			auto w = static_cast<const While *>(node);
+			child(&w->condition());
+			child(w->chunk());
+			break;
+		}
+		case Node::Type::Repeat: {
+			auto r = static_cast<const Repeat *>(node);
+			child(r->chunk());
+			child(&r->condition());
+			break;
+		}
+		case Node::Type::For: {
+			auto f = static_cast<const For *>(node);
+			child(&f->start());
+			child(&f->limit());
+			child(f->step());
+			child(f->chunk());
+			break;
+		}
+		case Node::Type::ForEach: {
+			auto f = static_cast<const ForEach *>(node);
+			child(&f->iterators());
+			child(&f->exprs());
+			child(f->chunk());
+			break;
+		}
+		default:
+			break;
+	}
+}
+
+// Visits root and everything below it in pre-order, with an explicit stack.
+// visit(node) returns whether to go on into the children of node.
+template <typename Visit>
+void walk(const Node *root, Visit &&visit)
+{
+	std::vector <const Node *> stack;
+	if (root)
+		stack.push_back(root);
+
+	while (!stack.empty()) {
+		const Node *node = stack.back();
+		stack.pop_back();
+		if (!visit(node))
+			continue;
+
+		const std::size_t size = stack.size();
+		forEachChild(node, [&stack](const Node *n) { stack.push_back(n); });
+		std::reverse(stack.begin() + size, stack.end());
+	}
+}
+
+}
@@ -0,0 +1,548 @@
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <string_view>
+#include <unordered_map>
+
+#include "OutputBuffer.hpp"
+#include "Traversal.hpp"
+#include "TreeDiff.hpp"
+
+namespace {
+
+std::uint64_t mix(std::uint64_t h)
+{
+	h ^= h >> 30;
+	h *= 0xbf58476d1ce4e5b9;
+	h ^= h >> 27;
+	h *= 0x94d049bb133111eb;
+	h ^= h >> 31;
+	return h;
+}
+
+std::uint64_t combine(std::uint64_t seed, std::uint64_t value)
+{
+	return mix(seed + 0x9e3779b97f4a7c15 + value);
+}
+
+std::uint64_t text(std::string_view s)
+{
+	return std::hash<std::string_view>{}(s);
+}
+
+std::uint16_t kindOf(const Node *node)
+{
+	unsigned sub = 0;
+	switch (node->type()) {
+		case Node::Type::LValue:
+			sub = toUnderlying(static_cast<const LValue *>(node)->lvalueType());
+			break;
+		case Node::Type::Assignment:
+			sub = static_cast<const Assignment *>(node)->isLocal();
+			break;
+		case Node::Type::Value:
+			sub = toUnderlying(static_cast<const Value *>(node)->valueType());
+			break;
+		case Node::Type::Field:
+			sub = toUnderlying(static_cast<const Field *>(node)->fieldType());
+			break;
+		case Node::Type::Function:
+			sub = static_cast<const Function *>(node)->isLocal();
+			break;
+		default:
+			break;
+	}
+	return toUnderlying(node->type()) << 8 | sub;
+}
+
+// What a node is apart from its children. Children which may be missing
+// are part of it as a mask, so the child hashes can't be mistaken for one
+// another.
+std::uint64_t labelOf(const Node *node, std::uint16_t kind)
+{
+	std::uint64_t h = mix(kind + 1);
+	switch (node->type()) {
+		case Node::Type::ParamList: {
+			auto pl = static_cast<const ParamList *>(node);
+			for (const auto &name : pl->names())
+				h = combine(h, text(name));
+			h = combine(h, pl->hasEllipsis());
+			break;
+		}
+		case Node::Type::LValue:
+			h = combine(h, text(static_cast<const LValue *>(node)->name()));
+			break;
+		case Node::Type::FunctionCall:
+			h = combine(h, static_cast<const FunctionCall *>(node)->isTruncated());
+			break;
+		case Node::Type::MethodCall: {
+			auto mc = static_cast<const MethodCall *>(node);
+			h = combine(h, text(mc->methodName()));
+			h = combine(h, mc->isTruncated());
+			break;
+		}
+		case Node::Type::Ellipsis:
+			h = combine(h, static_cast<const Ellipsis *>(node)->isTruncated());
+			break;
+		// operators are labels, a node with another one is changed
+		case Node::Type::BinOp:
+			h = combine(h, toUnderlying(static_cast<const BinOp *>(node)->binOpType()));
+			break;
+		case Node::Type::UnOp:
+			h = combine(h, toUnderlying(static_cast<const UnOp *>(node)->unOpType()));
+			break;
+		case Node::Type::Value: {
+			auto v = static_cast<const Value *>(node);
+			switch (v->valueType()) {
+				case ValueType::Boolean:
+					h = combine(h, static_cast<const BooleanValue *>(v)->value());
+					break;
+				case ValueType::Integer:
+					h = combine(h, static_cast<const IntValue *>(v)->value());
+					break;
+				case ValueType::Real: {
+					const double real = static_cast<const RealValue *>(v)->value();
+					std::uint64_t bits;
+					std::memcpy(&bits, &real, sizeof(bits));
+					h = combine(h, bits);
+					break;
+				}
+				case ValueType::String:
+					h = combine(h, text(static_cast<const StringValue *>(v)->value()));
+					break;
+				default:
+					break;
+			}
+			break;
+		}
+		case Node::Type::Field:
+			h = combine(h, text(static_cast<const Field *>(node)->fieldName()));
+			break;
+		case Node::Type::Return:
+			h = combine(h, static_cast<const Return *>(node)->exprList() != nullptr);
+			break;
+		case Node::Type::Function: {
+			auto f = static_cast<const Function *>(node);
+			for (const auto &part : f->nameParts())
+				h = combine(h, text(part));
+			h = combine(h, text(f->methodName()));
+			h = combine(h, f->hasParams() | f->hasChunk() << 1);
+			break;
+		}
+		case Node::Type::If: {
+			auto i = static_cast<const If *>(node);
+			h = combine(h, (i->chunk() != nullptr) | (i->nextIf() != nullptr) << 1 | (i->elseChunk() != nullptr) << 2);
+			break;
+		}
+		case Node::Type::While:
+			h = combine(h, static_cast<const While *>(node)->chunk() != nullptr);
+			break;
+		case Node::Type::Repeat:
+			h = combine(h, static_cast<const Repeat *>(node)->chunk() != nullptr);
+			break;
+		case Node::Type::For: {
+			auto f = static_cast<const For *>(node);
+			h = combine(h, text(f->iterator()));
+			h = combine(h, (f->step() != nullptr) | (f->chunk() != nullptr) << 1);
+			break;
+		}
+		case Node::Type::ForEach:
+			h = combine(h, static_cast<const ForEach *>(node)->chunk() != nullptr);
+			break;
+		default:
+			break;
+	}
+	return h;
+}
+
+}
+
+HashedTree::HashedTree(const Chunk *root)
+{
+	struct Pending {
+		const Node *node;
+		Index parent;
+		Span statement;
+	};
+
+	std::vector <Pending> stack;
+	if (root)
+		stack.push_back(Pending{root, None, Span{}});
+
+	while (!stack.empty()) {
+		const Pending p = stack.back();
+		stack.pop_back();
+
+		const Index i = m_nodes.size();
+		const std::uint16_t kind = kindOf(p.node);
+		m_nodes.push_back(p.node);
+		m_parent.push_back(p.parent);
+		m_kind.push_back(kind);
+		m_label.push_back(labelOf(p.node, kind));
+		m_statement.push_back(p.statement);
+
+		// Statements of a chunk are relative to the statement the chunk
+		// belongs to, which is where everything else below it is.
+		const std::size_t size = stack.size();
+		if (p.node->type() == Node::Type::Chunk) {
+			auto chunk = static_cast<const Chunk *>(p.node);
+			const auto &spans = chunk->spans();
+			for (std::size_t c = 0; c < spans.size(); ++c) {
+				if (chunk->children()[c])
+					stack.push_back(Pending{chunk->children()[c].get(), i, Span{p.statement.begin + spans[c].begin, p.statement.begin + spans[c].end}});
+			}
+		} else {
+			Traversal::forEachChild(p.node, [&stack, &p, i](const Node *n) { stack.push_back(Pending{n, i, p.statement}); });
+		}
+		std::reverse(stack.begin() + size, stack.end());
+	}
+
+	// Children come after their parent, so going backwards every subtree is
+	// complete before its parent is reached. The children of a node are
+	// combined last to first.
+	const std::size_t n = m_nodes.size();
+	m_end.resize(n);
+	m_hash.resize(n);
+	std::vector <std::uint64_t> children(n, 0);
+	for (std::size_t i = 0; i < n; ++i)
+		m_end[i] = i + 1;
+	for (std::size_t i = n; i-- > 0;) {
+		m_hash[i] = combine(m_label[i], children[i]);
+		const Index parent = m_parent[i];
+		if (parent != None) {
+			children[parent] = combine(children[parent], m_hash[i]);
+			m_end[parent] = std::max(m_end[parent], m_end[i]);
+		}
+	}
+}
+
+class TreeDiff::Builder {
+public:
+	Builder(TreeDiff &diff, const HashedTree &from, const HashedTree &to)
+		: m_diff{diff}, m_fromTree{from}, m_toTree{to}, m_to{diff.m_to}, m_back(to.size(), None)
+	{
+		m_to.assign(from.size(), None);
+	}
+
+	void build()
+	{
+		if (m_fromTree.size() > 0 && m_toTree.size() > 0)
+			pair(0, 0);
+
+		while (!m_work.empty()) {
+			const auto [a, b] = m_work.back();
+			m_work.pop_back();
+			children(a, b);
+		}
+
+		moves();
+		report();
+	}
+
+private:
+	static constexpr Index None = HashedTree::None;
+	// smaller subtrees are not looked for elsewhere, they would be found
+	// all over the tree
+	static constexpr std::size_t MinMoved = 4;
+	// how far ahead unmatched children of the same kind are paired
+	static constexpr std::size_t Window = 8;
+
+	void identical(Index a, Index b)
+	{
+		for (std::size_t k = 0; k < m_fromTree.subtreeSize(a); ++k) {
+			m_to[a + k] = b + k;
+			m_back[b + k] = a + k;
+		}
+	}
+
+	void pair(Index a, Index b)
+	{
+		if (m_fromTree.hash(a) == m_toTree.hash(b)) {
+			identical(a, b);
+			return;
+		}
+
+		m_to[a] = b;
+		m_back[b] = a;
+		if (m_fromTree.label(a) != m_toTree.label(b))
+			m_diff.m_edits.push_back(Edit{Edit::Kind::Changed, a, b});
+		m_work.emplace_back(a, b);
+	}
+
+	static void childrenOf(const HashedTree &tree, Index i, std::vector <Index> &out)
+	{
+		out.clear();
+		for (Index c = i + 1; c < tree.end(i); c = tree.end(c))
+			out.push_back(c);
+	}
+
+	void children(Index a, Index b)
+	{
+		childrenOf(m_fromTree, a, m_a);
+		childrenOf(m_toTree, b, m_b);
+
+		// common ends first, most edits leave them alone
+		std::size_t first = 0, lastA = m_a.size(), lastB = m_b.size();
+		while (first < lastA && first < lastB && m_fromTree.hash(m_a[first]) == m_toTree.hash(m_b[first])) {
+			identical(m_a[first], m_b[first]);
+			++first;
+		}
+		while (lastA > first && lastB > first && m_fromTree.hash(m_a[lastA - 1]) == m_toTree.hash(m_b[lastB - 1])) {
+			identical(m_a[lastA - 1], m_b[lastB - 1]);
+			--lastA;
+			--lastB;
+		}
+		if (first == lastA && first == lastB)
+			return;
+
+		// equal subtrees in between, in the order of the new children
+		m_used.assign(lastA - first, false);
+		m_matched.clear();
+		if ((lastA - first) * (lastB - first) <= 64) {
+			for (std::size_t j = first; j < lastB; ++j) {
+				for (std::size_t i = first; i < lastA; ++i) {
+					if (!m_used[i - first] && m_fromTree.hash(m_a[i]) == m_toTree.hash(m_b[j])) {
+						m_used[i - first] = true;
+						m_matched.emplace_back(i, j);
+						break;
+					}
+				}
+			}
+		} else {
+			m_positions.clear();
+			for (std::size_t i = lastA; i-- > first;)
+				m_positions[m_fromTree.hash(m_a[i])].push_back(i);
+			for (std::size_t j = first; j < lastB; ++j) {
+				const auto it = m_positions.find(m_toTree.hash(m_b[j]));
+				if (it == m_positions.end() || it->second.empty())
+					continue;
+				const std::size_t i = it->second.back();
+				it->second.pop_back();
+				m_used[i - first] = true;
+				m_matched.emplace_back(i, j);
+			}
+		}
+
+		// equal children which are out of order are moves, all but the
+		// longest run keeping its order
+		reordered();
+		for (const auto &[i, j] : m_matched)
+			identical(m_a[i], m_b[j]);
+
+		// The rest is paired in order, with a node of the same label if there
+		// is one close ahead, else of the same kind.
+		m_unmatched.clear();
+		for (std::size_t i = first; i < lastA; ++i) {
+			if (!m_used[i - first])
+				m_unmatched.push_back(m_a[i]);
+		}
+
+		std::size_t next = 0;
+		for (std::size_t j = first; j < lastB && next < m_unmatched.size(); ++j) {
+			const Index b = m_b[j];
+			if (m_back[b] != None)
+				continue;
+
+			const std::size_t end = std::min(next + Window, m_unmatched.size());
+			std::size_t found = end;
+			for (std::size_t i = next; i < end && found == end; ++i) {
+				if (m_fromTree.label(m_unmatched[i]) == m_toTree.label(b))
+					found = i;
+			}
+			for (std::size_t i = next; i < end && found == end; ++i) {
+				if (m_fromTree.kind(m_unmatched[i]) == m_toTree.kind(b))
+					found = i;
+			}
+			if (found < end) {
+				pair(m_unmatched[found], b);
+				next = found + 1;
+			}
+		}
+	}
+
+	// Longest increasing subsequence of the old positions of m_matched, the
+	// others are reported as moved.
+	void reordered()
+	{
+		const std::size_t n = m_matched.size();
+		if (n < 2)
+			return;
+
+		std::vector <std::size_t> tails, tailIndex, previous(n, n);
+		for (std::size_t k = 0; k < n; ++k) {
+			const std::size_t position = m_matched[k].first;
+			const auto it = std::lower_bound(tails.begin(), tails.end(), position);
+			const std::size_t length = it - tails.begin();
+			if (it == tails.end()) {
+				tails.push_back(position);
+				tailIndex.push_back(k);
+			} else {
+				*it = position;
+				tailIndex[length] = k;
+			}
+			previous[k] = length > 0 ? tailIndex[length - 1] : n;
+		}
+
+		std::vector <bool> kept(n, false);
+		for (std::size_t k = tailIndex.back(); k != n; k = previous[k])
+			kept[k] = true;
+		for (std::size_t k = 0; k < n; ++k) {
+			if (!kept[k])
+				m_diff.m_edits.push_back(Edit{Edit::Kind::Moved, m_a[m_matched[k].first], m_b[m_matched[k].second]});
+		}
+	}
+
+	// Unmatched subtrees found unchanged somewhere else in the old tree.
+	void moves()
+	{
+		std::unordered_map <std::uint64_t, std::vector <Index> > candidates;
+		for (Index a = m_fromTree.size(); a-- > 0;) {
+			if (m_to[a] == None && m_fromTree.subtreeSize(a) >= MinMoved)
+				candidates[m_fromTree.hash(a)].push_back(a);
+		}
+		if (candidates.empty())
+			return;
+
+		for (Index b = 0; b < m_toTree.size();) {
+			if (m_back[b] != None || m_toTree.subtreeSize(b) < MinMoved) {
+				++b;
+				continue;
+			}
+
+			const auto it = candidates.find(m_toTree.hash(b));
+			if (it != candidates.end()) {
+				auto &list = it->second;
+				while (!list.empty() && m_to[list.back()] != None)
+					list.pop_back();
+				if (!list.empty()) {
+					identical(list.back(), b);
+					m_diff.m_edits.push_back(Edit{Edit::Kind::Moved, list.back(), b});
+					list.pop_back();
+					b = m_toTree.end(b);
+					continue;
+				}
+			}
+			++b;
+		}
+	}
+
+	void report()
+	{
+		auto &edits = m_diff.m_edits;
+		for (Index b = 0; b < m_toTree.size(); ++b) {
+			const Index parent = m_toTree.parent(b);
+			if (m_back[b] == None && (parent == None || m_back[parent] != None))
+				edits.push_back(Edit{Edit::Kind::Inserted, None, b});
+		}
+		for (Index a = 0; a < m_fromTree.size(); ++a) {
+			const Index parent = m_fromTree.parent(a);
+			if (m_to[a] == None && (parent == None || m_to[parent] != None))
+				edits.push_back(Edit{Edit::Kind::Deleted, a, None});
+		}
+
+		auto position = [this](const Edit &e) -> std::size_t
+		{
+			if (e.to != None)
+				return e.to;
+			const Index parent = m_fromTree.parent(e.from);
+			return parent == None ? 0 : m_to[parent];
+		};
+		std::stable_sort(edits.begin(), edits.end(), [&position](const Edit &x, const Edit &y) { return position(x) < position(y); });
+	}
+
+	TreeDiff &m_diff;
+	const HashedTree &m_fromTree;
+	const HashedTree &m_toTree;
+	std::vector <Index> &m_to;
+	std::vector <Index> m_back;
+	std::vector <std::pair <Index, Index> > m_work;
+
+	// scratch space of children()
+	std::vector <Index> m_a, m_b, m_unmatched;
+	std::vector <bool> m_used;
+	std::vector <std::pair <std::size_t, std::size_t> > m_matched;
+	std::unordered_map <std::uint64_t, std::vector <std::size_t> > m_positions;
+};
+
+TreeDiff::TreeDiff(const HashedTree &from, const HashedTree &to)
+{
+	Builder{*this, from, to}.build();
+}
+
+std::string TreeDiff::describe(const Node *node)
+{
+	std::string s = Node::toString(node->type());
+	auto add = [&s](std::string_view label)
+	{
+		s.push_back(' ');
+		s += label;
+	};
+
+	switch (node->type()) {
+		case Node::Type::ParamList:
+			for (const auto &name : static_cast<const ParamList *>(node)->names())
+				add(name);
+			if (static_cast<const ParamList *>(node)->hasEllipsis())
+				add("...");
+			break;
+		case Node::Type::LValue:
+			if (static_cast<const LValue *>(node)->lvalueType() != LValue::Type::Bracket)
+				add(static_cast<const LValue *>(node)->name());
+			break;
+		case Node::Type::MethodCall:
+			add(static_cast<const MethodCall *>(node)->methodName());
+			break;
+		case Node::Type::Assignment:
+			if (static_cast<const Assignment *>(node)->isLocal())
+				add("local");
+			break;
+		case Node::Type::Value: {
+			auto v = static_cast<const Value *>(node);
+			switch (v->valueType()) {
+				case ValueType::Nil:
+					add("nil");
+					break;
+				case ValueType::Boolean:
+					add(static_cast<const BooleanValue *>(v)->value() ? "true" : "false");
+					break;
+				case ValueType::Integer:
+					add(std::to_string(static_cast<const IntValue *>(v)->value()));
+					break;
+				case ValueType::Real: {
+					std::string real;
+					{
+						OutputBuffer out{real};
+						out.writeShortestReal(static_cast<const RealValue *>(v)->value());
+					}
+					add(real);
+					break;
+				}
+				case ValueType::String:
+					add(static_cast<const StringValue *>(v)->value());
+					break;
+				default:
+					break;
+			}
+			break;
+		}
+		case Node::Type::Field:
+			if (static_cast<const Field *>(node)->fieldType() == Field::Type::Literal)
+				add(static_cast<const Field *>(node)->fieldName());
+			break;
+		case Node::Type::BinOp:
+			add(static_cast<const BinOp *>(node)->toString());
+			break;
+		case Node::Type::UnOp:
+			add(static_cast<const UnOp *>(node)->toString());
+			break;
+		case Node::Type::Function:
+			add(static_cast<const Function *>(node)->fullName());
+			break;
+		case Node::Type::For:
+			add(static_cast<const For *>(node)->iterator());
+			break;
+		default:
+			break;
+	}
+	return s;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "AST.hpp"
+
+// A tree flattened in pre-order with a hash of every subtree, computed
+// bottom-up from the node type, its operator or other kind, its names and
+// literal values and the hashes of its children. Subtree i is [i, end(i)).
+class HashedTree {
+public:
+	using Index = std::uint32_t;
+	static constexpr Index None = std::numeric_limits<Index>::max();
+
+	explicit HashedTree(const Chunk *root);
+
+	std::size_t size() const { return m_nodes.size(); }
+	const Node * node(Index i) const { return m_nodes[i]; }
+	// None for the root
+	Index parent(Index i) const { return m_parent[i]; }
+	Index end(Index i) const { return m_end[i]; }
+	std::size_t subtreeSize(Index i) const { return m_end[i] - i; }
+
+	std::uint64_t hash(Index i) const { return m_hash[i]; }
+	// hash of the node alone, equal if only its children differ
+	std::uint64_t label(Index i) const { return m_label[i]; }
+	// node type and kind within it, e.g. the BinOp::Type
+	std::uint16_t kind(Index i) const { return m_kind[i]; }
+	// absolute byte range of the statement the node is in
+	Span statement(Index i) const { return m_statement[i]; }
+
+private:
+	std::vector <const Node *> m_nodes;
+	std::vector <Index> m_parent;
+	std::vector <Index> m_end;
+	std::vector <std::uint64_t> m_hash;
+	std::vector <std::uint64_t> m_label;
+	std::vector <std::uint16_t> m_kind;
+	std::vector <Span> m_statement;
+};
+
+// The edits turning one tree into another. Subtrees with equal hashes are
+// taken to be equal. Matching goes top-down from the roots, pairing the
+// children of matched nodes by hash and otherwise in order by kind; what
+// remains is looked up by hash anywhere in the other tree to find moves.
+// Only the outermost inserted or deleted node of a subtree is reported.
+class TreeDiff {
+public:
+	using Index = HashedTree::Index;
+
+	struct Edit {
+		enum class Kind : std::uint8_t {
+			Inserted,
+			Deleted,
+			Moved,
+			// the same node with another label, e.g. a renamed variable
+			Changed,
+		};
+
+		Kind kind;
+		// None for inserted and deleted nodes respectively
+		Index from;
+		Index to;
+	};
+
+	TreeDiff(const HashedTree &from, const HashedTree &to);
+
+	// Ordered by position in the new tree, deletions at the place their
+	// parent went to.
+	const std::vector <Edit> & edits() const { return m_edits; }
+	// the node of to that node i of from became, None if it was deleted
+	Index match(Index i) const { return m_to[i]; }
+
+	// e.g. "LValue x" or "BinOp .."
+	static std::string describe(const Node *node);
+
+private:
+	class Builder;
+	friend class Builder;
+
+	std::vector <Index> m_to;
+	std::vector <Edit> m_edits;
+};
@@ -0,0 +1,123 @@
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "Protocol.hpp"
+
+// Small client for luaparse --server=SOCKET. All requests are sent up front
+// so the server can work on them concurrently, the answers are matched back
+// by request id.
+int main(int argc, char **argv)
+{
+	if (argc < 2) {
+		std::cerr << "Usage: " << argv[0] << " SOCKET [--format=none|text|json|sexpr] [--profile] [--source] [--stats] [--shutdown] FILE...\n";
+		return 1;
+	}
+
+	std::string format = "none";
+	bool profile = false;
+	bool source = false;
+	bool stats = false;
+	bool shutdown = false;
+	std::vector <std::string> files;
+
+	for (int i = 2; i < argc; ++i) {
+		const std::string_view arg{argv[i]};
+		if (arg.substr(0, 9) == "--format=")
+			format = std::string{arg.substr(9)};
+		else if (arg == "--profile")
+			profile = true;
+		else if (arg == "--source")
+			source = true;
+		else if (arg == "--stats")
+			stats = true;
+		else if (arg == "--shutdown")
+			shutdown = true;
+		else
+			files.emplace_back(arg);
+	}
+
+	const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+	struct sockaddr_un addr;
+	std::memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	std::strncpy(addr.sun_path, argv[1], sizeof(addr.sun_path) - 1);
+	if (fd < 0 || ::connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0) {
+		std::cerr << "Unable to connect to " << argv[1] << ": " << std::strerror(errno) << '\n';
+		return 1;
+	}
+
+	using Clock = std::chrono::steady_clock;
+	std::unordered_map <std::string, std::pair <std::string, Clock::time_point> > pending;
+	int nextId = 0;
+
+	auto send = [&](const std::string &command, const std::string &body, const std::string &label)
+	{
+		const std::string id = std::to_string(nextId++);
+		pending[id] = {label, Clock::now()};
+		return Protocol::writeFrame(fd, id + ' ' + command + ' ' + format + '\n' + body);
+	};
+
+	for (const auto &file : files) {
+		std::string command = profile ? "profile" : "parse";
+		std::string body = file;
+		if (source) {
+			std::string text;
+			char buf[1 << 16];
+			FILE *f = std::fopen(file.c_str(), "rb");
+			if (!f) {
+				std::cerr << "Unable to open file for reading: " << file << '\n';
+				continue;
+			}
+			for (std::size_t n; (n = std::fread(buf, 1, sizeof(buf), f)) > 0;)
+				text.append(buf, n);
+			std::fclose(f);
+			body = std::move(text);
+		} else {
+			command += "-file";
+		}
+
+		if (!send(command, body, file))
+			break;
+	}
+
+	if (stats)
+		send("stats", "", "<stats>");
+
+	int failures = 0;
+	std::string payload;
+	while (!pending.empty() && Protocol::readFrame(fd, payload)) {
+		const auto received = Clock::now();
+		const std::size_t eol = std::min(payload.find('\n'), payload.size());
+		const std::string header = payload.substr(0, eol);
+		const std::string id = header.substr(0, header.find(' '));
+
+		auto it = pending.find(id);
+		if (it == pending.end())
+			continue;
+
+		const auto roundTrip = std::chrono::duration_cast<std::chrono::microseconds>(received - it->second.second).count();
+		std::cerr << it->second.first << ": " << header.substr(id.size() + 1) << " us server, " << roundTrip << " us round trip\n";
+		if (header.find(" error ") != std::string::npos)
+			++failures;
+
+		std::cout.write(payload.data() + std::min(eol + 1, payload.size()), payload.size() - std::min(eol + 1, payload.size()));
+		pending.erase(it);
+	}
+
+	if (shutdown) {
+		Protocol::writeFrame(fd, "shutdown shutdown\n");
+		Protocol::readFrame(fd, payload);
+	}
+
+	::close(fd);
+	return failures == 0 && pending.empty() ? 0 : 1;
+}
@@ -17,7 +17,7 @@ class Driver;
 #include "Scanner.hpp"
 
 #undef yylex
-#define yylex driver.m_scanner.token
+#define yylex driver.nextToken
 
 %}
 
@@ -50,6 +50,7 @@ class Driver;
 %token <long> INT_VALUE
 %token <double> REAL_VALUE
 %token <std::string> ID STRING_VALUE
+%token <Span> BODY
 %token NIL TRUE FALSE ELLIPSIS
 %token BREAK RETURN FUNCTION DO WHILE END REPEAT UNTIL FOR IF THEN ELSE ELSEIF IN LOCAL
 %token HASH NOT
@@ -86,11 +87,11 @@ SEMICOLON {
 chunk :
 last_statement {
 	$$ = new Chunk{};
-	$$->append($last_statement);
+	driver.appendStatement($$, $last_statement, @last_statement);
 }
 | chunk_base last_statement {
 	$$ = $chunk_base;
-	$$->append($last_statement);
+	driver.appendStatement($$, $last_statement, @last_statement);
 }
 | chunk_base {
 	$$ = $chunk_base;
@@ -103,17 +104,18 @@ last_statement {
 chunk_base :
 statement opt_semicolon {
 	$$ = new Chunk{};
-	$$->append($statement);
+	driver.appendStatement($$, $statement, @statement);
 }
 | chunk statement opt_semicolon {
 	$$ = $chunk;
-	$$->append($statement);
+	driver.appendStatement($$, $statement, @statement);
 }
 ;
 
 block :
 chunk {
 	$$ = $chunk;
+	driver.closeBlock($$);
 }
 ;
 
@@ -126,6 +128,11 @@ var {
 }
 | LPAREN expr RPAREN {
 	$$ = $expr;
+	// the parentheses change what a call or ... gives
+	if ($$->type() == Node::Type::FunctionCall || $$->type() == Node::Type::MethodCall)
+		static_cast<FunctionCall *>($$)->setTruncated();
+	else if ($$->type() == Node::Type::Ellipsis)
+		static_cast<Ellipsis *>($$)->setTruncated();
 }
 ;
 
@@ -228,7 +235,7 @@ else_if {
 }
 | else_if_list[base] else_if {
 	$$ = $base;
-	$$->setNextIf($else_if);
+	$$->appendNextIf($else_if);
 }
 | %empty {
 	$$ = nullptr;
@@ -319,6 +326,12 @@ LPAREN RPAREN function_body_block[block] {
 | LPAREN param_list RPAREN function_body_block[block] {
 	$$ = new Function{$param_list, $block};
 }
+| LPAREN RPAREN BODY END {
+	$$ = driver.lazyFunction(nullptr, $BODY, @BODY);
+}
+| LPAREN param_list RPAREN BODY END {
+	$$ = driver.lazyFunction($param_list, $BODY, @BODY);
+}
 ;
 
 function_body_block :
@@ -494,8 +507,75 @@ LBRACKET expr[key] RBRACKET ASSIGN expr[val] {
 
 %%
 
+namespace {
+
+template <typename T>
+void discard(yy::Parser::value_type &value)
+{
+	delete value.as<T>();
+	value.as<T>() = nullptr;
+}
+
+}
+
 void yy::Parser::error(const location &loc, const std::string &msg)
 {
-	std::cerr << "Parse error: " << loc << " : " << msg << '\n';
-	std::exit(1);
+	driver.error(loc, msg);
+
+	// There are no error recovery rules, so parsing stops here. Free the nodes
+	// which are still on the stack, nothing else is going to take them.
+	for (int i = 0; i < static_cast<int>(yystack_.size()); ++i) {
+		auto &sym = yystack_[i];
+		switch (sym.kind()) {
+			case symbol_kind::S_block:
+			case symbol_kind::S_chunk:
+			case symbol_kind::S_chunk_base:
+			case symbol_kind::S_else:
+			case symbol_kind::S_function_body_block:
+				discard<Chunk *>(sym.value);
+				break;
+			case symbol_kind::S_expr:
+			case symbol_kind::S_prefix_expr:
+			case symbol_kind::S_statement:
+			case symbol_kind::S_last_statement:
+				discard<Node *>(sym.value);
+				break;
+			case symbol_kind::S_if:
+			case symbol_kind::S_else_if:
+			case symbol_kind::S_else_if_list:
+				discard<If *>(sym.value);
+				break;
+			case symbol_kind::S_name_list:
+			case symbol_kind::S_param_list:
+				discard<ParamList *>(sym.value);
+				break;
+			case symbol_kind::S_args:
+			case symbol_kind::S_expr_list:
+				discard<ExprList *>(sym.value);
+				break;
+			case symbol_kind::S_function_call:
+				discard<FunctionCall *>(sym.value);
+				break;
+			case symbol_kind::S_var_list:
+				discard<VarList *>(sym.value);
+				break;
+			case symbol_kind::S_var:
+				discard<LValue *>(sym.value);
+				break;
+			case symbol_kind::S_field_list:
+			case symbol_kind::S_field_list_base:
+			case symbol_kind::S_table_ctor:
+				discard<TableCtor *>(sym.value);
+				break;
+			case symbol_kind::S_field:
+				discard<Field *>(sym.value);
+				break;
+			case symbol_kind::S_function:
+			case symbol_kind::S_function_body:
+				discard<Function *>(sym.value);
+				break;
+			default:
+				break;
+		}
+	}
 }
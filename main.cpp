@@ -1,17 +1,985 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
 
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Advisor.hpp"
+#include "CallGraph.hpp"
+#include "ControlFlowGraph.hpp"
+#include "DataLoader.hpp"
+#include "Linter.hpp"
 #include "Driver.hpp"
+#include "Emitter.hpp"
+#include "FileLoader.hpp"
+#include "MemoryProfile.hpp"
+#include "Optimizer.hpp"
+#include "Query.hpp"
+#include "Scaling.hpp"
+#include "Server.hpp"
+#include "ThreadPool.hpp"
+#include "TokenStream.hpp"
+#include "Traversal.hpp"
+#include "TreeDiff.hpp"
+
+namespace {
+
+// Writes locations in a parsed source as "name:line:column:". Offsets are
+// only known for sources whose lines the scanners kept, otherwise it is
+// just "name:".
+class Locator {
+public:
+	explicit Locator(const ParseResult &result) : m_result{result}
+	{
+		if (!result.exactSpans)
+			return;
+		for (std::size_t i = 0; i < result.source.size(); ++i) {
+			if (result.source[i] == '\n')
+				m_lineStarts.push_back(i + 1);
+		}
+	}
+
+	void write(std::ostream &os, std::size_t offset) const
+	{
+		os << *m_result.filename << ':';
+		if (m_result.exactSpans) {
+			const std::size_t line = std::upper_bound(m_lineStarts.begin(), m_lineStarts.end(), offset) - m_lineStarts.begin();
+			os << line << ':' << offset - m_lineStarts[line - 1] + 1 << ':';
+		}
+	}
+
+private:
+	const ParseResult &m_result;
+	std::vector <std::size_t> m_lineStarts{0};
+};
+
+// Builds the graph of the main chunk and of every function and reports the
+// code that can never run.
+bool printControlFlow(const ParseResult &result)
+{
+	for (const auto &d : result.diagnostics)
+		std::cerr << "Parse error: " << d << '\n';
+	if (!result.success())
+		return false;
+
+	const Locator locator{result};
+
+	const auto start = std::chrono::steady_clock::now();
+	std::size_t functions = 0, blocks = 0, edges = 0, unreachable = 0;
+
+	std::vector <ControlFlowGraph::NestedFunction> pending{{nullptr, 0}};
+	while (!pending.empty()) {
+		const auto f = pending.back();
+		pending.pop_back();
+
+		const Chunk *body = f.function ? (f.function->hasChunk() ? &f.function->chunk() : nullptr) : result.chunk();
+		const ControlFlowGraph graph{body, f.base, f.function};
+		pending.insert(pending.end(), graph.functions().rbegin(), graph.functions().rend());
+
+		++functions;
+		blocks += graph.size();
+		edges += graph.edgeCount();
+
+		for (const auto &s : graph.unreachable()) {
+			++unreachable;
+			locator.write(std::cout, s.offset);
+			std::cout << " unreachable " << Node::toString(s.node->type()) << " in "
+				<< (f.function ? f.function->fullName() : "main chunk") << '\n';
+		}
+	}
+
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	std::cout << functions << " functions, " << blocks << " blocks, " << edges << " edges, " << unreachable
+		<< " unreachable in " << elapsed.count() * 1000.0 << " ms\n";
+	return true;
+}
+
+// Prints the callees of every function with two summaries computed bottom-up
+// over the components: whether it may reach coroutine.yield through known
+// calls and whether it may touch global names.
+bool printCallGraph(const ParseResult &result, unsigned threads)
+{
+	for (const auto &d : result.diagnostics)
+		std::cerr << "Parse error: " << d << '\n';
+	if (!result.success())
+		return false;
+
+	enum : unsigned char {
+		Yields = 1,
+		Globals = 2,
+	};
+
+	const auto start = std::chrono::steady_clock::now();
+	const CallGraph graph{result.chunk()};
+
+	ThreadPool pool{threads};
+	const auto summaries = graph.summarize<unsigned char>([&graph](CallGraph::FunctionId f, const std::vector <unsigned char> &done)
+	{
+		unsigned char s = graph.globals(f).empty() ? 0 : Globals;
+		for (const auto &call : graph.calls(f)) {
+			if (call.name == "coroutine.yield")
+				s |= Yields;
+		}
+		for (CallGraph::FunctionId g : graph.callees(f))
+			s |= done[g];
+		return s;
+	}, &pool);
+
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	std::size_t edges = 0, unresolved = 0;
+	for (CallGraph::FunctionId f = 0; f < graph.size(); ++f) {
+		const auto callees = graph.callees(f);
+		edges += callees.size();
+
+		std::cout << *result.filename << ": " << graph.name(f);
+		if (graph.recursive(graph.component(f)))
+			std::cout << " [recursive]";
+		if (summaries[f] & Yields)
+			std::cout << " [yields]";
+		if (summaries[f] & Globals)
+			std::cout << " [globals]";
+		std::cout << " ->";
+		for (CallGraph::FunctionId g : callees)
+			std::cout << ' ' << graph.name(g);
+
+		std::size_t unknown = 0;
+		for (const auto &call : graph.calls(f)) {
+			if (call.callee == CallGraph::None)
+				++unknown;
+		}
+		if (unknown > 0)
+			std::cout << " (" << unknown << " unknown)";
+		std::cout << '\n';
+		unresolved += unknown;
+	}
+
+	std::cout << graph.size() << " functions, " << edges << " edges, " << graph.componentCount() << " components, "
+		<< unresolved << " unresolved calls in " << elapsed.count() * 1000.0 << " ms\n";
+	return true;
+}
+
+// Builds the graph of small sources whose last call has a known target, or
+// none, and compares it.
+bool checkCallGraph(Driver &d)
+{
+	static const struct {
+		const char *source;
+		// fullName() of the target, empty if it is unknown
+		const char *callee;
+	} Cases[] = {
+		{"local function f() end\nf()\n", "f"},
+		{"local function f() end\nf = g\nf()\n", ""},
+		{"M = {}\nfunction M.f() end\nM.f()\n", "M.f"},
+		{"M = {}\nfunction M.f() end\nM = require(\"other\")\nM.f()\n", ""},
+		{"M = {}\nM = M or {}\nfunction M.f() end\nM.f()\n", "M.f"},
+		{"local M = {a = {}}\nfunction M.a.f() end\nM.a = other\nM.a.f()\n", ""},
+		{"local M = {}\nfunction M:f() end\nfunction M:g() self:f() end\nM:g()\n", "M:g"},
+	};
+
+	bool ok = true;
+	for (const auto &c : Cases) {
+		const ParseResult result = d.parse(c.source, "<call graph case>");
+		if (!result.success()) {
+			std::cerr << "Parse error in call graph case:\n" << c.source;
+			ok = false;
+			continue;
+		}
+
+		const CallGraph graph{result.chunk()};
+		const CallGraph::FunctionId callee = (graph.calls(0).end() - 1)->callee;
+		const std::string found = callee == CallGraph::None ? std::string{} : graph.function(callee)->fullName();
+		if (found != c.callee) {
+			std::cerr << "Last call resolved to \"" << found << "\" instead of \"" << c.callee << "\" in:\n" << c.source;
+			ok = false;
+		}
+	}
+
+	if (ok)
+		std::cout << std::size(Cases) << " call graph cases resolved as expected\n";
+	return ok;
+}
+
+// Reads a whole file, or stdin if input is null.
+bool readInput(const char *input, std::string &source)
+{
+	if (!input) {
+		source.assign(std::istreambuf_iterator<char>{std::cin}, std::istreambuf_iterator<char>{});
+		return true;
+	}
+
+	std::error_code error;
+	const std::uintmax_t size = std::filesystem::file_size(input, error);
+	std::ifstream file{input, std::ios::binary};
+	if (error || file.fail())
+		return false;
+	source.resize(size);
+	return static_cast<bool>(file.read(source.data(), source.size()));
+}
+
+// Runs the rules named in rules, all if it is empty, over every input and
+// prints what they found. Fails if anything was.
+bool lint(Driver &d, const std::vector <const char *> &inputs, std::string_view rules, FileLoader::Backend io)
+{
+	Linter linter;
+	if (rules.empty())
+		linter.addDefaultRules();
+	while (!rules.empty()) {
+		const std::size_t n = std::min(rules.find(','), rules.size());
+		if (!linter.addRule(rules.substr(0, n))) {
+			std::cerr << "Unknown lint rule: " << rules.substr(0, n) << '\n';
+			return false;
+		}
+		rules.remove_prefix(std::min(n + 1, rules.size()));
+	}
+
+	std::vector <const char *> files = inputs;
+	if (files.empty())
+		files.push_back(nullptr);
+
+	bool ok = true;
+	std::size_t found = 0;
+	FileLoader loader{files, FileLoader::DefaultWindow, io};
+	for (FileLoader::File file; loader.next(file); loader.release(file)) {
+		if (!file.error.empty()) {
+			ok = false;
+			continue;
+		}
+
+		const ParseResult result = d.parse(file.data, file.name ? file.name : "<stdin>");
+		for (const auto &diagnostic : result.diagnostics)
+			std::cerr << "Parse error: " << diagnostic << '\n';
+		if (!result.success()) {
+			ok = false;
+			continue;
+		}
+
+		const Locator locator{result};
+
+		for (const auto &diagnostic : linter.run(result)) {
+			locator.write(std::cout, diagnostic.span.begin);
+			std::cout << ' ' << diagnostic.rule << ": " << diagnostic.message << '\n';
+			++found;
+		}
+	}
+
+	return ok && found == 0;
+}
+
+// Looks for slow patterns in every input and prints the findings of all of
+// them ranked by score, each with the rewrite suggested.
+bool advise(Driver &d, const std::vector <const char *> &inputs, std::string_view patterns, FileLoader::Backend io)
+{
+	Advisor advisor;
+	if (!advisor.select(patterns))
+		return false;
+
+	std::vector <const char *> files = inputs;
+	if (files.empty())
+		files.push_back(nullptr);
+
+	bool ok = true;
+	// with their locations, which outlive the files
+	std::vector <std::pair <Advice, std::string> > found;
+	std::ostringstream location;
+	const auto start = std::chrono::steady_clock::now();
+	FileLoader loader{files, FileLoader::DefaultWindow, io};
+	for (FileLoader::File file; loader.next(file); loader.release(file)) {
+		if (!file.error.empty()) {
+			ok = false;
+			continue;
+		}
+
+		const ParseResult result = d.parse(file.data, file.name ? file.name : "<stdin>");
+		for (const auto &diagnostic : result.diagnostics)
+			std::cerr << "Parse error: " << diagnostic << '\n';
+		if (!result.success()) {
+			ok = false;
+			continue;
+		}
+
+		const Locator locator{result};
+		for (auto &advice : advisor.run(result)) {
+			location.str({});
+			locator.write(location, advice.span.begin);
+			found.emplace_back(std::move(advice), location.str());
+		}
+	}
+
+	std::stable_sort(found.begin(), found.end(), [](const auto &a, const auto &b) { return a.first.score > b.first.score; });
+	for (const auto &f : found) {
+		const Advice &advice = f.first;
+		std::cout << f.second << ' ' << advice.pattern << " (score " << advice.score << "): " << advice.message;
+		if (advice.count > 1)
+			std::cout << " (" << advice.count << " times)";
+		std::cout << "\n\t" << advice.suggestion << '\n';
+	}
+
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	std::cerr << found.size() << " findings in " << files.size() << " files in " << elapsed.count() * 1000.0 << " ms\n";
+	return ok;
+}
+
+// Runs the queries over every input and prints each match with the
+// S-expressions of its captures.
+bool query(Driver &d, const std::vector <const char *> &inputs, const QuerySet &queries, FileLoader::Backend io)
+{
+	std::vector <const char *> files = inputs;
+	if (files.empty())
+		files.push_back(nullptr);
+
+	bool ok = true;
+	std::size_t found = 0;
+	std::chrono::duration<double> elapsed{0};
+	std::string capture;
+	FileLoader loader{files, FileLoader::DefaultWindow, io};
+	for (FileLoader::File file; loader.next(file); loader.release(file)) {
+		if (!file.error.empty()) {
+			ok = false;
+			continue;
+		}
+
+		const ParseResult result = d.parse(file.data, file.name ? file.name : "<stdin>");
+		for (const auto &diagnostic : result.diagnostics)
+			std::cerr << "Parse error: " << diagnostic << '\n';
+		if (!result.success()) {
+			ok = false;
+			continue;
+		}
+
+		const auto start = std::chrono::steady_clock::now();
+		const std::vector <QueryMatch> matches = queries.run(result.chunk());
+		elapsed += std::chrono::steady_clock::now() - start;
+		found += matches.size();
+
+		const Locator locator{result};
+
+		for (const auto &match : matches) {
+			locator.write(std::cout, match.statement.begin);
+			std::cout << ' ' << queries.text(match.query);
+
+			const auto &names = queries.captures(match.query);
+			for (std::size_t i = 0; i < names.size(); ++i) {
+				if (!match.captures[i])
+					continue;
+				capture.clear();
+				{
+					OutputBuffer out{capture};
+					Emitter::create(OutputFormat::Sexpr, out)->emit(match.captures[i]);
+				}
+				std::cout << " @" << names[i] << '=' << capture;
+			}
+			std::cout << '\n';
+		}
+	}
+
+	std::cerr << queries.size() << " queries, " << found << " matches in " << elapsed.count() * 1000.0 << " ms\n";
+	return ok;
+}
+
+// Prints the structural edits from the first input to the second.
+bool diff(Driver &d, const std::vector <const char *> &inputs)
+{
+	if (inputs.size() != 2) {
+		std::cerr << "--diff needs two files\n";
+		return false;
+	}
+
+	std::string source[2];
+	ParseResult result[2];
+	for (int i = 0; i < 2; ++i) {
+		if (!readInput(inputs[i], source[i])) {
+			std::cerr << "Unable to open file for reading: " << inputs[i] << '\n';
+			return false;
+		}
+		result[i] = d.parse(source[i], inputs[i]);
+		for (const auto &diagnostic : result[i].diagnostics)
+			std::cerr << "Parse error: " << diagnostic << '\n';
+		if (!result[i].success())
+			return false;
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+	const HashedTree from{result[0].chunk()}, to{result[1].chunk()};
+	const TreeDiff changes{from, to};
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	const Locator fromLocator{result[0]}, toLocator{result[1]};
+	for (const auto &edit : changes.edits()) {
+		switch (edit.kind) {
+			case TreeDiff::Edit::Kind::Inserted:
+				std::cout << "+ ";
+				toLocator.write(std::cout, to.statement(edit.to).begin);
+				std::cout << " inserted " << TreeDiff::describe(to.node(edit.to)) << '\n';
+				break;
+			case TreeDiff::Edit::Kind::Deleted:
+				std::cout << "- ";
+				fromLocator.write(std::cout, from.statement(edit.from).begin);
+				std::cout << " deleted " << TreeDiff::describe(from.node(edit.from)) << '\n';
+				break;
+			case TreeDiff::Edit::Kind::Moved:
+				std::cout << "> ";
+				fromLocator.write(std::cout, from.statement(edit.from).begin);
+				std::cout << " -> ";
+				toLocator.write(std::cout, to.statement(edit.to).begin);
+				std::cout << " moved " << TreeDiff::describe(to.node(edit.to)) << '\n';
+				break;
+			case TreeDiff::Edit::Kind::Changed:
+				std::cout << "~ ";
+				fromLocator.write(std::cout, from.statement(edit.from).begin);
+				std::cout << " -> ";
+				toLocator.write(std::cout, to.statement(edit.to).begin);
+				std::cout << " changed " << TreeDiff::describe(from.node(edit.from)) << " -> " << TreeDiff::describe(to.node(edit.to)) << '\n';
+				break;
+		}
+	}
+
+	std::cerr << from.size() << " and " << to.size() << " nodes, " << changes.edits().size() << " edits in "
+		<< elapsed.count() * 1000.0 << " ms\n";
+	return true;
+}
+
+enum class TokenFormat {
+	Text,
+	Binary,
+	Count,
+};
+
+void writeTokens(OutputBuffer &out, const TokenStream &tokens, const std::vector <std::string> &names)
+{
+	const std::string &source = tokens.source();
+	std::size_t line = 1, lineStart = 0, scanned = 0;
+
+	for (std::size_t i = 0; i < tokens.size(); ++i) {
+		const std::size_t offset = tokens.offset(i);
+		for (const char *p = source.data() + scanned, *end = source.data() + offset;
+			(p = static_cast<const char *>(std::memchr(p, '\n', end - p))); ++line)
+			lineStart = ++p - source.data();
+		scanned = offset;
+
+		out.write(tokens.name());
+		out.put(':');
+		out.writeInt(line);
+		out.put(':');
+		out.writeInt(offset - lineStart + 1);
+		out.put(' ');
+		out.write(names[tokens.kind(i)]);
+		out.put(' ');
+		out.write(tokens.text(i));
+		out.put('\n');
+	}
+}
+
+// Tokenizes the inputs (stdin if there are none) on a pool of threads and
+// writes the streams in the order of the inputs. Counting keeps no stream
+// around and reports the throughput.
+bool printTokens(const std::vector <const char *> &inputs, TokenFormat format, unsigned threads, FileLoader::Backend io)
+{
+	const auto start = std::chrono::steady_clock::now();
+	const std::size_t count = std::max<std::size_t>(inputs.size(), 1);
+	std::vector <TokenStream> streams(format == TokenFormat::Count ? 0 : count);
+	std::vector <std::size_t> tokenCounts(count), sizes(count);
+	std::vector <std::string> errors(count);
+	std::vector <const char *> files = inputs;
+	if (files.empty())
+		files.push_back(nullptr);
+	FileLoader loader{files, FileLoader::DefaultWindow, io};
+
+	auto work = [&]
+	{
+		Tokenizer tokenizer;
+		TokenStream counted;
+
+		for (FileLoader::File file; loader.next(file); loader.release(file)) {
+			const std::size_t i = file.index;
+			const std::string name = file.name ? file.name : "<stdin>";
+			if (!file.error.empty()) {
+				errors[i] = "Unable to open file for reading: " + name;
+				continue;
+			}
+
+			const std::string &source = file.data;
+			TokenStream &tokens = streams.empty() ? counted : streams[i];
+			if (!tokenizer.tokenize(source, name, tokens)) {
+				const yy::position &pos = tokenizer.errorPosition();
+				errors[i] = name + ':' + std::to_string(pos.line) + '.' + std::to_string(pos.column) + " : " + tokenizer.error();
+			}
+			tokenCounts[i] = tokens.size();
+			sizes[i] = source.size();
+		}
+	};
+
+	if (inputs.size() < 2) {
+		work();
+	} else {
+		ThreadPool pool{threads};
+		std::vector <std::future <void> > done;
+		for (unsigned t = 0; t < pool.size(); ++t)
+			done.push_back(pool.submit(work));
+		for (auto &d : done)
+			d.get();
+	}
+
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	std::vector <std::string> names;
+	for (int k = 0; k < yy::Parser::YYNTOKENS; ++k)
+		names.push_back(yy::Parser::symbol_name(static_cast<yy::Parser::symbol_kind_type>(k)));
+
+	bool ok = true;
+	std::size_t totalTokens = 0, totalBytes = 0;
+	OutputBuffer out{STDOUT_FILENO};
+
+	for (std::size_t i = 0; i < count; ++i) {
+		if (!errors[i].empty()) {
+			std::cerr << errors[i] << '\n';
+			ok = false;
+			continue;
+		}
+
+		totalTokens += tokenCounts[i];
+		totalBytes += sizes[i];
+		switch (format) {
+			case TokenFormat::Text:
+				writeTokens(out, streams[i], names);
+				break;
+			case TokenFormat::Binary:
+				streams[i].write(out);
+				break;
+			case TokenFormat::Count:
+				out.writeInt(tokenCounts[i]);
+				out.put('\t');
+				out.writeInt(sizes[i]);
+				out.put('\t');
+				out.write(inputs.empty() ? "<stdin>" : inputs[i]);
+				out.put('\n');
+				break;
+		}
+	}
+
+	if (!out.flush())
+		return false;
+
+	if (format == TokenFormat::Count) {
+		std::cerr << count << " files, " << totalTokens << " tokens, " << totalBytes << " bytes in "
+			<< elapsed.count() * 1000.0 << " ms (" << totalBytes / elapsed.count() / 1e6 << " MB/s)\n";
+	}
+	return ok;
+}
+
+// Evaluates constant data files (stdin if there are none) and writes one
+// document per input.
+bool loadData(const std::vector <const char *> &inputs, bool messagePack)
+{
+	DataLoader loader;
+	DataDocument document;
+	std::string source;
+	OutputBuffer out{STDOUT_FILENO};
+	bool ok = true;
+
+	for (std::size_t i = 0; i < std::max<std::size_t>(inputs.size(), 1); ++i) {
+		const char *input = inputs.empty() ? nullptr : inputs[i];
+		if (!readInput(input, source)) {
+			std::cerr << "Unable to open file for reading: " << input << '\n';
+			ok = false;
+			continue;
+		}
+
+		if (!loader.load(source, input ? input : "<stdin>", document)) {
+			std::cerr << "Data error: " << loader.error() << '\n';
+			ok = false;
+			continue;
+		}
+
+		if (messagePack) {
+			document.writeMessagePack(out, document.root());
+		} else {
+			document.writeJson(out, document.root());
+			out.put('\n');
+		}
+	}
+
+	return out.flush() && ok;
+}
+
+// Rewritten copies of the chunks of a file, reporting what was changed.
+std::vector <std::unique_ptr <Chunk> > optimize(Optimizer optimizer, const std::vector <std::unique_ptr <Chunk> > &chunks, const char *name)
+{
+	std::vector <std::unique_ptr <Chunk> > result;
+	for (const auto &chunk : chunks)
+		result.push_back(optimizer.run(*chunk));
+
+	const Optimizer::Stats &stats = optimizer.stats();
+	std::cerr << (name ? name : "<stdin>") << ": " << stats.inlined << " calls inlined, " << stats.hoisted
+		<< " expressions hoisted, " << stats.cached << " reads cached\n";
+	return result;
+}
+
+// Writes every input in the format into a file of the same relative path
+// under directory, e.g. to minify a whole source tree in one run. With an
+// optimizer the rewritten trees are written.
+bool dumpFiles(Driver &d, const std::vector <const char *> &inputs, OutputFormat format, const std::filesystem::path &directory,
+	FileLoader::Backend io, const Optimizer *optimizer)
+{
+	bool ok = true;
+	FileLoader loader{inputs, FileLoader::DefaultWindow, io};
+
+	for (FileLoader::File file; loader.next(file); loader.release(file)) {
+		const char *input = file.name;
+		if (!file.error.empty()) {
+			std::cerr << "Unable to open file for reading: " << input << '\n';
+			ok = false;
+			continue;
+		}
+
+		const ParseResult result = d.parse(file.data, input);
+		for (const auto &diagnostic : result.diagnostics)
+			std::cerr << "Parse error: " << diagnostic << '\n';
+		if (!result.success()) {
+			ok = false;
+			continue;
+		}
+
+		const std::filesystem::path path = directory / std::filesystem::path{input}.relative_path();
+		std::error_code error;
+		std::filesystem::create_directories(path.parent_path(), error);
+		const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0) {
+			std::cerr << "Unable to open file for writing: " << path.native() << '\n';
+			ok = false;
+			continue;
+		}
+
+		{
+			const auto optimized = optimizer ? optimize(*optimizer, result.chunks, input) : std::vector <std::unique_ptr <Chunk> >{};
+			OutputBuffer out{fd};
+			auto emitter = Emitter::create(format, out);
+			for (const auto &chunk : optimizer ? optimized : result.chunks) {
+				emitter->emit(chunk.get());
+				if (format != OutputFormat::Text)
+					out.put('\n');
+			}
+			if (!out.flush()) {
+				std::cerr << "Unable to write " << path.native() << '\n';
+				ok = false;
+			}
+		}
+		::close(fd);
+	}
+
+	return ok;
+}
+
+// Lazy function bodies which failed to parse, once something looked at them.
+bool reportBodyErrors(const std::vector <std::unique_ptr <Chunk> > &chunks)
+{
+	bool ok = true;
+	for (const auto &chunk : chunks) {
+		Traversal::walk(chunk.get(), [&ok](const Node *node)
+		{
+			if (node->type() == Node::Type::Function && !static_cast<const Function *>(node)->bodyError().empty()) {
+				std::cerr << "Parse error: " << static_cast<const Function *>(node)->bodyError() << '\n';
+				ok = false;
+			}
+			return true;
+		});
+	}
+	return ok;
+}
+
+}
 
 int main(int argc, char **argv)
 {
 	Driver d;
+	const char *inputFile = nullptr;
+	std::vector <const char *> inputFiles;
+	const char *outputDir = nullptr;
+	bool tokens = false;
+	bool data = false;
+	bool dataMessagePack = false;
+	TokenFormat tokenFormat = TokenFormat::Text;
+	bool checkLexers = false;
+	bool checkScaling = false;
+	std::string_view scalingFamilies;
+	unsigned incrementalEdits = 0;
+	bool checkRoundTrip = false;
+	bool checkLazy = false;
+	bool checkCalls = false;
+	bool controlFlow = false;
+	bool callGraph = false;
+	bool lintFiles = false;
+	bool adviseFiles = false;
+	std::string_view advisePatterns;
+	bool diffFiles = false;
+	QuerySet queries;
+	bool queryFiles = false;
+	std::string_view lintRules;
+	bool dump = false;
+	bool lazy = false;
+	OutputFormat dumpFormat = OutputFormat::Text;
+	Optimizer optimizer;
+	bool optimizeFiles = false;
+	bool memoryProfile = false;
+	bool memoryProfileJson = false;
+	const char *serverSocket = nullptr;
+	bool serverStdio = false;
+	Server::Options serverOptions;
+	FileLoader::Backend io = FileLoader::Backend::Auto;
+
+	for (int i = 1; i < argc; ++i) {
+		const std::string_view arg{argv[i]};
+		if (arg == "--lexer=flex") {
+			d.setLexer(Driver::Lexer::Flex);
+			serverOptions.lexer = Driver::Lexer::Flex;
+		} else if (arg == "--lexer=fast") {
+			d.setLexer(Driver::Lexer::Fast);
+			serverOptions.lexer = Driver::Lexer::Fast;
+		} else if (arg == "--lazy") {
+			d.setLazyFunctions(true);
+			lazy = true;
+		} else if (arg == "--check-lexer") {
+			checkLexers = true;
+		} else if (arg == "--check-scaling") {
+			checkScaling = true;
+		} else if (arg.substr(0, 16) == "--check-scaling=") {
+			checkScaling = true;
+			scalingFamilies = arg.substr(16);
+		} else if (arg == "--check-incremental") {
+			incrementalEdits = 1000;
+		} else if (arg.substr(0, 20) == "--check-incremental=") {
+			incrementalEdits = std::atoi(argv[i] + 20);
+		} else if (arg == "--check-roundtrip") {
+			checkRoundTrip = true;
+		} else if (arg == "--check-lazy") {
+			checkLazy = true;
+		} else if (arg == "--check-callgraph") {
+			checkCalls = true;
+		} else if (arg == "--cfg") {
+			controlFlow = true;
+		} else if (arg == "--callgraph") {
+			callGraph = true;
+		} else if (arg.substr(0, 8) == "--query=") {
+			queryFiles = true;
+			if (!queries.add(arg.substr(8))) {
+				std::cerr << "Invalid query: " << queries.error() << '\n';
+				return 1;
+			}
+		} else if (arg.substr(0, 10) == "--queries=") {
+			std::string text;
+			queryFiles = true;
+			if (!readInput(argv[i] + 10, text)) {
+				std::cerr << "Unable to open file for reading: " << argv[i] + 10 << '\n';
+				return 1;
+			}
+			if (!queries.add(text)) {
+				std::cerr << "Invalid query in " << argv[i] + 10 << ": " << queries.error() << '\n';
+				return 1;
+			}
+		} else if (arg == "--diff") {
+			diffFiles = true;
+		} else if (arg == "--lint") {
+			lintFiles = true;
+		} else if (arg.substr(0, 7) == "--lint=") {
+			lintFiles = true;
+			lintRules = arg.substr(7);
+		} else if (arg == "--advise") {
+			adviseFiles = true;
+		} else if (arg.substr(0, 9) == "--advise=") {
+			adviseFiles = true;
+			advisePatterns = arg.substr(9);
+		} else if (arg == "--dump" || arg == "--dump=text") {
+			dump = true;
+			dumpFormat = OutputFormat::Text;
+		} else if (arg == "--dump=json") {
+			dump = true;
+			dumpFormat = OutputFormat::Json;
+		} else if (arg == "--dump=sexpr") {
+			dump = true;
+			dumpFormat = OutputFormat::Sexpr;
+		} else if (arg == "--dump=lua") {
+			dump = true;
+			dumpFormat = OutputFormat::Lua;
+		} else if (arg == "--dump=lua-min") {
+			dump = true;
+			dumpFormat = OutputFormat::LuaMinified;
+		} else if (arg == "--optimize" || arg.substr(0, 11) == "--optimize=") {
+			optimizeFiles = true;
+			if (!optimizer.select(arg == "--optimize" ? std::string_view{} : arg.substr(11)))
+				return 1;
+		} else if (arg == "--memory-profile") {
+			memoryProfile = true;
+		} else if (arg == "--memory-profile=json") {
+			memoryProfile = true;
+			memoryProfileJson = true;
+		} else if (arg == "--tokens" || arg == "--tokens=text") {
+			tokens = true;
+			tokenFormat = TokenFormat::Text;
+		} else if (arg == "--tokens=binary") {
+			tokens = true;
+			tokenFormat = TokenFormat::Binary;
+		} else if (arg == "--tokens=count") {
+			tokens = true;
+			tokenFormat = TokenFormat::Count;
+		} else if (arg == "--data" || arg == "--data=json") {
+			data = true;
+			dataMessagePack = false;
+		} else if (arg == "--data=msgpack") {
+			data = true;
+			dataMessagePack = true;
+		} else if (arg.substr(0, 13) == "--output-dir=") {
+			outputDir = argv[i] + 13;
+		} else if (arg.substr(0, 9) == "--server=") {
+			serverSocket = argv[i] + 9;
+		} else if (arg == "--server-stdio") {
+			serverStdio = true;
+		} else if (arg == "--io=uring") {
+			io = FileLoader::Backend::IoUring;
+		} else if (arg == "--io=pread") {
+			io = FileLoader::Backend::Pread;
+		} else if (arg.substr(0, 10) == "--threads=") {
+			serverOptions.threads = std::atoi(argv[i] + 10);
+			d.setThreads(serverOptions.threads);
+		} else if (arg.size() > 1 && arg[0] == '-') {
+			std::cerr << "Unknown option: " << arg << '\n';
+			return 1;
+		} else {
+			inputFile = argv[i];
+			inputFiles.push_back(argv[i]);
+		}
+	}
+
+	if (checkScaling) {
+		Scaling scaling{d};
+		if (!scaling.select(scalingFamilies))
+			return 1;
+		return scaling.run() ? 0 : 1;
+	}
+
+	if (tokens)
+		return printTokens(inputFiles, tokenFormat, serverOptions.threads, io) ? 0 : 1;
+
+	if (data)
+		return loadData(inputFiles, dataMessagePack) ? 0 : 1;
+
+	if (lintFiles)
+		return lint(d, inputFiles, lintRules, io) ? 0 : 1;
+
+	if (adviseFiles)
+		return advise(d, inputFiles, advisePatterns, io) ? 0 : 1;
+
+	if (queryFiles)
+		return query(d, inputFiles, queries, io) ? 0 : 1;
+
+	if (diffFiles)
+		return diff(d, inputFiles) ? 0 : 1;
+
+	// optimized code is meant to be run
+	if (optimizeFiles && !dump) {
+		dump = true;
+		dumpFormat = OutputFormat::Lua;
+	}
 
-	if (argc > 1) {
-		if (!d.setInputFile(argv[1]))
+	if (outputDir) {
+		if (!dump) {
+			std::cerr << "--output-dir needs a --dump format\n";
 			return 1;
+		}
+		return dumpFiles(d, inputFiles, dumpFormat, outputDir, io, optimizeFiles ? &optimizer : nullptr) ? 0 : 1;
+	}
+
+	if (serverSocket || serverStdio) {
+		Server server{serverOptions};
+		if (serverSocket)
+			return server.serveSocket(serverSocket) ? 0 : 1;
+		return server.serveStdio() ? 0 : 1;
+	}
+
+	if (incrementalEdits > 0 || checkRoundTrip || checkLazy || controlFlow || callGraph) {
+		std::ifstream file;
+		if (inputFile) {
+			file.open(inputFile);
+			if (file.fail()) {
+				std::cerr << "Unable to open file for reading: " << inputFile << '\n';
+				return 1;
+			}
+		}
+
+		std::istream &in = inputFile ? file : std::cin;
+		const std::string source{std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{}};
+		const std::string name = inputFile ? inputFile : "<stdin>";
+		if (controlFlow)
+			return printControlFlow(d.parse(source, name)) ? 0 : 1;
+		if (callGraph)
+			return printCallGraph(d.parse(source, name), serverOptions.threads) ? 0 : 1;
+		if (checkRoundTrip)
+			return d.checkRoundTrip(source, name) ? 0 : 1;
+		if (checkLazy)
+			return d.checkLazy(source, name) ? 0 : 1;
+		return d.checkIncremental(source, name, incrementalEdits) ? 0 : 1;
+	}
+
+	if (inputFile) {
+		if (!d.setInputFile(inputFile))
+			return 1;
+	}
+
+	if (checkLexers)
+		return d.checkLexers() ? 0 : 1;
+	if (checkCalls)
+		return checkCallGraph(d) ? 0 : 1;
+
+	const auto start = std::chrono::steady_clock::now();
+	if (d.parse() != 0) {
+		for (const auto &diagnostic : d.diagnostics())
+			std::cerr << "Parse error: " << diagnostic << '\n';
+		return 1;
+	}
+
+	const Decompressor &decompressor = d.decompressor();
+	if (decompressor.format() != Decompressor::Format::None) {
+		const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		std::cerr << inputFile << ": " << decompressor.compressedBytes() << " bytes of " << Decompressor::name(decompressor.format())
+			<< ", " << decompressor.decompressedBytes() << " bytes decompressed and parsed in " << elapsed.count() * 1000.0
+			<< " ms (" << decompressor.decompressedBytes() / elapsed.count() / 1e6 << " MB/s)\n";
+	}
+
+	if (dump) {
+		const auto optimized = optimizeFiles ? optimize(optimizer, d.chunks(), inputFile) : std::vector <std::unique_ptr <Chunk> >{};
+		OutputBuffer out{STDOUT_FILENO};
+		auto emitter = Emitter::create(dumpFormat, out);
+		for (const auto &chunk : optimizeFiles ? optimized : d.chunks()) {
+			emitter->emit(chunk.get());
+			if (dumpFormat != OutputFormat::Text)
+				out.put('\n');
+		}
+		if (!out.flush())
+			return 1;
+		if (lazy && !reportBodyErrors(d.chunks()))
+			return 1;
+	}
+
+	if (memoryProfile) {
+		MemoryProfile profile;
+		for (const auto &chunk : d.chunks())
+			profile.add(chunk.get());
+
+		OutputBuffer out{STDERR_FILENO};
+		if (memoryProfileJson)
+			profile.writeJson(out);
+		else
+			profile.writeTable(out);
 	}
 
-	d.parse();
 	return 0;
 }